@@ -21,6 +21,11 @@ struct ud_ifcfg {
     const char *addr;      /* eth addr  */
     const char *mask;      /* eth mask  */
     const char *broadcast; /* broadcast */
+    const char *addr6;     /* eth IPv6 addr, optional */
+    const char *prefix6;   /* IPv6 prefix length or mask, default 64 */
+    const char *parent;    /* set up name as a VLAN of this interface */
+    unsigned short vlan;   /* 802.1Q tag of the VLAN, 1-4094 */
+    int promisc;           /* receive frames for any MAC, default off */
 };
 
 int ud_ifsetup(struct ud_ifcfg* cfg);
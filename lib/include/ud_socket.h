@@ -59,6 +59,24 @@ ssize_t ud_sendmsg(int sockfd, const struct msghdr *msg, int flags);
    Returns the number of bytes read or -1 for errors.*/
 ssize_t ud_recvmsg(int sockfd, struct msghdr *msg, int flags);
 
+/* Receive up to VLEN messages as described by VMESSAGES from socket FD.
+   With MSG_WAITFORONE only the first message is waited for.  Stops once
+   TIMEOUT has passed, if it is not NULL.  A message with a control buffer
+   gets its UDP_GRO segment size, as with ud_recvmsg.  Returns the number
+   of messages received or -1 for errors.  */
+struct mmsghdr;
+struct timespec;
+int ud_recvmmsg(int sockfd, struct mmsghdr *vmessages, unsigned int vlen,
+                int flags, struct timespec *timeout);
+
+/* SOL_UDP option: an int number of slots.  Received datagrams are queued
+   on a lockless ring of that size instead of the socket buffer, and
+   ud_recvfrom/ud_recvmsg/ud_recvmmsg take them off without locking or
+   allocating.  SO_RCVBUF still bounds the data the ring holds.  Set it
+   before the socket receives anything, and read the socket from one
+   thread only.  Ring sockets get no UDP_GRO.  */
+#define UD_UDP_RING     200
+
 /* Put the current value for socket FD's option OPTNAME at protocol level LEVEL
    into OPTVAL (which is *OPTLEN bytes long), and set *OPTLEN to the value's
    actual length.  Returns 0 on success, -1 for errors.  */
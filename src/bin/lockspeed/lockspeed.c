@@ -0,0 +1,365 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "uinet_host_interface.h"
+
+/*
+ * Per-packet lock sequence of a TCP echo through the stack: driver rx
+ * lock, inpcb lock (tcp_input), receive sockbuf lock (append), receive
+ * sockbuf lock (ud_recv), send sockbuf lock (ud_send), inpcb lock
+ * (tcp_output), driver tx lock.
+ */
+enum {
+	ECHO_LOCK_RX,
+	ECHO_LOCK_INP,
+	ECHO_LOCK_SO_RCV,
+	ECHO_LOCK_SO_SND,
+	ECHO_LOCK_TX,
+	ECHO_NUM_LOCKS
+};
+
+static const int echo_path[] = {
+	ECHO_LOCK_RX,
+	ECHO_LOCK_INP,
+	ECHO_LOCK_SO_RCV,
+	ECHO_LOCK_SO_RCV,
+	ECHO_LOCK_SO_SND,
+	ECHO_LOCK_INP,
+	ECHO_LOCK_TX
+};
+#define ECHO_PATH_LEN (sizeof(echo_path) / sizeof(echo_path[0]))
+
+enum lock_mode {
+	LOCK_MODE_PTHREAD,
+	LOCK_MODE_UHI,
+	LOCK_MODE_NOOP
+};
+
+struct lock_set {
+	pthread_mutex_t pm[ECHO_NUM_LOCKS];
+	uhi_mutex_t um[ECHO_NUM_LOCKS];
+};
+
+/* 
+ * pthread_barrier_t is not implemented on some platforms, so roll one that
+ * will work everywhere.
+ */
+struct barrier {
+	int target;
+	int count;
+	pthread_cond_t cv;
+	pthread_mutex_t mtx;
+};
+
+
+struct test_params {
+	int id;
+	enum lock_mode mode;
+	int num_packets;
+	int work;
+	struct lock_set *locks;
+	pthread_t thread;
+	struct barrier *barrier;
+};
+
+
+static int
+barrier_init(struct barrier *barrier, int target)
+{
+	if (target < 1)
+		return (1);
+
+	barrier->target = target;
+	barrier->count = 0;
+
+	if (pthread_cond_init(&barrier->cv, NULL))
+		return (1);
+
+	if (pthread_mutex_init(&barrier->mtx, NULL)) {
+		pthread_cond_destroy(&barrier->cv);
+		return (1);
+	}
+	
+	return (0);
+}
+
+
+static void
+barrier_destroy(struct barrier *barrier)
+{
+	pthread_mutex_destroy(&barrier->mtx);
+	pthread_cond_destroy(&barrier->cv);
+}
+
+
+static void
+barrier_wait(struct barrier *barrier)
+{
+	pthread_mutex_lock(&barrier->mtx);
+	barrier->count++;
+	if (barrier->count == barrier->target) {
+		barrier->count = 0;
+		pthread_cond_broadcast(&barrier->cv);
+	} else {
+		do { 
+			pthread_cond_wait(&barrier->cv, &barrier->mtx);
+		} while (barrier->count != 0);
+	}
+	pthread_mutex_unlock(&barrier->mtx);
+}
+
+
+static int
+lock_set_init(struct lock_set *ls, enum lock_mode mode)
+{
+	pthread_mutexattr_t attr;
+	int i;
+
+	pthread_mutexattr_init(&attr);
+#if defined(__linux__)
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+#endif
+	for (i = 0; i < ECHO_NUM_LOCKS; i++) {
+		if (pthread_mutex_init(&ls->pm[i], &attr))
+			return (1);
+		if (uhi_mutex_init(&ls->um[i], mode == LOCK_MODE_NOOP ? UHI_MTX_NOOP : 0))
+			return (1);
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	return (0);
+}
+
+
+static void
+lock_set_destroy(struct lock_set *ls)
+{
+	int i;
+
+	for (i = 0; i < ECHO_NUM_LOCKS; i++) {
+		pthread_mutex_destroy(&ls->pm[i]);
+		uhi_mutex_destroy(&ls->um[i]);
+	}
+}
+
+
+static void
+do_work(int work)
+{
+	volatile int i;
+
+	for (i = 0; i < work; i++)
+		;
+}
+
+
+static void
+do_test(const struct test_params *params)
+{
+	struct lock_set *ls = params->locks;
+	unsigned int i, j;
+
+	if (params->mode == LOCK_MODE_PTHREAD) {
+		for (i = 0; i < params->num_packets; i++) {
+			for (j = 0; j < ECHO_PATH_LEN; j++) {
+				pthread_mutex_lock(&ls->pm[echo_path[j]]);
+				do_work(params->work);
+				pthread_mutex_unlock(&ls->pm[echo_path[j]]);
+			}
+		}
+	} else {
+		for (i = 0; i < params->num_packets; i++) {
+			for (j = 0; j < ECHO_PATH_LEN; j++) {
+				_uhi_mutex_lock(&ls->um[echo_path[j]], NULL, NULL, 0);
+				do_work(params->work);
+				_uhi_mutex_unlock(&ls->um[echo_path[j]], NULL, NULL, 0);
+			}
+		}
+	}
+}
+
+
+static void *
+start_test_thread(void *arg)
+{
+	const struct test_params *params = arg;
+
+	printf("Thread %d: count=%d\n", params->id, params->num_packets);
+	barrier_wait(params->barrier);
+
+	do_test(arg);
+
+	return (NULL);
+}
+
+
+static void
+usage(const char *progname)
+{
+
+	printf("Usage: %s [options]\n", progname);
+	printf("    -c num_threads       run n threads [1]\n");
+	printf("    -h                   show usage\n");
+	printf("    -m mode              lock implementation: pthread, uhi, noop [uhi]\n");
+	printf("    -n num_packets       simulate num_packets echoed packets [1000000]\n");
+	printf("    -s                   all threads share one set of locks\n");
+	printf("    -w work              busy-loop iterations inside each lock [0]\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	int num_packets = 1000 * 1000;
+	int concurrency = 1;
+	int shared = 0;
+	int work = 0;
+	enum lock_mode mode = LOCK_MODE_UHI;
+	const char *mode_name = "uhi";
+	int i;
+	struct timespec t1, t2;
+	uint64_t elapsed_ns;
+	char ch;
+	struct test_params *params;
+	struct lock_set *locks;
+	int num_lock_sets;
+	struct barrier barrier;
+	int packets_per_thread;
+	int remainder;
+
+	while ((ch = getopt(argc, argv, "c:hm:n:sw:")) != -1) {
+		switch (ch) {
+		case 'c':
+			concurrency = atoi(optarg);
+			if (concurrency < 1)
+				concurrency = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return (0);
+			break;
+		case 'm':
+			if (strcmp(optarg, "pthread") == 0)
+				mode = LOCK_MODE_PTHREAD;
+			else if (strcmp(optarg, "uhi") == 0)
+				mode = LOCK_MODE_UHI;
+			else if (strcmp(optarg, "noop") == 0)
+				mode = LOCK_MODE_NOOP;
+			else {
+				printf("Unknown lock mode \"%s\"\n", optarg);
+				return (1);
+			}
+			mode_name = optarg;
+			break;
+		case 'n':
+			num_packets = atoi(optarg);
+			if (num_packets < 1)
+				num_packets = 1;
+			break;
+		case 's':
+			shared = 1;
+			break;
+		case 'w':
+			work = atoi(optarg);
+			if (work < 0)
+				work = 0;
+			break;
+		default:
+			printf("Unknown option \"%c\"\n", ch);
+			return (1);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (mode == LOCK_MODE_NOOP && concurrency > 1 && shared) {
+		printf("noop locks cannot be shared between threads\n");
+		return (1);
+	}
+
+	params = malloc(sizeof(struct test_params) * concurrency);
+	if (params == NULL) {
+		printf("Failed to allocate params array\n");
+		return (1);
+	}
+
+	num_lock_sets = shared ? 1 : concurrency;
+	locks = malloc(sizeof(struct lock_set) * num_lock_sets);
+	if (locks == NULL) {
+		printf("Failed to allocate lock sets\n");
+		return (1);
+	}
+	for (i = 0; i < num_lock_sets; i++) {
+		if (lock_set_init(&locks[i], mode)) {
+			printf("Failed to initialize lock set %d\n", i);
+			return (1);
+		}
+	}
+
+	if (barrier_init(&barrier, concurrency)) {
+		printf("Failed to initialize thread sync barrier\n");
+		return (1);
+	}
+
+	printf("Test plan: mode=%s threads=%d packets=%d locks=%s work=%d\n",
+	       mode_name, concurrency, num_packets, shared ? "shared" : "private", work);
+
+	packets_per_thread = num_packets / concurrency;
+	remainder = num_packets % concurrency;
+	for (i = 0; i < concurrency; i++) {
+		params[i].id = i;
+		params[i].mode = mode;
+		params[i].num_packets = packets_per_thread;
+		if (remainder) {
+			params[i].num_packets++;
+			remainder--;
+		}
+		params[i].work = work;
+		params[i].locks = shared ? &locks[0] : &locks[i];
+		params[i].barrier = &barrier;
+		
+		if (i > 0)
+			if (pthread_create(&params[i].thread, NULL, start_test_thread, &params[i])) {
+				printf("Failed to create thread %d\n", i);
+				return (1);
+			}
+	}
+	printf("Thread 0: count=%d\n", params[0].num_packets);
+
+	/* 
+	 * Give the other threads 100 ms to reach their barriers so timing
+	 * uncertainty is reduced.
+	 */
+	t1.tv_sec = 0;
+	t1.tv_nsec = 100 * 1000 * 1000;
+	nanosleep(&t1, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	barrier_wait(params[0].barrier);
+	
+	do_test(&params[0]);
+
+	for (i = 1; i < concurrency; i++)
+		pthread_join(params[i].thread, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	elapsed_ns = (uint64_t)(t2.tv_sec - t1.tv_sec) * 1000000000ULL +
+	    t2.tv_nsec - t1.tv_nsec;
+	printf("Time for %d packets (%d lock/unlock pairs each) was %llums, %.1fns/packet\n",
+	       num_packets, (int)ECHO_PATH_LEN,
+	       (unsigned long long)(elapsed_ns / 1000000),
+	       (double)elapsed_ns / num_packets);
+
+	barrier_destroy(&barrier);
+	for (i = 0; i < num_lock_sets; i++)
+		lock_set_destroy(&locks[i]);
+	free(locks);
+	free(params);
+
+	return (0);
+}
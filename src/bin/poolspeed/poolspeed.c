@@ -1,4 +1,5 @@
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -24,6 +25,7 @@ struct test_params {
 	int use_malloc;
 	int alloc_size;
 	int num_allocs;
+	int batch;
 	int touch;
 	uinet_pool_t pool;
 	pthread_t thread;
@@ -76,12 +78,71 @@ barrier_wait(struct barrier *barrier)
 }
 
 
+/*
+ * Allocate batch items, then free them all, until num_allocs allocations
+ * have been made.  With several threads running this against the same
+ * pool, every thread keeps draining full buckets back to the zone and
+ * refilling empty ones from it, which is where the threads contend.
+ */
+static void
+do_test_churn(const struct test_params *params)
+{
+	void **items;
+	volatile char *p;
+	int done, n, i;
+
+	items = malloc(sizeof(void *) * params->batch);
+	if (items == NULL) {
+		printf("Thread %d: failed to allocate batch array\n", params->id);
+		return;
+	}
+
+	for (done = 0; done < params->num_allocs; done += n) {
+		n = params->num_allocs - done;
+		if (n > params->batch)
+			n = params->batch;
+
+		for (i = 0; i < n; i++) {
+			if (params->use_malloc)
+				p = malloc(params->alloc_size);
+			else
+				p = uinet_pool_alloc(params->pool, UINET_POOL_ALLOC_NOWAIT);
+			if (p == NULL) {
+				printf("Thread %d: allocation %d failed\n", params->id, done + i);
+				n = i;
+				break;
+			}
+			if (params->touch)
+				*p = 1;
+			items[i] = (void *)p;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (params->use_malloc)
+				free(items[i]);
+			else
+				uinet_pool_free(params->pool, items[i]);
+		}
+
+		if (n == 0)
+			break;
+	}
+
+	free(items);
+}
+
+
 static void
 do_test(const struct test_params *params)
 {
 	int i;
 	volatile char *p;
 	
+	if (params->batch) {
+		do_test_churn(params);
+		return;
+	}
+
 	if (params->use_malloc) {
 		for (i = 0; i < params->num_allocs; i++) {
 			p = malloc(params->alloc_size);
@@ -131,6 +192,7 @@ usage(const char *progname)
 {
 
 	printf("Usage: %s [options]\n", progname);
+	printf("    -b batch_size        free every batch_size allocations [0 = never]\n");
 	printf("    -c num_threads       allocate using n threads [1]\n");
 	printf("    -h                   show usage\n");
 	printf("    -m                   use malloc instead of pool allocator\n");
@@ -152,6 +214,9 @@ int main(int argc, char **argv)
 	int touch = 0;
 	int warm = 0;
 	int concurrency = 1;
+	int batch = 0;
+	struct uinet_global_cfg cfg;
+	uint64_t elapsed_ns;
 	uinet_pool_t pool;
 	int i;
 	struct timespec t1, t2;
@@ -162,8 +227,13 @@ int main(int argc, char **argv)
 	int allocs_per_thread;
 	int remainder;
 
-	while ((ch = getopt(argc, argv, "c:hmn:p:s:tw")) != -1) {
+	while ((ch = getopt(argc, argv, "b:c:hmn:p:s:tw")) != -1) {
 		switch (ch) {
+		case 'b':
+			batch = atoi(optarg);
+			if (batch < 0)
+				batch = 0;
+			break;
 		case 'c':
 			concurrency = atoi(optarg);
 			if (concurrency < 1)
@@ -219,7 +289,7 @@ int main(int argc, char **argv)
 	 * fill two buckets of 128 elements per thread.
 	 */
 	if (pool_auto_size)
-		pool_size = num_allocs + concurrency * 256;
+		pool_size = (batch ? batch * concurrency : num_allocs) + concurrency * 256;
 
 	params = malloc(sizeof(struct test_params) * concurrency);
 	if (params == NULL) {
@@ -228,7 +298,9 @@ int main(int argc, char **argv)
 	}
 
 	if (!use_malloc) {
-		uinet_init(1, 128*1024, 0);
+		uinet_default_cfg(&cfg, UINET_GLOBAL_CFG_MEDIUM);
+		cfg.ncpus = concurrency;
+		uinet_init(&cfg, NULL);
 		printf("Creating pool of %d elements\n", pool_size);
 		pool = uinet_pool_create("test pool", alloc_size, NULL, NULL, NULL, NULL, UINET_POOL_ALIGN_PTR, 0);
 		if (NULL == pool) {
@@ -238,7 +310,7 @@ int main(int argc, char **argv)
 		uinet_pool_set_max(pool, pool_size);
 	}
 
-	clock_getres(CLOCK_PROF, &t1);
+	clock_getres(CLOCK_MONOTONIC, &t1);
 	printf("Timing resolution is %ldms\n", t1.tv_nsec / 1000000);
 
 	if (barrier_init(&barrier, concurrency)) {
@@ -246,8 +318,8 @@ int main(int argc, char **argv)
 		return (1);
 	}
 
-	printf("Test plan: threads=%d size=%d count=%d warmup=%s\n",
-	       concurrency, alloc_size, num_allocs, warm ? "yes" : "no");
+	printf("Test plan: threads=%d size=%d count=%d batch=%d warmup=%s\n",
+	       concurrency, alloc_size, num_allocs, batch, warm ? "yes" : "no");
 
 	allocs_per_thread = num_allocs / concurrency;
 	remainder = num_allocs % concurrency;
@@ -261,6 +333,7 @@ int main(int argc, char **argv)
 			params[i].num_allocs++;
 			remainder--;
 		}
+		params[i].batch = batch;
 		params[i].touch = touch;
 		params[i].pool = pool;
 		params[i].barrier = &barrier;
@@ -312,7 +385,7 @@ int main(int argc, char **argv)
 	t1.tv_nsec = 100 * 1000 * 1000;
 	nanosleep(&t1, NULL);
 
-	clock_gettime(CLOCK_PROF, &t1);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 	barrier_wait(params[0].barrier);
 	
 	do_test(&params[0]);
@@ -320,17 +393,19 @@ int main(int argc, char **argv)
 	for (i = 1; i < concurrency; i++)
 		pthread_join(params[i].thread, NULL);
 
-	clock_gettime(CLOCK_PROF, &t2);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
 
-	if (t1.tv_nsec > t2.tv_nsec) {
-		t2.tv_nsec = 1000000000 + t2.tv_nsec - t1.tv_nsec;
-		t2.tv_sec = t2.tv_sec - t1.tv_sec - 1;
-	} else {
-		t2.tv_nsec = t2.tv_nsec - t1.tv_nsec;
-		t2.tv_sec = t2.tv_sec - t1.tv_sec;
-	}
-	printf("Time for %d allocations of %d bytes was %lds %ldms\n",
-	       num_allocs, alloc_size, t2.tv_sec, t2.tv_nsec / 1000000);
+	/*
+	 * Wall-clock time, so that added threads show up as added
+	 * throughput rather than added CPU time.
+	 */
+	elapsed_ns = (uint64_t)(t2.tv_sec - t1.tv_sec) * 1000000000ULL +
+	    t2.tv_nsec - t1.tv_nsec;
+	printf("Time for %d allocations of %d bytes was %llums\n",
+	       num_allocs, alloc_size, (unsigned long long)(elapsed_ns / 1000000));
+	printf("Throughput %.2f M allocs/s, %.1fns per allocation per thread\n",
+	       (double)num_allocs * 1000.0 / elapsed_ns,
+	       (double)elapsed_ns * concurrency / num_allocs);
 
 	barrier_destroy(&barrier);
 	if (!use_malloc) {
@@ -0,0 +1,390 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "uinet_api.h"
+
+/*
+ * Tail latency of short request/response exchanges when the last segment of
+ * some responses is lost.  Two stack instances are connected back to back
+ * through a pair of ring interfaces; the server side's transmit filter
+ * drops the final (PSH) segment of every Nth response.  Without RACK/TLP
+ * such a loss is only repaired by the retransmit timer, with it a tail loss
+ * probe repairs it after about two round trips.
+ */
+
+#define	SERVER_PORT	5000
+#define	REQUEST_SIZE	64
+
+struct loss_state {
+	int every;			/* drop every Nth response tail, 0 for none */
+	unsigned int tails;
+	uint32_t last_dropped_seq;
+	int have_dropped;
+	unsigned int dropped;
+};
+
+struct server_params {
+	uinet_instance_t uinst;
+	int response_size;
+	volatile int use_rack;
+	struct uinet_socket *listener;
+};
+
+
+static int
+drop_tail_filter(void *arg, const void *frame, unsigned int caplen,
+    unsigned int len)
+{
+	struct loss_state *ls = arg;
+	const uint8_t *p = frame;
+	unsigned int ihl, thl, iplen;
+	uint32_t seq;
+
+	if (ls->every == 0 || caplen < 14 + 20)
+		return (0);
+	if (p[12] != 0x08 || p[13] != 0x00)	/* IPv4 */
+		return (0);
+	p += 14;
+	ihl = (p[0] & 0x0f) * 4;
+	iplen = (p[2] << 8) | p[3];
+	if (p[9] != UINET_IPPROTO_TCP || caplen < 14 + ihl + 20)
+		return (0);
+	p += ihl;
+	thl = (p[12] >> 4) * 4;
+	if (iplen <= ihl + thl || (p[13] & 0x08) == 0)	/* data with PSH */
+		return (0);
+	seq = ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+
+	/* Let retransmissions of a dropped tail through. */
+	if (ls->have_dropped && seq == ls->last_dropped_seq)
+		return (0);
+	if (++ls->tails % ls->every != 0)
+		return (0);
+	ls->have_dropped = 1;
+	ls->last_dropped_seq = seq;
+	ls->dropped++;
+	return (1);
+}
+
+
+static int
+xfer(struct uinet_socket *so, char *buf, int len, int is_send)
+{
+	struct uinet_iovec iov;
+	struct uinet_uio uio;
+	int done, error;
+
+	done = 0;
+	while (done < len) {
+		iov.iov_base = buf + done;
+		iov.iov_len = len - done;
+		uio.uio_iov = &iov;
+		uio.uio_iovcnt = 1;
+		uio.uio_offset = 0;
+		uio.uio_resid = len - done;
+		if (is_send)
+			error = uinet_sosend(so, NULL, &uio, 0);
+		else
+			error = uinet_soreceive(so, NULL, &uio, NULL);
+		if (error)
+			return (error);
+		if (!is_send && uio.uio_resid == len - done)
+			return (-1);	/* EOF */
+		done += (len - done) - uio.uio_resid;
+	}
+
+	return (0);
+}
+
+
+static void *
+server_thread(void *arg)
+{
+	struct server_params *sp = arg;
+	struct uinet_socket *so;
+	char request[REQUEST_SIZE];
+	char *response;
+	int optval;
+
+	uinet_initialize_thread("server");
+
+	response = calloc(1, sp->response_size);
+	while (uinet_soaccept(sp->listener, NULL, &so) == 0) {
+		optval = 1;
+		uinet_sosetsockopt(so, UINET_IPPROTO_TCP, UINET_TCP_NODELAY,
+		    &optval, sizeof(optval));
+		optval = sp->use_rack;
+		if (uinet_sosetsockopt(so, UINET_IPPROTO_TCP, UINET_TCP_RACK,
+		    &optval, sizeof(optval)))
+			printf("Failed to set TCP_RACK\n");
+
+		while (xfer(so, request, sizeof(request), 0) == 0)
+			if (xfer(so, response, sp->response_size, 1))
+				break;
+		uinet_soclose(so);
+	}
+	free(response);
+
+	uinet_finalize_thread();
+	return (NULL);
+}
+
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+
+static uint64_t
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+
+static int
+run(uinet_instance_t client, uinet_instance_t server, struct server_params *sp,
+    struct loss_state *ls, int num_requests)
+{
+	struct uinet_socket *so;
+	struct uinet_sockaddr_in sin;
+	struct uinet_tcpstat before, after;
+	char request[REQUEST_SIZE];
+	char *response;
+	uint64_t *lat, start;
+	unsigned int dropped;
+	int i, error, optval;
+
+	lat = calloc(num_requests, sizeof(*lat));
+	response = malloc(sp->response_size);
+	memset(request, 'q', sizeof(request));
+
+	error = uinet_socreate(client, UINET_PF_INET, &so, UINET_SOCK_STREAM, 0);
+	if (error) {
+		printf("Failed to create client socket (%d)\n", error);
+		return (1);
+	}
+	optval = 1;
+	uinet_sosetsockopt(so, UINET_IPPROTO_TCP, UINET_TCP_NODELAY, &optval,
+	    sizeof(optval));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = UINET_AF_INET;
+	sin.sin_port = htons(SERVER_PORT);
+	uinet_inet_pton(UINET_AF_INET, "10.0.0.2", &sin.sin_addr);
+	error = uinet_soconnect(so, (struct uinet_sockaddr *)&sin);
+	if (error) {
+		printf("Failed to connect (%d)\n", error);
+		return (1);
+	}
+
+	/* Let the connection warm up before injecting loss. */
+	for (i = 0; i < 10; i++)
+		if (xfer(so, request, sizeof(request), 1) ||
+		    xfer(so, response, sp->response_size, 0)) {
+			printf("Warm-up exchange failed\n");
+			return (1);
+		}
+
+	uinet_gettcpstat(server, &before);
+	dropped = ls->dropped;
+	__sync_synchronize();
+	ls->tails = 0;
+
+	for (i = 0; i < num_requests; i++) {
+		start = now_us();
+		if (xfer(so, request, sizeof(request), 1) ||
+		    xfer(so, response, sp->response_size, 0)) {
+			printf("Exchange %d failed\n", i);
+			return (1);
+		}
+		lat[i] = now_us() - start;
+	}
+	uinet_gettcpstat(server, &after);
+	uinet_soclose(so);
+
+	qsort(lat, num_requests, sizeof(*lat), cmp_u64);
+	printf("%-8s %6u %9llu %9llu %9llu %9llu %6lu %6lu %6lu\n",
+	    sp->use_rack ? "rack" : "dupack",
+	    ls->dropped - dropped,
+	    (unsigned long long)lat[num_requests / 2],
+	    (unsigned long long)lat[num_requests * 90 / 100],
+	    (unsigned long long)lat[num_requests * 99 / 100],
+	    (unsigned long long)lat[num_requests - 1],
+	    after.tcps_rexmttimeo - before.tcps_rexmttimeo,
+	    after.tcps_tlp_probes - before.tcps_tlp_probes,
+	    after.tcps_tlp_recovered - before.tcps_tlp_recovered);
+
+	free(response);
+	free(lat);
+	return (0);
+}
+
+
+static int
+setup_interface(uinet_instance_t uinst, const char *alias, const char *addr,
+    struct loss_state *ls)
+{
+	struct uinet_if_cfg ifcfg;
+	uinet_if_t uif;
+	int error;
+
+	uinet_if_default_config(UINET_IFTYPE_RING, &ifcfg);
+	ifcfg.configstr = "racktail";
+	ifcfg.alias = alias;
+	if (ls != NULL) {
+		ifcfg.type_cfg.ring.tx_filter = drop_tail_filter;
+		ifcfg.type_cfg.ring.tx_filter_arg = ls;
+	}
+	error = uinet_ifcreate(uinst, &ifcfg, &uif);
+	if (error) {
+		printf("%s: Failed to create interface (%d)\n", alias, error);
+		return (error);
+	}
+	error = uinet_interface_add_alias(uinst, alias, addr, "10.0.0.255",
+	    "255.255.255.0");
+	if (error) {
+		printf("%s: Failed to add address %s (%d)\n", alias, addr, error);
+		return (error);
+	}
+	error = uinet_interface_up(uinst, alias, 0, 0);
+	if (error) {
+		printf("%s: Failed to bring up interface (%d)\n", alias, error);
+		return (error);
+	}
+
+	return (0);
+}
+
+
+static void
+usage(const char *progname)
+{
+
+	printf("Usage: %s [options]\n", progname);
+	printf("    -h                   show usage\n");
+	printf("    -l every             drop the tail of every Nth response (default 10, 0 for none)\n");
+	printf("    -m mode              0 for both, 1 for RACK/TLP only, 2 for dupack/RTO only (default 0)\n");
+	printf("    -n num_requests      number of timed exchanges per mode (default 200)\n");
+	printf("    -s response_size     response size in bytes (default 5000)\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	struct uinet_global_cfg cfg;
+	struct uinet_instance_cfg icfg;
+	struct loss_state ls;
+	struct server_params sp;
+	struct uinet_sockaddr_in sin;
+	uinet_instance_t client, server;
+	pthread_t server_tid;
+	int num_requests = 200;
+	int mode = 0;
+	int ch, error, optval;
+
+	memset(&ls, 0, sizeof(ls));
+	memset(&sp, 0, sizeof(sp));
+	ls.every = 10;
+	sp.response_size = 5000;
+
+	while ((ch = getopt(argc, argv, "hl:m:n:s:")) != -1) {
+		switch (ch) {
+		case 'h':
+			usage(argv[0]);
+			return (0);
+		case 'l':
+			ls.every = strtol(optarg, NULL, 10);
+			break;
+		case 'm':
+			mode = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			num_requests = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			sp.response_size = strtol(optarg, NULL, 10);
+			break;
+		default:
+			printf("Unknown option \"%c\"\n", ch);
+			usage(argv[0]);
+			return (1);
+		}
+	}
+	if (num_requests < 1 || sp.response_size < 1 || ls.every < 0 ||
+	    mode < 0 || mode > 2) {
+		usage(argv[0]);
+		return (1);
+	}
+
+	uinet_default_cfg(&cfg, UINET_GLOBAL_CFG_MEDIUM);
+	uinet_instance_default_cfg(&icfg);
+	icfg.loopback = 0;
+	uinet_init(&cfg, &icfg);
+
+	client = uinet_instance_default();
+	server = uinet_instance_create(&icfg);
+	if (server == NULL) {
+		printf("Failed to create server instance\n");
+		return (1);
+	}
+
+	if (setup_interface(client, "rtc0", "10.0.0.1", NULL) ||
+	    setup_interface(server, "rts0", "10.0.0.2", &ls))
+		return (1);
+
+	sp.uinst = server;
+	error = uinet_socreate(server, UINET_PF_INET, &sp.listener,
+	    UINET_SOCK_STREAM, 0);
+	if (error) {
+		printf("Failed to create listen socket (%d)\n", error);
+		return (1);
+	}
+	optval = 1;
+	uinet_sosetsockopt(sp.listener, UINET_SOL_SOCKET, UINET_SO_REUSEADDR,
+	    &optval, sizeof(optval));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = UINET_AF_INET;
+	sin.sin_port = htons(SERVER_PORT);
+	uinet_inet_pton(UINET_AF_INET, "10.0.0.2", &sin.sin_addr);
+	if ((error = uinet_sobind(sp.listener, (struct uinet_sockaddr *)&sin)) ||
+	    (error = uinet_solisten(sp.listener, 8))) {
+		printf("Failed to listen (%d)\n", error);
+		return (1);
+	}
+	pthread_create(&server_tid, NULL, server_thread, &sp);
+
+	printf("%d exchanges of %d/%d bytes, dropping every %dth response tail\n",
+	    num_requests, REQUEST_SIZE, sp.response_size, ls.every);
+	printf("%-8s %6s %9s %9s %9s %9s %6s %6s %6s\n", "mode", "drops",
+	    "p50(us)", "p90(us)", "p99(us)", "max(us)", "rto", "tlp", "tlprep");
+
+	error = 0;
+	if (mode != 2) {
+		sp.use_rack = 1;
+		error |= run(client, server, &sp, &ls, num_requests);
+	}
+	if (mode != 1) {
+		sp.use_rack = 0;
+		error |= run(client, server, &sp, &ls, num_requests);
+	}
+
+	fflush(stdout);
+	_exit(error ? 1 : 0);
+}
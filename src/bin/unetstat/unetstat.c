@@ -144,6 +144,21 @@ static void print_tcpstat(char* buf)
     printf("tcps_sig_err_buildsig:      %lu \n", stat->tcps_sig_err_buildsig);
     printf("tcps_sig_err_sigopt:        %lu \n", stat->tcps_sig_err_sigopt);
     printf("tcps_sig_err_nosigopt:      %lu \n", stat->tcps_sig_err_nosigopt);
+
+    printf("tcps_rack_recovery:         %lu \n", stat->tcps_rack_recovery);
+    printf("tcps_rack_rexmit_lost:      %lu \n", stat->tcps_rack_rexmit_lost);
+    printf("tcps_tlp_probes:            %lu \n", stat->tcps_tlp_probes);
+    printf("tcps_tlp_recovered:         %lu \n", stat->tcps_tlp_recovered);
+    printf("tcps_tfo_cookie_req:        %lu \n", stat->tcps_tfo_cookie_req);
+    printf("tcps_tfo_cookie_bad:        %lu \n", stat->tcps_tfo_cookie_bad);
+    printf("tcps_tfo_syn_data:          %lu \n", stat->tcps_tfo_syn_data);
+    printf("tcps_tfo_syn_data_sent:     %lu \n", stat->tcps_tfo_syn_data_sent);
+    printf("tcps_tfo_syn_data_acked:    %lu \n", stat->tcps_tfo_syn_data_acked);
+    printf("tcps_tw_recycled:           %lu \n", stat->tcps_tw_recycled);
+    printf("tcps_tw_reclaimed:          %lu \n", stat->tcps_tw_reclaimed);
+    printf("tcps_sc_cachehit:           %lu \n", stat->tcps_sc_cachehit);
+    printf("tcps_sc_cookiehit:          %lu \n", stat->tcps_sc_cookiehit);
+    printf("tcps_sc_cookieonly:         %lu \n", stat->tcps_sc_cookieonly);
 }
 
 /*---------------------------------------------------------------------------*/
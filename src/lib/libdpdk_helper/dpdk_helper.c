@@ -21,6 +21,9 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <rte_cycles.h>
 #include <rte_lcore.h>
 #include <rte_mbuf.h>
+#include <rte_lpm.h>
+#include <rte_ip.h>
+#include <rte_ip_frag.h>
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/timeb.h>
@@ -34,7 +37,16 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 //#define BURST_SIZE 32
 
 static const struct rte_eth_conf port_conf_default = {
-    .rxmode = { .max_rx_pkt_len = ETHER_MAX_LEN, },
+    .rxmode = {
+        .max_rx_pkt_len = ETHER_MAX_VLAN_FRAME_LEN, /* room for one 802.1Q tag */
+        .mq_mode = ETH_MQ_RX_RSS,
+    },
+    .rx_adv_conf = {
+        .rss_conf = {
+            .rss_key = NULL,
+            .rss_hf = ETH_RSS_IP | ETH_RSS_TCP | ETH_RSS_UDP,
+        },
+    },
 };
 
 static unsigned nb_ports;
@@ -81,11 +93,34 @@ calc_latency(uint8_t port __rte_unused, uint16_t qidx __rte_unused,
 }
 
 
+static inline uint32_t
+rss_type(const struct rte_mbuf *mb)
+{
+    uint32_t l4 = mb->packet_type & RTE_PTYPE_L4_MASK;
+
+    if (!(mb->ol_flags & PKT_RX_RSS_HASH))
+        return DH_RSS_NONE;
+    if (RTE_ETH_IS_IPV6_HDR(mb->packet_type))
+        return (l4 == RTE_PTYPE_L4_TCP) ? DH_RSS_TCP_IPV6 : DH_RSS_IPV6;
+    return (l4 == RTE_PTYPE_L4_TCP) ? DH_RSS_TCP_IPV4 : DH_RSS_IPV4;
+}
+
 /*---------------------------------------------------------------------------*/
+/*
+ * The private area starts right after the rte_mbuf header.  DPDK 16.07
+ * has no rte_mbuf_to_priv(), so compute it the way later releases do.
+ */
+static inline void*
+mbuf_priv(struct rte_mbuf* mb)
+{
+    return RTE_PTR_ADD(mb, sizeof(struct rte_mbuf));
+}
+
 static inline int
 port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 {
     struct rte_eth_conf port_conf = port_conf_default;
+    struct rte_eth_dev_info dev_info;
     const uint16_t rx_rings = 1, tx_rings = 1;
     int retval;
     uint16_t q;
@@ -93,6 +128,11 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
     if (port >= rte_eth_dev_count())
         return -1;
 
+    /* tags the NIC strips are handed up in dh_rte_mbuf_desc.vlan_tci */
+    rte_eth_dev_info_get(port, &dev_info);
+    if (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_VLAN_STRIP)
+        port_conf.rxmode.hw_vlan_strip = 1;
+
     retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
     if (retval != 0)
         return retval;
@@ -125,7 +165,10 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
            addr.addr_bytes[2], addr.addr_bytes[3],
            addr.addr_bytes[4], addr.addr_bytes[5]);
 
-    rte_eth_promiscuous_enable(port);
+    /*
+     * Ports start out unicast and broadcast only; the stack widens the
+     * receive filter through dh_set_promisc() and the multicast calls.
+     */
     rte_eth_add_rx_callback(port, 0, add_timestamps, NULL);
     rte_eth_add_tx_callback(port, 0, calc_latency, NULL);
 
@@ -136,9 +179,29 @@ struct rte_mempool *mbuf_pool;
 struct rte_mempool *mbuf_pool_tx;
 
 static int port = 0;
+static int eal_ready = 0;
+
+/*
+ * Fragments held for reassembly come out of the receive pool, so the
+ * table is sized to never pin more than a quarter of it.
+ */
+#define REASS_MAX_DATAGRAMS (NUM_MBUFS / 4 / RTE_LIBRTE_IP_FRAG_MAX_FRAG)
+#define REASS_BUCKET_ENTRIES 4
+
+/*
+ * Reassembly state of the single receive queue.  Only the thread polling
+ * that queue touches it, so there is no locking.
+ */
+static struct rte_ip_frag_tbl* frag_tbl;
+static struct rte_ip_frag_death_row death_row;
+
+/* Received packets left over when a burst of descriptors filled up */
+static struct rte_mbuf* rx_pending[MAX_BURST_SIZE];
+static uint16_t nb_rx_pending;
 /*---------------------------------------------------------------------------*/
 static int 
-dpdk_init(int argc, char *argv[], const char* ifname, uint8_t* mac_addr)
+dpdk_init(int argc, char *argv[], const char* ifname, uint8_t* mac_addr,
+          uint16_t priv_size)
 {
     uint8_t portid;
 
@@ -151,8 +214,16 @@ dpdk_init(int argc, char *argv[], const char* ifname, uint8_t* mac_addr)
     argc -= ret;
     argv += ret;
 
+    /*
+     * The private area of each rte_mbuf holds the stack's packet
+     * descriptor context and mbuf header for that buffer, so received
+     * packets can be handed to the stack without a separate allocation.
+     * Transmitted packets never carry one, so the TX pool has none.
+     */
+    priv_size = RTE_ALIGN(priv_size, RTE_MBUF_PRIV_ALIGN);
+
     mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL",
-                                        NUM_MBUFS * 1, MBUF_CACHE_SIZE, 0,
+                                        NUM_MBUFS * 1, MBUF_CACHE_SIZE, priv_size,
                                         RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
     mbuf_pool_tx = rte_pktmbuf_pool_create("MBUF_POOL_TX",
                                            NUM_MBUFS * 1, MBUF_CACHE_SIZE, 0,
@@ -180,44 +251,156 @@ dpdk_init(int argc, char *argv[], const char* ifname, uint8_t* mac_addr)
         printf("\nWARNING: Too much enabled lcores - "
                "App uses only 1 lcore\n");
 
+    eal_ready = 1;
     return 0;
 }
 
 /* Public */
 /*---------------------------------------------------------------------------*/
-int dh_send_pkts(const uint8_t *buf, uint16_t num)
+int dh_send_pkts(void **pkts, uint16_t num)
 {
-    if(buf != NULL && num > 0) {
+    if(pkts != NULL && num > 0) {
 #if 0
         int i = 0;
-        struct rte_mbuf** tx_pkt=&buf[0];
+        struct rte_mbuf** tx_pkt=(struct rte_mbuf **)pkts;
         for(; i < num; i++, tx_pkt++) {
             printf("i%d, %lx %lx, \n", i, *tx_pkt, (*tx_pkt)->next);
         }
 #endif
-        return rte_eth_tx_burst(port, 0, &(buf[0]), num);
+        return rte_eth_tx_burst(port, 0, (struct rte_mbuf **)pkts, num);
     }
     return 0;
 }
 
 /*---------------------------------------------------------------------------*/
-int dh_recv_pkts(uint8_t *buf, uint16_t *len, dh_rte_mbuf_desc* desc)
+/*
+ * Runs an IPv4 fragment through the reassembly table.  Returns the packet
+ * to deliver, which is mb itself if it is not a fragment, or NULL if the
+ * table kept or dropped it.  Malformed fragments are left to the stack,
+ * which accounts for them.
+ */
+static struct rte_mbuf*
+reass_ipv4(struct rte_mbuf* mb, uint64_t now)
 {
-    struct rte_mbuf* mbufs[MAX_BURST_SIZE];
-    uint16_t i = 0;
-    uint16_t nb = rte_eth_rx_burst(port, 0, mbufs, MAX_BURST_SIZE);
+    struct ether_hdr* eh;
+    struct ipv4_hdr* ip;
+    uint16_t hlen, len;
+
+    eh = rte_pktmbuf_mtod(mb, struct ether_hdr*);
+    if (mb->data_len < sizeof(*eh) + sizeof(*ip) ||
+        eh->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+        return mb;
+    ip = (struct ipv4_hdr*)(eh + 1);
+    if (!rte_ipv4_frag_pkt_is_fragmented(ip))
+        return mb;
+
+    hlen = (ip->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
+    len = rte_be_to_cpu_16(ip->total_length);
+    if ((ip->version_ihl >> 4) != 4 || hlen < sizeof(*ip) || len <= hlen ||
+        sizeof(*eh) + len > mb->data_len ||
+        rte_raw_cksum(ip, hlen) != 0xffff)
+        return mb;
+
+    /* Ethernet padding would otherwise end up inside the datagram */
+    if (sizeof(*eh) + len < mb->data_len)
+        rte_pktmbuf_trim(mb, mb->data_len - (sizeof(*eh) + len));
+    mb->l2_len = sizeof(*eh);
+    mb->l3_len = hlen;
+
+    mb = rte_ipv4_frag_reassemble_packet(frag_tbl, &death_row, mb, now, ip);
+
+    /* the death row has room for a few operations' worth of fragments */
+    if (death_row.cnt >= RTE_DIM(death_row.row) / 2)
+        rte_ip_frag_free_death_row(&death_row, 0);
+
+    if (mb == NULL)
+        return NULL;
+    if (mb->pkt_len - mb->l2_len > UINT16_MAX) {
+        rte_pktmbuf_free(mb);
+        return NULL;
+    }
+    ip = rte_pktmbuf_mtod_offset(mb, struct ipv4_hdr*, mb->l2_len);
+    ip->hdr_checksum = ~rte_raw_cksum(ip, mb->l3_len);
+    return mb;
+}
 
-    for(; i < nb; i++) {
-        struct rte_mbuf* mb = mbufs[i];
+/*
+ * Fills in one descriptor per buffer of mb, unlinking the buffers so each
+ * can be released on its own.  Returns the number of descriptors used.
+ */
+static uint16_t
+fill_desc(dh_rte_mbuf_desc* desc, struct rte_mbuf* mb)
+{
+    struct rte_mbuf* next;
+    uint16_t i, nb_segs;
+
+    nb_segs = mb->nb_segs;
+    desc[0].rss_hash = mb->hash.rss;
+    desc[0].rss_type = rss_type(mb);
+    desc[0].vlan_stripped = (mb->ol_flags & PKT_RX_VLAN_STRIPPED) != 0;
+    desc[0].vlan_tci = mb->vlan_tci;
+    for (i = 0; i < nb_segs; i++, mb = next) {
+        next = mb->next;
+        mb->next = NULL;
+        mb->nb_segs = 1;
+        mb->pkt_len = mb->data_len;
 
         desc[i].rm_base = (void*)mb;
         desc[i].rm_data = (void*)&((uint8_t*)mb->buf_addr+mb->data_off)[0];
         desc[i].data_len  = mb->data_len;
-        desc[i].buf_len = mb->buf_len;
+        desc[i].buf_len = mb->buf_len - mb->data_off;
         desc[i].ref_cnt = &mb->refcnt;
+        desc[i].priv = mbuf_priv(mb);
+        desc[i].nb_segs = i == 0 ? nb_segs : 0;
+        if (i > 0)
+            desc[i].vlan_stripped = 0;
+    }
+
+    return nb_segs;
+}
+
+int dh_recv_pkts(dh_rte_mbuf_desc* desc, uint16_t max, int reass)
+{
+    struct rte_mbuf* mbufs[MAX_BURST_SIZE];
+    struct rte_mbuf* mb;
+    uint64_t now = 0;
+    uint16_t i, j;
+    uint16_t nb;
+
+    if (max > MAX_BURST_SIZE)
+        max = MAX_BURST_SIZE;
+
+    /* a reassembled datagram takes up to one descriptor per fragment */
+    if (frag_tbl == NULL || max < RTE_LIBRTE_IP_FRAG_MAX_FRAG)
+        reass = 0;
+
+    nb = nb_rx_pending;
+    if (nb > 0) {
+        memcpy(mbufs, rx_pending, nb * sizeof(mbufs[0]));
+        nb_rx_pending = 0;
+    }
+    if (nb < max)
+        nb += rte_eth_rx_burst(port, 0, mbufs + nb, max - nb);
+    if (reass)
+        now = rte_rdtsc();
+
+    for (i = 0, j = 0; i < nb; i++) {
+        mb = mbufs[i];
+        if (reass) {
+            if (j + RTE_LIBRTE_IP_FRAG_MAX_FRAG > max) {
+                nb_rx_pending = nb - i;
+                memcpy(rx_pending, &mbufs[i], nb_rx_pending * sizeof(mb));
+                break;
+            }
+            if ((mb = reass_ipv4(mb, now)) == NULL)
+                continue;
+        }
+        j += fill_desc(&desc[j], mb);
     }
+    if (reass)
+        rte_ip_frag_free_death_row(&death_row, 0);
 
-    return nb;
+    return j;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -233,8 +416,11 @@ void* dh_alloc_desc(dh_rte_mbuf_desc* desc)
         desc->rm_base = mb;
         desc->rm_data = (void*)((uint8_t*)mb->buf_addr+mb->data_off);
         desc->data_len  = mb->data_len;
-        desc->buf_len = mb->buf_len;
+        desc->buf_len = mb->buf_len - mb->data_off;
         desc->ref_cnt = &mb->refcnt;
+        desc->priv = mbuf_priv(mb);
+        desc->rss_type = DH_RSS_NONE;
+        desc->vlan_stripped = 0;
         desc->rm_data_len = &mb->data_len;
         desc->rm_pkt_len = &mb->pkt_len;
         desc->debug_next = &mb->next;
@@ -246,8 +432,170 @@ void* dh_alloc_desc(dh_rte_mbuf_desc* desc)
 }
 
 /*---------------------------------------------------------------------------*/
-int dh_init_dpdk(const char* ifname, uint8_t* mac_addr)
+int dh_eal_ready(void)
+{
+    return eal_ready;
+}
+
+int dh_reass_init(uint32_t max_datagrams, uint32_t timeout_ms)
+{
+    uint64_t max_cycles;
+
+    if (!eal_ready || frag_tbl != NULL)
+        return -1;
+
+    if (max_datagrams > REASS_MAX_DATAGRAMS)
+        max_datagrams = REASS_MAX_DATAGRAMS;
+    max_cycles = (rte_get_tsc_hz() + 999) / 1000 * timeout_ms;
+    frag_tbl = rte_ip_frag_table_create(max_datagrams, REASS_BUCKET_ENTRIES,
+                                        max_datagrams, max_cycles,
+                                        rte_socket_id());
+    if (frag_tbl == NULL)
+        return -1;
+
+    printf("IPv4 reassembly: %u datagrams of up to %u fragments, %ums\n",
+           max_datagrams, RTE_LIBRTE_IP_FRAG_MAX_FRAG, timeout_ms);
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+int dh_set_promisc(int on)
+{
+    if (!eal_ready)
+        return -1;
+
+    if (on)
+        rte_eth_promiscuous_enable(port);
+    else
+        rte_eth_promiscuous_disable(port);
+    return (rte_eth_promiscuous_get(port) == !!on) ? 0 : -1;
+}
+
+int dh_set_allmulti(int on)
+{
+    if (!eal_ready)
+        return -1;
+
+    if (on)
+        rte_eth_allmulticast_enable(port);
+    else
+        rte_eth_allmulticast_disable(port);
+    return (rte_eth_allmulticast_get(port) == !!on) ? 0 : -1;
+}
+
+int dh_set_mc_addr_list(const uint8_t* addrs, uint32_t num)
+{
+    if (!eal_ready)
+        return -1;
+
+    return rte_eth_dev_set_mc_addr_list(port,
+                                        (struct ether_addr*)(uintptr_t)addrs,
+                                        num);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Returns 1 if the port can both strip and insert 802.1Q tags */
+int dh_vlan_offload(void)
+{
+    struct rte_eth_dev_info dev_info;
+
+    if (!eal_ready)
+        return 0;
+
+    rte_eth_dev_info_get(port, &dev_info);
+    return (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_VLAN_STRIP) &&
+           (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_VLAN_INSERT);
+}
+
+int dh_set_vlan_strip(int on)
+{
+    int mask;
+
+    if (!eal_ready)
+        return -1;
+
+    mask = rte_eth_dev_get_vlan_offload(port);
+    if (mask < 0)
+        return -1;
+    if (on)
+        mask |= ETH_VLAN_STRIP_OFFLOAD;
+    else
+        mask &= ~ETH_VLAN_STRIP_OFFLOAD;
+    return rte_eth_dev_set_vlan_offload(port, mask);
+}
+
+void dh_set_tx_vlan(void* ptr, uint16_t vlan_tci)
+{
+    struct rte_mbuf* mb = ptr;
+
+    mb->vlan_tci = vlan_tci;
+    mb->ol_flags |= PKT_TX_VLAN_PKT;
+}
+
+void* dh_lpm_create(const char* name, uint32_t max_rules, uint32_t number_tbl8s)
+{
+    struct rte_lpm_config config;
+
+    /* the tables live in hugepage memory, so wait for the EAL */
+    if (!eal_ready)
+        return NULL;
+
+    config.max_rules = max_rules;
+    config.number_tbl8s = number_tbl8s;
+    config.flags = 0;
+    return rte_lpm_create(name, rte_socket_id(), &config);
+}
+
+void dh_lpm_free(void* lpm)
+{
+    rte_lpm_free(lpm);
+}
+
+int dh_lpm_add(void* lpm, uint32_t ip, uint8_t depth, uint32_t next_hop)
+{
+    return rte_lpm_add(lpm, ip, depth, next_hop);
+}
+
+int dh_lpm_delete(void* lpm, uint32_t ip, uint8_t depth)
+{
+    return rte_lpm_delete(lpm, ip, depth);
+}
+
+/* Returns 1 and the rule's next hop if ip/depth is in the table, else 0 */
+int dh_lpm_rule(void* lpm, uint32_t ip, uint8_t depth, uint32_t* next_hop)
+{
+    return rte_lpm_is_rule_present(lpm, ip, depth, next_hop);
+}
+
+int dh_lpm_lookup(void* lpm, uint32_t ip, uint32_t* next_hop)
+{
+    return rte_lpm_lookup(lpm, ip, next_hop);
+}
+
+void dh_lpm_lookup_bulk(void* lpm, const uint32_t* ips, uint32_t* next_hops,
+                        uint32_t n)
+{
+    uint32_t i, chunk;
+
+    /* rte_lpm_lookup_bulk() keeps a per-call array on the stack */
+    while (n > 0) {
+        chunk = n > MAX_BURST_SIZE ? MAX_BURST_SIZE : n;
+        rte_lpm_lookup_bulk(lpm, ips, next_hops, chunk);
+        for (i = 0; i < chunk; i++) {
+            if (next_hops[i] & RTE_LPM_LOOKUP_SUCCESS)
+                next_hops[i] &= 0x00ffffff;
+            else
+                next_hops[i] = DH_LPM_MISS;
+        }
+        ips += chunk;
+        next_hops += chunk;
+        n -= chunk;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+int dh_init_dpdk(const char* ifname, uint8_t* mac_addr, uint16_t priv_size)
 {
     char* argv[] = {"", "-c", "0x8", "-n", "4"};
-    return dpdk_init(5, argv, ifname, mac_addr);
+    return dpdk_init(5, argv, ifname, mac_addr, priv_size);
 }
@@ -19,6 +19,16 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #define MAX_BURST_SIZE 512
 
+/* Receive hash types, numerically equal to the stack's M_HASHTYPE_* */
+#define DH_RSS_NONE     0
+#define DH_RSS_IPV4     1
+#define DH_RSS_TCP_IPV4 2
+#define DH_RSS_IPV6     3
+#define DH_RSS_TCP_IPV6 4
+
+/* Next hop reported by dh_lpm_lookup_bulk() for an address with no rule */
+#define DH_LPM_MISS     0xffffffffU
+
 typedef struct dh_rte_mbuf_desc {
     void*        rm_base;
     void*        rm_data;
@@ -28,11 +38,53 @@ typedef struct dh_rte_mbuf_desc {
     uint16_t*    rm_data_len;
     uint32_t*    rm_pkt_len;
     uint64_t*    debug_next;
+    void*        priv;          /* per-mbuf private area, priv_size bytes */
+    uint32_t     rss_hash;
+    uint32_t     rss_type;      /* DH_RSS_*, DH_RSS_NONE if no hash */
+    uint16_t     nb_segs;       /* buffers in the packet, 0 for the
+                                   continuation buffers that follow it */
+    uint16_t     vlan_tci;      /* 802.1Q TCI the NIC stripped, valid if
+                                   vlan_stripped */
+    uint16_t     vlan_stripped;
 } dh_rte_mbuf_desc;
 
-int   dh_init_dpdk (const char* ifname, uint8_t* mac_addr);
-int   dh_send_pkts (const uint8_t *buf, uint16_t num);
-int   dh_recv_pkts (uint8_t *buf, uint16_t *len, dh_rte_mbuf_desc* desc);
+int   dh_init_dpdk (const char* ifname, uint8_t* mac_addr, uint16_t priv_size);
+int   dh_send_pkts (void **pkts, uint16_t num);
+int   dh_recv_pkts (dh_rte_mbuf_desc* desc, uint16_t max, int reass);
 void  dh_free_desc (void* ptr);
 void* dh_alloc_desc(dh_rte_mbuf_desc* desc);
+int   dh_eal_ready (void);
+
+/*
+ * Receive filter.  dh_set_mc_addr_list() replaces the port's multicast MAC
+ * filter with num 6-byte addresses and fails if the PMD has no such filter
+ * or it is too small, in which case the caller falls back to allmulti.
+ */
+int   dh_set_promisc     (int on);
+int   dh_set_allmulti    (int on);
+int   dh_set_mc_addr_list(const uint8_t* addrs, uint32_t num);
+
+/*
+ * 802.1Q tag offload.  Ports strip received tags whenever the NIC can;
+ * dh_set_tx_vlan() asks for a tag to be inserted on an outbound rte_mbuf.
+ */
+int   dh_vlan_offload  (void);
+int   dh_set_vlan_strip(int on);
+void  dh_set_tx_vlan   (void* mb, uint16_t vlan_tci);
+
+/*
+ * IPv4 reassembly in the receive burst.  Once set up, dh_recv_pkts() calls
+ * with reass set hand up reassembled datagrams as a run of descriptors.
+ */
+int   dh_reass_init(uint32_t max_datagrams, uint32_t timeout_ms);
+
+/* DIR-24-8 longest prefix match tables; addresses are in host byte order */
+void* dh_lpm_create(const char* name, uint32_t max_rules, uint32_t number_tbl8s);
+void  dh_lpm_free  (void* lpm);
+int   dh_lpm_add   (void* lpm, uint32_t ip, uint8_t depth, uint32_t next_hop);
+int   dh_lpm_delete(void* lpm, uint32_t ip, uint8_t depth);
+int   dh_lpm_rule  (void* lpm, uint32_t ip, uint8_t depth, uint32_t* next_hop);
+int   dh_lpm_lookup(void* lpm, uint32_t ip, uint32_t* next_hop);
+void  dh_lpm_lookup_bulk(void* lpm, const uint32_t* ips, uint32_t* next_hops,
+                         uint32_t n);
 #endif
@@ -29,6 +29,7 @@ struct ud_if {
 } ud_ifs[MAX_UDIF];
 
 unsigned int udif_count = 0;
+static int udif_initialized = 0;
 
 uinet_if_t udif_getuif(char *ethname)
 {
@@ -38,25 +39,40 @@ uinet_if_t udif_getuif(char *ethname)
 int ud_ifsetup(struct ud_ifcfg* param)
 {
     int error = 0;
-    uinet_if_t ud_uif;
+    uinet_if_t ud_uif = NULL;
+    int isvlan = param->parent != NULL && param->parent[0] != '\0';
 
-    struct uinet_global_cfg cfg;
-    uinet_default_cfg(&cfg, UINET_GLOBAL_CFG_MEDIUM);
-    uinet_init(&cfg, NULL);
+    if (udif_count == MAX_UDIF) {
+        printf("Too many interfaces\n");
+        return -1;
+    }
+
+    if (!udif_initialized) {
+        struct uinet_global_cfg cfg;
+        uinet_default_cfg(&cfg, UINET_GLOBAL_CFG_MEDIUM);
+        uinet_init(&cfg, NULL);
 
-    uinet_install_sighandlers();
+        uinet_install_sighandlers();
+    }
 
-    struct uinet_if_cfg ifcfg;
-    uinet_if_default_config(UINET_IFTYPE_DPDK, &ifcfg);
+    if (isvlan) {
+        /* the parent port must have been set up by an earlier call */
+        error = uinet_interface_create_vlan(uinet_instance_default(),
+                    param->name, param->parent, param->vlan);
+    } else {
+        struct uinet_if_cfg ifcfg;
+        uinet_if_default_config(UINET_IFTYPE_DPDK, &ifcfg);
 
-    ifcfg.configstr = param->name;
-    ifcfg.alias = param->name;
+        ifcfg.configstr = param->name;
+        ifcfg.alias = param->name;
 
-    error = uinet_ifcreate(uinet_instance_default(), &ifcfg, &ud_uif);
+        error = uinet_ifcreate(uinet_instance_default(), &ifcfg, &ud_uif);
+    }
     if (0 != error) {
         printf("Failed to create interface (%d)\n", error);
     } else {
-        error = uinet_interface_up(uinet_instance_default(), param->name, 1, 0);
+        error = uinet_interface_up(uinet_instance_default(), param->name,
+                                   isvlan ? 0 : param->promisc, 0);
         if (0 != error) {
             printf("Failed to bring up interface (%d)\n", error);
         }
@@ -64,9 +80,18 @@ int ud_ifsetup(struct ud_ifcfg* param)
                           param->name, param->addr, param->broadcast, param->mask))) {
             printf("Loopback alias add failed %d\n", error);
         }
+        if (param->addr6 != NULL && param->addr6[0] != '\0' &&
+            0 != (error = uinet_interface_add_alias(uinet_instance_default(),
+                          param->name, param->addr6, NULL, param->prefix6))) {
+            printf("IPv6 alias add failed %d\n", error);
+        }
         ud_ifs[udif_count].cfg = *param;
         ud_ifs[udif_count].uif = ud_uif;
+        udif_count++;
     }
+    if (udif_initialized)
+        return error;
+    udif_initialized = 1;
 #if 1
     int tid;
     if(pthread_create(&tid, NULL, uinet_host_netstat_listener_thread, NULL)==-1)
@@ -14,6 +14,7 @@ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
 You should have received a copy of the GNU Lesser General Public License along
 with this program. If not, see <http://www.gnu.org/licenses/>.
 *******************************************************************************/
+#define _GNU_SOURCE
 #include<stdint.h>
 #include<string.h>
 #include<stdio.h>
@@ -30,7 +31,27 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "ud_error.h"
 #include "ud_file.h"
 #include "uinet_api.h"
+#include "ud_socket.h"
 
+#ifndef MSG_FASTOPEN
+#define MSG_FASTOPEN    0x20000000
+#endif
+
+#ifndef SOL_UDP
+#define SOL_UDP         17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT     103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO         104
+#endif
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE  0x10000
+#endif
+
+#define UD_MAXIOV       1024
+#define UD_CMSG_MAX     64  /* room for the control messages we translate */
 
 /*bsd2linux*/
 static inline int map_flags(int flags)
@@ -40,6 +61,11 @@ static inline int map_flags(int flags)
         flags &= (~MSG_DONTWAIT);
         ret |= UINET_MSG_DONTWAIT;
     }
+
+    if(flags & MSG_FASTOPEN) {
+        flags &= (~MSG_FASTOPEN);
+        ret |= UINET_MSG_FASTOPEN;
+    }
 #if 0
     if(flags & MSG_EOF) {
         flags &= (~MSG_EOF);
@@ -213,12 +239,90 @@ static void ud_set_errno(int error)
 }
 //extern uinet_if_t ud_uif;
 
+union ud_sockaddr {
+    struct uinet_sockaddr     sa;
+    struct uinet_sockaddr_in  sin;
+    struct uinet_sockaddr_in6 sin6;
+};
+
+/// Linux sockaddr_in/sockaddr_in6 to the BSD layout used by the stack
+static int ud_sockaddr_to_uinet(const struct sockaddr *addr, socklen_t addrlen,
+                                union ud_sockaddr *uaddr)
+{
+    if(addr == NULL)
+        return -1;
+
+    memset(uaddr, 0, sizeof(*uaddr));
+    switch(addr->sa_family) {
+    case AF_INET: {
+        const struct sockaddr_in *iaddr = (const struct sockaddr_in *)addr;
+
+        if(addrlen < sizeof(struct sockaddr_in))
+            return -1;
+        uaddr->sin.sin_len = sizeof(struct uinet_sockaddr_in);
+        uaddr->sin.sin_family = UINET_AF_INET;
+        uaddr->sin.sin_port = iaddr->sin_port;
+        memcpy(&uaddr->sin.sin_addr, &iaddr->sin_addr, sizeof(uaddr->sin.sin_addr));
+        return 0;
+    }
+    case AF_INET6: {
+        const struct sockaddr_in6 *iaddr6 = (const struct sockaddr_in6 *)addr;
+
+        if(addrlen < sizeof(struct sockaddr_in6))
+            return -1;
+        uaddr->sin6.sin6_len = sizeof(struct uinet_sockaddr_in6);
+        uaddr->sin6.sin6_family = UINET_AF_INET6;
+        uaddr->sin6.sin6_port = iaddr6->sin6_port;
+        uaddr->sin6.sin6_flowinfo = iaddr6->sin6_flowinfo;
+        memcpy(&uaddr->sin6.sin6_addr, &iaddr6->sin6_addr, sizeof(uaddr->sin6.sin6_addr));
+        uaddr->sin6.sin6_scope_id = iaddr6->sin6_scope_id;
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+/// BSD sockaddr from the stack back to the Linux layout, truncated to *addrlen
+static void ud_sockaddr_from_uinet(const struct uinet_sockaddr *uaddr,
+                                   struct sockaddr *addr, socklen_t *addrlen)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+
+    memset(&ss, 0, sizeof(ss));
+    if(uaddr->sa_family == UINET_AF_INET6) {
+        const struct uinet_sockaddr_in6 *u6 = (const struct uinet_sockaddr_in6 *)uaddr;
+        struct sockaddr_in6 *iaddr6 = (struct sockaddr_in6 *)&ss;
+
+        iaddr6->sin6_family = AF_INET6;
+        iaddr6->sin6_port = u6->sin6_port;
+        iaddr6->sin6_flowinfo = u6->sin6_flowinfo;
+        memcpy(&iaddr6->sin6_addr, &u6->sin6_addr, sizeof(iaddr6->sin6_addr));
+        iaddr6->sin6_scope_id = u6->sin6_scope_id;
+        len = sizeof(struct sockaddr_in6);
+    } else {
+        const struct uinet_sockaddr_in *u4 = (const struct uinet_sockaddr_in *)uaddr;
+        struct sockaddr_in *iaddr = (struct sockaddr_in *)&ss;
+
+        iaddr->sin_family = AF_INET;
+        iaddr->sin_port = u4->sin_port;
+        memcpy(&iaddr->sin_addr, &u4->sin_addr, sizeof(iaddr->sin_addr));
+        len = sizeof(struct sockaddr_in);
+    }
+
+    memcpy(addr, &ss, *addrlen < len ? *addrlen : len);
+    *addrlen = len;
+}
+
 
 /*----------------------------------------------------------------------------*/
 int ud_socket(int domain, int type, int protocol)
 {
     int error;
     struct uinet_socket *so = NULL;
+    if(domain == AF_INET6)
+        domain = UINET_PF_INET6;
     error = uinet_socreate(uinet_instance_default(),
                            domain, &so, type, 0);
 
@@ -230,32 +334,37 @@ int ud_socket(int domain, int type, int protocol)
 int ud_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
     struct uinet_socket *newso = NULL;
+    struct uinet_sockaddr *uaddr = NULL;
     struct uinet_socket *so = ud_fd_get_sock(sockfd);
     if(so == NULL) {
 //		printf("ppppppp %d\n", sockfd);
         return -1;
     }
 
-    int error = uinet_soaccept(so, (struct uinet_sockaddr **)&addr, &newso);
+    int error = uinet_soaccept(so, addr != NULL ? &uaddr : NULL, &newso);
+    if(uaddr != NULL) {
+        if(!error)
+            ud_sockaddr_from_uinet(uaddr, addr, addrlen);
+        uinet_free_sockaddr(uaddr);
+    }
     if(!error)
         return ud_fd_set_sock(newso);
     return error;
 }
 
-/// to convert the sockaddr in POSIX to BSD version sockaddr_in
+/// to convert the sockaddr in POSIX to BSD version sockaddr_in/sockaddr_in6
 int ud_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 {
     struct uinet_socket *so = ud_fd_get_sock(sockfd);
-    struct sockaddr_in *iaddr = (struct sockaddr_in*)addr;
-    struct uinet_sockaddr_in uaddr;
+    union ud_sockaddr uaddr;
 
-    uaddr.sin_len = sizeof(struct uinet_sockaddr);
-    uaddr.sin_family = iaddr->sin_family;
-    uaddr.sin_port = iaddr->sin_port;
-    memcpy((void*)&uaddr.sin_addr, (void*)&iaddr->sin_addr, sizeof(uaddr.sin_addr));
+    if(ud_sockaddr_to_uinet(addr, addrlen, &uaddr) < 0) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
 
     if(so != NULL)
-        return uinet_sobind(so, (struct uinet_sockaddr *)&uaddr);
+        return uinet_sobind(so, &uaddr.sa);
     return -1;
 }
 
@@ -267,16 +376,15 @@ int ud_connect(int sockfd, const struct sockaddr *addr, socklen_t address_len)
         goto ERR;
     }
 
-    struct sockaddr_in *iaddr = (struct sockaddr_in*)addr;
-    struct uinet_sockaddr_in uaddr;
+    union ud_sockaddr uaddr;
 
-    uaddr.sin_len = sizeof(struct uinet_sockaddr);
-    uaddr.sin_family = iaddr->sin_family;
-    uaddr.sin_port = iaddr->sin_port;
-    memcpy((void*)&uaddr.sin_addr, (void*)&iaddr->sin_addr, sizeof(uaddr.sin_addr));
+    if(ud_sockaddr_to_uinet(addr, address_len, &uaddr) < 0) {
+        errno = EAFNOSUPPORT;
+        goto ERR;
+    }
 
     if(so != NULL)
-        return uinet_soconnect(so, (struct uinet_sockaddr *)&uaddr);
+        return uinet_soconnect(so, &uaddr.sa);
     errno = 0;
     return 0;
 ERR:
@@ -289,8 +397,8 @@ ssize_t ud_recvfrom(int sockfd, void *buf, size_t len, int flags,
     struct uinet_iovec iov;
     struct uinet_uio uio;
     int error;
-    struct uinet_sockaddr_in* uaddr;
-    struct sockaddr_in *iaddr = (struct sockaddr_in*)from;
+    union ud_sockaddr uaddr;
+    unsigned int ualen = sizeof(uaddr);
 
     struct uinet_socket *so = ud_fd_get_sock(sockfd);
     if(so == NULL) {
@@ -312,21 +420,19 @@ ssize_t ud_recvfrom(int sockfd, void *buf, size_t len, int flags,
         goto ERR;
     }
 
-    error = uinet_soreceive(so, (struct uinet_sockaddr **)&uaddr, &uio, &flags);
+    error = uinet_sorecvfrom(so, &uio, from != NULL ? &uaddr.sa : NULL, &ualen, &flags);
     if(error != 0) {
         /* need adapt between LINUX and FreeBsd*/
         ud_set_errno(error);
         goto ERR;
     }
 
-    if(from != NULL && uaddr != NULL) {
-        iaddr->sin_family = uaddr->sin_family;
-        iaddr->sin_port = uaddr->sin_port;
-        memcpy((void*)&iaddr->sin_addr, (void*)&uaddr->sin_addr, sizeof(uaddr->sin_addr));
-        *fromlen = sizeof(struct sockaddr_in);
-
-        // need to free this memory allocated in soreceive
-        free(uaddr);
+    if(from != NULL) {
+        if(ualen != 0) {
+            ud_sockaddr_from_uinet(&uaddr.sa, from, fromlen);
+        } else {
+            *fromlen = 0;
+        }
     }
 
     errno = 0;
@@ -343,9 +449,275 @@ ssize_t ud_recv(int sockfd, void *buf, size_t len, int flags)
 }
 
 
+/* receive into uio, storing the source in msg->msg_name without allocating */
+static int ud_recvfrom_uio(struct uinet_socket *so, struct uinet_uio *uio,
+                           struct msghdr *msg, int *flags)
+{
+    union ud_sockaddr uaddr;
+    unsigned int ualen = sizeof(uaddr);
+    int error;
+
+    error = uinet_sorecvfrom(so, uio, msg->msg_name != NULL ? &uaddr.sa : NULL, &ualen, flags);
+    if(error == 0 && msg->msg_name != NULL) {
+        if(ualen != 0) {
+            ud_sockaddr_from_uinet(&uaddr.sa, msg->msg_name, &msg->msg_namelen);
+        } else {
+            msg->msg_namelen = 0;
+        }
+    }
+
+    return error;
+}
+
+/* linux2bsd: the only control message a sender may pass is UDP_SEGMENT */
+static int ud_cmsg_to_uinet(const struct msghdr *msg, void *ctl, unsigned int *ctllen)
+{
+    struct cmsghdr *cm;
+    struct uinet_cmsghdr *ucm;
+    unsigned int len = 0;
+    uint16_t segsz;
+
+    for(cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR((struct msghdr *)msg, cm)) {
+        if(cm->cmsg_level != SOL_UDP || cm->cmsg_type != UDP_SEGMENT ||
+           cm->cmsg_len != CMSG_LEN(sizeof(segsz)) ||
+           len + UINET_CMSG_SPACE(sizeof(segsz)) > UD_CMSG_MAX) {
+            return -1;
+        }
+
+        memcpy(&segsz, CMSG_DATA(cm), sizeof(segsz));
+        ucm = (struct uinet_cmsghdr *)((char *)ctl + len);
+        memset(ucm, 0, UINET_CMSG_SPACE(sizeof(segsz)));
+        ucm->cmsg_len = UINET_CMSG_LEN(sizeof(segsz));
+        ucm->cmsg_level = UINET_IPPROTO_UDP;
+        ucm->cmsg_type = UINET_UDP_SEGMENT;
+        memcpy(UINET_CMSG_DATA(ucm), &segsz, sizeof(segsz));
+        len += UINET_CMSG_SPACE(sizeof(segsz));
+    }
+
+    *ctllen = len;
+    return 0;
+}
+
+/* bsd2linux: UDP_GRO is passed on, anything else is dropped */
+static void ud_cmsg_from_uinet(const void *ctl, unsigned int ctllen, struct msghdr *msg)
+{
+    const struct uinet_cmsghdr *ucm;
+    unsigned int off = 0;
+    size_t len = 0;
+    struct cmsghdr *cm;
+    int segsz;
+
+    while(off + sizeof(*ucm) <= ctllen) {
+        ucm = (const struct uinet_cmsghdr *)((const char *)ctl + off);
+        if(ucm->cmsg_len < sizeof(*ucm) || off + ucm->cmsg_len > ctllen) {
+            break;
+        }
+        off += UINET_CMSG_ALIGN(ucm->cmsg_len);
+
+        if(ucm->cmsg_level != UINET_IPPROTO_UDP || ucm->cmsg_type != UINET_UDP_GRO ||
+           ucm->cmsg_len != UINET_CMSG_LEN(sizeof(segsz))) {
+            continue;
+        }
+        if(len + CMSG_SPACE(sizeof(segsz)) > msg->msg_controllen) {
+            msg->msg_flags |= MSG_CTRUNC;
+            break;
+        }
+
+        memcpy(&segsz, UINET_CMSG_DATA(ucm), sizeof(segsz));
+        cm = (struct cmsghdr *)((char *)msg->msg_control + len);
+        memset(cm, 0, CMSG_SPACE(sizeof(segsz)));
+        cm->cmsg_len = CMSG_LEN(sizeof(segsz));
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_GRO;
+        memcpy(CMSG_DATA(cm), &segsz, sizeof(segsz));
+        len += CMSG_SPACE(sizeof(segsz));
+    }
+
+    msg->msg_controllen = len;
+}
+
+/* Receive one datagram into UIO and fill in the rest of MSG, with its
+   control messages when the caller passed a control buffer */
+static int ud_recvmsg_uio(struct uinet_socket *so, struct uinet_uio *uio,
+                          struct msghdr *msg, int *flags)
+{
+    struct uinet_sockaddr *uaddr = NULL;
+    char ctl[UD_CMSG_MAX];
+    unsigned int ctllen = sizeof(ctl);
+    int error;
+
+    if(msg->msg_control != NULL) {
+        error = uinet_soreceive_control(so, msg->msg_name != NULL ? &uaddr : NULL, uio,
+                                        ctl, &ctllen, flags);
+    } else {
+        error = ud_recvfrom_uio(so, uio, msg, flags);
+    }
+    if(error != 0) {
+        return error;
+    }
+
+    msg->msg_flags = 0;
+    if(*flags & UINET_MSG_TRUNC) {
+        msg->msg_flags |= MSG_TRUNC;
+    }
+    if(*flags & UINET_MSG_CTRUNC) {
+        msg->msg_flags |= MSG_CTRUNC;
+    }
+
+    if(msg->msg_control != NULL) {
+        if(msg->msg_name != NULL) {
+            if(uaddr != NULL) {
+                ud_sockaddr_from_uinet(uaddr, msg->msg_name, &msg->msg_namelen);
+                uinet_free_sockaddr(uaddr);
+            } else {
+                msg->msg_namelen = 0;
+            }
+        }
+        ud_cmsg_from_uinet(ctl, ctllen, msg);
+    } else {
+        msg->msg_controllen = 0;
+    }
+
+    return 0;
+}
+
 ssize_t ud_recvmsg(int sockfd, struct msghdr *msg, int flags)
 {
+    struct uinet_iovec iov[UD_MAXIOV];
+    struct uinet_uio uio;
+    ssize_t len = 0;
+    int error;
+    size_t i;
+
+    struct uinet_socket *so = ud_fd_get_sock(sockfd);
+    if(so == NULL) {
+        errno = EBADF;
+        goto ERR;
+    }
+
+    if(msg->msg_iovlen > UD_MAXIOV) {
+        errno = EMSGSIZE;
+        goto ERR;
+    }
+
+    for(i = 0; i < msg->msg_iovlen; i++) {
+        iov[i].iov_base = msg->msg_iov[i].iov_base;
+        iov[i].iov_len = msg->msg_iov[i].iov_len;
+        len += msg->msg_iov[i].iov_len;
+    }
+    uio.uio_iov = iov;
+    uio.uio_iovcnt = msg->msg_iovlen;
+    uio.uio_offset = 0;
+    uio.uio_resid = len;
+
+    flags = map_flags(flags);
+    if(flags < 0) {
+        ud_set_errno(UINET_EINVAL);
+        goto ERR;
+    }
+
+    error = ud_recvmsg_uio(so, &uio, msg, &flags);
+    if(error != 0) {
+        /* need adapt between LINUX and FreeBsd*/
+        ud_set_errno(error);
+        goto ERR;
+    }
+
+    errno = 0;
+    return (len - uio.uio_resid);
+ERR:
+    return -1;
+}
+
+int ud_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                struct timespec *timeout)
+{
+    struct uinet_iovec iov[UD_MAXIOV];
+    struct uinet_uio uio;
+    struct timespec deadline, now;
+    struct msghdr *msg;
+    unsigned int i;
+    ssize_t len;
+    int error, uflags, waitforone;
+    size_t j;
 
+    struct uinet_socket *so = ud_fd_get_sock(sockfd);
+    if(so == NULL) {
+        errno = EBADF;
+        goto ERR;
+    }
+
+    waitforone = flags & MSG_WAITFORONE;
+    flags = map_flags(flags & ~MSG_WAITFORONE);
+    if(flags < 0) {
+        ud_set_errno(UINET_EINVAL);
+        goto ERR;
+    }
+
+    if(vlen == 0) {
+        errno = 0;
+        return 0;
+    }
+
+    if(timeout != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout->tv_sec;
+        deadline.tv_nsec += timeout->tv_nsec;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    for(i = 0; i < vlen; i++) {
+        msg = &msgvec[i].msg_hdr;
+        if(msg->msg_iovlen > UD_MAXIOV) {
+            error = UINET_EMSGSIZE;
+            break;
+        }
+
+        len = 0;
+        for(j = 0; j < msg->msg_iovlen; j++) {
+            iov[j].iov_base = msg->msg_iov[j].iov_base;
+            iov[j].iov_len = msg->msg_iov[j].iov_len;
+            len += msg->msg_iov[j].iov_len;
+        }
+        uio.uio_iov = iov;
+        uio.uio_iovcnt = msg->msg_iovlen;
+        uio.uio_offset = 0;
+        uio.uio_resid = len;
+
+        uflags = flags;
+        if(i > 0 && waitforone) {
+            uflags |= UINET_MSG_DONTWAIT;
+        }
+        error = ud_recvmsg_uio(so, &uio, msg, &uflags);
+        if(error != 0) {
+            break;
+        }
+
+        msgvec[i].msg_len = len - uio.uio_resid;
+
+        if(timeout != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if(now.tv_sec > deadline.tv_sec ||
+               (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+                i++;
+                break;
+            }
+        }
+    }
+
+    /* an error after the first datagram is left for the next call */
+    if(i == 0) {
+        ud_set_errno(error);
+        goto ERR;
+    }
+
+    errno = 0;
+    return i;
+ERR:
+    return -1;
 }
 
 
@@ -397,14 +769,12 @@ ssize_t ud_sendto(int sockfd, const void *buf, size_t len, int flags,
     struct uinet_iovec iov;
     struct uinet_uio uio;
 
-    struct sockaddr_in *iaddr = (struct sockaddr_in*)addr;
-    struct uinet_sockaddr_in uaddr;
-
-    uaddr.sin_len = sizeof(struct uinet_sockaddr);
-    uaddr.sin_family = iaddr->sin_family;
-    uaddr.sin_port = iaddr->sin_port;
-    memcpy((void*)&uaddr.sin_addr, (void*)&iaddr->sin_addr, sizeof(uaddr.sin_addr));
+    union ud_sockaddr uaddr;
 
+    if(ud_sockaddr_to_uinet(addr, addrlen, &uaddr) < 0) {
+        errno = EAFNOSUPPORT;
+        goto ERR;
+    }
 
     uio.uio_iov = &iov;
     iov.iov_base = buf;
@@ -420,7 +790,7 @@ ssize_t ud_sendto(int sockfd, const void *buf, size_t len, int flags,
     }
 
     struct uinet_socket *so = ud_fd_get_sock(sockfd);
-    int error = uinet_sosend(so, (struct uinet_sockaddr *)&uaddr, &uio, flags);
+    int error = uinet_sosend(so, &uaddr.sa, &uio, flags);
     if(error != 0) {
         /* need adapt between LINUX and FreeBsd*/
         printf("error %d \n", error);
@@ -436,6 +806,65 @@ ERR:
 
 ssize_t ud_sendmsg(int sockfd, const struct msghdr *msg, int flags)
 {
+    struct uinet_iovec iov[UD_MAXIOV];
+    struct uinet_uio uio;
+    union ud_sockaddr uaddr;
+    char ctl[UD_CMSG_MAX];
+    unsigned int ctllen = 0;
+    ssize_t len = 0;
+    int error;
+    size_t i;
+
+    struct uinet_socket *so = ud_fd_get_sock(sockfd);
+    if(so == NULL) {
+        errno = EBADF;
+        goto ERR;
+    }
+
+    if(msg->msg_name != NULL &&
+       ud_sockaddr_to_uinet(msg->msg_name, msg->msg_namelen, &uaddr) < 0) {
+        errno = EAFNOSUPPORT;
+        goto ERR;
+    }
+
+    if(msg->msg_iovlen > UD_MAXIOV) {
+        errno = EMSGSIZE;
+        goto ERR;
+    }
+
+    if(msg->msg_control != NULL && msg->msg_controllen > 0 &&
+       ud_cmsg_to_uinet(msg, ctl, &ctllen) < 0) {
+        errno = EINVAL;
+        goto ERR;
+    }
+
+    for(i = 0; i < msg->msg_iovlen; i++) {
+        iov[i].iov_base = msg->msg_iov[i].iov_base;
+        iov[i].iov_len = msg->msg_iov[i].iov_len;
+        len += msg->msg_iov[i].iov_len;
+    }
+    uio.uio_iov = iov;
+    uio.uio_iovcnt = msg->msg_iovlen;
+    uio.uio_offset = 0;
+    uio.uio_resid = len;
+
+    flags = map_flags(flags);
+    if(flags < 0) {
+        ud_set_errno(UINET_EINVAL);
+        goto ERR;
+    }
+
+    error = uinet_sosend_control(so, msg->msg_name != NULL ? &uaddr.sa : NULL, &uio,
+                                 ctl, ctllen, flags);
+    if(error != 0) {
+        /* need adapt between LINUX and FreeBsd*/
+        ud_set_errno(error);
+        goto ERR;
+    }
+    errno = 0;
+    return (len - uio.uio_resid);
+ERR:
+    return -1;
 }
 
 #if 0
@@ -500,7 +929,7 @@ ssize_t ud_sendmsg(int sockfd, const struct msghdr *msg, int flags)
 
 #endif
 
-static unsigned int ud_soopts[30] = {
+static unsigned int ud_soopts[48] = {
     0,
     UINET_SO_DEBUG,
     UINET_SO_REUSEADDR,
@@ -514,7 +943,9 @@ static unsigned int ud_soopts[30] = {
     UINET_SO_OOBINLINE,
     0,
     0,
-    UINET_SO_LINGER
+    UINET_SO_LINGER,
+    [15] = UINET_SO_REUSEPORT,          /* SO_REUSEPORT */
+    [47] = UINET_SO_MAX_PACING_RATE     /* SO_MAX_PACING_RATE */
 };
 
 #if 0
@@ -567,39 +998,62 @@ static unsigned int ud_tcpopts[31] = {
     UINET_TCP_MD5SIG,//14
     0,//15
     0,//16
+    0,//17
     0,//18
     0,//19
     0,//20
     0,//21
     0,//22
-    0,//23
+    UINET_TCP_FASTOPEN,//23
     0,//24
     0,//25
     0,//26
     0,//27
     0,//28
     0,//29
-    0//30
+    UINET_TCP_FASTOPEN//30 TCP_FASTOPEN_CONNECT
 };
 
 static int ud_maplevelopt(int *level, int *opt)
 {
     if(*level == 1) { /* SOCKET  */
         *level = UINET_SOL_SOCKET;
-        if(*opt > sizeof(ud_tcpopts) || ud_soopts[*opt] == 0) {
+        if(*opt < 0 || *opt >= (int)(sizeof(ud_soopts) / sizeof(ud_soopts[0])) ||
+           ud_soopts[*opt] == 0) {
             printf("invalid opt !\n");
             goto ERR;
         }
 
         *opt = ud_soopts[*opt];
     } else if(*level == 6) { /* tcp*/
-        *level = UINET_SOL_SOCKET;
-        if(*opt > sizeof(ud_tcpopts) || ud_tcpopts[*opt] == 0) {
+        *level = UINET_IPPROTO_TCP;
+        if(*opt < 0 || *opt >= (int)(sizeof(ud_tcpopts) / sizeof(ud_tcpopts[0])) ||
+           ud_tcpopts[*opt] == 0) {
             printf("invalid opt !\n");
             goto ERR;
         }
 
         *opt = ud_tcpopts[*opt];
+    } else if(*level == 41) { /* ipv6 */
+        *level = UINET_IPPROTO_IPV6;
+        if(*opt != 26) { /* only IPV6_V6ONLY */
+            printf("invalid opt !\n");
+            goto ERR;
+        }
+
+        *opt = UINET_IPV6_V6ONLY;
+    } else if(*level == 17) { /* udp */
+        *level = UINET_IPPROTO_UDP;
+        if(*opt == UDP_SEGMENT) {
+            *opt = UINET_UDP_SEGMENT;
+        } else if(*opt == UDP_GRO) {
+            *opt = UINET_UDP_GRO;
+        } else if(*opt == UD_UDP_RING) {
+            *opt = UINET_UDP_RING;
+        } else {
+            printf("invalid opt !\n");
+            goto ERR;
+        }
     }
     return 0;
 ERR:
@@ -664,8 +1118,7 @@ int ud_shutdown(int sockfd, int how)
 
 int ud_getpeername(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
-    struct uinet_sockaddr_in* uaddr;
-    struct sockaddr_in *iaddr = (struct sockaddr_in*)addr;
+    struct uinet_sockaddr *uaddr = NULL;
 
     struct uinet_socket *so = ud_fd_get_sock(sockfd);
     if(so == NULL) {
@@ -673,19 +1126,15 @@ int ud_getpeername(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
         goto ERR;
     }
 
-    int error = uinet_sogetsockaddr(so,(struct uinet_sockaddr **)&uaddr);
+    int error = uinet_sogetpeeraddr(so, &uaddr);
     if(error != 0) {
         goto ERR;
     }
 
-    if(addr!= NULL && uaddr != NULL) {
-        iaddr->sin_family = uaddr->sin_family;
-        iaddr->sin_port = uaddr->sin_port;
-        memcpy((void*)&iaddr->sin_addr, (void*)&uaddr->sin_addr, sizeof(uaddr->sin_addr));
-        addrlen = sizeof(struct sockaddr_in);
-
-        free(uaddr);
-    }
+    if(addr != NULL && uaddr != NULL)
+        ud_sockaddr_from_uinet(uaddr, addr, addrlen);
+    if(uaddr != NULL)
+        uinet_free_sockaddr(uaddr);
 
     return 0;
 ERR:
@@ -695,8 +1144,7 @@ ERR:
 
 int	ud_getsockname(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
-    struct uinet_sockaddr_in* uaddr;
-    struct sockaddr_in *iaddr = (struct sockaddr_in*)addr;
+    struct uinet_sockaddr *uaddr = NULL;
 
     struct uinet_socket *so = ud_fd_get_sock(sockfd);
     if(so == NULL) {
@@ -704,19 +1152,15 @@ int	ud_getsockname(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
         goto ERR;
     }
 
-    int error = uinet_sogetsockaddr(so,(struct uinet_sockaddr **)&uaddr);
+    int error = uinet_sogetsockaddr(so, &uaddr);
     if(error != 0) {
         goto ERR;
     }
 
-    if(addr!= NULL && uaddr != NULL) {
-        iaddr->sin_family = uaddr->sin_family;
-        iaddr->sin_port = uaddr->sin_port;
-        memcpy((void*)&iaddr->sin_addr, (void*)&uaddr->sin_addr, sizeof(uaddr->sin_addr));
-        *addrlen = sizeof(struct sockaddr_in);
-
-        free(uaddr);
-    }
+    if(addr != NULL && uaddr != NULL)
+        ud_sockaddr_from_uinet(uaddr, addr, addrlen);
+    if(uaddr != NULL)
+        uinet_free_sockaddr(uaddr);
 
     return 0;
 ERR:
@@ -43,10 +43,12 @@ int   uinet_getl2info(struct uinet_socket *so, struct uinet_in_l2info *l2i);
 int   uinet_getifstat(uinet_if_t uif, struct uinet_ifstat *stat);
 void  uinet_gettcpstat(uinet_instance_t uinst, struct uinet_tcpstat *stat);
 void  uinet_getipstat(uinet_instance_t uinst, struct uinet_ipstat *stat);
+int   uinet_getmallocstat(struct uinet_mallocstat *stats, int maxstats);
 
 char *uinet_inet_ntoa(struct uinet_in_addr in, char *buf, unsigned int size);
 const char *uinet_inet_ntop(int af, const void *src, char *dst, unsigned int size);
 int   uinet_inet_pton(int af, const char *src, void *dst);
+int   uinet_rtlookup_bulk(uinet_instance_t uinst, const struct uinet_in_addr *dst, struct uinet_rtlookup *res, unsigned int n);
 int   uinet_inet6_enabled(void);
 void  uinet_default_cfg(struct uinet_global_cfg *cfg, enum uinet_global_cfg_type which);
 void  uinet_print_cfg(struct uinet_global_cfg *cfg);
@@ -55,6 +57,7 @@ int   uinet_initialize_thread(const char *name);
 void  uinet_install_sighandlers(void);
 int   uinet_interface_add_alias(uinet_instance_t uinst, const char *name, const char *addr, const char *braddr, const char *mask);
 int   uinet_interface_create(uinet_instance_t uinst, const char *name);
+int   uinet_interface_create_vlan(uinet_instance_t uinst, const char *name, const char *parent, uint16_t tag);
 int   uinet_interface_up(uinet_instance_t uinst, const char *name, unsigned int promisc, unsigned int promiscinet);
 int   uinet_l2tagstack_cmp(const struct uinet_in_l2tagstack *ts1, const struct uinet_in_l2tagstack *ts2);
 uint32_t uinet_l2tagstack_hash(const struct uinet_in_l2tagstack *ts);
@@ -103,6 +106,10 @@ int   uinet_solisten(struct uinet_socket *so, int backlog);
 int   uinet_soreadable(struct uinet_socket *so, unsigned int in_upcall);
 int   uinet_sowritable(struct uinet_socket *so, unsigned int in_upcall);
 int   uinet_soreceive(struct uinet_socket *so, struct uinet_sockaddr **psa, struct uinet_uio *uio, int *flagsp);
+int   uinet_soreceive_control(struct uinet_socket *so, struct uinet_sockaddr **psa, struct uinet_uio *uio,
+			      void *control, unsigned int *controllen, int *flagsp);
+int   uinet_sorecvfrom(struct uinet_socket *so, struct uinet_uio *uio, struct uinet_sockaddr *from,
+		       unsigned int *fromlen, int *flagsp);
 int   uinet_sosetcatchall(struct uinet_socket *so);
 int   uinet_sosetcopymode(struct uinet_socket *so, unsigned int mode, uint64_t limit, uinet_if_t uif);
 void  uinet_sosetnonblocking(struct uinet_socket *so, unsigned int nonblocking);
@@ -114,6 +121,8 @@ void  uinet_sosetupcallprep(struct uinet_socket *so,
 			    void (*soup_send)(struct uinet_socket *, void *, int64_t), void *soup_send_arg);
 void  uinet_sosetuserctx(struct uinet_socket *so, int key, void *ctx);
 int   uinet_sosend(struct uinet_socket *so, struct uinet_sockaddr *addr, struct uinet_uio *uio, int flags);
+int   uinet_sosend_control(struct uinet_socket *so, struct uinet_sockaddr *addr, struct uinet_uio *uio,
+			   const void *control, unsigned int controllen, int flags);
 int   uinet_soshutdown(struct uinet_socket *so, int how);
 int   uinet_sogetpeeraddr(struct uinet_socket *so, struct uinet_sockaddr **sa);
 int   uinet_sogetsockaddr(struct uinet_socket *so, struct uinet_sockaddr **sa);
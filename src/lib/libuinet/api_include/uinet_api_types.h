@@ -98,6 +98,15 @@ struct uinet_sockaddr_in {
 	char	sin_zero[8];
 };
 
+struct uinet_sockaddr_in6 {
+	uint8_t		sin6_len;	/* length of this struct */
+	uinet_sa_family_t	sin6_family;	/* AF_INET6 */
+	uinet_in_port_t	sin6_port;	/* Transport layer port # */
+	uint32_t	sin6_flowinfo;	/* IP6 flow information */
+	struct uinet_in6_addr	sin6_addr;	/* IP6 address */
+	uint32_t	sin6_scope_id;	/* scope zone index */
+};
+
 struct uinet_in_addr_4in6 {
 	uint32_t		ia46_pad32[3];
 	struct	uinet_in_addr	ia46_addr4;
@@ -209,6 +218,7 @@ struct uinet_uio {
 #define	UINET_SO_PROTOCOL	0x1016		/* get socket protocol (Linux name) */
 #define	UINET_SO_PROTOTYPE	UINET_SO_PROTOCOL	/* alias for UINET_SO_PROTOCOL (SunOS name) */
 #define UINET_SO_L2INFO		0x1017		/* PROMISCUOUS_INET MAC addrs and tags */
+#define	UINET_SO_MAX_PACING_RATE 0x1018	/* socket's max TX pacing rate (Linux name) */
 
 /*
  * Structure used for manipulating linger option.
@@ -229,10 +239,13 @@ struct uinet_linger {
 #define	UINET_PF_INET6		UINET_AF_INET6
 
 
+#define	UINET_MSG_TRUNC		0x10		/* data discarded before delivery */
+#define	UINET_MSG_CTRUNC	0x20		/* control data lost before delivery */
 #define	UINET_MSG_DONTWAIT	0x80		/* this message should be nonblocking */
 #define	UINET_MSG_EOF		0x100		/* data completes connection */
 #define	UINET_MSG_NBIO		0x4000		/* FIONBIO mode, used by fifofs */
 #define	UINET_MSG_HOLE_BREAK	0x40000		/* break at and indicate hole boundary */
+#define	UINET_MSG_FASTOPEN	0x80000		/* send data in SYN (TCP Fast Open) */
 
 #define	UINET_SHUT_RD		0		/* shut down the reading side */
 #define	UINET_SHUT_WR		1		/* shut down the writing side */
@@ -242,6 +255,7 @@ struct uinet_linger {
 #define	UINET_IPPROTO_ICMP	1	/* control message protocol */
 #define	UINET_IPPROTO_TCP	6	/* tcp */
 #define	UINET_IPPROTO_UDP	17	/* user datagram protocol */
+#define	UINET_IPPROTO_IPV6	41	/* IP6 header */
 
 #define	UINET_INADDR_ANY		(uint32_t)0x00000000
 #define UINET_IN_PROMISC_PORT_ANY	0
@@ -259,6 +273,11 @@ struct uinet_linger {
 #define UINET_IP_COPY_MODE_TX		0x08
 #define UINET_IP_COPY_MODE_TXRX		(UINET_IP_COPY_MODE_TX|UINET_IP_COPY_MODE_RX)
 
+/*
+ * Options for use with [gs]etsockopt at the IPV6 level.
+ */
+#define	UINET_IPV6_V6ONLY	27   /* bool: only bind INET6 at wildcard bind */
+
 
 #define	UINET_TCP_NODELAY	0x01	/* don't delay send to coalesce packets */
 #define	UINET_TCP_MAXSEG	0x02	/* set maximum segment size */
@@ -274,6 +293,31 @@ struct uinet_linger {
 #define UINET_TCP_REASSDL	0x800	/* wait this long for missing segments */
 #define UINET_TCP_TRIVIAL_ISN	0x1000	/* use cheap, insecure ISN */
 #define	UINET_TCP_NOTIMEWAIT	0x2000	/* skip TIMEWAIT state */
+#define	UINET_TCP_RACK		0x4000	/* RACK loss detection and tail loss probes */
+#define	UINET_TCP_FASTOPEN	0x8000	/* TCP Fast Open (RFC 7413) */
+
+#define	UINET_UDP_SEGMENT	0x02	/* uint16_t; send in this size */
+#define	UINET_UDP_GRO		0x03	/* coalesce received datagrams */
+#define	UINET_UDP_RING		0x04	/* unsigned int; lockless receive slots */
+#define	UINET_UDP_MAX_SEGMENTS	64	/* most datagrams per UDP_SEGMENT send */
+
+/*
+ * Control messages passed to uinet_sosend_control() and returned by
+ * uinet_soreceive_control(), laid out as the stack's struct cmsghdr.
+ */
+struct uinet_cmsghdr {
+	uint32_t	cmsg_len;		/* data byte count, including hdr */
+	int		cmsg_level;		/* originating protocol */
+	int		cmsg_type;		/* protocol-specific type */
+/* followed by	u_char  cmsg_data[]; */
+};
+
+#define	UINET_CMSG_ALIGN(n)	(((n) + sizeof(long) - 1) & ~(sizeof(long) - 1))
+#define	UINET_CMSG_DATA(cmsg)	((unsigned char *)(cmsg) + \
+				 UINET_CMSG_ALIGN(sizeof(struct uinet_cmsghdr)))
+#define	UINET_CMSG_SPACE(l)	(UINET_CMSG_ALIGN(sizeof(struct uinet_cmsghdr)) + \
+				 UINET_CMSG_ALIGN(l))
+#define	UINET_CMSG_LEN(l)	(UINET_CMSG_ALIGN(sizeof(struct uinet_cmsghdr)) + (l))
 
 struct uinet_tcp_info {
 	uint8_t		tcpi_state;		/* TCP FSM state. */
@@ -441,7 +485,29 @@ struct	uinet_tcpstat {
 	unsigned long	tcps_sig_err_sigopt;	/* No signature expected by socket */
 	unsigned long	tcps_sig_err_nosigopt;	/* No signature provided by segment */
 
-	unsigned long	_pad[12];		/* 6 UTO, 6 TBD */
+	/* RACK/TLP related stats */
+	unsigned long	tcps_rack_recovery;	/* recoveries entered by RACK */
+	unsigned long	tcps_rack_rexmit_lost;	/* lost retransmissions detected */
+	unsigned long	tcps_tlp_probes;	/* tail loss probes sent */
+	unsigned long	tcps_tlp_recovered;	/* tail losses repaired by a probe */
+
+	/* TCP Fast Open related stats */
+	unsigned long	tcps_tfo_cookie_req;	/* cookie requests received */
+	unsigned long	tcps_tfo_cookie_bad;	/* invalid cookies received */
+	unsigned long	tcps_tfo_syn_data;	/* connections opened by a cookie */
+	unsigned long	tcps_tfo_syn_data_sent;	/* SYNs sent carrying data */
+	unsigned long	tcps_tfo_syn_data_acked; /* data in our SYN acked by SYN|ACK */
+
+	/* TIME_WAIT related stats */
+	unsigned long	tcps_tw_recycled;	/* TIME_WAIT ended early by a new SYN */
+	unsigned long	tcps_tw_reclaimed;	/* TIME_WAIT ended early for lack of space */
+
+	/* Syncache related stats */
+	unsigned long	tcps_sc_cachehit;	/* handshakes completed from an entry */
+	unsigned long	tcps_sc_cookiehit;	/* handshakes completed from a cookie */
+	unsigned long	tcps_sc_cookieonly;	/* SYN|ACKs sent without an entry */
+
+	unsigned long	_pad[6];		/* 6 UTO */
 };
 
 
@@ -474,6 +540,22 @@ struct uinet_in_l2info {
 typedef void * uinet_synf_deferral_t;
 
 
+struct uinet_mallocstat {
+	char		ums_name[32];		/* malloc type name */
+	uint64_t	ums_numallocs;		/* number of allocations */
+	uint64_t	ums_numfrees;		/* number of frees */
+	uint64_t	ums_memalloced;		/* bytes allocated */
+	uint64_t	ums_memfreed;		/* bytes freed */
+	uint64_t	ums_arena_pages;	/* arena pages carved into size classes */
+};
+
+
+struct uinet_rtlookup {
+	struct uinet_in_addr	rl_gateway;	/* next hop, the destination itself if on-link */
+	unsigned int		rl_ifindex;	/* outgoing interface, 0 if no route */
+};
+
+
 struct uinet_ifstat {
 	unsigned long	ifi_ipackets;		/* packets received on interface */
 	unsigned long	ifi_ierrors;		/* input errors on interface */
@@ -609,6 +691,7 @@ typedef enum {
 	UINET_IFTYPE_NETMAP,
 	UINET_IFTYPE_PCAP,
 	UINET_IFTYPE_DPDK,
+	UINET_IFTYPE_RING,
 
 	/* always last */
 	UINET_IFTYPE_COUNT
@@ -708,12 +791,44 @@ struct uinet_if_dpdk_cfg {
 	 * subdirectory.
 	 */
 	unsigned int dir_bits;
+
+	/*
+	 * If non-zero, IPv4 fragments are reassembled in the receive burst,
+	 * before the stack sees them, with up to this many datagrams in
+	 * progress.  The limit is capped so that held fragments never tie
+	 * up more than a quarter of the receive buffer pool.  Datagrams of
+	 * more than RTE_LIBRTE_IP_FRAG_MAX_FRAG fragments are dropped.
+	 * Reassembly is skipped while a first-look handler is installed.
+	 */
+	unsigned int reass_max_datagrams;
+
+	/*
+	 * Time allowed for all fragments of a datagram to arrive.
+	 */
+	unsigned int reass_timeout_ms;
+};
+
+struct uinet_if_ring_cfg {
+	/*
+	 * Maximum number of packets queued towards the peer interface.
+	 */
+	unsigned int queue_len;
+
+	/*
+	 * If set, called for each transmitted frame with its first caplen
+	 * bytes and total length.  Returning non-zero drops the frame,
+	 * which can be used to inject loss.
+	 */
+	int (*tx_filter)(void *arg, const void *frame, unsigned int caplen,
+			 unsigned int len);
+	void *tx_filter_arg;
 };
 
 union uinet_if_type_cfg {
 	struct uinet_if_netmap_cfg netmap;
 	struct uinet_if_pcap_cfg pcap;
 	struct uinet_if_dpdk_cfg dpdk;
+	struct uinet_if_ring_cfg ring;
 };
 
 
@@ -739,6 +854,9 @@ struct uinet_if_cfg {
 	 *
 	 *  UINET_IFTYPE_PCAP - <hostifname> or file://<filename>
 	 *
+	 *  UINET_IFTYPE_RING - <ringname>, the same for both interfaces
+	 *                      to be connected back to back
+	 *
 	 */
 	const char *configstr;
 
@@ -787,11 +905,15 @@ struct uinet_global_cfg {
 	uint32_t netmap_extra_bufs;
 	struct {
 		struct {
+			struct {
+				unsigned int lpm_rules;   /* DIR-24-8 forwarding table size, 0 = radix lookups only */
+			} ip;
 			struct {
 				struct {
-					unsigned int hashsize;    /* number of buckets */
+					unsigned int hashsize;    /* number of buckets per shard */
 					unsigned int bucketlimit; /* per-bucket limit */
-					unsigned int cachelimit;  /* overall entry limit */
+					unsigned int cachelimit;  /* overall entry limit, split across shards */
+					unsigned int shards;      /* 0 = one per cpu */
 				} syncache;
 				unsigned int tcbhashsize; /* number of buckets in connection cache */
 			} tcp;
@@ -803,7 +925,20 @@ struct uinet_global_cfg {
 			unsigned int nmbclusters; /* maximum number of cluster mbufs */ 
 			unsigned int somaxconn;  /* maximum accept queue depth */
 		} ipc;
+		struct {
+			unsigned int size;          /* MB preallocated for kernel malloc() and UMA slabs, 0 = disabled */
+			unsigned int hugepage_size; /* kB, 0 = use regular pages */
+		} arena;
 	} kern;
+	struct {
+		/*
+		 * Elides the locks of STS instances only.  uinet_init()
+		 * refuses it unless the initial instance is STS and its
+		 * timers are run by the application.
+		 */
+		unsigned int mtx_noop;       /* make STS instance mutexes no-ops */
+		unsigned int mtx_spin_limit; /* max spins before parking, 0 = default */
+	} locks;
 };
 
 
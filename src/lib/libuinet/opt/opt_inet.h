@@ -1,4 +1,3 @@
 #define INET 1
 #define INET_NO_CC_UNLOAD 1
-#define INET_NO_TCP_KHELP 1
 #define INET_COPY 1
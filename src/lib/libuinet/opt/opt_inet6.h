@@ -0,0 +1 @@
+#define INET6 1
@@ -0,0 +1 @@
+#define PCBGROUP 1
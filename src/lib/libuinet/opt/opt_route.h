@@ -1 +1,3 @@
 #define ROUTETABLES 16
+#define FLOWTABLE 1
+#define INET_LPM 1
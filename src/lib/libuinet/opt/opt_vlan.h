@@ -0,0 +1 @@
+#define VLAN_ARRAY 1
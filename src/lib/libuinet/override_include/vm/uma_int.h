@@ -41,74 +41,95 @@
 #define NO_OBJ_ALLOC
 
 
-void thread_bucket_lock(void);
-void thread_bucket_unlock(void);
-void uma_page_slab_hash_lock(void);
-void uma_page_slab_hash_unlock(void);
+#include <machine/atomic.h>
 
-#define critical_enter()        thread_bucket_lock()
-#define critical_exit()         thread_bucket_unlock()
+/*
+ * Per-thread UMA caches are reached through TLS (see CACHE_ENTER()), so the
+ * critical sections the native kernel uses to pin a per-cpu cache are not
+ * needed here.
+ */
+#define critical_enter()
+#define critical_exit()
 
 extern int uma_page_mask;
 
 
 #define UMA_PAGE_HASH(pgno) ((pgno) & uma_page_mask)
 
+/*
+ * Page to slab lookup.  Entries are never removed from the hash, only
+ * repointed when a page is reused for a different slab, and a new entry is
+ * fully initialized before it is published at the head of its chain with a
+ * release CAS.  Lookups therefore walk the chains without taking any lock.
+ */
 typedef struct uma_page {
-        LIST_ENTRY(uma_page)    list_entry;
-	unsigned long		up_pageno;
-        uma_slab_t              up_slab;
+	struct uma_page * volatile	up_next;
+	unsigned long			up_pageno;
+	uma_slab_t volatile		up_slab;
 } *uma_page_t;
 
-LIST_HEAD(uma_page_head, uma_page);
+struct uma_page_head {
+	struct uma_page * volatile	uph_first;
+};
 extern struct uma_page_head *uma_page_slab_hash;
 
+static __inline uma_page_t
+uma_page_find(uma_page_t up, unsigned long pageno)
+{
+	while (up != NULL && up->up_pageno != pageno)
+		up = (uma_page_t)atomic_load_acq_ptr((volatile uintptr_t *)&up->up_next);
+
+	return (up);
+}
+
 static __inline uma_slab_t
 vtoslab(vm_offset_t va)
 {       
-        struct uma_page_head *hash_list;
-        uma_page_t up;
-	uma_slab_t slab = NULL;
+	struct uma_page_head *hash_list;
+	uma_page_t up;
 	unsigned long pageno = atop(va);
 
-        hash_list = &uma_page_slab_hash[UMA_PAGE_HASH(pageno)];
+	hash_list = &uma_page_slab_hash[UMA_PAGE_HASH(pageno)];
 
- 	uma_page_slab_hash_lock();
-	LIST_FOREACH(up, hash_list, list_entry)
-	    if (up->up_pageno == pageno) {
-		    slab = up->up_slab;
-		    break;
-	    }
-	uma_page_slab_hash_unlock();
-	
-        return (slab);
+	up = (uma_page_t)atomic_load_acq_ptr((volatile uintptr_t *)&hash_list->uph_first);
+	up = uma_page_find(up, pageno);
+
+	return (up ? up->up_slab : NULL);
 }
 
 static __inline void
 vsetslab(vm_offset_t va, uma_slab_t slab)
 {
-        struct uma_page_head *hash_list;
-        uma_page_t up;
+	struct uma_page_head *hash_list;
+	uma_page_t up, first, newup = NULL;
 	unsigned long pageno = atop(va);
 	
-        hash_list = &uma_page_slab_hash[UMA_PAGE_HASH(pageno)];
-
- 	uma_page_slab_hash_lock();
-	
-	LIST_FOREACH(up, hash_list, list_entry)
-                if (up->up_pageno == pageno)
-                        break;
-
-        if (up != NULL) {
-                up->up_slab = slab;
-        } else {
-		up = malloc(sizeof(*up), M_DEVBUF, M_WAITOK);
-		up->up_pageno = pageno;
-		up->up_slab = slab;
-		LIST_INSERT_HEAD(hash_list, up, list_entry);
+	hash_list = &uma_page_slab_hash[UMA_PAGE_HASH(pageno)];
+
+	/*
+	 * A given page is only ever being set by the one thread that owns
+	 * it, so only inserts of other pages can race with this one.
+	 */
+	for (;;) {
+		first = (uma_page_t)atomic_load_acq_ptr((volatile uintptr_t *)&hash_list->uph_first);
+		up = uma_page_find(first, pageno);
+		if (up != NULL) {
+			up->up_slab = slab;
+			if (newup != NULL)
+				free(newup, M_DEVBUF);
+			return;
+		}
+
+		if (newup == NULL) {
+			newup = malloc(sizeof(*newup), M_DEVBUF, M_WAITOK);
+			newup->up_pageno = pageno;
+			newup->up_slab = slab;
+		}
+		newup->up_next = first;
+		if (atomic_cmpset_rel_ptr((volatile uintptr_t *)&hash_list->uph_first,
+		    (uintptr_t)first, (uintptr_t)newup))
+			return;
 	}
-
-	uma_page_slab_hash_unlock();
 }
 
 #endif	/* _UINET_VM_UMA_INT_H_ */
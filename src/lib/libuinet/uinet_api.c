@@ -23,6 +23,7 @@
  * SUCH DAMAGE.
  */
 
+#include "opt_inet6.h"
 #include "opt_passiveinet.h"
 
 #include <sys/param.h>
@@ -39,21 +40,30 @@
 #include <sys/sysctl.h>
 #include <sys/uio.h>
 
+#include <net/ethernet.h>
 #include <net/if.h>
 #include <net/if_promiscinet.h>
+#include <net/if_vlan_var.h>
+#include <net/route.h>
 #include <netinet/in.h>
 #include <netinet/in_var.h>
 #include <netinet/in_promisc.h>
+#include <netinet/ip.h>
 #include <netinet/ip_var.h>
 #include <netinet/tcp_syncache.h>
+#include <netinet/udp.h>
+#include <netinet/udp_var.h>
 #include <net/pfil.h>
 #include <net/vnet.h>
+#ifdef INET6
+#include <netinet/ip6.h>
+#include <netinet6/in6_var.h>
+#include <netinet6/nd6.h>
+#endif
 
 #include "uinet_internal.h"
 #include "uinet_host_interface.h"
 
-#include "opt_inet6.h"
-
 
 int
 uinet_inet6_enabled(void)
@@ -184,6 +194,43 @@ uinet_getipstat(uinet_instance_t uinst, struct uinet_ipstat *stat)
 }
 
 
+/*
+ * Resolve a burst of IPv4 destinations against the instance's default
+ * routing table, e.g. for a batch of frames taken from a first-look
+ * handler.  Returns the number of destinations that have a route.
+ */
+int
+uinet_rtlookup_bulk(uinet_instance_t uinst, const struct uinet_in_addr *dst,
+                    struct uinet_rtlookup *res, unsigned int n)
+{
+    struct rtentry *rt[64];
+    unsigned int i, j, chunk;
+    int found = 0;
+
+    CURVNET_SET(uinst->ui_vnet);
+    for (i = 0; i < n; i += chunk) {
+        chunk = min(n - i, sizeof(rt) / sizeof(rt[0]));
+        found += in_rtalloc_bulk((const struct in_addr *)&dst[i], rt, chunk, 0);
+        for (j = 0; j < chunk; j++) {
+            if (rt[j] == NULL) {
+                res[i + j].rl_gateway.s_addr = INADDR_ANY;
+                res[i + j].rl_ifindex = 0;
+                continue;
+            }
+            if (rt[j]->rt_flags & RTF_GATEWAY)
+                res[i + j].rl_gateway.s_addr = satosin(rt[j]->rt_gateway)->sin_addr.s_addr;
+            else
+                res[i + j].rl_gateway = dst[i + j];
+            res[i + j].rl_ifindex = rt[j]->rt_ifp->if_index;
+            RTFREE(rt[j]);
+        }
+    }
+    CURVNET_RESTORE();
+
+    return (found);
+}
+
+
 char *
 uinet_inet_ntoa(struct uinet_in_addr in, char *buf, unsigned int size)
 {
@@ -209,25 +256,22 @@ uinet_inet_pton(int af, const char *src, void *dst)
 
 static int
 uinet_ifconfig_begin(uinet_instance_t uinst, struct socket **so,
-             struct ifreq *ifr, const char *name)
+             struct ifreq *ifr, const char *name, int dom)
 {
     struct thread *td = curthread;
     struct uinet_if *uif;
     int error;
 
-    uif = uinet_iffind_byname(uinst, name);
-    if (NULL == uif) {
-        printf("could not find interface %s\n", name);
-        return (EINVAL);
-    }
-
-    error = socreate(PF_INET, so, SOCK_DGRAM, 0, td->td_ucred, td, uinst->ui_vnet);
+    error = socreate(dom, so, SOCK_DGRAM, 0, td->td_ucred, td, uinst->ui_vnet);
     if (0 != error) {
         printf("ifconfig socket creation failed (%d)\n", error);
         return (error);
     }
 
-    snprintf(ifr->ifr_name, sizeof(ifr->ifr_name), "%s", uif->name);
+    /* Cloned interfaces, such as VLANs, are known only to the stack */
+    uif = uinet_iffind_byname(uinst, name);
+    snprintf(ifr->ifr_name, sizeof(ifr->ifr_name), "%s",
+             uif != NULL ? uif->name : name);
     
     return (0);
 }
@@ -253,6 +297,67 @@ uinet_ifconfig_end(struct socket *so)
 }
 
 
+#ifdef INET6
+/*
+ * The mask of an IPv6 alias may be given either as a prefix length or in
+ * address form.  A missing mask means /64.
+ */
+static int
+uinet_interface_add_alias6(uinet_instance_t uinst, const char *name,
+              const char *addr, const char *mask)
+{
+    struct socket *cfg_so;
+    struct in6_aliasreq ifra;
+    struct sockaddr_in6 template = {
+        .sin6_len = sizeof(struct sockaddr_in6),
+        .sin6_family = AF_INET6
+    };
+    char *end;
+    unsigned long plen;
+    int error;
+
+    memset(&ifra, 0, sizeof(ifra));
+    error = uinet_ifconfig_begin(uinst, &cfg_so, (struct ifreq *)&ifra, name, PF_INET6);
+    if (0 != error) {
+        return (error);
+    }
+
+    ifra.ifra_addr = template;
+    if (inet_pton(AF_INET6, addr, &ifra.ifra_addr.sin6_addr) <= 0) {
+        error = EAFNOSUPPORT;
+        goto out;
+    }
+
+    ifra.ifra_prefixmask = template;
+    if (mask == NULL || mask[0] == '\0') {
+        in6_prefixlen2mask(&ifra.ifra_prefixmask.sin6_addr, 64);
+    } else if (strchr(mask, ':') != NULL) {
+        if (inet_pton(AF_INET6, mask, &ifra.ifra_prefixmask.sin6_addr) <= 0) {
+            error = EAFNOSUPPORT;
+            goto out;
+        }
+    } else {
+        plen = strtoul(mask, &end, 10);
+        if (*end != '\0' || plen > 128) {
+            error = EINVAL;
+            goto out;
+        }
+        in6_prefixlen2mask(&ifra.ifra_prefixmask.sin6_addr, plen);
+    }
+
+    ifra.ifra_lifetime.ia6t_vltime = ND6_INFINITE_LIFETIME;
+    ifra.ifra_lifetime.ia6t_pltime = ND6_INFINITE_LIFETIME;
+
+    error = uinet_ifconfig_do(cfg_so, SIOCAIFADDR_IN6, &ifra);
+
+out:
+    uinet_ifconfig_end(cfg_so);
+
+    return (error);
+}
+#endif
+
+
 int
 uinet_interface_add_alias(uinet_instance_t uinst, const char *name,
               const char *addr, const char *braddr, const char *mask)
@@ -265,12 +370,17 @@ uinet_interface_add_alias(uinet_instance_t uinst, const char *name,
     };
     int error;
 
+#ifdef INET6
+    if (strchr(addr, ':') != NULL)
+        return (uinet_interface_add_alias6(uinst, name, addr, mask));
+#endif
+
     /*
      * The cast of ina to (struct ifreq *) is safe because they both
      * begin with the same size name field, and uinet_ifconfig_begin
      * only touches the name field.
      */
-    error = uinet_ifconfig_begin(uinst, &cfg_so, (struct ifreq *)&ina, name);
+    error = uinet_ifconfig_begin(uinst, &cfg_so, (struct ifreq *)&ina, name, PF_INET);
     if (0 != error) {
         return (error);
     }
@@ -319,7 +429,7 @@ uinet_interface_create(uinet_instance_t uinst, const char *name)
     struct ifreq ifr;
     int error;
 
-    error = uinet_ifconfig_begin(uinst, &cfg_so, &ifr, name);
+    error = uinet_ifconfig_begin(uinst, &cfg_so, &ifr, name, PF_INET);
     if (0 != error)
         return (error);
 
@@ -331,6 +441,49 @@ uinet_interface_create(uinet_instance_t uinst, const char *name)
 }
 
 
+/*
+ * Create an 802.1Q sub-interface of parent carrying the given tag.  A
+ * parent that is itself a VLAN yields a QinQ interface.  The stack names
+ * VLAN clones vlanN or <parent>.<tag>, so any other name is applied with
+ * a rename once the interface exists.
+ */
+int
+uinet_interface_create_vlan(uinet_instance_t uinst, const char *name,
+                            const char *parent, uint16_t tag)
+{
+    struct socket *cfg_so;
+    struct ifreq ifr;
+    struct vlanreq vlr;
+    struct uinet_if *uif;
+    int error;
+
+    if (tag == 0 || tag >= EVL_VLID_MASK)
+        return (EINVAL);
+
+    memset(&vlr, 0, sizeof(vlr));
+    uif = uinet_iffind_byname(uinst, parent);
+    snprintf(vlr.vlr_parent, sizeof(vlr.vlr_parent), "%s",
+             uif != NULL ? uif->name : parent);
+    vlr.vlr_tag = tag;
+
+    error = uinet_ifconfig_begin(uinst, &cfg_so, &ifr, "vlan", PF_INET);
+    if (0 != error)
+        return (error);
+
+    ifr.ifr_data = (caddr_t)&vlr;
+    error = uinet_ifconfig_do(cfg_so, SIOCIFCREATE2, &ifr);
+    if (0 == error && strcmp(ifr.ifr_name, name) != 0) {
+        ifr.ifr_data = __DECONST(caddr_t, name);
+        if (0 != (error = uinet_ifconfig_do(cfg_so, SIOCSIFNAME, &ifr)))
+            uinet_ifconfig_do(cfg_so, SIOCIFDESTROY, &ifr);
+    }
+
+    uinet_ifconfig_end(cfg_so);
+
+    return (error);
+}
+
+
 int
 uinet_interface_up(uinet_instance_t uinst, const char *name, unsigned int promisc, unsigned int promiscinet)
 {
@@ -338,7 +491,7 @@ uinet_interface_up(uinet_instance_t uinst, const char *name, unsigned int promis
     struct ifreq ifr;
     int error;
 
-    error = uinet_ifconfig_begin(uinst, &cfg_so, &ifr, name);
+    error = uinet_ifconfig_begin(uinst, &cfg_so, &ifr, name, PF_INET);
     if (0 != error)
         return (error);
     
@@ -637,10 +790,33 @@ noconnection:
 }
 
 
+/*
+ * The stack may rewrite the address it is handed (in6_pcbbind() clears
+ * the port, sa6_embedscope() embeds the zone), so, like getsockaddr() in
+ * the kernel, work on a private copy of the caller's address.
+ */
+static int
+uinet_sockaddr_copyin(const struct uinet_sockaddr *nam, struct sockaddr_storage *ss)
+{
+    if (nam->sa_len > sizeof(*ss) ||
+        nam->sa_len < offsetof(struct sockaddr, sa_data))
+        return (EINVAL);
+
+    memcpy(ss, nam, nam->sa_len);
+    return (0);
+}
+
+
 int
 uinet_sobind(struct uinet_socket *so, struct uinet_sockaddr *nam)
 {
-    return sobind((struct socket *)so, (struct sockaddr *)nam, curthread);
+    struct sockaddr_storage ss;
+    int error;
+
+    if ((error = uinet_sockaddr_copyin(nam, &ss)))
+        return (error);
+
+    return sobind((struct socket *)so, (struct sockaddr *)&ss, curthread);
 }
 
 
@@ -661,6 +837,7 @@ int
 uinet_soconnect(struct uinet_socket *uso, struct uinet_sockaddr *nam)
 {
     struct socket *so = (struct socket *)uso;
+    struct sockaddr_storage ss;
     int error;
     int interrupted = 0;
 
@@ -669,7 +846,10 @@ uinet_soconnect(struct uinet_socket *uso, struct uinet_sockaddr *nam)
         goto done1;
     }
 
-    error = soconnect(so, (struct sockaddr *)nam, curthread);
+    error = uinet_sockaddr_copyin(nam, &ss);
+    if (error)
+        goto bad;
+    error = soconnect(so, (struct sockaddr *)&ss, curthread);
     if (error)
         goto bad;
     if ((so->so_state & SS_NBIO) && (so->so_state & SS_ISCONNECTING)) {
@@ -797,12 +977,19 @@ uinet_solisten(struct uinet_socket *so, int backlog)
 }
 
 
+static inline int
+uinet_so_isudp(struct socket *so)
+{
+    return (so->so_proto->pr_type == SOCK_DGRAM && so->so_proto->pr_protocol == IPPROTO_UDP);
+}
+
+
 int
 uinet_soreadable(struct uinet_socket *so, unsigned int in_upcall)
 {
     struct socket *so_internal = (struct socket *)so;
     unsigned int avail; 
-    int canread;
+    int canread, ringcnt;
 
     CURVNET_SET(so_internal->so_vnet);
     if (so_internal->so_options & SO_ACCEPTCONN) {
@@ -818,6 +1005,9 @@ uinet_soreadable(struct uinet_socket *so, unsigned int in_upcall)
             SOCKBUF_LOCK(&so_internal->so_rcv);
 
         avail = so_internal->so_rcv.sb_cc;
+        /* A datagram waiting on a UDP_RING counts as readable. */
+        if (uinet_so_isudp(so_internal) && (ringcnt = udp_ring_count(so_internal)) > 0)
+            avail += ringcnt;
         if (avail || (!so_internal->so_error && !(so_internal->so_rcv.sb_state & SBS_CANTRCVMORE))) {
             if (avail > INT_MAX)
                 canread = INT_MAX;
@@ -913,9 +1103,25 @@ uinet_sosetuserctx(struct uinet_socket *so, int key, void *ctx)
 
 int
 uinet_soreceive(struct uinet_socket *so, struct uinet_sockaddr **psa, struct uinet_uio *uio, int *flagsp)
+{
+    return (uinet_soreceive_control(so, psa, uio, NULL, NULL, flagsp));
+}
+
+
+/*
+ * As uinet_soreceive(), also returning the record's control messages in
+ * control as a sequence of struct uinet_cmsghdr.  On return, *controllen
+ * is the number of bytes stored, and UINET_MSG_CTRUNC is set in *flagsp
+ * if some did not fit.
+ */
+int
+uinet_soreceive_control(struct uinet_socket *so, struct uinet_sockaddr **psa, struct uinet_uio *uio,
+			void *control, unsigned int *controllen, int *flagsp)
 {
     struct iovec iov[uio->uio_iovcnt];
     struct uio uio_internal;
+    struct mbuf *cm, *m;
+    unsigned int space, used;
     int i;
     int result;
 
@@ -931,14 +1137,94 @@ uinet_soreceive(struct uinet_socket *so, struct uinet_sockaddr **psa, struct uin
     uio_internal.uio_rw = UIO_READ;
     uio_internal.uio_td = curthread;
     
-    result = soreceive((struct socket *)so, (struct sockaddr **)psa, &uio_internal, NULL, NULL, flagsp);
+    cm = NULL;
+    result = soreceive((struct socket *)so, (struct sockaddr **)psa, &uio_internal, NULL,
+		       control != NULL ? &cm : NULL, flagsp);
 
     uio->uio_resid = uio_internal.uio_resid;
 
+    if (control != NULL) {
+        space = *controllen;
+        used = 0;
+        for (m = cm; m != NULL; m = m->m_next) {
+            if (m->m_len > space - used) {
+                if (flagsp != NULL)
+                    *flagsp |= MSG_CTRUNC;
+                break;
+            }
+            memcpy((char *)control + used, mtod(m, void *), m->m_len);
+            used += m->m_len;
+        }
+        *controllen = used;
+        m_freem(cm);
+    }
+
     return (result);
 }
 
 
+/*
+ * As uinet_soreceive(), but the source address is stored in the caller's
+ * from buffer, which is fromlen bytes long; *fromlen is set to the
+ * address's actual length.  On a UDP_RING socket the datagram comes
+ * straight off the ring, with no locking and no allocation.
+ */
+int
+uinet_sorecvfrom(struct uinet_socket *so, struct uinet_uio *uio, struct uinet_sockaddr *from,
+		 unsigned int *fromlen, int *flagsp)
+{
+    struct socket *so_internal = (struct socket *)so;
+    struct uinet_sockaddr *sa;
+    struct sockaddr_in sin;
+    struct mbuf *m;
+    unsigned int len, n;
+    int i, flags, result;
+
+    flags = (flagsp != NULL) ? *flagsp : 0;
+    if (!uinet_so_isudp(so_internal) || (flags & (MSG_PEEK | MSG_OOB)) ||
+        (result = udp_ring_get(so_internal, &m, &sin, flags)) == EOPNOTSUPP) {
+        sa = NULL;
+        result = uinet_soreceive(so, from != NULL ? &sa : NULL, uio, flagsp);
+        if (from != NULL) {
+            if (sa != NULL) {
+                memcpy(from, sa, min(*fromlen, sa->sa_len));
+                *fromlen = sa->sa_len;
+                uinet_free_sockaddr(sa);
+            } else
+                *fromlen = 0;
+        }
+        return (result);
+    }
+    if (result != 0)
+        return (result);
+
+    if (from != NULL) {
+        if (m != NULL) {
+            memcpy(from, &sin, min(*fromlen, sizeof(sin)));
+            *fromlen = sizeof(sin);
+        } else
+            *fromlen = 0;
+    }
+    if (m == NULL)
+        return (0);
+
+    len = 0;
+    for (i = 0; i < uio->uio_iovcnt && len < m->m_pkthdr.len; i++) {
+        n = m->m_pkthdr.len - len;
+        if (uio->uio_iov[i].iov_len < n)
+            n = uio->uio_iov[i].iov_len;
+        m_copydata(m, len, n, uio->uio_iov[i].iov_base);
+        len += n;
+    }
+    uio->uio_resid -= len;
+    if (len < m->m_pkthdr.len && flagsp != NULL)
+        *flagsp |= MSG_TRUNC;
+    m_freem(m);
+
+    return (0);
+}
+
+
 int
 uinet_sosetcatchall(struct uinet_socket *so)
 {
@@ -1041,12 +1327,41 @@ uinet_sosetupcallprep(struct uinet_socket *so,
 
 int
 uinet_sosend(struct uinet_socket *so, struct uinet_sockaddr *addr, struct uinet_uio *uio, int flags)
+{
+    return (uinet_sosend_control(so, addr, uio, NULL, 0, flags));
+}
+
+
+/*
+ * As uinet_sosend(), passing along controllen bytes of control messages
+ * laid out as a sequence of struct uinet_cmsghdr.
+ */
+int
+uinet_sosend_control(struct uinet_socket *so, struct uinet_sockaddr *addr, struct uinet_uio *uio,
+		     const void *control, unsigned int controllen, int flags)
 {
     struct iovec iov[uio->uio_iovcnt];
     struct uio uio_internal;
+    struct sockaddr_storage ss;
+    struct mbuf *cm;
     int i;
     int result;
 
+    if (addr != NULL) {
+        if ((result = uinet_sockaddr_copyin(addr, &ss)))
+            return (result);
+        addr = (struct uinet_sockaddr *)&ss;
+    }
+
+    cm = NULL;
+    if (controllen > 0) {
+        if (controllen > MLEN)
+            return (EINVAL);
+        cm = m_get(M_WAITOK, MT_CONTROL);
+        memcpy(mtod(cm, void *), control, controllen);
+        cm->m_len = controllen;
+    }
+
     for (i = 0; i < uio->uio_iovcnt; i++) {
         iov[i].iov_base = uio->uio_iov[i].iov_base;
         iov[i].iov_len = uio->uio_iov[i].iov_len;
@@ -1059,7 +1374,7 @@ uinet_sosend(struct uinet_socket *so, struct uinet_sockaddr *addr, struct uinet_
     uio_internal.uio_rw = UIO_WRITE;
     uio_internal.uio_td = curthread;
 
-    result = sosend((struct socket *)so, (struct sockaddr *)addr, &uio_internal, NULL, NULL, flags, curthread);
+    result = sosend((struct socket *)so, (struct sockaddr *)addr, &uio_internal, NULL, cm, flags, curthread);
 
     uio->uio_resid = uio_internal.uio_resid;
 
@@ -1687,14 +2002,22 @@ uinet_default_cfg(struct uinet_global_cfg *cfg, enum uinet_global_cfg_type which
                     .nmbclusters = 4*1024,
                     .somaxconn = 128,
                 },
+                .arena = {
+                    .size = 0,
+                    .hugepage_size = 2048,
+                },
             },
             .net = {
                 .inet = {
+                    .ip = {
+                        .lpm_rules = 0,
+                    },
                     .tcp = {
                         .syncache = {
                             .hashsize = 512,
                             .bucketlimit = 30,
                             .cachelimit = 15360, /* (512 * 30) */
+                            .shards = 0,
                         },
                         .tcbhashsize = 512,
                     },
@@ -1713,14 +2036,22 @@ uinet_default_cfg(struct uinet_global_cfg *cfg, enum uinet_global_cfg_type which
                     .nmbclusters = 128*1024,
                     .somaxconn = 1024,
                 },
+                .arena = {
+                    .size = 0,
+                    .hugepage_size = 2048,
+                },
             },
             .net = {
                 .inet = {
+                    .ip = {
+                        .lpm_rules = 0,
+                    },
                     .tcp = {
                         .syncache = {
                             .hashsize = 2048,
                             .bucketlimit = 30,
                             .cachelimit = 61440, /* (2048 * 30) */
+                            .shards = 0,
                         },
                         .tcbhashsize = 8192,
                     },
@@ -1738,14 +2069,22 @@ uinet_default_cfg(struct uinet_global_cfg *cfg, enum uinet_global_cfg_type which
                     .nmbclusters = 512*1024,
                     .somaxconn = 2048,
                 },
+                .arena = {
+                    .size = 0,
+                    .hugepage_size = 2048,
+                },
             },
             .net = {
                 .inet = {
+                    .ip = {
+                        .lpm_rules = 1024*1024,
+                    },
                     .tcp = {
                         .syncache = {
                             .hashsize = 4096,
                             .bucketlimit = 30,
                             .cachelimit = 122880, /* (4096 * 30) */
+                            .shards = 0,
                         },
                         .tcbhashsize = 32768,
                     },
@@ -1763,13 +2102,19 @@ uinet_print_cfg(struct uinet_global_cfg *cfg)
 #define PRINT_TUNABLE(t) printf("%s=%u\n", #t, cfg->t)
 
     printf("ncpus=%u netmap_extra_bufs=%u\n", cfg->ncpus, cfg->netmap_extra_bufs);
+    PRINT_TUNABLE(net.inet.ip.lpm_rules);
     PRINT_TUNABLE(net.inet.tcp.syncache.hashsize);
     PRINT_TUNABLE(net.inet.tcp.syncache.bucketlimit);
     PRINT_TUNABLE(net.inet.tcp.syncache.cachelimit);
+    PRINT_TUNABLE(net.inet.tcp.syncache.shards);
     PRINT_TUNABLE(net.inet.tcp.tcbhashsize);
     PRINT_TUNABLE(kern.ipc.maxsockets);
     PRINT_TUNABLE(kern.ipc.nmbclusters);
     PRINT_TUNABLE(kern.ipc.somaxconn);
+    PRINT_TUNABLE(kern.arena.size);
+    PRINT_TUNABLE(kern.arena.hugepage_size);
+    PRINT_TUNABLE(locks.mtx_noop);
+    PRINT_TUNABLE(locks.mtx_spin_limit);
 
 #undef PRINT_TUNABLE    
 }
@@ -2172,29 +2517,186 @@ uinet_pd_ref_release(struct uinet_pd_ctx *pdctx[], uint32_t n)
 }
 
 
-void
-uinet_pd_deliver_to_stack(struct uinet_if *uif, struct uinet_pd_list *pkts)
+#define UINET_PD_DELIVER_BATCH		64
+#define UINET_PD_DELIVER_PREFETCH	4
+#define UINET_PD_DELIVER_BUCKETS	128	/* power of 2, > UINET_PD_DELIVER_BATCH */
+
+#ifdef INET6
+static inline uint32_t
+uinet_pd_flow_key6(const uint8_t *data, uint32_t len, uint32_t off)
+{
+    const struct ip6_hdr *ip6;
+    uint32_t key, word;
+    int i;
+
+    if (len < off + sizeof(struct ip6_hdr))
+        return (0);
+
+    ip6 = (const struct ip6_hdr *)(data + off);
+    key = 0;
+    for (i = 0; i < 8; i++) {
+        memcpy(&word, (const uint8_t *)&ip6->ip6_src + i * sizeof(word), sizeof(word));
+        key = (key ^ word) * 0x9e3779b1;
+    }
+
+    /* Ports are only keyed when no extension header precedes them */
+    if ((ip6->ip6_nxt == IPPROTO_TCP || ip6->ip6_nxt == IPPROTO_UDP) &&
+        (len >= off + sizeof(struct ip6_hdr) + sizeof(word))) {
+        memcpy(&word, data + off + sizeof(struct ip6_hdr), sizeof(word));
+        key = (key ^ word) * 0x9e3779b1;
+    }
+    key ^= ip6->ip6_nxt;
+
+    return (key ? key : 1);
+}
+#endif
+
+/*
+ * Compute a flow key for grouping received packets.  Only untagged or
+ * single-tagged IPv4 and IPv6 packets are keyed; 0 is returned for
+ * everything else.
+ */
+static inline uint32_t
+uinet_pd_flow_key(const void *buf, uint32_t len)
+{
+    const uint8_t *data = buf;
+    const struct ip *ip;
+    uint32_t key, ports;
+    uint32_t off, hlen;
+    uint16_t etype;
+
+    off = ETHER_HDR_LEN;
+    if (len < off + sizeof(struct ip))
+        return (0);
+
+    memcpy(&etype, data + off - sizeof(etype), sizeof(etype));
+    if (etype == htons(ETHERTYPE_VLAN)) {
+        off += ETHER_VLAN_ENCAP_LEN;
+        if (len < off + sizeof(struct ip))
+            return (0);
+        memcpy(&etype, data + off - sizeof(etype), sizeof(etype));
+    }
+#ifdef INET6
+    if (etype == htons(ETHERTYPE_IPV6))
+        return (uinet_pd_flow_key6(data, len, off));
+#endif
+    if (etype != htons(ETHERTYPE_IP))
+        return (0);
+
+    ip = (const struct ip *)(data + off);
+    memcpy(&key, &ip->ip_src, sizeof(key));
+    key = key * 0x9e3779b1;
+    memcpy(&ports, &ip->ip_dst, sizeof(ports));
+    key = (key ^ ports) * 0x9e3779b1;
+
+    hlen = ip->ip_hl << 2;
+    if ((ip->ip_p == IPPROTO_TCP || ip->ip_p == IPPROTO_UDP) &&
+        ((ip->ip_off & htons(IP_MF | IP_OFFMASK)) == 0) &&
+        (len >= off + hlen + sizeof(ports))) {
+        memcpy(&ports, data + off + hlen, sizeof(ports));
+        key = (key ^ ports) * 0x9e3779b1;
+    }
+    key ^= ip->ip_p;
+
+    return (key ? key : 1);
+}
+
+
+/*
+ * Deliver up to UINET_PD_DELIVER_BATCH packets to the stack.
+ *
+ * A first pass prefetches the descriptor contexts, mbuf headers and packet
+ * headers ahead of use, prepares the mbufs and computes a flow key for each
+ * packet.  Packets are then handed to if_input grouped by flow, in order of
+ * each flow's first appearance in the batch, so that consecutive input
+ * calls hit the same pcb and socket while they are still cache-hot.
+ * Ordering within each flow is preserved.
+ */
+static void
+uinet_pd_deliver_batch(struct ifnet *ifp, struct uinet_pd *descs, uint32_t n)
 {
-    struct ifnet *ifp;
     struct uinet_pd *pd;
     struct uinet_pd_ctx *pdctx;
     struct mbuf *m;
-    uint32_t i;
+    uint32_t keys[UINET_PD_DELIVER_BATCH];
+    uint8_t next[UINET_PD_DELIVER_BATCH];
+    uint8_t group_first[UINET_PD_DELIVER_BATCH];
+    uint8_t group_last[UINET_PD_DELIVER_BATCH];
+    uint8_t buckets[UINET_PD_DELIVER_BUCKETS];
+    uint32_t num_groups;
+    uint32_t i, b, g;
+
+    for (i = 0; i < UINET_PD_DELIVER_PREFETCH && i < n; i++) {
+        __builtin_prefetch(descs[i].ctx);
+        __builtin_prefetch(descs[i].data);
+    }
 
-    ifp = uif->ifp;
-    for (i = 0; i < pkts->num_descs; i++) {
-        pd = &pkts->descs[i];
+    memset(buckets, 0xff, sizeof(buckets));
+    num_groups = 0;
+    for (i = 0; i < n; i++) {
+        if (i + UINET_PD_DELIVER_PREFETCH < n) {
+            pd = &descs[i + UINET_PD_DELIVER_PREFETCH];
+            __builtin_prefetch(pd->ctx);
+            __builtin_prefetch(pd->data);
+        }
 
-        if (pd->flags & UINET_PD_TO_STACK) {
-            pdctx = pd->ctx;
-            pdctx->flags &= ~UINET_PD_CTX_SINGLE_REF;  /* no telling how many refs the stack will add */
-            pdctx->flags |= UINET_PD_CTX_MBUF_USED;
-            pdctx->m_orig_len = pd->length;
-            m = pdctx->m;
-            m->m_pkthdr.len = m->m_len = pd->length;
-            m->m_pkthdr.rcvif = ifp;
+        pd = &descs[i];
+        if (!(pd->flags & UINET_PD_TO_STACK))
+            continue;
+
+        pdctx = pd->ctx;
+        pdctx->flags &= ~UINET_PD_CTX_SINGLE_REF;  /* no telling how many refs the stack will add */
+        pdctx->flags |= UINET_PD_CTX_MBUF_USED;
+        m = pdctx->m;
+        m->m_pkthdr.len = pd->length;
+        /* Drivers that hand up mbuf chains have set up the lengths */
+        if (m->m_next == NULL)
+            m->m_len = pd->length;
+        pdctx->m_orig_len = m->m_len;
+        m->m_pkthdr.rcvif = ifp;
+
+        if (M_HASHTYPE_GET(m) != M_HASHTYPE_NONE)
+            keys[i] = m->m_pkthdr.flowid | 1;
+        else
+            keys[i] = uinet_pd_flow_key(pd->data, pd->length);
+        next[i] = 0xff;
+
+        /* Unkeyed packets each form their own group */
+        g = 0xff;
+        if (keys[i] != 0) {
+            b = keys[i] & (UINET_PD_DELIVER_BUCKETS - 1);
+            while ((g = buckets[b]) != 0xff &&
+                   keys[group_first[g]] != keys[i])
+                b = (b + 1) & (UINET_PD_DELIVER_BUCKETS - 1);
+        }
+        if (g == 0xff) {
+            g = num_groups++;
+            group_first[g] = i;
+            if (keys[i] != 0)
+                buckets[b] = g;
+        } else
+            next[group_last[g]] = i;
+        group_last[g] = i;
+    }
+
+    for (g = 0; g < num_groups; g++)
+        for (i = group_first[g]; i != 0xff; i = next[i]) {
+            m = descs[i].ctx->m;
             ifp->if_input(ifp, m);
         }
+}
+
+
+void
+uinet_pd_deliver_to_stack(struct uinet_if *uif, struct uinet_pd_list *pkts)
+{
+    uint32_t i, n;
+
+    for (i = 0; i < pkts->num_descs; i += n) {
+        n = pkts->num_descs - i;
+        if (n > UINET_PD_DELIVER_BATCH)
+            n = UINET_PD_DELIVER_BATCH;
+        uinet_pd_deliver_batch(uif->ifp, &pkts->descs[i], n);
     }
 }
 
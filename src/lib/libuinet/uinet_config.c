@@ -34,6 +34,7 @@
 #include "uinet_if_netmap.h"
 #include "uinet_if_pcap.h"
 #include "uinet_if_dpdk.h"
+#include "uinet_if_ring.h"
 #include "uinet_if_bridge.h"
 #include "uinet_if_span.h"
 
@@ -158,6 +159,9 @@ uinet_ifcreate(uinet_instance_t uinst, struct uinet_if_cfg *cfg, uinet_if_t *uif
 	case UINET_IFTYPE_DPDK:
 		error = if_dpdk_attach(new_uif);
 		break;
+	case UINET_IFTYPE_RING:
+		error = if_ring_attach(new_uif);
+		break;
 	default:
 		printf("Error attaching interface with config %s: unknown interface type %d\n", new_uif->configstr, new_uif->type);
 		error = ENXIO;
@@ -209,6 +213,9 @@ uinet_ifdestroy_internal(struct uinet_instance *uinst, struct uinet_if *uif)
 	case UINET_IFTYPE_DPDK:
 		error = if_dpdk_detach(uif);
 		break;
+	case UINET_IFTYPE_RING:
+		error = if_ring_detach(uif);
+		break;
 	default:
 		printf("Error detaching interface %s: unknown interface type %d\n", uif->name, uif->type);
 		error = ENXIO;
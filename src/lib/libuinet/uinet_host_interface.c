@@ -42,6 +42,7 @@
 #include <poll.h>
 #include <pthread.h>
 #if defined(__FreeBSD__)
+#include <malloc_np.h>
 #include <pthread_np.h>
 #endif /* __FreeBSD__ */
 #include <sched.h>
@@ -54,6 +55,7 @@
 #include <unistd.h>
 
 #if defined(__APPLE__)
+#include <malloc/malloc.h>
 #include <mach/clock.h>
 #include <mach/mach.h>
 #include <mach/thread_policy.h>
@@ -68,7 +70,10 @@
 #endif /*  __FreeBSD__ */
 
 #if defined(__linux__)
+#include <linux/futex.h>
+#include <malloc.h>
 #include <netpacket/packet.h>
+#include <sys/syscall.h>
 #endif /* __linux__ */
 
 #include <ifaddrs.h>
@@ -282,6 +287,17 @@ uhi_free(void *p)
 }
 
 
+uint64_t
+uhi_malloc_usable_size(void *p)
+{
+#if defined(__APPLE__)
+	return (malloc_size(p));
+#else
+	return (malloc_usable_size(p));
+#endif
+}
+
+
 void
 uhi_clock_gettime(int id, int64_t *sec, long *nsec)
 {
@@ -448,6 +464,13 @@ uhi_mmap(void *addr, uint64_t len, int prot, int flags, int fd, uint64_t offset)
 	if ((flags & UHI_MAP_ANON) == UHI_MAP_ANON)       host_flags |= MAP_ANON;
 #if defined(__FreeBSD__)
 	if ((flags & UHI_MAP_NOCORE) == UHI_MAP_NOCORE)   host_flags |= MAP_NOCORE;
+	if ((flags & UHI_MAP_HUGETLB) == UHI_MAP_HUGETLB) host_flags |= MAP_ALIGNED_SUPER;
+#elif defined(__linux__)
+	if ((flags & UHI_MAP_HUGETLB) == UHI_MAP_HUGETLB) {
+		host_flags |= MAP_HUGETLB;
+		if ((flags & UHI_MAP_HUGE_1GB) == UHI_MAP_HUGE_1GB)
+			host_flags |= 30 << MAP_HUGE_SHIFT;
+	}
 #endif
 
 	return (mmap(addr, len, host_prot, host_flags, fd, offset));
@@ -798,45 +821,216 @@ uhi_thread_setprio_rt(unsigned int prio)
 }
 
 
+/*
+ * uhi mutexes are spin-then-park locks.  The lock word holds 0 when the
+ * lock is free, 1 when it is held and 2 when it is held and there may be
+ * parked waiters.  An uncontended acquire or release is a single atomic
+ * operation.  A contended acquire first spins for a number of iterations
+ * that adapts to the recent hold times of the lock, and only then parks
+ * the thread (on a futex on Linux; elsewhere by yielding the CPU).
+ *
+ * Mutexes initialized with UHI_MTX_NOOP do nothing at all.  They are only
+ * handed out for the locks of stack instances that a single application
+ * thread drives, timers included.
+ */
+struct uhi_mutex {
+	volatile uint32_t state;
+	uint32_t flags;
+	uint32_t spins;
+	uint32_t recurse;
+	volatile uint64_t owner;
+};
+
+#define UHI_MTX_UNLOCKED	0
+#define UHI_MTX_LOCKED		1
+#define UHI_MTX_CONTESTED	2
+
+#define UHI_MTX_SPIN_LIMIT_DEFAULT	100
+
+static unsigned int uhi_mutex_spin_limit = UHI_MTX_SPIN_LIMIT_DEFAULT;
+
+
+struct uhi_cond {
+	pthread_mutex_t mtx;
+	pthread_cond_t cv;
+};
+
+
+static inline void
+uhi_cpu_pause(void)
+{
+#if defined(__amd64__) || defined(__x86_64__) || defined(__i386__)
+	__asm __volatile("pause");
+#endif
+}
+
+
+static void
+uhi_mutex_park(struct uhi_mutex *mx)
+{
+#if defined(__linux__)
+	syscall(SYS_futex, &mx->state, FUTEX_WAIT_PRIVATE, UHI_MTX_CONTESTED,
+		NULL, NULL, 0);
+#else
+	sched_yield();
+#endif
+}
+
+
+static void
+uhi_mutex_unpark(struct uhi_mutex *mx)
+{
+#if defined(__linux__)
+	syscall(SYS_futex, &mx->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+
+static inline int
+uhi_mutex_try_acquire(struct uhi_mutex *mx)
+{
+	uint32_t expected = UHI_MTX_UNLOCKED;
+
+	return (__atomic_compare_exchange_n(&mx->state, &expected, UHI_MTX_LOCKED,
+					    0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+}
+
+
+static void
+uhi_mutex_acquire_slow(struct uhi_mutex *mx)
+{
+	unsigned int max_spins;
+	unsigned int i;
+
+	max_spins = mx->spins * 2 + 10;
+	if (max_spins > uhi_mutex_spin_limit)
+		max_spins = uhi_mutex_spin_limit;
+
+	for (i = 0; i < max_spins; i++) {
+		if (mx->state == UHI_MTX_UNLOCKED && uhi_mutex_try_acquire(mx)) {
+			/* Move the spin estimate 1/8th toward this spin count. */
+			mx->spins += ((int)i - (int)mx->spins) / 8;
+			return;
+		}
+		uhi_cpu_pause();
+	}
+	mx->spins += ((int)max_spins - (int)mx->spins) / 8;
+
+	while (__atomic_exchange_n(&mx->state, UHI_MTX_CONTESTED, __ATOMIC_ACQUIRE) !=
+	       UHI_MTX_UNLOCKED)
+		uhi_mutex_park(mx);
+}
+
+
+static inline void
+uhi_mutex_acquire(struct uhi_mutex *mx)
+{
+	if (!uhi_mutex_try_acquire(mx))
+		uhi_mutex_acquire_slow(mx);
+}
+
+
+static inline void
+uhi_mutex_release(struct uhi_mutex *mx)
+{
+	if (__atomic_exchange_n(&mx->state, UHI_MTX_UNLOCKED, __ATOMIC_RELEASE) ==
+	    UHI_MTX_CONTESTED)
+		uhi_mutex_unpark(mx);
+}
+
+
+void
+uhi_mutex_set_spin_limit(unsigned int spins)
+{
+	uhi_mutex_spin_limit = spins;
+}
+
+
 int
 uhi_cond_init(uhi_cond_t *c)
 {
-	pthread_condattr_t attr;
-	pthread_cond_t *pc;
+	struct uhi_cond *uc;
 	int error;
 
-	
-	pc = malloc(sizeof(pthread_cond_t));
-	if (NULL == pc)
+	uc = malloc(sizeof(struct uhi_cond));
+	if (NULL == uc)
 		return (ENOMEM);
 
-	*c = pc;
+	error = pthread_mutex_init(&uc->mtx, NULL);
+	if (error) {
+		free(uc);
+		return (error);
+	}
 
-	pthread_condattr_init(&attr);
+	error = pthread_cond_init(&uc->cv, NULL);
+	if (error) {
+		pthread_mutex_destroy(&uc->mtx);
+		free(uc);
+		return (error);
+	}
 
-	error = pthread_cond_init(pc, &attr);
-	pthread_condattr_destroy(&attr);
+	*c = uc;
 
-	return (error);
+	return (0);
 }
 
 
 void
 uhi_cond_destroy(uhi_cond_t *c)
 {
-	pthread_cond_t *pc;
+	struct uhi_cond *uc;
 	
-	pc = (pthread_cond_t *)(*c);
+	uc = (struct uhi_cond *)(*c);
+
+	pthread_cond_destroy(&uc->cv);
+	pthread_mutex_destroy(&uc->mtx);
+	free(uc);
+}
+
+
+/*
+ * The condition variable carries its own pthread mutex, which is taken
+ * before the caller's uhi mutex is dropped.  A signal issued after the
+ * caller's mutex is released therefore cannot be lost, and the uhi mutex
+ * itself never has to be a pthread mutex.
+ */
+static int
+uhi_cond_wait_common(uhi_cond_t *c, uhi_mutex_t *m, const struct timespec *abstime)
+{
+	struct uhi_cond *uc = (struct uhi_cond *)(*c);
+	struct uhi_mutex *mx = (struct uhi_mutex *)(*m);
+	uint32_t recurse;
+	int error;
+
+	pthread_mutex_lock(&uc->mtx);
+
+	recurse = mx->recurse;
+	if (!(mx->flags & UHI_MTX_NOOP)) {
+		mx->recurse = 0;
+		mx->owner = 0;
+		uhi_mutex_release(mx);
+	}
+
+	if (abstime)
+		error = pthread_cond_timedwait(&uc->cv, &uc->mtx, abstime);
+	else
+		error = pthread_cond_wait(&uc->cv, &uc->mtx);
+	pthread_mutex_unlock(&uc->mtx);
+
+	if (!(mx->flags & UHI_MTX_NOOP)) {
+		uhi_mutex_acquire(mx);
+		mx->owner = uhi_thread_self_id();
+		mx->recurse = recurse;
+	}
 
-	pthread_cond_destroy(pc);
-	free(pc);
+	return (error);
 }
 
 
 void
 uhi_cond_wait(uhi_cond_t *c, uhi_mutex_t *m)
 {
-	pthread_cond_wait((pthread_cond_t *)(*c), (pthread_mutex_t *)(*m));
+	uhi_cond_wait_common(c, m, NULL);
 }
 
 
@@ -858,65 +1052,117 @@ uhi_cond_timedwait(uhi_cond_t *c, uhi_mutex_t *m, uint64_t nsecs)
 	}
 	abstime.tv_nsec = total_nsec;
 	
-	return (pthread_cond_timedwait((pthread_cond_t *)(*c), (pthread_mutex_t *)(*m), &abstime));
+	return (uhi_cond_wait_common(c, m, &abstime));
 }
 
 
 void
 uhi_cond_signal(uhi_cond_t *c)
 {
-	pthread_cond_signal((pthread_cond_t *)(*c));
+	struct uhi_cond *uc = (struct uhi_cond *)(*c);
+
+	pthread_mutex_lock(&uc->mtx);
+	pthread_cond_signal(&uc->cv);
+	pthread_mutex_unlock(&uc->mtx);
 }
 
 
 void
 uhi_cond_broadcast(uhi_cond_t *c)
 {
-	pthread_cond_broadcast((pthread_cond_t *)(*c));
+	struct uhi_cond *uc = (struct uhi_cond *)(*c);
+
+	pthread_mutex_lock(&uc->mtx);
+	pthread_cond_broadcast(&uc->cv);
+	pthread_mutex_unlock(&uc->mtx);
 }
 
 
 int
 uhi_mutex_init(uhi_mutex_t *m, int opts)
 {
-	pthread_mutexattr_t attr;
-	pthread_mutex_t *pm;
-	int error;
+	struct uhi_mutex *mx;
 
-	pm = malloc(sizeof(pthread_mutex_t));
-	if (NULL == pm)
+	mx = malloc(sizeof(struct uhi_mutex));
+	if (NULL == mx)
 		return (ENOMEM);
 
-	*m = pm;
-
-	pthread_mutexattr_init(&attr);
+	mx->state = UHI_MTX_UNLOCKED;
+	mx->flags = opts;
+	mx->spins = 0;
+	mx->recurse = 0;
+	mx->owner = 0;
 
-	if (opts & UHI_MTX_RECURSE) {
-		if (0 != pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE)) 
-			printf("Warning: mtx will not be recursive\n");
-	} else {
-#if !defined(__APPLE__)
-		if (0 != pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP))
-#endif /* __APPLE__ */
-			pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_NORMAL);
-	}
-	
-	error = pthread_mutex_init(pm, &attr);
-	pthread_mutexattr_destroy(&attr);	    
+	*m = mx;
 
-	return (error);
+	return (0);
 }
 
 
 void
 uhi_mutex_destroy(uhi_mutex_t *m)
 {
-	pthread_mutex_t *pm;
-	
-	pm = (pthread_mutex_t *)(*m);
+	free(*m);
+}
+
+
+static inline void
+uhi_mutex_lock_common(struct uhi_mutex *mx)
+{
+	uint64_t self;
+
+	if (mx->flags & UHI_MTX_NOOP)
+		return;
 
-	pthread_mutex_destroy(pm);
-	free(pm);
+	if (mx->flags & UHI_MTX_RECURSE) {
+		self = uhi_thread_self_id();
+		if (mx->owner == self) {
+			mx->recurse++;
+			return;
+		}
+		uhi_mutex_acquire(mx);
+		mx->owner = self;
+	} else
+		uhi_mutex_acquire(mx);
+}
+
+
+static inline int
+uhi_mutex_trylock_common(struct uhi_mutex *mx)
+{
+	uint64_t self;
+	int ret;
+
+	if (mx->flags & UHI_MTX_NOOP)
+		ret = 1;
+	else if (mx->flags & UHI_MTX_RECURSE) {
+		self = uhi_thread_self_id();
+		if (mx->owner == self) {
+			mx->recurse++;
+			ret = 1;
+		} else if ((ret = uhi_mutex_try_acquire(mx)))
+			mx->owner = self;
+	} else
+		ret = uhi_mutex_try_acquire(mx);
+
+	return (ret);
+}
+
+
+static inline void
+uhi_mutex_unlock_common(struct uhi_mutex *mx)
+{
+	if (mx->flags & UHI_MTX_NOOP)
+		return;
+
+	if (mx->flags & UHI_MTX_RECURSE) {
+		if (mx->recurse > 0) {
+			mx->recurse--;
+			return;
+		}
+		mx->owner = 0;
+	}
+	uhi_mutex_release(mx);
 }
 
 
@@ -924,7 +1170,7 @@ void
 _uhi_mutex_lock(uhi_mutex_t *m, void *l, const char *file, int line)
 {
 	uhi_lock_log("mtx", "lock", l, m, file, line);
-	pthread_mutex_lock((pthread_mutex_t *)(*m));
+	uhi_mutex_lock_common((struct uhi_mutex *)(*m));
 }
 
 
@@ -935,7 +1181,8 @@ int
 _uhi_mutex_trylock(uhi_mutex_t *m, void *l, const char *file, int line)
 {
 	int ret;
-	ret = (0 == pthread_mutex_trylock((pthread_mutex_t *)(*m)));
+
+	ret = uhi_mutex_trylock_common((struct uhi_mutex *)(*m));
 	if (ret)
 		uhi_lock_log("mtx", "trylock", l, m, file, line);
 	return (ret);
@@ -946,64 +1193,33 @@ void
 _uhi_mutex_unlock(uhi_mutex_t *m, void *l, const char *file, int line)
 {
 	uhi_lock_log("mtx", "unlock", l, m, file, line);
-	pthread_mutex_unlock((pthread_mutex_t *)(*m));
+	uhi_mutex_unlock_common((struct uhi_mutex *)(*m));
 }
 
 
+/*
+ * rwlocks are exclusive locks built on the same lock as uhi mutexes.  This
+ * keeps them usable with uhi_cond_wait(), which _sleep() relies on for
+ * rw_sleep() and sx_sleep().
+ *
+ * XXX
+ *
+ * An rwlock always allows recursive read locks and allows recursive write
+ * locks if UHI_RW_WRECURSE is specified.  As there is only one grade of
+ * lock here, it is always made recursive in order to not break the
+ * always-read-recursive behavior of rwlocks.
+ */
 int
 uhi_rwlock_init(uhi_rwlock_t *rw, int opts)
 {
-	pthread_mutexattr_t attr;
-	pthread_mutex_t *pm;
-	int error;
-	
-	pm = malloc(sizeof(pthread_mutex_t));
-	if (NULL == pm)
-		return (ENOMEM);
-
-	*rw = pm;
-
-	pthread_mutexattr_init(&attr);
-
-	/* XXX
-	 *
-	 * An rwlock always allows recursive read locks and allows recursive
-	 * write locks if UHI_RW_WRECURSE is specified.  pthread_mutex can
-	 * either be recursive or not, so we always specify a recursive
-	 * pthread_mutex in order to not break the always-read-recursive
-	 * behavior of rwlocks.
-	 *
-	 * Note that pthread_rwlocks do not allow recursion, so aren't a
-	 * contender for implementing the rwlock API.
-	 *
-	 */
-
-	if (0 != pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE)) {
-		printf("Warning: rwlock will not be read recursive\n");
-		if (opts & UHI_RW_WRECURSE)
-			printf("Warning: rwlock will not be write recursive\n");
-	}
-
-	if (0 != pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT)) {
-		printf("Warning: priority will not propagate to rwlock holder\n");
-	}
-
-	error = pthread_mutex_init(pm, &attr);
-	pthread_mutexattr_destroy(&attr);
-
-	return (error);
+	return (uhi_mutex_init((uhi_mutex_t *)rw, UHI_MTX_RECURSE));
 }
 
 
 void
 uhi_rwlock_destroy(uhi_rwlock_t *rw)
 {
-	pthread_mutex_t *pm;
-	
-	pm = (pthread_mutex_t *)(*rw);
-
-	pthread_mutex_destroy(pm);
-	free(pm);
+	uhi_mutex_destroy((uhi_mutex_t *)rw);
 }
 
 
@@ -1011,7 +1227,7 @@ void
 _uhi_rwlock_wlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
 	uhi_lock_log("rw", "wlock", l, rw, file, line);
-	pthread_mutex_lock((pthread_mutex_t *)(*rw));
+	uhi_mutex_lock_common((struct uhi_mutex *)(*rw));
 }
 
 
@@ -1020,7 +1236,7 @@ _uhi_rwlock_trywlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
 	int ret;
 
-	ret = (0 == pthread_mutex_trylock((pthread_mutex_t *)(*rw)));
+	ret = uhi_mutex_trylock_common((struct uhi_mutex *)(*rw));
 	if (ret)
 		uhi_lock_log("rw", "trywlock", l, rw, file, line);
 	return (ret);
@@ -1031,7 +1247,7 @@ void
 _uhi_rwlock_wunlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
 	uhi_lock_log("rw", "wunlock", l, rw, file, line);
-	pthread_mutex_unlock((pthread_mutex_t *)(*rw));
+	uhi_mutex_unlock_common((struct uhi_mutex *)(*rw));
 }
 
 
@@ -1039,7 +1255,7 @@ void
 _uhi_rwlock_rlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
 	uhi_lock_log("rw", "rlock", l, rw, file, line);
-	pthread_mutex_lock((pthread_mutex_t *)(*rw));
+	uhi_mutex_lock_common((struct uhi_mutex *)(*rw));
 }
 
 
@@ -1048,7 +1264,7 @@ _uhi_rwlock_tryrlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
 	int ret;
 
-	ret = (0 == pthread_mutex_trylock((pthread_mutex_t *)(*rw)));
+	ret = uhi_mutex_trylock_common((struct uhi_mutex *)(*rw));
 	if (ret)
 		uhi_lock_log("rw", "tryrlock", l, rw, file, line);
 	return (ret);
@@ -1059,7 +1275,7 @@ void
 _uhi_rwlock_runlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
 	uhi_lock_log("rw", "runlock", l, rw, file, line);
-	pthread_mutex_unlock((pthread_mutex_t *)(*rw));
+	uhi_mutex_unlock_common((struct uhi_mutex *)(*rw));
 }
 
 
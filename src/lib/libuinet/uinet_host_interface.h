@@ -85,6 +85,8 @@ struct uhi_pollfd {
 #define	UHI_MAP_PRIVATE	0x0002
 #define UHI_MAP_ANON	0x1000
 #define	UHI_MAP_NOCORE	0x00020000
+#define	UHI_MAP_HUGETLB	0x00040000	/* back with hugepages */
+#define	UHI_MAP_HUGE_1GB 0x00080000	/* with UHI_MAP_HUGETLB, use 1GB pages */
 
 #define UHI_MAP_FAILED	((void *)-1)
 
@@ -113,6 +115,7 @@ typedef void (*uhi_thread_hook_t)(void *);
 typedef void * uhi_mutex_t;
 
 #define UHI_MTX_RECURSE	0x1
+#define UHI_MTX_NOOP	0x2	/* lock ops do nothing; single-thread use only */
 
 
 typedef void * uhi_cond_t;
@@ -156,6 +159,7 @@ void *uhi_malloc(uint64_t size);
 void *uhi_calloc(uint64_t number, uint64_t size);
 void *uhi_realloc(void *p, uint64_t size);
 void  uhi_free(void *p);
+uint64_t uhi_malloc_usable_size(void *p);
 
 void  uhi_clock_gettime(int id, int64_t *sec, long *nsec);
 uint64_t  uhi_clock_gettime_ns(int id);
@@ -198,6 +202,7 @@ void  uhi_mutex_destroy(uhi_mutex_t *m);
 void  _uhi_mutex_lock(uhi_mutex_t *m, void *l, const char *file, int line);
 int   _uhi_mutex_trylock(uhi_mutex_t *m, void *l, const char *file, int line);
 void  _uhi_mutex_unlock(uhi_mutex_t *m, void *l, const char *file, int line);
+void  uhi_mutex_set_spin_limit(unsigned int spins);
 
 #if 0
 #define	uhi_mutex_lock(m)	_uhi_mutex_lock((m),	\
@@ -32,6 +32,9 @@
 #include <sys/kernel.h>
 #include <sys/proc.h>
 #include <sys/kthread.h>
+#include <sys/lock.h>
+#include <sys/mbuf.h>
+#include <sys/mutex.h>
 #include <sys/sched.h>
 #include <sys/sockio.h>
 
@@ -42,6 +45,7 @@
 #include <net/if_arp.h>
 #include <net/if_tap.h>
 #include <net/if_dl.h>
+#include <net/if_vlan_var.h>
 
 #include <machine/atomic.h>
 
@@ -61,6 +65,29 @@ static struct uinet_if_type_info if_dpdk_type_info = {
 UINET_IF_REGISTER_TYPE(DPDK, &if_dpdk_type_info);
 
 
+/*
+ * Outbound packets stamped with a future departure time (m_pkthdr.txtime,
+ * set by the TCP pacer) are parked on a timing wheel of IF_DPDK_PACE_SLOTS
+ * slots, each IF_DPDK_PACE_SLOT_US wide, and released to the TX burst
+ * queue when their slot comes due.  Departures beyond the wheel's horizon
+ * are clamped to its last slot.
+ */
+#define IF_DPDK_PACE_SLOT_US    16
+#define IF_DPDK_PACE_SLOTS      4096
+
+struct if_dpdk_pace_slot {
+    struct mbuf *head;
+    struct mbuf *tail;
+};
+
+struct if_dpdk_pacer {
+    struct mtx lock;
+    uint64_t next_slot;         /* first slot not yet released */
+    volatile unsigned int count;
+    struct if_dpdk_pace_slot slots[IF_DPDK_PACE_SLOTS];
+};
+
+
 struct if_dpdk_softc {
     struct ifnet *ifp;
     struct uinet_if *uif;
@@ -80,7 +107,6 @@ struct if_dpdk_softc {
     struct uinet_pd_list *rx_pds;
     int rx_fd;
     unsigned int rx_thread_run_state;
-    unsigned int rx_packet_waiting;
     uint32_t rx_batch_size;
     uint32_t rx_pd_count;
     
@@ -93,13 +119,47 @@ struct if_dpdk_softc {
     int tx_pkts_to_send;
     struct uinet_pd_ring *tx_inject_ring;
     struct uinet_pd_ctx **tx_pdctx_to_free;
+    struct if_dpdk_pacer *pacer;
+
+    /*
+     * While a receive batch is processed, packets that thread transmits
+     * are gathered here and sent as one burst when the batch ends.
+     */
+    struct thread *tx_batch_td;
+    unsigned int tx_batch_count;
+    void *tx_batch[MAX_BURST_SIZE];
+};
+
+
+/*
+ * Each rte_mbuf carries one of these in its private area.  On receive, the
+ * packet descriptor context and the mbuf header handed to the stack are
+ * initialized in place, with the mbuf external storage pointing at the
+ * rte_mbuf data buffer, so that the receive path performs no mbuf or
+ * cluster allocations and no copies.  The descriptor context and the mbuf
+ * share the builtin refcount, and the rte_mbuf is returned to its mempool
+ * when the last reference is released via either api.
+ */
+struct if_dpdk_pd_priv {
+    struct uinet_pd_ctx pdctx;
+    struct mbuf m;
 };
 
 
 static int if_dpdk_setup_interface(struct if_dpdk_softc *sc);
+static void if_dpdk_pd_free(struct uinet_pd_ctx *pdctx[], unsigned int n);
+static int if_dpdk_pace_ticks(struct if_dpdk_softc *sc);
 
 static unsigned int interface_count;
 
+static struct uinet_pd_pool_info if_dpdk_pd_pool = {
+    .type = UINET_PD_TYPE_DPDK,
+    .bufsize = MCLBYTES,
+    .ctx = NULL,
+    .free = if_dpdk_pd_free
+};
+static int if_dpdk_pd_pool_id = -1;
+
 
 static void
 if_dpdk_default_config(union uinet_if_type_cfg *cfg)
@@ -113,6 +173,8 @@ if_dpdk_default_config(union uinet_if_type_cfg *cfg)
     pcfg->file_per_flow = 0;
     pcfg->max_concurrent_files = 1000;
     pcfg->dir_bits = 10;
+    pcfg->reass_max_datagrams = 0;
+    pcfg->reass_timeout_ms = 500;
 }
 
 
@@ -240,6 +302,17 @@ if_dpdk_attach(struct uinet_if *uif)
     
     sc->uif = uif;
     sc->rx_batch_size = uif->rx_batch_size;
+    if (sc->rx_batch_size > MAX_BURST_SIZE)
+        sc->rx_batch_size = MAX_BURST_SIZE;
+
+    if (if_dpdk_pd_pool_id == -1) {
+        if_dpdk_pd_pool_id = uinet_pd_pool_register(&if_dpdk_pd_pool);
+        if (if_dpdk_pd_pool_id == -1) {
+            printf("%s: Failed to register packet descriptor pool\n", uif->name);
+            error = ENOMEM;
+            goto fail;
+        }
+    }
     
     error = if_dpdk_process_configstr(sc);
     if (0 != error) {
@@ -268,13 +341,19 @@ if_dpdk_attach(struct uinet_if *uif)
                           sc->tx_ifname, sc->tx_isfile,
                           p_cfg->file_snapshot_length, p_cfg->file_per_flow,
                           sc->addr, p_cfg->dir_bits,
-                          epoch_number, uinet_instance_index(uif->uinst));
+                          epoch_number, uinet_instance_index(uif->uinst),
+                          sizeof(struct if_dpdk_pd_priv));
     if (NULL == sc->dpdk_host_ctx) {
         printf("%s: Failed to create dpdk handle\n", uif->name);
         error = ENXIO;
         goto fail;
     }
 
+    if (p_cfg->reass_max_datagrams > 0 &&
+        dh_reass_init(p_cfg->reass_max_datagrams, p_cfg->reass_timeout_ms) != 0)
+        printf("%s: Failed to set up IPv4 reassembly, leaving it to the stack\n",
+               uif->name);
+
     if (!uinet_uifsts(sc->uif) || p_cfg->use_file_io_thread)
         sc->tx_use_thread = 1;
     
@@ -303,6 +382,14 @@ if_dpdk_attach(struct uinet_if *uif)
         goto fail;
     }
 
+    sc->pacer = malloc(sizeof(*sc->pacer), M_DEVBUF, M_WAITOK | M_ZERO);
+    if (sc->pacer == NULL) {
+        printf("%s: Failed to allocate transmit pacer\n", uif->name);
+        error = ENOMEM;
+        goto fail;
+    }
+    mtx_init(&sc->pacer->lock, "dpdkpace", NULL, MTX_DEF);
+
     if (0 != if_dpdk_setup_interface(sc)) {
         error = ENXIO;
         goto fail;
@@ -326,6 +413,10 @@ fail:
             uinet_pd_ring_free(sc->tx_inject_ring);
         if (sc->tx_pdctx_to_free)
             free(sc->tx_pdctx_to_free, M_DEVBUF);
+        if (sc->pacer) {
+            mtx_destroy(&sc->pacer->lock);
+            free(sc->pacer, M_DEVBUF);
+        }
         
         free(sc, M_DEVBUF);
     }
@@ -441,6 +532,7 @@ if_dpdk_process_tx_inject_ring(struct if_dpdk_softc *sc, uint32_t *cur_inject_ta
     int do_single_flush;
     int done;
     int mb_len;
+    int timo, pace_ticks;
     
     txr = sc->tx_inject_ring;
     done = 0;
@@ -450,9 +542,22 @@ if_dpdk_process_tx_inject_ring(struct if_dpdk_softc *sc, uint32_t *cur_inject_ta
 
         /* release inject ring descriptors we've processed */
         txr->take = *cur_inject_take;
-        while ((sc->tx_pkts_to_send == 0) && !done)
-            if (EWOULDBLOCK == cv_timedwait(&sc->tx_cv, &sc->tx_lock, curthread->td_stop_check_ticks))
+        while ((sc->tx_pkts_to_send == 0) && !done) {
+            /*
+             * Sleep until the next occupied pacer slot is due rather
+             * than spinning while the wheel holds only future packets.
+             */
+            timo = curthread->td_stop_check_ticks;
+            if (sc->pacer->count != 0) {
+                pace_ticks = if_dpdk_pace_ticks(sc);
+                if (pace_ticks == 0)
+                    break;
+                if (pace_ticks < timo)
+                    timo = pace_ticks;
+            }
+            if (EWOULDBLOCK == cv_timedwait(&sc->tx_cv, &sc->tx_lock, timo))
                 done = kthread_stop_check();
+        }
         sc->tx_pkts_to_send = 0;
     }
 
@@ -557,6 +662,212 @@ if_dpdk_process_tx_inject_ring(struct if_dpdk_softc *sc, uint32_t *cur_inject_ta
 
 
 
+static inline uint64_t
+if_dpdk_pace_now(void)
+{
+    struct timeval tv;
+
+    microuptime(&tv);
+    return ((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+
+/*
+ * Copy an outbound packet into a newly allocated rte_mbuf.
+ */
+static void *
+if_dpdk_tx_copy(struct mbuf *m)
+{
+    dh_rte_mbuf_desc dh_desc;
+    void *rte_mb;
+    int len;
+
+    rte_mb = dh_alloc_desc(&dh_desc);
+    if (rte_mb == NULL)
+        return (NULL);
+
+    len = m->m_pkthdr.len;
+    if (len > dh_desc.buf_len) {
+        dh_free_desc(rte_mb);
+        return (NULL);
+    }
+
+    *dh_desc.rm_data_len = len;
+    *dh_desc.rm_pkt_len = len;
+    m_copydata(m, 0, len, (caddr_t)dh_desc.rm_data);
+    if (m->m_flags & M_VLANTAG)
+        dh_set_tx_vlan(rte_mb, m->m_pkthdr.ether_vtag);
+
+    return (rte_mb);
+}
+
+
+static void
+if_dpdk_pace_enqueue(struct if_dpdk_softc *sc, struct mbuf *m)
+{
+    struct if_dpdk_pacer *pacer = sc->pacer;
+    struct if_dpdk_pace_slot *slot;
+    uint64_t slotno;
+    int wakeup;
+
+    m->m_nextpkt = NULL;
+    slotno = m->m_pkthdr.txtime / IF_DPDK_PACE_SLOT_US;
+
+    mtx_lock(&pacer->lock);
+    if (pacer->count == 0)
+        pacer->next_slot = if_dpdk_pace_now() / IF_DPDK_PACE_SLOT_US;
+    if (slotno < pacer->next_slot)
+        slotno = pacer->next_slot;
+    else if (slotno >= pacer->next_slot + IF_DPDK_PACE_SLOTS)
+        slotno = pacer->next_slot + IF_DPDK_PACE_SLOTS - 1;
+
+    slot = &pacer->slots[slotno % IF_DPDK_PACE_SLOTS];
+    if (slot->tail != NULL)
+        slot->tail->m_nextpkt = m;
+    else
+        slot->head = m;
+    slot->tail = m;
+    wakeup = (pacer->count++ == 0);
+    mtx_unlock(&pacer->lock);
+
+    /* The transmit thread sleeps while the wheel is empty. */
+    if (wakeup && sc->tx_use_thread) {
+        mtx_lock(&sc->tx_lock);
+        cv_signal(&sc->tx_cv);
+        mtx_unlock(&sc->tx_lock);
+    }
+}
+
+
+/*
+ * Return the number of whole ticks until the earliest occupied slot comes
+ * due, or 0 if it is due within the current tick.
+ */
+static int
+if_dpdk_pace_ticks(struct if_dpdk_softc *sc)
+{
+    struct if_dpdk_pacer *pacer = sc->pacer;
+    uint64_t now_us, due_us, slotno;
+    unsigned int i;
+
+    now_us = if_dpdk_pace_now();
+
+    mtx_lock(&pacer->lock);
+    slotno = pacer->next_slot;
+    for (i = 0; i < IF_DPDK_PACE_SLOTS && pacer->count != 0; i++, slotno++)
+        if (pacer->slots[slotno % IF_DPDK_PACE_SLOTS].head != NULL)
+            break;
+    mtx_unlock(&pacer->lock);
+
+    due_us = slotno * IF_DPDK_PACE_SLOT_US;
+    if (due_us <= now_us)
+        return (0);
+    return ((int)((due_us - now_us) * hz / 1000000));
+}
+
+
+/*
+ * Release all packets whose departure slot has come due, in bursts.
+ */
+static void
+if_dpdk_pace_run(struct if_dpdk_softc *sc)
+{
+    struct if_dpdk_pacer *pacer = sc->pacer;
+    struct if_dpdk_pace_slot *slot;
+    struct ifnet *ifp = sc->ifp;
+    struct mbuf *head, *tail, *m;
+    void *pkts[MAX_BURST_SIZE];
+    uint64_t now_slot;
+    unsigned int i, n, released, sent;
+
+    if (pacer->count == 0)
+        return;
+
+    head = tail = NULL;
+    released = 0;
+    now_slot = if_dpdk_pace_now() / IF_DPDK_PACE_SLOT_US;
+
+    mtx_lock(&pacer->lock);
+    for (i = 0; i < IF_DPDK_PACE_SLOTS && pacer->count > released &&
+             pacer->next_slot <= now_slot; i++, pacer->next_slot++) {
+        slot = &pacer->slots[pacer->next_slot % IF_DPDK_PACE_SLOTS];
+        if (slot->head == NULL)
+            continue;
+        if (tail != NULL)
+            tail->m_nextpkt = slot->head;
+        else
+            head = slot->head;
+        tail = slot->tail;
+        for (m = slot->head; m != NULL; m = m->m_nextpkt)
+            released++;
+        slot->head = slot->tail = NULL;
+    }
+    pacer->count -= released;
+    mtx_unlock(&pacer->lock);
+
+    n = 0;
+    while (head != NULL) {
+        m = head;
+        head = m->m_nextpkt;
+        m->m_nextpkt = NULL;
+
+        pkts[n] = if_dpdk_tx_copy(m);
+        if (pkts[n] != NULL)
+            n++;
+        else
+            ifp->if_oerrors++;
+        m_freem(m);
+
+        if (n == MAX_BURST_SIZE || (head == NULL && n > 0)) {
+            sent = dh_send_pkts(pkts, n);
+            ifp->if_opackets += sent;
+            ifp->if_oerrors += n - sent;
+            for (i = sent; i < n; i++)
+                dh_free_desc(pkts[i]);
+            n = 0;
+        }
+    }
+}
+
+
+static void
+if_dpdk_pace_flush(struct if_dpdk_softc *sc)
+{
+    struct if_dpdk_pacer *pacer = sc->pacer;
+    struct mbuf *m;
+    unsigned int i;
+
+    for (i = 0; i < IF_DPDK_PACE_SLOTS; i++) {
+        while ((m = pacer->slots[i].head) != NULL) {
+            pacer->slots[i].head = m->m_nextpkt;
+            m->m_nextpkt = NULL;
+            m_freem(m);
+        }
+        pacer->slots[i].tail = NULL;
+    }
+    pacer->count = 0;
+}
+
+
+static void
+if_dpdk_tx_batch_flush(struct if_dpdk_softc *sc)
+{
+    struct ifnet *ifp = sc->ifp;
+    unsigned int i, n, sent;
+
+    n = sc->tx_batch_count;
+    if (n == 0)
+        return;
+
+    sent = dh_send_pkts(sc->tx_batch, n);
+    ifp->if_opackets += sent;
+    ifp->if_oerrors += n - sent;
+    for (i = sent; i < n; i++)
+        dh_free_desc(sc->tx_batch[i]);
+    sc->tx_batch_count = 0;
+}
+
+
 static int
 if_dpdk_transmit(struct ifnet *ifp, struct mbuf *m)
 {
@@ -578,42 +889,33 @@ if_dpdk_transmit(struct ifnet *ifp, struct mbuf *m)
         goto out;
     }
 #if 1    
-    volatile dh_rte_mbuf_desc dh_desc;
-    void* rte_mb = dh_alloc_desc(&dh_desc);
-    if(rte_mb == NULL )
-    {
-        error = ENOBUFS;
-        ifp->if_oerrors++;
-        goto out;
+    if (m->m_pkthdr.txtime != 0 &&
+        m->m_pkthdr.txtime >= if_dpdk_pace_now() + IF_DPDK_PACE_SLOT_US) {
+        if_dpdk_pace_enqueue(sc, m);
+        return (0);
     }
 
-    int len = m->m_pkthdr.len;
-    if(len > dh_desc.buf_len)
-    {
+    void* pkts[1];
+    pkts[0] = if_dpdk_tx_copy(m);
+    if (pkts[0] == NULL) {
         error = ENOBUFS;
         ifp->if_oerrors++;
-        //should free this rte mbuf
         goto out;
     }
-    
-
-   *dh_desc.rm_data_len = len;
-   *dh_desc.rm_pkt_len = len;
-   m_copydata(m, 0, len, (caddr_t)dh_desc.rm_data);
-
-   void* pkts[MAX_BURST_SIZE];
-   pkts[0] = rte_mb;
-   if(dh_send_pkts(pkts, 1) == 0)
-   {
+    if (sc->tx_batch_td == curthread) {
+        sc->tx_batch[sc->tx_batch_count++] = pkts[0];
+        if (sc->tx_batch_count == MAX_BURST_SIZE)
+            if_dpdk_tx_batch_flush(sc);
+        goto out;
+    }
+    if (dh_send_pkts(pkts, 1) == 0) {
+        dh_free_desc(pkts[0]);
         error = ENOBUFS;
         ifp->if_oerrors++;
-        //should free this rte mbuf        
         goto out;
-   }
-   ifp->if_opackets++;
-   error = 0;
-   volatile uint64_t debug_next = *(dh_desc.debug_next);
-
+    }
+    ifp->if_opackets++;
+    error = 0;
 #endif
     
 #if 0
@@ -694,8 +996,10 @@ if_dpdk_batch_send(struct uinet_if *uif, int *fd, uint64_t *wait_ns)
      * by if_transmit() and will be processed in the send thread,
      * otherwise the TX inject ring is handled here.
      */
-    if (!sc->tx_disabled && !sc->tx_use_thread)
+    if (!sc->tx_disabled && !sc->tx_use_thread) {
+        if_dpdk_pace_run(sc);
         if_dpdk_process_tx_inject_ring(sc, NULL);
+    }
 
     *wait_ns = 0;
     *fd = -1;  /* call again at earliest convenience */
@@ -735,6 +1039,7 @@ if_dpdk_send(void *arg)
 
     cur_inject_take = 0;
     while (1) {
+        if_dpdk_pace_run(sc);
         if (if_dpdk_process_tx_inject_ring(sc, &cur_inject_take))
             goto done;
     }
@@ -745,6 +1050,41 @@ done:
 
 //#define _KERNEL
 
+/*
+ * Multicast groups beyond what the NIC's exact-match filter can hold, or
+ * a PMD without one, put the port in allmulti instead.
+ */
+#define IF_DPDK_MC_MAX 128
+
+static void
+if_dpdk_rx_filter(struct if_dpdk_softc *sc)
+{
+    struct ifnet *ifp = sc->ifp;
+    struct ifmultiaddr *ifma;
+    uint8_t mc[IF_DPDK_MC_MAX][ETHER_ADDR_LEN];
+    uint32_t n = 0;
+    int allmulti = (ifp->if_flags & IFF_ALLMULTI) != 0;
+
+    dh_set_promisc((ifp->if_flags & IFF_PROMISC) != 0);
+
+    if_maddr_rlock(ifp);
+    TAILQ_FOREACH(ifma, &ifp->if_multiaddrs, ifma_link) {
+        if (ifma->ifma_addr->sa_family != AF_LINK)
+            continue;
+        if (n == IF_DPDK_MC_MAX) {
+            allmulti = 1;
+            break;
+        }
+        bcopy(LLADDR((struct sockaddr_dl *)ifma->ifma_addr), mc[n++],
+              ETHER_ADDR_LEN);
+    }
+    if_maddr_runlock(ifp);
+
+    if (!allmulti && dh_set_mc_addr_list(&mc[0][0], n) != 0)
+        allmulti = 1;
+    dh_set_allmulti(allmulti);
+}
+
 static void
 if_dpdk_stop(struct if_dpdk_softc *sc)
 {
@@ -758,7 +1098,9 @@ static int
 if_dpdk_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
 {
     int error = 0;
+    int mask;
     struct if_dpdk_softc *sc = ifp->if_softc;
+    struct ifreq *ifr = (struct ifreq *)data;
 
     switch (cmd) {
     case SIOCSIFFLAGS:
@@ -792,6 +1134,23 @@ if_dpdk_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
 
             if_dpdk_stop(sc);
         }
+        if_dpdk_rx_filter(sc);
+        break;
+    case SIOCADDMULTI:
+    case SIOCDELMULTI:
+        if_dpdk_rx_filter(sc);
+        break;
+    case SIOCSIFCAP:
+        mask = (ifr->ifr_reqcap ^ ifp->if_capenable) & ifp->if_capabilities;
+        if (mask & IFCAP_VLAN_HWTAGGING) {
+            if (dh_set_vlan_strip(
+                    (ifr->ifr_reqcap & IFCAP_VLAN_HWTAGGING) != 0) != 0) {
+                error = EIO;
+                break;
+            }
+            ifp->if_capenable ^= IFCAP_VLAN_HWTAGGING;
+            VLAN_CAPABILITIES(ifp);
+        }
         break;
     default:
         error = ether_ioctl(ifp, cmd, data);
@@ -801,17 +1160,130 @@ if_dpdk_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
     return (error);
 }
 
-extern void uinet_pd_mbuf_free_ctx(struct uinet_pd_ctx *pdctx);
-static void if_dpdk_free_rte_buf(void* base, void* dummy)
+static void
+if_dpdk_pd_release(struct uinet_pd_ctx *pdctx)
+{
+    struct mbuf *m;
+
+    m = pdctx->m;
+    if ((pdctx->flags & UINET_PD_CTX_MBUF_USED) && (m->m_flags & M_PKTHDR))
+        m_tag_delete_chain(m, NULL);
+    dh_free_desc((void *)pdctx->ref);
+}
+
+
+/*
+ * Invoked when the last reference to a received packet is released via the
+ * packet descriptor api.
+ */
+static void
+if_dpdk_pd_free(struct uinet_pd_ctx *pdctx[], unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        if_dpdk_pd_release(pdctx[i]);
+}
+
+
+/*
+ * Invoked when the last reference to a received packet is released via the
+ * mbuf api.
+ */
+static void
+if_dpdk_ext_free(void *arg1, void *arg2)
+{
+    if_dpdk_pd_release((struct uinet_pd_ctx *)arg2);
+}
+
+
+static inline struct uinet_pd_ctx *
+if_dpdk_ctx_init(dh_rte_mbuf_desc *desc, int pkthdr)
+{
+    struct if_dpdk_pd_priv *priv;
+    struct uinet_pd_ctx *pdctx;
+    struct mbuf *m;
+
+    priv = desc->priv;
+    pdctx = &priv->pdctx;
+    m = &priv->m;
+
+    pdctx->timestamp = 0;
+    pdctx->m = m;
+    pdctx->ref = (uintptr_t)desc->rm_base;
+    pdctx->flags = UINET_PD_CTX_SINGLE_REF;
+    pdctx->pool_id = if_dpdk_pd_pool_id;
+    pdctx->refcnt = &pdctx->builtin_refcnt;
+    pdctx->builtin_refcnt = 1;
+
+    /* Do this first as it resets m_data, which m_extadd() sets below */
+    if (pkthdr)
+        m_pkthdr_init(m, M_NOWAIT);
+    m->m_next = NULL;
+    m->m_nextpkt = NULL;
+    m->m_len = 0;
+    m->m_type = MT_DATA;
+    m->m_flags = pkthdr ? M_PKTHDR : 0;
+    m->m_ext.ref_cnt = pdctx->refcnt;
+    m_extadd(m, desc->rm_data, desc->buf_len, if_dpdk_ext_free,
+             desc->rm_base, pdctx, M_NOFREE, EXT_EXTREF);
+
+    return (pdctx);
+}
+
+
+static inline void
+if_dpdk_pd_init(struct uinet_pd *pd, dh_rte_mbuf_desc *desc)
 {
-    struct uinet_pd_ctx *pdctx[10];
-    dh_free_desc(base);
+    struct uinet_pd_ctx *pdctx;
+    struct mbuf *m;
+
+    pdctx = if_dpdk_ctx_init(desc, 1);
+    m = pdctx->m;
+    if (desc->rss_type != DH_RSS_NONE) {
+        m->m_pkthdr.flowid = desc->rss_hash;
+        M_HASHTYPE_SET(m, desc->rss_type);
+    }
+    if (desc->vlan_stripped) {
+        m->m_pkthdr.ether_vtag = desc->vlan_tci;
+        m->m_flags |= M_VLANTAG;
+    }
 
-    struct uinet_pd_ctx *ctx = (struct uinet_pd_ctx *)dummy;
-    pdctx[0] = ctx;
-    uinet_pd_mbuf_free_descs(pdctx, 1);
+    pd->flags = UINET_PD_TYPE_DPDK;
+    pd->length = desc->data_len;
+    pd->pool_id = if_dpdk_pd_pool_id;
+    pd->ref = pdctx->ref;
+    pd->data = desc->rm_data;
+    pd->ctx = pdctx;
 }
 
+
+/*
+ * Appends the continuation buffers of a reassembled datagram to the mbuf
+ * of its first buffer.  Only the first buffer is visible as a packet
+ * descriptor.
+ */
+static void
+if_dpdk_pd_chain(struct uinet_pd *pd, dh_rte_mbuf_desc *desc, unsigned int n)
+{
+    struct uinet_pd_ctx *pdctx;
+    struct mbuf *tail;
+    unsigned int i;
+
+    tail = pd->ctx->m;
+    tail->m_len = pd->length;
+    for (i = 0; i < n; i++, desc++) {
+        pdctx = if_dpdk_ctx_init(desc, 0);
+        pdctx->flags = UINET_PD_CTX_MBUF_USED;
+        pdctx->m_orig_len = desc->data_len;
+        pdctx->m->m_len = desc->data_len;
+        tail->m_next = pdctx->m;
+        tail = pdctx->m;
+        pd->length += desc->data_len;
+    }
+}
+
+
 static int
 if_dpdk_batch_receive(struct uinet_if *uif, int *fd, uint64_t *wait_ns)
 {
@@ -819,12 +1291,10 @@ if_dpdk_batch_receive(struct uinet_if *uif, int *fd, uint64_t *wait_ns)
     struct uinet_pd *rx_pd;
     uint64_t now;
     uint64_t timestamp;
-    unsigned int had_packet_waiting;
     unsigned int max_rx;
-    unsigned int i;
-    int rv;
-    uint32_t used, to_move;
-    dh_rte_mbuf_desc descs[MAX_BURST_SIZE];    
+    int i, rv, reass;
+    uint32_t npkts;
+    dh_rte_mbuf_desc descs[MAX_BURST_SIZE];
 
     sc = uif->ifdata;
 
@@ -836,63 +1306,62 @@ if_dpdk_batch_receive(struct uinet_if *uif, int *fd, uint64_t *wait_ns)
     }
     *wait_ns = 0;
 
-    /* Top off the packet descriptor list */
-    uinet_pd_mbuf_alloc_descs(sc->rx_pds, sc->rx_batch_size - sc->rx_pds->num_descs);
     now = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+    max_rx = sc->rx_batch_size;
 
-    had_packet_waiting = sc->rx_packet_waiting;
-    sc->rx_packet_waiting = 0;
-    rx_pd = &sc->rx_pds->descs[had_packet_waiting];
-    max_rx = sc->rx_pds->num_descs - had_packet_waiting;
-
-    rv = if_dpdk_getpacket(sc->dpdk_host_ctx, now, rx_pd->data, MCLBYTES,
-                           &rx_pd->length, &timestamp, wait_ns, &descs);
-    if(rv <= 0) 
-        return (i == max_rx);
+    /* a first-look handler gets to see the fragments as they arrived */
+    reass = (uif->first_look_handler == NULL);
+    rv = if_dpdk_getpacket(sc->dpdk_host_ctx, now, max_rx, &timestamp,
+                           wait_ns, descs, reass);
+    if (rv <= 0) {
+        *fd = sc->rx_fd; /* need to wait for a new packet to arrive */
+        return (0);
+    }
     uif->ifp->if_ipackets += rv;
 
-    for (i = 0; i < max_rx && i < rv; i++, rx_pd++) {
+    /*
+     * The receive descriptors are built directly from the rte_mbufs, so
+     * there is no packet descriptor list to keep topped off.
+     */
+    rx_pd = &sc->rx_pds->descs[0];
+    npkts = 0;
+    for (i = 0; i < rv; i += descs[i].nb_segs, rx_pd++, npkts++) {
+        if_dpdk_pd_init(rx_pd, &descs[i]);
+        if (descs[i].nb_segs > 1)
+            if_dpdk_pd_chain(rx_pd, &descs[i + 1], descs[i].nb_segs - 1);
         if (uif->timestamp_mode == UINET_IF_TIMESTAMP_HW)
             rx_pd->ctx->timestamp = timestamp;
-
-        PRINT_TIMESTAMP;
-        rx_pd->ctx->m->m_ext.ref_cnt = descs[i].ref_cnt;
-        m_extadd(rx_pd->ctx->m, descs[i].rm_data, descs[i].buf_len, 
-            if_dpdk_free_rte_buf, descs[i].rm_base, rx_pd->ctx, 0,EXT_EXTREF);
-        rx_pd->length = descs[i].data_len;
         rx_pd->flags |= UINET_PD_TO_STACK;
-        if (*wait_ns > 0) {
-            sc->rx_packet_waiting = 1;
-            break;
-        }
     }
-    used = i + had_packet_waiting;
-    to_move = sc->rx_pds->num_descs - used;
+    sc->rx_pds->num_descs = npkts;
 
-    if (used) {
-        UIF_TIMESTAMP(uif, sc->rx_pds);
-    
-        UIF_BATCH_EVENT(uif, UINET_BATCH_EVENT_START);
+    UIF_TIMESTAMP(uif, sc->rx_pds);
 
-        UIF_FIRST_LOOK(uif, sc->rx_pds);
+    /*
+     * Responses generated by the batch, such as the SYN|ACKs answering
+     * a run of SYNs, leave in bursts rather than one packet at a time.
+     */
+    sc->tx_batch_td = curthread;
 
-        uinet_pd_deliver_to_stack(uif, sc->rx_pds);
+    UIF_BATCH_EVENT(uif, UINET_BATCH_EVENT_START);
 
-        UIF_BATCH_EVENT(uif, UINET_BATCH_EVENT_FINISH);
+    UIF_FIRST_LOOK(uif, sc->rx_pds);
 
-        if (to_move)
-            memmove(sc->rx_pds->descs, &sc->rx_pds->descs[used],
-                sizeof(sc->rx_pds->descs[0]) * to_move);
+    uinet_pd_deliver_to_stack(uif, sc->rx_pds);
 
-        sc->rx_pds->num_descs -= used;
-    }
-    
-    if (sc->rx_packet_waiting || (i == max_rx))
-        *fd = -1; /* wait_ns is non-zero or we were batch limited */
+    UIF_BATCH_EVENT(uif, UINET_BATCH_EVENT_FINISH);
+
+    sc->tx_batch_td = NULL;
+    if_dpdk_tx_batch_flush(sc);
+
+    sc->rx_pds->num_descs = 0;
+
+    if ((unsigned int)rv == max_rx)
+        *fd = -1; /* we were batch limited */
     else
-        *fd = sc->rx_fd; /* need to wait for a new packet to arrive */
+        *fd = sc->rx_fd;
 
-    return (i == max_rx);
+    return ((unsigned int)rv == max_rx);
 }
 
 
@@ -964,7 +1433,10 @@ if_dpdk_setup_interface(struct if_dpdk_softc *sc)
     IFQ_SET_READY(&ifp->if_snd);
 
     ether_ifattach(ifp, sc->addr);
-    ifp->if_capabilities = ifp->if_capenable = IFCAP_HWSTATS;
+    ifp->if_capabilities = IFCAP_HWSTATS;
+    if (dh_vlan_offload())
+        ifp->if_capabilities |= IFCAP_VLAN_HWTAGGING | IFCAP_VLAN_MTU;
+    ifp->if_capenable = ifp->if_capabilities;
 
     uif->pd_alloc = if_dpdk_pd_alloc_user;
     uif->inject_tx_pkts = if_dpdk_inject_tx_pkts;
@@ -1042,6 +1514,9 @@ if_dpdk_detach(struct uinet_if *uif)
         uinet_pd_list_free(sc->tx_pds);
         uinet_pd_ring_free(sc->tx_inject_ring);
         free(sc->tx_pdctx_to_free, M_DEVBUF);
+        if_dpdk_pace_flush(sc);
+        mtx_destroy(&sc->pacer->lock);
+        free(sc->pacer, M_DEVBUF);
         
         free(sc, M_DEVBUF);
     }
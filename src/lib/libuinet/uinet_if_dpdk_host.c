@@ -181,12 +181,13 @@ struct if_dpdk_host_context *
 if_dpdk_create_handle(const char *rx_ifname, unsigned int rx_isfile, int *rx_fd, unsigned int rx_isnonblock,
 		      const char *tx_ifname, unsigned int tx_isfile, unsigned int tx_file_snaplen,
 		      unsigned int tx_file_per_flow, uint8_t* mac_addr, unsigned int tx_file_dirbits,
-		      uint32_t tx_file_epoch_no, uint32_t tx_file_instance_index)
+		      uint32_t tx_file_epoch_no, uint32_t tx_file_instance_index,
+		      uint16_t priv_size)
 {
 	struct if_dpdk_host_context *ctx;
 	int txisrx;
 
-	if(dh_init_dpdk(rx_ifname, mac_addr))
+	if(dh_init_dpdk(rx_ifname, mac_addr, priv_size))
 	{
 		printf("dpdk init failed....\n");
 		goto fail;
@@ -272,11 +273,12 @@ if_dpdk_sendpacket(struct if_dpdk_host_context *ctx, const uint8_t *buf, unsigne
 }
 
 int
-if_dpdk_getpacket(struct if_dpdk_host_context *ctx, uint64_t now,
-		  uint32_t *buffer, uint16_t max_length, uint16_t *length, uint64_t *timestamp, uint64_t *wait_ns, dh_rte_mbuf_desc *info)
+if_dpdk_getpacket(struct if_dpdk_host_context *ctx, uint64_t now, uint16_t max_pkts,
+		  uint64_t *timestamp, uint64_t *wait_ns, dh_rte_mbuf_desc *info,
+		  int reass)
 {
 	*wait_ns = 0;
-	return dh_recv_pkts((uint8_t*)buffer, length, info);
+	return dh_recv_pkts(info, max_pkts, reass);
 }
 
 
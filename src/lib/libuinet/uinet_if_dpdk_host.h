@@ -35,13 +35,14 @@ typedef void (*if_dpdk_handler)(void *ctx, const uint8_t *buf, unsigned int size
 struct if_dpdk_host_context * if_dpdk_create_handle(const char *rx_ifname, unsigned int rx_isfile, int *rx_fd, unsigned int rx_isnonblock,
 						    const char *tx_ifname, unsigned int tx_isfile, unsigned int tx_file_snaplen,
 						    unsigned int tx_file_per_flow, uint8_t* mac_addr, unsigned int tx_file_dirbits,
-						    uint32_t tx_file_epoch_no, uint32_t tx_file_instance_index);
+						    uint32_t tx_file_epoch_no, uint32_t tx_file_instance_index,
+						    uint16_t priv_size);
 void if_dpdk_destroy_handle(struct if_dpdk_host_context *ctx);
 int if_dpdk_sendpacket(struct if_dpdk_host_context *ctx, const uint8_t *buf, unsigned int size,
 		       uint64_t flowid, uint64_t ts_nsec, void* pkts, unsigned int num);
 void if_dpdk_flushflow(struct if_dpdk_host_context *ctx, uint64_t flowid);
-int if_dpdk_getpacket(struct if_dpdk_host_context *ctx, uint64_t now,
-		      uint32_t *buffer, uint16_t max_length, uint16_t *length,
-		      uint64_t *timestamp, uint64_t *wait_ns, dh_rte_mbuf_desc *info);
+int if_dpdk_getpacket(struct if_dpdk_host_context *ctx, uint64_t now, uint16_t max_pkts,
+		      uint64_t *timestamp, uint64_t *wait_ns, dh_rte_mbuf_desc *info,
+		      int reass);
 
 #endif /* _UINET_IF_PCAP_HOST_H_ */
@@ -0,0 +1,399 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * In-process back-to-back Ethernet interfaces.  Two ring interfaces created
+ * with the same configstr, normally in different uinet instances, are
+ * connected to each other: what one transmits, the other receives from its
+ * receive thread.  An optional transmit filter can drop frames, which makes
+ * this a convenient harness for exercising loss recovery without any host
+ * networking.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/socket.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/proc.h>
+#include <sys/kthread.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/mutex.h>
+#include <sys/condvar.h>
+#include <sys/sched.h>
+#include <sys/sockio.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/if_types.h>
+#include <net/ethernet.h>
+#include <net/if_arp.h>
+#include <net/if_dl.h>
+
+#include <machine/atomic.h>
+
+#include "uinet_internal.h"
+#include "uinet_if_ring.h"
+
+
+/* Number of leading bytes of a frame passed to the transmit filter. */
+#define	IF_RING_FILTER_CAPLEN	128
+
+static void if_ring_default_config(union uinet_if_type_cfg *cfg);
+
+static struct uinet_if_type_info if_ring_type_info = {
+	.type = UINET_IFTYPE_RING,
+	.type_name = "ring",
+	.default_cfg = if_ring_default_config
+};
+UINET_IF_REGISTER_TYPE(RING, &if_ring_type_info);
+
+
+struct if_ring_softc {
+	struct ifnet *ifp;
+	struct uinet_if *uif;
+	uint8_t addr[ETHER_ADDR_LEN];
+	LIST_ENTRY(if_ring_softc) link;
+	struct if_ring_softc *peer;
+
+	struct thread *rx_thread;
+	struct mtx rx_lock;
+	struct cv rx_cv;
+	struct ifqueue rx_queue;
+};
+
+
+static LIST_HEAD(, if_ring_softc) if_ring_list =
+    LIST_HEAD_INITIALIZER(if_ring_list);
+
+/* Protects if_ring_list and the peer links; ordered before rx_lock. */
+static struct mtx if_ring_list_mtx;
+MTX_SYSINIT(if_ring_list, &if_ring_list_mtx, "ringlist", MTX_DEF);
+
+static unsigned int interface_count;
+
+
+static void
+if_ring_default_config(union uinet_if_type_cfg *cfg)
+{
+	struct uinet_if_ring_cfg *rcfg;
+
+	rcfg = &cfg->ring;
+
+	rcfg->queue_len = 1024;
+	rcfg->tx_filter = NULL;
+	rcfg->tx_filter_arg = NULL;
+}
+
+
+static void
+if_ring_init(void *arg)
+{
+	struct if_ring_softc *sc = arg;
+	struct ifnet *ifp = sc->ifp;
+
+	ifp->if_drv_flags |= IFF_DRV_RUNNING;
+	ifp->if_drv_flags &= ~IFF_DRV_OACTIVE;
+}
+
+
+static int
+if_ring_transmit(struct ifnet *ifp, struct mbuf *m)
+{
+	struct if_ring_softc *sc = ifp->if_softc;
+	struct uinet_if_ring_cfg *cfg = &sc->uif->type_cfg.ring;
+	struct if_ring_softc *peer;
+	uint8_t frame[IF_RING_FILTER_CAPLEN];
+	unsigned int caplen;
+	int error = 0;
+
+	if (cfg->tx_filter != NULL) {
+		caplen = min(m->m_pkthdr.len, sizeof(frame));
+		m_copydata(m, 0, caplen, frame);
+		if (cfg->tx_filter(cfg->tx_filter_arg, frame, caplen,
+		    m->m_pkthdr.len)) {
+			/* Lost on the wire. */
+			ifp->if_opackets++;
+			m_freem(m);
+			return (0);
+		}
+	}
+
+	/*
+	 * Strip whatever the sending stack attached that the receiving one
+	 * must not see.
+	 */
+	m_tag_delete_chain(m, NULL);
+	m->m_flags &= ~(M_FLOWID | M_VLANTAG);
+	m->m_pkthdr.flowid = 0;
+	m->m_pkthdr.csum_flags = 0;
+	m->m_pkthdr.txtime = 0;
+
+	mtx_lock(&if_ring_list_mtx);
+	peer = sc->peer;
+	if (peer == NULL) {
+		mtx_unlock(&if_ring_list_mtx);
+		ifp->if_oerrors++;
+		m_freem(m);
+		return (ENETDOWN);
+	}
+	m->m_pkthdr.rcvif = peer->ifp;
+
+	mtx_lock(&peer->rx_lock);
+	if (_IF_QFULL(&peer->rx_queue)) {
+		_IF_DROP(&peer->rx_queue);
+		ifp->if_oerrors++;
+		error = ENOBUFS;
+	} else {
+		ifp->if_opackets++;
+		ifp->if_obytes += m->m_pkthdr.len;
+		_IF_ENQUEUE(&peer->rx_queue, m);
+		m = NULL;
+		cv_signal(&peer->rx_cv);
+	}
+	mtx_unlock(&peer->rx_lock);
+	mtx_unlock(&if_ring_list_mtx);
+
+	if (m != NULL)
+		m_freem(m);
+
+	return (error);
+}
+
+
+static void
+if_ring_receive(void *arg)
+{
+	struct if_ring_softc *sc = (struct if_ring_softc *)arg;
+	struct ifnet *ifp = sc->ifp;
+	struct mbuf *m, *next;
+
+	if (sc->uif->rx_cpu >= 0)
+		sched_bind(curthread, sc->uif->rx_cpu);
+
+	while (!kthread_stop_check()) {
+		mtx_lock(&sc->rx_lock);
+		if (_IF_QLEN(&sc->rx_queue) == 0)
+			cv_timedwait(&sc->rx_cv, &sc->rx_lock,
+			    curthread->td_stop_check_ticks);
+		_IF_DEQUEUE_ALL(&sc->rx_queue, m);
+		mtx_unlock(&sc->rx_lock);
+
+		for (; m != NULL; m = next) {
+			next = m->m_nextpkt;
+			m->m_nextpkt = NULL;
+			if ((ifp->if_drv_flags & IFF_DRV_RUNNING) == 0) {
+				ifp->if_iqdrops++;
+				m_freem(m);
+				continue;
+			}
+			ifp->if_ipackets++;
+			(*ifp->if_input)(ifp, m);
+		}
+	}
+
+	kthread_stop_ack();
+}
+
+
+static int
+if_ring_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
+{
+	struct if_ring_softc *sc = ifp->if_softc;
+	int error = 0;
+
+	switch (cmd) {
+	case SIOCSIFFLAGS:
+		if (ifp->if_flags & IFF_UP)
+			if_ring_init(sc);
+		else if (ifp->if_drv_flags & IFF_DRV_RUNNING)
+			ifp->if_drv_flags &= ~(IFF_DRV_RUNNING|IFF_DRV_OACTIVE);
+		break;
+	default:
+		error = ether_ioctl(ifp, cmd, data);
+		break;
+	}
+
+	return (error);
+}
+
+
+/*
+ * Connect sc to the other interface created with the same ring name.
+ */
+static int
+if_ring_pair(struct if_ring_softc *sc)
+{
+	struct if_ring_softc *other;
+	int count = 0;
+
+	mtx_lock(&if_ring_list_mtx);
+	LIST_FOREACH(other, &if_ring_list, link) {
+		if (strcmp(other->uif->configstr, sc->uif->configstr) != 0)
+			continue;
+		if (++count == 2)
+			break;
+	}
+	if (count == 2) {
+		mtx_unlock(&if_ring_list_mtx);
+		return (EADDRINUSE);
+	}
+	LIST_FOREACH(other, &if_ring_list, link) {
+		if (strcmp(other->uif->configstr, sc->uif->configstr) == 0) {
+			other->peer = sc;
+			sc->peer = other;
+			break;
+		}
+	}
+	LIST_INSERT_HEAD(&if_ring_list, sc, link);
+	mtx_unlock(&if_ring_list_mtx);
+
+	return (0);
+}
+
+
+static void
+if_ring_unpair(struct if_ring_softc *sc)
+{
+
+	mtx_lock(&if_ring_list_mtx);
+	if (sc->peer != NULL) {
+		sc->peer->peer = NULL;
+		sc->peer = NULL;
+	}
+	LIST_REMOVE(sc, link);
+	mtx_unlock(&if_ring_list_mtx);
+}
+
+
+int
+if_ring_attach(struct uinet_if *uif)
+{
+	struct if_ring_softc *sc;
+	struct ifnet *ifp;
+	unsigned int unit;
+	int error;
+
+	if (NULL == uif->configstr || uif->configstr[0] == '\0')
+		return (EINVAL);
+
+	/* Frames are handed straight to if_input(), there is no STS path. */
+	if (uinet_uifsts(uif))
+		return (EOPNOTSUPP);
+
+	unit = atomic_fetchadd_int(&interface_count, 1);
+	snprintf(uif->name, sizeof(uif->name), "ring%u", unit);
+
+	sc = malloc(sizeof(struct if_ring_softc), M_DEVBUF, M_WAITOK|M_ZERO);
+	sc->uif = uif;
+
+	/* Locally administered, unique per ring interface. */
+	sc->addr[0] = 0x02;
+	sc->addr[3] = uinet_instance_index(uif->uinst);
+	sc->addr[4] = (unit >> 8) & 0xff;
+	sc->addr[5] = unit & 0xff;
+
+	mtx_init(&sc->rx_lock, "ringrxlk", NULL, MTX_DEF);
+	cv_init(&sc->rx_cv, "ringrxcv");
+	sc->rx_queue.ifq_maxlen = uif->type_cfg.ring.queue_len;
+
+	ifp = sc->ifp = if_alloc(IFT_ETHER);
+	ifp->if_init = if_ring_init;
+	ifp->if_softc = sc;
+
+	if_initname(ifp, uif->name, IF_DUNIT_NONE);
+	ifp->if_flags = IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST;
+	ifp->if_ioctl = if_ring_ioctl;
+	ifp->if_transmit = if_ring_transmit;
+
+	IFQ_SET_MAXLEN(&ifp->if_snd, 1024);
+	ifp->if_snd.ifq_drv_maxlen = 1024;
+	IFQ_SET_READY(&ifp->if_snd);
+
+	ether_ifattach(ifp, sc->addr);
+	ifp->if_capabilities = ifp->if_capenable = 0;
+
+	uinet_if_attach(uif, sc->ifp, sc);
+
+	error = if_ring_pair(sc);
+	if (error) {
+		ether_ifdetach(ifp);
+		if_free(ifp);
+		goto fail;
+	}
+
+	if (kthread_add(if_ring_receive, sc, NULL, &sc->rx_thread, 0, 0,
+	    "ring_rx: %s", ifp->if_xname)) {
+		printf("Could not start receive thread for %s\n",
+		    ifp->if_xname);
+		if_ring_unpair(sc);
+		ether_ifdetach(ifp);
+		if_free(ifp);
+		error = ENXIO;
+		goto fail;
+	}
+
+	return (0);
+
+fail:
+	cv_destroy(&sc->rx_cv);
+	mtx_destroy(&sc->rx_lock);
+	free(sc, M_DEVBUF);
+
+	return (error);
+}
+
+
+int
+if_ring_detach(struct uinet_if *uif)
+{
+	struct if_ring_softc *sc = uif->ifdata;
+	struct thread_stop_req rx_tsr;
+	struct mbuf *m, *next;
+
+	if (sc) {
+		if_ring_unpair(sc);
+
+		kthread_stop(sc->rx_thread, &rx_tsr);
+		kthread_stop_wait(&rx_tsr);
+
+		mtx_lock(&sc->rx_lock);
+		_IF_DEQUEUE_ALL(&sc->rx_queue, m);
+		mtx_unlock(&sc->rx_lock);
+		for (; m != NULL; m = next) {
+			next = m->m_nextpkt;
+			m_freem(m);
+		}
+
+		mtx_destroy(&sc->rx_lock);
+		cv_destroy(&sc->rx_cv);
+
+		ether_ifdetach(sc->ifp);
+		if_free(sc->ifp);
+		free(sc, M_DEVBUF);
+	}
+
+	return (0);
+}
@@ -0,0 +1,308 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * DIR-24-8 forwarding tables for the AF_INET radix heads, kept in
+ * librte_lpm.  rte_lpm tables live in hugepage memory, so a head's mirror
+ * is created on the first route insertion after the EAL is up and is
+ * seeded from the radix tree at that point.  The rte_lpm next hop of each
+ * rule is an index into il_rt[], which holds the rtentry the rule came
+ * from.  The default route cannot be expressed as a depth 0 rule and is
+ * kept aside in il_default.
+ *
+ * Anything the mirror cannot represent (non-contiguous netmasks, more
+ * prefixes than net.inet.ip.lpm_rules) disables it for that head, and
+ * lookups go back to the radix tree.
+ */
+
+#include "opt_route.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/rwlock.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/syslog.h>
+
+#include <machine/atomic.h>
+
+#include <net/if.h>
+#include <net/radix.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_var.h>
+#include <netinet/in_lpm.h>
+
+#include "../libdpdk_helper/dpdk_helper.h"
+
+#ifdef INET_LPM
+
+/* rte_lpm next hops are 24 bits wide */
+#define	IN_LPM_MAXRULES		(1 << 24)
+#define	IN_LPM_BATCH		64
+
+static u_int in_lpm_rules = 0;
+TUNABLE_INT("net.inet.ip.lpm_rules", &in_lpm_rules);
+SYSCTL_UINT(_net_inet_ip, OID_AUTO, lpm_rules, CTLFLAG_RDTUN,
+    &in_lpm_rules, 0,
+    "Prefixes per DIR-24-8 forwarding table, 0 for radix lookups only");
+
+/* Each table costs 64MB of tbl24, so only the low FIBs get one. */
+static u_int in_lpm_fibs = 1;
+TUNABLE_INT("net.inet.ip.lpm_fibs", &in_lpm_fibs);
+SYSCTL_UINT(_net_inet_ip, OID_AUTO, lpm_fibs, CTLFLAG_RDTUN,
+    &in_lpm_fibs, 0, "Number of FIBs given a DIR-24-8 forwarding table");
+
+static u_int in_lpm_unit;
+
+struct in_lpm {
+	void		*il_lpm;	/* rte_lpm table, NULL once disabled */
+	struct rtentry	**il_rt;	/* next hop index -> route */
+	uint32_t	*il_free;	/* stack of unused next hop indices */
+	uint32_t	il_nfree;
+	struct rtentry	*il_default;	/* 0/0, which DIR-24-8 cannot hold */
+};
+
+static int
+in_lpm_prefix(struct rtentry *rt, uint32_t *addr, uint8_t *depth)
+{
+	struct sockaddr *mask = rt_mask(rt);
+	const u_char *cp;
+	uint32_t m;
+	int i, off;
+
+	*addr = ntohl(satosin(rt_key(rt))->sin_addr.s_addr);
+	if (mask == NULL) {
+		*depth = 32;
+		return (0);
+	}
+
+	/* Radix masks are cut short after their last non-zero byte. */
+	cp = (const u_char *)mask;
+	m = 0;
+	for (i = 0; i < 4; i++) {
+		off = offsetof(struct sockaddr_in, sin_addr) + i;
+		if (off < mask->sa_len)
+			m |= (uint32_t)cp[off] << (24 - 8 * i);
+	}
+	if ((~m & (~m + 1)) != 0)
+		return (EINVAL);
+	*depth = m ? 33 - ffs(m) : 0;
+	*addr &= m;
+	return (0);
+}
+
+static void
+in_lpm_release(struct in_lpm *il)
+{
+
+	if (il->il_lpm != NULL)
+		dh_lpm_free(il->il_lpm);
+	if (il->il_rt != NULL)
+		free(il->il_rt, M_RTABLE);
+	if (il->il_free != NULL)
+		free(il->il_free, M_RTABLE);
+	il->il_lpm = NULL;
+	il->il_rt = NULL;
+	il->il_free = NULL;
+	il->il_default = NULL;
+}
+
+static void
+in_lpm_disable(struct in_lpm *il, const char *why)
+{
+
+	log(LOG_WARNING, "in_lpm: %s, using radix lookups\n", why);
+	in_lpm_release(il);
+}
+
+static int
+in_lpm_insert(struct in_lpm *il, struct rtentry *rt)
+{
+	uint32_t addr, nh;
+	uint8_t depth;
+	int error;
+
+	if ((error = in_lpm_prefix(rt, &addr, &depth)) != 0)
+		return (error);
+	if (depth == 0) {
+		il->il_default = rt;
+		return (0);
+	}
+	if (il->il_nfree == 0)
+		return (ENOSPC);
+	nh = il->il_free[--il->il_nfree];
+	if (dh_lpm_add(il->il_lpm, addr, depth, nh) != 0) {
+		il->il_nfree++;
+		return (ENOSPC);
+	}
+	il->il_rt[nh] = rt;
+	return (0);
+}
+
+static int
+in_lpm_walk_add(struct radix_node *rn, void *arg)
+{
+
+	return (in_lpm_insert(arg, (struct rtentry *)rn));
+}
+
+static void
+in_lpm_attach(struct radix_node_head *rnh)
+{
+	struct in_lpm *il;
+	char name[32];
+	uint32_t i, size;
+	int error;
+
+	il = malloc(sizeof(*il), M_RTABLE, M_NOWAIT | M_ZERO);
+	if (il == NULL)
+		return;
+	rnh->rnh_lpm = il;
+
+	size = min(in_lpm_rules, IN_LPM_MAXRULES);
+	il->il_rt = malloc(size * sizeof(*il->il_rt), M_RTABLE,
+	    M_NOWAIT | M_ZERO);
+	il->il_free = malloc(size * sizeof(*il->il_free), M_RTABLE, M_NOWAIT);
+	if (il->il_rt != NULL && il->il_free != NULL) {
+		snprintf(name, sizeof(name), "in_lpm%u",
+		    atomic_fetchadd_int(&in_lpm_unit, 1));
+		il->il_lpm = dh_lpm_create(name, size,
+		    max(256, min(size / 8, 65536)));
+	}
+	if (il->il_lpm == NULL) {
+		in_lpm_disable(il, "cannot allocate table");
+		return;
+	}
+	for (i = 0; i < size; i++)
+		il->il_free[i] = size - 1 - i;
+	il->il_nfree = size;
+
+	error = rnh->rnh_walktree(rnh, in_lpm_walk_add, il);
+	if (error != 0)
+		in_lpm_disable(il, error == ENOSPC ? "table full" :
+		    "non-contiguous netmask");
+}
+
+void
+in_lpm_addroute(struct radix_node_head *rnh, struct rtentry *rt)
+{
+	struct in_lpm *il = rnh->rnh_lpm;
+	int error;
+
+	RADIX_NODE_HEAD_WLOCK_ASSERT(rnh);
+	if (il == NULL) {
+		/* The walk in in_lpm_attach() picks up rt as well. */
+		if (in_lpm_rules != 0 && rt->rt_fibnum < in_lpm_fibs &&
+		    dh_eal_ready())
+			in_lpm_attach(rnh);
+		return;
+	}
+	if (il->il_lpm == NULL)
+		return;
+	if ((error = in_lpm_insert(il, rt)) != 0)
+		in_lpm_disable(il, error == ENOSPC ? "table full" :
+		    "non-contiguous netmask");
+}
+
+void
+in_lpm_delroute(struct radix_node_head *rnh, struct rtentry *rt)
+{
+	struct in_lpm *il = rnh->rnh_lpm;
+	uint32_t addr, nh;
+	uint8_t depth;
+
+	RADIX_NODE_HEAD_WLOCK_ASSERT(rnh);
+	if (il == NULL || il->il_lpm == NULL)
+		return;
+	if (in_lpm_prefix(rt, &addr, &depth) != 0)
+		return;
+	if (depth == 0) {
+		if (il->il_default == rt)
+			il->il_default = NULL;
+		return;
+	}
+	if (dh_lpm_rule(il->il_lpm, addr, depth, &nh) == 1 &&
+	    il->il_rt[nh] == rt) {
+		dh_lpm_delete(il->il_lpm, addr, depth);
+		il->il_rt[nh] = NULL;
+		il->il_free[il->il_nfree++] = nh;
+	}
+}
+
+void
+in_lpm_detach(struct radix_node_head *rnh)
+{
+	struct in_lpm *il = rnh->rnh_lpm;
+
+	if (il == NULL)
+		return;
+	in_lpm_release(il);
+	free(il, M_RTABLE);
+	rnh->rnh_lpm = NULL;
+}
+
+struct radix_node *
+in_lpm_match(struct radix_node_head *rnh, struct sockaddr_in *dst)
+{
+	struct in_lpm *il = rnh->rnh_lpm;
+	uint32_t nh;
+
+	if (il->il_lpm == NULL)
+		return (rn_match(dst, rnh));
+	if (dh_lpm_lookup(il->il_lpm, ntohl(dst->sin_addr.s_addr), &nh) == 0)
+		return ((struct radix_node *)il->il_rt[nh]);
+	return ((struct radix_node *)il->il_default);
+}
+
+/*
+ * Resolve n destinations at once.  Returns ENXIO, leaving rt[] untouched,
+ * if the head has no usable mirror.
+ */
+int
+in_lpm_match_bulk(struct radix_node_head *rnh, const struct in_addr *dst,
+    struct rtentry **rt, int n)
+{
+	struct in_lpm *il = rnh->rnh_lpm;
+	uint32_t ips[IN_LPM_BATCH], nh[IN_LPM_BATCH];
+	int i, j, chunk;
+
+	if (il == NULL || il->il_lpm == NULL)
+		return (ENXIO);
+	for (i = 0; i < n; i += chunk) {
+		chunk = min(n - i, IN_LPM_BATCH);
+		for (j = 0; j < chunk; j++)
+			ips[j] = ntohl(dst[i + j].s_addr);
+		dh_lpm_lookup_bulk(il->il_lpm, ips, nh, chunk);
+		for (j = 0; j < chunk; j++)
+			rt[i + j] = nh[j] == DH_LPM_MISS ? il->il_default :
+			    il->il_rt[nh[j]];
+	}
+	return (0);
+}
+
+#endif /* INET_LPM */
@@ -41,6 +41,8 @@
 #include <sys/sx.h>
 
 #include <vm/vm.h>
+#include <vm/vm_extern.h>
+#include <vm/vm_kern.h>
 #include <vm/vm_page.h>
 #include <vm/uma.h>
 #include <vm/uma_int.h>
@@ -134,6 +136,17 @@ uinet_hz = HZ;
 	}
 
 	epoch_number = cfg->epoch_number;
+
+	if (cfg->locks.mtx_noop &&
+	    (inst_cfg == NULL || !inst_cfg->sts.sts_enabled ||
+	     inst_cfg->sts.sts_callout_reset == NULL)) {
+		printf("locks.mtx_noop requires an STS instance with "
+		    "application-driven timers\n");
+		return (EINVAL);
+	}
+	uinet_mtx_noop = cfg->locks.mtx_noop;
+	if (cfg->locks.mtx_spin_limit)
+		uhi_mutex_set_spin_limit(cfg->locks.mtx_spin_limit);
 	
 #if defined(VIMAGE_STS) || defined(VIMAGE_STS_ONLY)
 	if (inst_cfg) {
@@ -145,6 +158,11 @@ uinet_hz = HZ;
 	printf("requested configuration:\n");
 	uinet_print_cfg(cfg);
 
+	if (cfg->kern.arena.size &&
+	    uinet_arena_init((uint64_t)cfg->kern.arena.size * 1024 * 1024,
+		cfg->kern.arena.hugepage_size) != 0)
+		printf("Failed to allocate %uMB malloc arena\n", cfg->kern.arena.size);
+
 #if 0
 	if_netmap_num_extra_bufs = cfg->netmap_extra_bufs;
 #endif
@@ -174,6 +192,9 @@ uinet_hz = HZ;
 	snprintf(tmpbuf, sizeof(tmpbuf), "%u", ncallout);
 	setenv("kern.ncallout", tmpbuf);
 
+	snprintf(tmpbuf, sizeof(tmpbuf), "%u", cfg->net.inet.ip.lpm_rules);
+	setenv("net.inet.ip.lpm_rules", tmpbuf);
+
 	snprintf(tmpbuf, sizeof(tmpbuf), "%u", roundup_nearest_power_of_2(cfg->net.inet.tcp.syncache.hashsize));
 	setenv("net.inet.tcp.syncache.hashsize", tmpbuf);
 
@@ -183,6 +204,9 @@ uinet_hz = HZ;
 	snprintf(tmpbuf, sizeof(tmpbuf), "%u", cfg->net.inet.tcp.syncache.cachelimit);
 	setenv("net.inet.tcp.syncache.cachelimit", tmpbuf);
 
+	snprintf(tmpbuf, sizeof(tmpbuf), "%u", cfg->net.inet.tcp.syncache.shards);
+	setenv("net.inet.tcp.syncache.shards", tmpbuf);
+
 	snprintf(tmpbuf, sizeof(tmpbuf), "%u", roundup_nearest_power_of_2(cfg->net.inet.tcp.tcbhashsize));	
 	setenv("net.inet.tcp.tcbhashsize", tmpbuf);
 
@@ -204,12 +228,22 @@ uinet_hz = HZ;
 	uinet_thread_init();
 	uinet_init_thread0();
 
-        uma_startup(malloc(boot_pages*PAGE_SIZE, M_DEVBUF, M_ZERO), boot_pages);
+	/*
+	 * The boot pages must be page aligned, as slab headers for items
+	 * allocated from them are found by masking the item address.
+	 */
+        uma_startup((void *)kmem_malloc(kmem_map, boot_pages*PAGE_SIZE, M_ZERO), boot_pages);
 	uma_startup2();
 
-	/* XXX any need to tune this? */
-	num_hash_buckets = 8192;  /* power of 2.  32 bytes per bucket on a 64-bit system, so no need to skimp */
-	uma_page_slab_hash = malloc(sizeof(struct uma_page)*num_hash_buckets, M_DEVBUF, M_ZERO);
+	/*
+	 * Size the page to slab hash so that the pages backing all of the
+	 * configured mbuf clusters still average at most one entry per
+	 * chain.  The hash is consulted on every cluster refcount lookup.
+	 */
+	num_hash_buckets = roundup_nearest_power_of_2(cfg->kern.ipc.nmbclusters);
+	if (num_hash_buckets < 8192)
+		num_hash_buckets = 8192;
+	uma_page_slab_hash = malloc(sizeof(struct uma_page_head)*num_hash_buckets, M_DEVBUF, M_ZERO);
 	uma_page_mask = num_hash_buckets - 1;
 
 #if 0
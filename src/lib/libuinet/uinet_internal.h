@@ -43,6 +43,13 @@ extern uint32_t epoch_number;
 
 extern uint32_t instance_count;
 
+/* when set, mtx_init() creates mutexes whose operations are no-ops */
+extern int uinet_mtx_noop;
+
+int uinet_arena_init(uint64_t size, unsigned int hugepage_size);
+void *uinet_arena_alloc_pages(unsigned long size, int flags);
+int uinet_arena_free_pages(void *addr, unsigned long size);
+
 struct uinet_instance {
 	struct vnet *ui_vnet;
 	struct uinet_sts_cfg ui_sts;
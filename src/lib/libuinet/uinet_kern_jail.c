@@ -36,6 +36,7 @@
 #include <sys/kernel.h>
 #include <sys/jail.h>
 #include <sys/lock.h>
+#include <sys/mutex.h>
 #include <sys/sx.h>
 
 
@@ -43,6 +44,7 @@
  * uinet_init_main.c.
  */
 struct	prison prison0;
+MTX_SYSINIT(prison0, &prison0.pr_mtx, "jail mutex", MTX_DEF);
 
 /* allprison, allprison_racct and lastprid are protected by allprison_lock. */
 struct	sx allprison_lock;
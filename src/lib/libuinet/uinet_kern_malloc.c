@@ -33,6 +33,8 @@
 #include <sys/kernel.h>
 #include <sys/systm.h>
 #include <sys/types.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
 
 /*
  * This include will catch the libuinet sys/malloc.h, which redefines the
@@ -43,7 +45,9 @@
  */
 #include <sys/malloc.h>
 
+#include <machine/atomic.h>
 
+#include "uinet_internal.h"
 #include "uinet_host_interface.h"
 
 
@@ -54,10 +58,397 @@ MALLOC_DEFINE(M_IP6OPT, "ip6opt", "IPv6 options");
 MALLOC_DEFINE(M_IP6NDP, "ip6ndp", "IPv6 Neighbor Discovery");
 
 
+/*
+ * Optional arena that malloc() and UMA slab allocations (via kmem_malloc())
+ * are carved out of.  It is a single region mapped at init time, ideally
+ * with hugepages, so that the stack's working set is covered by a handful
+ * of TLB entries instead of being spread over 4K pages of the host heap.
+ *
+ * The arena hands out runs of pages.  Freed runs are kept on lists indexed
+ * by length, with runs longer than ARENA_RUN_LISTS pages on a first-fit
+ * list.  Runs are not coalesced.  Pages that have never been handed out
+ * are taken from the top of the arena and are known to be zero.
+ *
+ * Requests of up to half a page are served from power of two size classes.
+ * Each malloc type keeps its own free list per size class, refilled a page
+ * at a time, and a page carved for a size class stays carved.  Larger
+ * requests get a run of their own.  A word per page records what the page
+ * is used for, so free() needs no per-item header.
+ *
+ * Anything that doesn't fit in the arena, or any request when there is no
+ * arena, goes to the host allocator.
+ */
+#define ARENA_MIN_SHIFT		4
+#define ARENA_NCLASSES		(PAGE_SHIFT - ARENA_MIN_SHIFT)
+#define ARENA_MAX_SMALL		(PAGE_SIZE / 2)
+#define ARENA_CLASS_SIZE(c)	(1UL << ((c) + ARENA_MIN_SHIFT))
+#define ARENA_RUN_LISTS		64
+
+#define ARENA_PI_SMALL		0x40000000	/* low bits are the size class */
+#define ARENA_PI_LARGE		0x80000000	/* low bits are the run length */
+#define ARENA_PI_MASK		0x3fffffff
+
+struct arena_run {
+	struct arena_run	*ar_next;
+	unsigned long		 ar_npages;
+};
+
+struct arena_chunk {
+	struct arena_chunk	*ac_next;
+};
+
+struct uinet_arena {
+	struct mtx		 ua_lock;
+	char			*ua_base;
+	char			*ua_end;
+	char			*ua_top;	/* first never used page */
+	uint32_t		*ua_pageinfo;
+	struct arena_run	*ua_runs[ARENA_RUN_LISTS + 1]; /* [0] is for long runs */
+};
+
+/*
+ * Per malloc type state, hung off of ks_handle.
+ */
+struct uinet_malloc_type {
+	struct mtx		 umt_lock;
+	struct arena_chunk	*umt_free[ARENA_NCLASSES];
+	u_long			 umt_numallocs;
+	u_long			 umt_numfrees;
+	u_long			 umt_memalloced;
+	u_long			 umt_memfreed;
+	u_long			 umt_arena_pages;
+};
+
+static struct uinet_arena arena;
+
+struct mtx malloc_mtx;
+static struct malloc_type *kmemstatistics;
+
+static void malloc_mtx_init(void) __attribute__((constructor));
+
+
+static void
+malloc_mtx_init(void)
+{
+	mtx_init(&malloc_mtx, "malloc", NULL, MTX_DEF);
+}
+
+
+int
+uinet_arena_init(uint64_t size, unsigned int hugepage_size)
+{
+	void *base;
+	int flags;
+
+	if (arena.ua_base != NULL)
+		return (EEXIST);
+
+	flags = UHI_MAP_ANON | UHI_MAP_PRIVATE;
+	base = UHI_MAP_FAILED;
+	if (hugepage_size) {
+		size = roundup2(size, (uint64_t)hugepage_size * 1024);
+		base = uhi_mmap(NULL, size, UHI_PROT_READ | UHI_PROT_WRITE,
+		    flags | UHI_MAP_HUGETLB |
+		    (hugepage_size >= 1024 * 1024 ? UHI_MAP_HUGE_1GB : 0),
+		    -1, 0);
+		if (base == UHI_MAP_FAILED)
+			printf("Unable to map malloc arena with %ukB pages, using regular pages\n",
+			    hugepage_size);
+	}
+	if (base == UHI_MAP_FAILED)
+		base = uhi_mmap(NULL, size, UHI_PROT_READ | UHI_PROT_WRITE,
+		    flags, -1, 0);
+	if (base == UHI_MAP_FAILED)
+		return (ENOMEM);
+
+	arena.ua_pageinfo = uhi_calloc(atop(size), sizeof(uint32_t));
+	if (arena.ua_pageinfo == NULL) {
+		uhi_munmap(base, size);
+		return (ENOMEM);
+	}
+
+	mtx_init(&arena.ua_lock, "malloc arena", NULL, MTX_DEF);
+	arena.ua_top = base;
+	arena.ua_end = (char *)base + size;
+	atomic_store_rel_ptr((volatile uintptr_t *)&arena.ua_base, (uintptr_t)base);
+
+	printf("Malloc arena of %lluMB at %p\n",
+	    (unsigned long long)(size / (1024 * 1024)), base);
+
+	return (0);
+}
+
+
+static __inline int
+arena_contains(void *addr)
+{
+	return ((char *)addr >= arena.ua_base && (char *)addr < arena.ua_end);
+}
+
+
+static __inline uint32_t *
+arena_pageinfo(void *addr)
+{
+	return (&arena.ua_pageinfo[atop((char *)addr - arena.ua_base)]);
+}
+
+
+static void
+arena_run_insert(char *p, unsigned long npages)
+{
+	struct arena_run *run;
+	unsigned int list;
+
+	run = (struct arena_run *)p;
+	run->ar_npages = npages;
+	list = npages <= ARENA_RUN_LISTS ? npages : 0;
+	run->ar_next = arena.ua_runs[list];
+	arena.ua_runs[list] = run;
+}
+
+
+/*
+ * Returns a run of npages pages, or NULL if the arena can't supply one.
+ * *fresh is set if the pages have never been used.
+ */
+static char *
+arena_run_alloc(unsigned long npages, int *fresh)
+{
+	struct arena_run *run, **prev;
+	unsigned int list;
+	char *p;
+
+	p = NULL;
+	*fresh = 0;
+
+	mtx_lock(&arena.ua_lock);
+	if (npages <= ARENA_RUN_LISTS && arena.ua_runs[npages] != NULL) {
+		run = arena.ua_runs[npages];
+		arena.ua_runs[npages] = run->ar_next;
+		p = (char *)run;
+	} else if (npages <= atop(arena.ua_end - arena.ua_top)) {
+		p = arena.ua_top;
+		arena.ua_top += ptoa(npages);
+		*fresh = 1;
+	} else {
+		/* Split the smallest longer run available. */
+		run = NULL;
+		for (list = npages + 1; list <= ARENA_RUN_LISTS; list++) {
+			if ((run = arena.ua_runs[list]) != NULL) {
+				arena.ua_runs[list] = run->ar_next;
+				break;
+			}
+		}
+		if (run == NULL) {
+			for (prev = &arena.ua_runs[0]; (run = *prev) != NULL;
+			     prev = &run->ar_next)
+				if (run->ar_npages >= npages) {
+					*prev = run->ar_next;
+					break;
+				}
+		}
+		if (run != NULL) {
+			p = (char *)run;
+			if (run->ar_npages > npages)
+				arena_run_insert(p + ptoa(npages),
+				    run->ar_npages - npages);
+		}
+	}
+	mtx_unlock(&arena.ua_lock);
+
+	return (p);
+}
+
+
+static void
+arena_run_free(char *p, unsigned long npages)
+{
+	mtx_lock(&arena.ua_lock);
+	arena_run_insert(p, npages);
+	mtx_unlock(&arena.ua_lock);
+}
+
+
+/*
+ * Page allocation for kmem_malloc().  Returns NULL if there is no arena or
+ * it is exhausted.
+ */
+void *
+uinet_arena_alloc_pages(unsigned long size, int flags)
+{
+	char *p;
+	int fresh;
+
+	if (arena.ua_base == NULL)
+		return (NULL);
+
+	p = arena_run_alloc(atop(round_page(size)), &fresh);
+	if (p != NULL && !fresh && (flags & M_ZERO))
+		bzero(p, round_page(size));
+
+	return (p);
+}
+
+
+/*
+ * Returns non-zero if addr was in the arena and has been returned to it.
+ */
+int
+uinet_arena_free_pages(void *addr, unsigned long size)
+{
+	if (!arena_contains(addr))
+		return (0);
+
+	arena_run_free(addr, atop(round_page(size)));
+	return (1);
+}
+
+
+static int
+arena_refill(struct uinet_malloc_type *umt, unsigned int c)
+{
+	struct arena_chunk *chunk;
+	char *p, *end;
+	int fresh;
+
+	p = arena_run_alloc(1, &fresh);
+	if (p == NULL)
+		return (ENOMEM);
+
+	*arena_pageinfo(p) = ARENA_PI_SMALL | c;
+	umt->umt_arena_pages++;
+
+	end = p + PAGE_SIZE;
+	for (; p < end; p += ARENA_CLASS_SIZE(c)) {
+		chunk = (struct arena_chunk *)p;
+		chunk->ac_next = umt->umt_free[c];
+		umt->umt_free[c] = chunk;
+	}
+
+	return (0);
+}
+
+
+static void *
+arena_malloc(struct uinet_malloc_type *umt, unsigned long size,
+    unsigned long *allocsize)
+{
+	struct arena_chunk *chunk;
+	unsigned long npages;
+	unsigned int c;
+	char *p;
+	int fresh;
+
+	if (size <= ARENA_MAX_SMALL) {
+		if (size == 0)
+			size = 1;
+		c = fls((size - 1) | (ARENA_CLASS_SIZE(0) - 1)) - ARENA_MIN_SHIFT;
+
+		mtx_lock(&umt->umt_lock);
+		if (umt->umt_free[c] == NULL && arena_refill(umt, c) != 0) {
+			mtx_unlock(&umt->umt_lock);
+			return (NULL);
+		}
+		chunk = umt->umt_free[c];
+		umt->umt_free[c] = chunk->ac_next;
+		mtx_unlock(&umt->umt_lock);
+
+		*allocsize = ARENA_CLASS_SIZE(c);
+		return (chunk);
+	}
+
+	npages = atop(round_page(size));
+	if (npages > ARENA_PI_MASK)
+		return (NULL);
+	p = arena_run_alloc(npages, &fresh);
+	if (p == NULL)
+		return (NULL);
+	*arena_pageinfo(p) = ARENA_PI_LARGE | npages;
+
+	*allocsize = ptoa(npages);
+	return (p);
+}
+
+
+static unsigned long
+arena_allocsize(void *addr)
+{
+	uint32_t pi;
+
+	pi = *arena_pageinfo(addr);
+	if (pi & ARENA_PI_SMALL)
+		return (ARENA_CLASS_SIZE(pi & ARENA_PI_MASK));
+
+	return (ptoa(pi & ARENA_PI_MASK));
+}
+
+
+static unsigned long
+arena_free(struct uinet_malloc_type *umt, void *addr)
+{
+	struct arena_chunk *chunk;
+	unsigned long npages;
+	uint32_t *pi;
+	unsigned int c;
+
+	pi = arena_pageinfo(addr);
+	if (*pi & ARENA_PI_SMALL) {
+		c = *pi & ARENA_PI_MASK;
+		chunk = addr;
+
+		mtx_lock(&umt->umt_lock);
+		chunk->ac_next = umt->umt_free[c];
+		umt->umt_free[c] = chunk;
+		mtx_unlock(&umt->umt_lock);
+
+		return (ARENA_CLASS_SIZE(c));
+	}
+
+	KASSERT(*pi & ARENA_PI_LARGE, ("%s: %p is not a malloc page", __func__, addr));
+	npages = *pi & ARENA_PI_MASK;
+	*pi = 0;
+	arena_run_free(addr, npages);
+
+	return (ptoa(npages));
+}
+
+
+/*
+ * Types are set up by malloc_init() via SYSINIT, but malloc() is used
+ * before the SYSINITs run, so set up on first use as well.
+ */
+static struct uinet_malloc_type *
+malloc_type_internal(struct malloc_type *type)
+{
+	struct uinet_malloc_type *umt;
+
+	umt = (struct uinet_malloc_type *)atomic_load_acq_ptr((volatile uintptr_t *)&type->ks_handle);
+	if (umt != NULL)
+		return (umt);
+
+	mtx_lock(&malloc_mtx);
+	umt = type->ks_handle;
+	if (umt == NULL) {
+		umt = uhi_calloc(1, sizeof(*umt));
+		if (umt == NULL)
+			panic("%s: unable to set up malloc type %s", __func__,
+			    type->ks_shortdesc);
+		mtx_init(&umt->umt_lock, type->ks_shortdesc, NULL, MTX_DEF);
+
+		type->ks_next = kmemstatistics;
+		kmemstatistics = type;
+		atomic_store_rel_ptr((volatile uintptr_t *)&type->ks_handle, (uintptr_t)umt);
+	}
+	mtx_unlock(&malloc_mtx);
+
+	return (umt);
+}
+
+
 void
 malloc_init(void *data)
 {
-	/* Nothing to do here */
+	malloc_type_internal(data);
 }
 
 
@@ -75,17 +466,34 @@ malloc_uninit(void *data)
 void *
 malloc(unsigned long size, struct malloc_type *type, int flags)
 {
+	struct uinet_malloc_type *umt;
+	unsigned long allocsize;
 	void *alloc;
 
-	do {
-		alloc = uhi_malloc(size);
-		if (alloc || !(flags & M_WAITOK))
-			break;
+	umt = malloc_type_internal(type);
+
+	alloc = NULL;
+	if (arena.ua_base != NULL)
+		alloc = arena_malloc(umt, size, &allocsize);
+
+	if (alloc == NULL) {
+		do {
+			alloc = uhi_malloc(size);
+			if (alloc || !(flags & M_WAITOK))
+				break;
 
-		pause("malloc", hz/100);
-	} while (alloc == NULL);
+			pause("malloc", hz/100);
+		} while (alloc == NULL);
 
-	if ((flags & M_ZERO) && alloc != NULL)
+		if (alloc == NULL)
+			return (NULL);
+		allocsize = uhi_malloc_usable_size(alloc);
+	}
+
+	atomic_add_long(&umt->umt_numallocs, 1);
+	atomic_add_long(&umt->umt_memalloced, allocsize);
+
+	if (flags & M_ZERO)
 		bzero(alloc, size);
 	return (alloc);
 }
@@ -94,8 +502,23 @@ malloc(unsigned long size, struct malloc_type *type, int flags)
 void
 free(void *addr, struct malloc_type *type)
 {
+	struct uinet_malloc_type *umt;
+	unsigned long size;
+
+	if (addr == NULL)
+		return;
+
+	umt = malloc_type_internal(type);
 
-	uhi_free(addr);
+	if (arena_contains(addr))
+		size = arena_free(umt, addr);
+	else {
+		size = uhi_malloc_usable_size(addr);
+		uhi_free(addr);
+	}
+
+	atomic_add_long(&umt->umt_numfrees, 1);
+	atomic_add_long(&umt->umt_memfreed, size);
 }
 
 
@@ -103,7 +526,35 @@ void *
 realloc(void *addr, unsigned long size, struct malloc_type *type,
 	int flags)
 {
-	return (uhi_realloc(addr, size));
+	struct uinet_malloc_type *umt;
+	unsigned long oldsize;
+	void *mem;
+
+	if (addr == NULL)
+		return (malloc(size, type, flags));
+
+	if (arena_contains(addr)) {
+		oldsize = arena_allocsize(addr);
+		if (size <= oldsize)
+			return (addr);
+
+		if ((mem = malloc(size, type, flags)) == NULL)
+			return (NULL);
+		bcopy(addr, mem, oldsize);
+		free(addr, type);
+		return (mem);
+	}
+
+	umt = malloc_type_internal(type);
+	oldsize = uhi_malloc_usable_size(addr);
+	if ((mem = uhi_realloc(addr, size)) != NULL) {
+		atomic_add_long(&umt->umt_numallocs, 1);
+		atomic_add_long(&umt->umt_memalloced, uhi_malloc_usable_size(mem));
+		atomic_add_long(&umt->umt_numfrees, 1);
+		atomic_add_long(&umt->umt_memfreed, oldsize);
+	}
+
+	return (mem);
 }
 
 
@@ -113,8 +564,36 @@ reallocf(void *addr, unsigned long size, struct malloc_type *type,
 {
 	void *mem;
 
-	if ((mem = uhi_realloc(addr, size)) == NULL)
-		uhi_free(addr);
+	if ((mem = realloc(addr, size, type, flags)) == NULL)
+		free(addr, type);
 
 	return (mem);
 }
+
+
+int
+uinet_getmallocstat(struct uinet_mallocstat *stats, int maxstats)
+{
+	struct uinet_malloc_type *umt;
+	struct malloc_type *mtp;
+	int n;
+
+	n = 0;
+	mtx_lock(&malloc_mtx);
+	for (mtp = kmemstatistics; mtp != NULL; mtp = mtp->ks_next, n++) {
+		if (n >= maxstats)
+			continue;
+
+		umt = mtp->ks_handle;
+		strlcpy(stats[n].ums_name, mtp->ks_shortdesc,
+		    sizeof(stats[n].ums_name));
+		stats[n].ums_numallocs = umt->umt_numallocs;
+		stats[n].ums_numfrees = umt->umt_numfrees;
+		stats[n].ums_memalloced = umt->umt_memalloced;
+		stats[n].ums_memfreed = umt->umt_memfreed;
+		stats[n].ums_arena_pages = umt->umt_arena_pages;
+	}
+	mtx_unlock(&malloc_mtx);
+
+	return (n);
+}
@@ -35,10 +35,15 @@
 #include <sys/systm.h>
 #include <sys/sx.h>
 
+#include <net/vnet.h>
+
 #include "uinet_host_interface.h"
+#include "uinet_internal.h"
 
 struct mtx Giant;
 
+int uinet_mtx_noop = 0;
+
 
 static void
 assert_mtx(struct lock_object *lock, int what)
@@ -140,9 +145,22 @@ mutex_init(void)
 void
 mtx_init(struct mtx *m, const char *name, const char *type, int opts)
 {
+	int uhi_opts = 0;
+
 	lock_init(&m->lock_object, &lock_class_mtx_sleep, name, type, opts);
 
-	if (0 != uhi_mutex_init(&m->mtx_lock, opts & MTX_RECURSE ? UHI_MTX_RECURSE : 0))
+	if (opts & MTX_RECURSE)
+		uhi_opts |= UHI_MTX_RECURSE;
+	/*
+	 * Only locks that belong to an STS instance, whose timers the
+	 * application runs on its own thread, may be elided.  Everything
+	 * else is shared with the stack's kthreads.
+	 */
+	if (uinet_mtx_noop && VNET_IS_STS(curvnet) &&
+	    curvnet->vnet_sts.sts_callout_reset != NULL)
+		uhi_opts |= UHI_MTX_NOOP;
+
+	if (0 != uhi_mutex_init(&m->mtx_lock, uhi_opts))
 		panic("Could not initialize mutex");
 }
 
@@ -118,6 +118,7 @@ struct uinet_pd_pool_info {
 #define UINET_PD_TYPE_NETMAP	0x0000
 #define UINET_PD_TYPE_MBUF	0x0001
 #define UINET_PD_TYPE_PTR	0x0002
+#define UINET_PD_TYPE_DPDK	0x0003
 
 #define UINET_PD_CTX_SINGLE_REF	0x0001	/* Packet descriptor will be freed without examining refcount */
 #define UINET_PD_CTX_MBUF_USED	0x0002	/* The associated mbuf must be reinitialized upon release of last ref */
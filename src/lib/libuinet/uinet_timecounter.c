@@ -50,9 +50,13 @@
  *
  *  This timecounter implementation retrieves the current host time and
  *  reports it as the equivalent number of counts from a counter
- *  incrementing at 'hz'.
+ *  incrementing at 1MHz, so that binuptime() and friends resolve
+ *  intervals well below a tick.  The 32-bit count wraps after ~71
+ *  minutes, far longer than the interval between tc_ticktock() calls.
  */
 
+#define	UINET_TC_FREQ	1000000
+
 
 static unsigned int
 uinet_tc_get_timecount(struct timecounter *tc)
@@ -60,11 +64,11 @@ uinet_tc_get_timecount(struct timecounter *tc)
 	uint64_t ns;
 
 	ns = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
-	return ((ns * HZ) / UHI_NSEC_PER_SEC);
+	return (ns / (UHI_NSEC_PER_SEC / UINET_TC_FREQ));
 }
 
 static struct timecounter uinet_timecounter = {
-	uinet_tc_get_timecount, 0, ~0u, HZ, "uinet clock", 1
+	uinet_tc_get_timecount, 0, ~0u, UINET_TC_FREQ, "uinet clock", 1
 };
 
 static void
@@ -31,11 +31,13 @@
 
 
 #include <sys/param.h>
+#include <sys/malloc.h>
 
 #include <vm/vm.h>
 
 
 #include "uinet_host_interface.h"
+#include "uinet_internal.h"
 
 
 vm_offset_t kmem_malloc(void * map, int bytes, int wait);
@@ -47,8 +49,16 @@ vm_map_t kmem_map=0;
 vm_offset_t
 kmem_malloc(void * map, int bytes, int wait)
 {
+	void *p;
 
-	return ((vm_offset_t)uhi_mmap(NULL, bytes, UHI_PROT_READ|UHI_PROT_WRITE, UHI_MAP_ANON|UHI_MAP_PRIVATE, -1, 0));
+	if ((p = uinet_arena_alloc_pages(bytes, wait)) != NULL)
+		return ((vm_offset_t)p);
+
+	p = uhi_mmap(NULL, bytes, UHI_PROT_READ|UHI_PROT_WRITE, UHI_MAP_ANON|UHI_MAP_PRIVATE, -1, 0);
+	if (p == UHI_MAP_FAILED)
+		return (0);
+
+	return ((vm_offset_t)p);
 }
 
 
@@ -56,5 +66,6 @@ void
 kmem_free(void *map, vm_offset_t addr, vm_size_t size)
 {
 
-	uhi_munmap((void *)addr, size);
+	if (!uinet_arena_free_pages((void *)addr, size))
+		uhi_munmap((void *)addr, size);
 }
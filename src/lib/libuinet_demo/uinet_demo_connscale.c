@@ -66,6 +66,7 @@ enum connscale_option_id {
 	CONNSCALE_OPT_RST_CLOSE,
 	CONNSCALE_OPT_RX_SIZE,
 	CONNSCALE_OPT_SERVER,
+	CONNSCALE_OPT_STATS,
 	CONNSCALE_OPT_TX_SIZE,
 	CONNSCALE_OPT_VLAN
 };
@@ -83,6 +84,7 @@ static const struct option connscale_long_options[] = {
 	{ "rst-close",		no_argument,		NULL,	CONNSCALE_OPT_RST_CLOSE },
 	{ "rx-size",		required_argument,	NULL,	CONNSCALE_OPT_RX_SIZE },
 	{ "server",		no_argument,		NULL,	CONNSCALE_OPT_SERVER },
+	{ "conn-stats",		optional_argument,	NULL,	CONNSCALE_OPT_STATS },
 	{ "tx-size",		required_argument,	NULL,	CONNSCALE_OPT_TX_SIZE },
 	{ "vlan",		required_argument,	NULL,	CONNSCALE_OPT_VLAN},
 	{ 0, 0, 0, 0 }
@@ -118,6 +120,8 @@ connscale_print_usage(void)
 	printf("  --rst-close             Send RST when closing client connections (default is normal TCP close)\n");
 	printf("  --rx-size               Server receive size before transmitting or client receive size after transmitting (default is 0)\n");
 	printf("  --server                Function as a server instead of a client\n");
+	printf("  --conn-stats [=interval]\n");
+	printf("                          Print connection rate for this instance every <interval> seconds (default 1)\n");
 	printf("  --tx-size               Server transmit size after receiving or client transmit size before receiving (default is 0)\n");
 	printf("  --vlan <vlan>|<vlan1>-<vlan2>\n");
 	printf("                          Specify the VLAN tag stack or range to use (default is none)\n");
@@ -212,6 +216,9 @@ connscale_process_args(struct uinet_demo_config *cfg, int argc, char **argv)
 		case CONNSCALE_OPT_SERVER:
 			connscale->server = 1;
 			break;
+		case CONNSCALE_OPT_STATS:
+			connscale->stats_interval = optarg ? strtoul(optarg, NULL, 10) : 1;
+			break;
 		case CONNSCALE_OPT_TX_SIZE:
 			connscale->write_size = strtoul(optarg, NULL, 10);
 			break;
@@ -256,6 +263,8 @@ connscale_print_cfg(struct uinet_demo_config *cfg)
 		else
 			printf(" max-conn=unlimited");
 	}
+	if (connscale->stats_interval)
+		printf(" conn-stats=%us", connscale->stats_interval);
 	printf(" vlan=%s", uinet_demo_vlan_range_str(buf, sizeof(buf), &connscale->vlans));
 	if (!connscale->server)
 		printf(" l_mac=%s", uinet_demo_mac_addr_range_str(buf, sizeof(buf), &connscale->local_mac_addrs));
@@ -784,6 +793,7 @@ connscale_client_cb(struct ev_loop *loop, ev_uinet *w, int revents)
 	ev_uinet_detach(w->ctx);
 	uinet_soclose(w->so);
 	uinet_pool_free(connscale->connection_pool, conn);
+	connscale->client_connections_completed++;
 
 	if ((connscale->connection_launch_rate == 0) &&
 	    !((connscale->client_connections_max > 0) &&
@@ -1074,6 +1084,37 @@ connscale_start_client(struct uinet_demo_connscale *connscale)
 }
 
 
+/*
+ * Each connscale instance runs on the thread of the event loop it was
+ * started on, so running one instance per event loop against the same
+ * stack and summing the per-instance rates shows how connection setup and
+ * teardown scale across threads.
+ */
+static void
+connscale_stats_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	struct uinet_demo_connscale *connscale = w->data;
+	uint64_t launched, completed;
+
+	if (connscale->server) {
+		launched = connscale->num_connections;
+		completed = connscale->num_connections;
+	} else {
+		launched = connscale->client_connections_launched;
+		completed = connscale->client_connections_completed;
+	}
+
+	printf("%s: launched/s=%.1f completed/s=%.1f total=%llu\n",
+	       connscale->cfg.name,
+	       (double)(launched - connscale->last_stats_launched) / connscale->stats_interval,
+	       (double)(completed - connscale->last_stats_completed) / connscale->stats_interval,
+	       (unsigned long long)completed);
+
+	connscale->last_stats_launched = launched;
+	connscale->last_stats_completed = completed;
+}
+
+
 static int
 connscale_start(struct uinet_demo_config *cfg, uinet_instance_t uinst, struct ev_loop *loop)
 {
@@ -1096,6 +1137,13 @@ connscale_start(struct uinet_demo_config *cfg, uinet_instance_t uinst, struct ev
 			return (-1);
 	}
 
+	if (connscale->stats_interval) {
+		ev_timer_init(&connscale->stats_watcher, connscale_stats_cb,
+			      connscale->stats_interval, connscale->stats_interval);
+		connscale->stats_watcher.data = connscale;
+		ev_timer_start(loop, &connscale->stats_watcher);
+	}
+
 	return (0);
 }
 
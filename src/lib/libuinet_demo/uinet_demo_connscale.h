@@ -60,6 +60,12 @@ struct uinet_demo_connscale {
 	ev_tstamp connection_launch_period;
 	double client_connections_per_period;
 	int client_rst_close;
+	uint64_t client_connections_completed;
+
+	ev_timer stats_watcher;
+	unsigned int stats_interval;
+	uint64_t last_stats_launched;
+	uint64_t last_stats_completed;
 };
 
 
@@ -67,6 +67,8 @@ UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/librte_mbuf.a
 UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/libethdev.a
 UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/librte_mempool.a 
 UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/librte_ring.a 
+UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/librte_lpm.a
+UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/librte_ip_frag.a
 UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/librte_eal.a
 
 #UINET_LDADD+=${RTE_SDK}/${RTE_TARGET}/lib/librte_pmd_af_packet.a
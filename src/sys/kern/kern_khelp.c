@@ -421,6 +421,13 @@ khelp_init(const void *vnet)
 			    !vinit)) {
 				error = hhook_add_hook_lookup(&h->h_hooks[i],
 				    HHOOK_NOWAIT);
+				/*
+				 * Helpers registered after this vnet's hook
+				 * points were created already had their hooks
+				 * added by khelp_register_helper().
+				 */
+				if (error == EEXIST)
+					error = 0;
 			}
 		}
 
@@ -522,6 +522,7 @@ sonewconn(struct socket *head, int connstatus)
 	so->so_linger = head->so_linger;
 	so->so_state = head->so_state | SS_NOFDREF;
 	so->so_fibnum = head->so_fibnum;
+	so->so_max_pacing_rate = head->so_max_pacing_rate;
 	so->so_proto = head->so_proto;
 	so->so_cred = crhold(head->so_cred);
 #ifdef MAC
@@ -610,6 +611,7 @@ sonewconn_passive_client(struct socket *head, int connstatus)
 	so->so_linger = head->so_linger;
 	so->so_state = head->so_state | SS_NOFDREF;
 	so->so_fibnum = head->so_fibnum;
+	so->so_max_pacing_rate = head->so_max_pacing_rate;
 	so->so_proto = head->so_proto;
 	so->so_cred = crhold(head->so_cred);
 #ifdef MAC
@@ -1503,7 +1505,7 @@ restart:
 			 */
 			VNET_SO_ASSERT(so);
 			error = (*so->so_proto->pr_usrreqs->pru_send)(so,
-			    (flags & MSG_OOB) ? PRUS_OOB :
+			    ((flags & MSG_OOB) ? PRUS_OOB :
 			/*
 			 * If the user set MSG_EOF, the protocol understands
 			 * this flag and nothing left to send then use
@@ -1514,7 +1516,9 @@ restart:
 			     (resid <= 0)) ?
 				PRUS_EOF :
 			/* If there is more to send set PRUS_MORETOCOME. */
-			    (resid > 0 && space > 0) ? PRUS_MORETOCOME : 0,
+			    (resid > 0 && space > 0) ? PRUS_MORETOCOME : 0) |
+			/* Let TCP put the data in its SYN. */
+			    ((flags & MSG_FASTOPEN) ? PRUS_FASTOPEN : 0),
 			    top, addr, control, td);
 			if (dontroute) {
 				SOCK_LOCK(so);
@@ -2764,6 +2768,19 @@ sosetopt(struct socket *so, struct sockopt *sopt)
 			so->so_user_cookie = val32;
 			break;
 
+		case SO_MAX_PACING_RATE:
+			if (sopt->sopt_valsize == sizeof(val32)) {
+				error = sooptcopyin(sopt, &val32, sizeof val32,
+				    sizeof val32);
+				val = val32;
+			} else
+				error = sooptcopyin(sopt, &val, sizeof val,
+				    sizeof val);
+			if (error)
+				goto bad;
+			so->so_max_pacing_rate = val;
+			break;
+
 		case SO_L2INFO:
 #ifdef PROMISCUOUS_INET
 			error = sooptcopyin(sopt, &l2info, sizeof l2info,
@@ -3003,6 +3020,8 @@ sogetopt(struct socket *so, struct sockopt *sopt)
 	int	error, optval;
 	struct	linger l;
 	struct	timeval tv;
+	uint32_t val32;
+	uint64_t val64;
 #ifdef MAC
 	struct mac extmac;
 #endif
@@ -3065,6 +3084,17 @@ integer:
 			optval = so->so_proto->pr_protocol;
 			goto integer;
 
+		case SO_MAX_PACING_RATE:
+			if (sopt->sopt_valsize == sizeof(uint32_t)) {
+				val32 = so->so_max_pacing_rate > UINT32_MAX ?
+				    UINT32_MAX : so->so_max_pacing_rate;
+				error = sooptcopyout(sopt, &val32, sizeof val32);
+			} else {
+				val64 = so->so_max_pacing_rate;
+				error = sooptcopyout(sopt, &val64, sizeof val64);
+			}
+			break;
+
 		case SO_ERROR:
 			SOCK_LOCK(so);
 			optval = so->so_error;
@@ -38,6 +38,8 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/net/flowtable.c 232292 2012-02-29 09:47:26
 
 #include <sys/param.h>  
 #include <sys/types.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
 #include <sys/bitstring.h>
 #include <sys/condvar.h>
 #include <sys/callout.h>
@@ -64,6 +66,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/net/flowtable.c 232292 2012-02-29 09:47:26
 #include <netinet/in.h>
 #include <netinet/in_systm.h>
 #include <netinet/in_var.h>
+#include <netinet/in_pcb.h>
 #include <netinet/if_ether.h>
 #include <netinet/ip.h>
 #ifdef INET6
@@ -74,7 +77,9 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/net/flowtable.c 232292 2012-02-29 09:47:26
 #include <netinet/sctp.h>
 
 #include <libkern/jenkins.h>
+#ifdef DDB
 #include <ddb/ddb.h>
+#endif
 
 struct ipv4_tuple {
 	uint16_t 	ip_sport;	/* source port */
@@ -181,9 +186,12 @@ struct flowtable {
 	uint32_t	ft_syn_idle;
 	uint32_t	ft_tcp_idle;
 	boolean_t	ft_full;
+	volatile u_int	ft_gen;		/* bumped when routes are flushed */
 } __aligned(CACHE_LINE_SIZE);
 
+#ifndef UINET
 static struct proc *flowcleanerproc;
+#endif
 static VNET_DEFINE(struct flowtable *, flow_list_head);
 static VNET_DEFINE(uint32_t, flow_hashjitter);
 static VNET_DEFINE(uma_zone_t, flow_ipv4_zone);
@@ -619,6 +627,99 @@ flow_to_route(struct flentry *fle, struct route *ro)
 	ro->ro_rt = __DEVOLATILE(struct rtentry *, fle->f_rt);
 	ro->ro_lle = __DEVOLATILE(struct llentry *, fle->f_lle);
 }
+
+/*
+ * Connected sockets hold their own references to the route and L2 entry
+ * of their flow, so that steady-state transmits skip the flow table as
+ * well as the routing table and ARP lookups.  The cache is read under the
+ * inpcb read lock and replaced only under the write lock.  It is dropped
+ * when the route goes down, the L2 entry is invalidated, or the table
+ * generation moves on because a more specific route was added.
+ */
+static int
+flow_inpcb_valid(struct flowtable *ft, struct inpcb *inp, struct in_addr dst)
+{
+	struct rtentry *rt;
+
+	rt = inp->inp_rt;
+	if (rt == NULL || inp->inp_flowgen != ft->ft_gen ||
+	    inp->inp_faddr.s_addr != dst.s_addr ||
+	    (rt->rt_flags & RTF_UP) == 0 || rt->rt_ifp == NULL ||
+	    !RT_LINK_IS_UP(rt->rt_ifp) ||
+	    (inp->inp_lle->la_flags & LLE_VALID) == 0)
+		return (0);
+	return (1);
+}
+
+int
+flowtable_inpcb_stale(struct flowtable *ft, struct inpcb *inp)
+{
+
+	INP_LOCK_ASSERT(inp);
+	if (V_flowtable_enable == 0 || inp->inp_faddr.s_addr == INADDR_ANY)
+		return (0);
+	return (!flow_inpcb_valid(ft, inp, inp->inp_faddr));
+}
+
+int
+inpcb_to_route(struct flowtable *ft, struct inpcb *inp, struct in_addr dst,
+    struct route *ro)
+{
+	struct sockaddr_in *sin;
+
+	INP_LOCK_ASSERT(inp);
+	if (V_flowtable_enable == 0 || !flow_inpcb_valid(ft, inp, dst))
+		return (0);
+
+	sin = (struct sockaddr_in *)&ro->ro_dst;
+	sin->sin_family = AF_INET;
+	sin->sin_len = sizeof(*sin);
+	sin->sin_addr = dst;
+	ro->ro_rt = inp->inp_rt;
+	ro->ro_lle = inp->inp_lle;
+	return (1);
+}
+
+void
+flow_to_inpcb(struct flowtable *ft, struct flentry *fle, struct inpcb *inp)
+{
+	struct rtentry *rt;
+	struct llentry *lle;
+
+	INP_WLOCK_ASSERT(inp);
+	rt = __DEVOLATILE(struct rtentry *, fle->f_rt);
+	lle = __DEVOLATILE(struct llentry *, fle->f_lle);
+	if (inp->inp_faddr.s_addr != ((struct flentry_v4 *)fle)->fl_flow.ipf_key[2] ||
+	    (rt == inp->inp_rt && lle == inp->inp_lle &&
+	    inp->inp_flowgen == ft->ft_gen))
+		return;
+
+	flowtable_inpcb_free(inp);
+	RT_LOCK(rt);
+	RT_ADDREF(rt);
+	RT_UNLOCK(rt);
+	LLE_WLOCK(lle);
+	LLE_ADDREF(lle);
+	LLE_WUNLOCK(lle);
+	inp->inp_rt = rt;
+	inp->inp_lle = lle;
+	inp->inp_flowgen = ft->ft_gen;
+}
+
+void
+flowtable_inpcb_free(struct inpcb *inp)
+{
+
+	INP_WLOCK_ASSERT(inp);
+	if (inp->inp_rt != NULL) {
+		RTFREE(inp->inp_rt);
+		inp->inp_rt = NULL;
+	}
+	if (inp->inp_lle != NULL) {
+		LLE_FREE(inp->inp_lle);
+		inp->inp_lle = NULL;
+	}
+}
 #endif /* INET */
 
 #ifdef INET6
@@ -1490,26 +1591,57 @@ flowtable_free_stale(struct flowtable *ft, struct rtentry *rt)
 		log(LOG_DEBUG, "freed %d flow entries\n", count);
 }
 
+/*
+ * Per-cpu tables are only touched from their own cpu.  In uinet, per-cpu
+ * state is indexed by td_oncpu and serialized by the per-cpu critical
+ * section lock rather than by the scheduler, so borrowing the index is
+ * enough and the host thread's affinity is left alone.
+ */
+static int
+flowtable_bind_cpu(int cpu)
+{
+	int oncpu;
+
+#ifdef UINET
+	oncpu = curthread->td_oncpu;
+	curthread->td_oncpu = cpu;
+#else
+	oncpu = NOCPU;
+	if (smp_started == 1) {
+		thread_lock(curthread);
+		sched_bind(curthread, cpu);
+		thread_unlock(curthread);
+	}
+#endif
+	return (oncpu);
+}
+
+static void
+flowtable_unbind_cpu(int oncpu)
+{
+
+#ifdef UINET
+	curthread->td_oncpu = oncpu;
+#else
+	if (smp_started == 1) {
+		thread_lock(curthread);
+		sched_unbind(curthread);
+		thread_unlock(curthread);
+	}
+#endif
+}
+
 void
 flowtable_route_flush(struct flowtable *ft, struct rtentry *rt)
 {
-	int i;
+	int i, oncpu;
 
+	atomic_add_int(&ft->ft_gen, 1);
 	if (ft->ft_flags & FL_PCPU) {
 		CPU_FOREACH(i) {
-			if (smp_started == 1) {
-				thread_lock(curthread);
-				sched_bind(curthread, i);
-				thread_unlock(curthread);
-			}
-
+			oncpu = flowtable_bind_cpu(i);
 			flowtable_free_stale(ft, rt);
-
-			if (smp_started == 1) {
-				thread_lock(curthread);
-				sched_unbind(curthread);
-				thread_unlock(curthread);
-			}
+			flowtable_unbind_cpu(oncpu);
 		}
 	} else {
 		flowtable_free_stale(ft, rt);
@@ -1520,25 +1652,15 @@ static void
 flowtable_clean_vnet(void)
 {
 	struct flowtable *ft;
-	int i;
+	int i, oncpu;
 
 	ft = V_flow_list_head;
 	while (ft != NULL) {
 		if (ft->ft_flags & FL_PCPU) {
 			CPU_FOREACH(i) {
-				if (smp_started == 1) {
-					thread_lock(curthread);
-					sched_bind(curthread, i);
-					thread_unlock(curthread);
-				}
-
+				oncpu = flowtable_bind_cpu(i);
 				flowtable_free_stale(ft, NULL);
-
-				if (smp_started == 1) {
-					thread_lock(curthread);
-					sched_unbind(curthread);
-					thread_unlock(curthread);
-				}
+				flowtable_unbind_cpu(oncpu);
 			}
 		} else {
 			flowtable_free_stale(ft, NULL);
@@ -1559,6 +1681,9 @@ flowtable_cleaner(void)
 	while (1) {
 		VNET_LIST_RLOCK();
 		VNET_FOREACH(vnet_iter) {
+			/* STS instances may not be touched from this thread. */
+			if (VNET_IS_STS(vnet_iter))
+				continue;
 			CURVNET_SET(vnet_iter);
 			flowtable_clean_vnet();
 			CURVNET_RESTORE();
@@ -1570,9 +1695,11 @@ flowtable_cleaner(void)
 		 * is arbitrary
 		 */
 		mtx_lock(&flowclean_lock);
+#ifndef UINET
 		thread_lock(td);
 		sched_prio(td, PPAUSE);
 		thread_unlock(td);
+#endif
 		flowclean_cycles++;
 		cv_broadcast(&flowclean_f_cv);
 		cv_timedwait(&flowclean_c_cv, &flowclean_lock, flowclean_freq);
@@ -1594,12 +1721,25 @@ flowtable_flush(void *unused __unused)
 	mtx_unlock(&flowclean_lock);
 }
 
+#ifdef UINET
+static void
+flowtable_cleaner_start(const void *unused __unused)
+{
+
+	if (kthread_add((void (*)(void *))flowtable_cleaner, NULL, NULL,
+	    NULL, 0, 0, "flowcleaner"))
+		panic("flowtable_cleaner_start: kthread_add failed");
+}
+SYSINIT(flowcleaner, SI_SUB_KTHREAD_IDLE, SI_ORDER_ANY,
+    flowtable_cleaner_start, NULL);
+#else
 static struct kproc_desc flow_kp = {
 	"flowcleaner",
 	flowtable_cleaner,
 	&flowcleanerproc
 };
 SYSINIT(flowcleaner, SI_SUB_KTHREAD_IDLE, SI_ORDER_ANY, kproc_start, &flow_kp);
+#endif
 
 static void
 flowtable_init_vnet(const void *unused __unused)
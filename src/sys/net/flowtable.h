@@ -47,6 +47,8 @@ $FreeBSD: release/9.1.0/sys/net/flowtable.h 208171 2010-05-16 21:48:39Z kmacy $
 
 struct flowtable;
 struct flentry;
+struct inpcb;
+struct in_addr;
 struct route;
 struct route_in6;
 
@@ -78,6 +80,16 @@ void flow_to_route(struct flentry *fl, struct route *ro);
 
 void flow_to_route_in6(struct flentry *fl, struct route_in6 *ro);
 
+/*
+ * Per-connection cache of the flow's route and L2 entry, kept in the
+ * inpcb of connected IPv4 sockets.
+ */
+int inpcb_to_route(struct flowtable *ft, struct inpcb *inp, struct in_addr dst,
+    struct route *ro);
+void flow_to_inpcb(struct flowtable *ft, struct flentry *fl, struct inpcb *inp);
+int flowtable_inpcb_stale(struct flowtable *ft, struct inpcb *inp);
+void flowtable_inpcb_free(struct inpcb *inp);
+
 
 #endif /* _KERNEL */
 #endif
@@ -211,9 +211,12 @@ ether_output(struct ifnet *ifp, struct mbuf *m,
 			break;
 		}
 #endif
-		if (lle != NULL && (lle->la_flags & LLE_VALID))
+		if (lle != NULL && (lle->la_flags & LLE_VALID)) {
 			memcpy(edst, &lle->ll_addr.mac16, sizeof(edst));
-		else
+			/* tells arptimer() to refresh it */
+			if (lle->la_used == 0)
+				lle->la_used = 1;
+		} else
 			error = arpresolve(ifp, rt0, m, dst, edst, &lle);
 		if (error)
 			return (error == EWOULDBLOCK ? 0 : error);
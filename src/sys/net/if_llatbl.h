@@ -70,6 +70,7 @@ struct llentry {
 	uint16_t		 ln_byhint;
 	int16_t			 ln_state;	/* IPv6 has ND6_LLINFO_NOSTATE == -2 */
 	uint16_t		 ln_router; 
+	uint16_t		 la_used;	/* referenced without the lock */
 	time_t			 ln_ntick;
 	int			 lle_refcnt;
 				 
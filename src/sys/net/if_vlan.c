@@ -795,9 +795,10 @@ vlan_clone_match_ethertag(struct if_clone *ifc, const char *name, int *tag)
 	TAILQ_FOREACH(ifp, &V_ifnet, if_link) {
 		/*
 		 * We can handle non-ethernet hardware types as long as
-		 * they handle the tagging and headers themselves.
+		 * they handle the tagging and headers themselves.  A
+		 * vlan(4) parent stacks an 802.1Q-in-802.1Q (QinQ) tag.
 		 */
-		if (ifp->if_type != IFT_ETHER &&
+		if (ifp->if_type != IFT_ETHER && ifp->if_type != IFT_L2VLAN &&
 		    (ifp->if_capenable & IFCAP_VLAN_HWTAGGING) == 0)
 			continue;
 		if (strncmp(ifp->if_xname, name, strlen(ifp->if_xname)) != 0)
@@ -898,6 +899,7 @@ vlan_clone_create(struct if_clone *ifc, char *name, size_t len, caddr_t params)
 			return (EINVAL);
 	} else {
 		ethertag = 0;
+		tag = 0;
 
 		error = ifc_name2unit(name, &unit);
 		if (error != 0)
@@ -1179,7 +1181,7 @@ vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag)
 	/* VID numbers 0x0 and 0xFFF are reserved */
 	if (tag == 0 || tag == 0xFFF)
 		return (EINVAL);
-	if (p->if_type != IFT_ETHER &&
+	if (p->if_type != IFT_ETHER && p->if_type != IFT_L2VLAN &&
 	    (p->if_capenable & IFCAP_VLAN_HWTAGGING) == 0)
 		return (EPROTONOSUPPORT);
 	if ((p->if_flags & VLAN_IFFLAGS) != VLAN_IFFLAGS)
@@ -135,6 +135,7 @@ struct radix_node_head {
 	struct	radix_node rnh_nodes[3];	/* empty tree for common case */
 #ifdef _KERNEL
 	struct	rwlock rnh_lock;		/* locks entire radix tree */
+	void	*rnh_lpm;			/* forwarding table mirror */
 #endif
 };
 
@@ -97,6 +97,18 @@ struct cc_var {
 #define	CC_PARTIALACK	0x0004	/* Not yet. */
 #define	CC_SACK		0x0008	/* Not yet. */
 
+/*
+ * Delivery rate sample passed to the rate_sample() hook, generated when the
+ * segment timed by tcp_rate_sent() is cumulatively acknowledged.
+ */
+struct cc_rate_sample {
+	uint64_t	delivered;	/* Bytes delivered during interval. */
+	uint64_t	interval_us;	/* Length of sampling interval. */
+	uint64_t	rtt_us;		/* RTT of the timed segment. */
+	uint64_t	prior_delivered; /* Delivered count when timed. */
+	int		app_limited;	/* Sender ran out of data. */
+};
+
 /*
  * Congestion signal types passed to the cong_signal() hook. The highest order 8
  * bits (0x01000000 - 0x80000000) are reserved for CC algos to declare their own
@@ -143,6 +155,9 @@ struct cc_algo {
 	/* Called when data transfer resumes after an idle period. */
 	void	(*after_idle)(struct cc_var *ccv);
 
+	/* Called with each new delivery rate sample. */
+	void	(*rate_sample)(struct cc_var *ccv, struct cc_rate_sample *rs);
+
 	STAILQ_ENTRY (cc_algo) entries;
 };
 
@@ -0,0 +1,475 @@
+/*-
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A model-based congestion control algorithm in the style of BBR
+ * (draft-cardwell-iccrg-bbr-congestion-control).  Rather than reacting to
+ * loss, it tracks the bottleneck bandwidth (windowed max of delivery rate
+ * samples) and the round-trip propagation delay (windowed min RTT), and
+ * paces at a gain-cycled multiple of their product.
+ *
+ * Delivery rate samples arrive through the rate_sample() hook, one per
+ * timed segment (see tcp_rate_sent()/tcp_rate_acked()).  The pacing rate is
+ * published in t_pacing_rate for the output path to enforce.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/param.h>
+#include <sys/kernel.h>
+#include <sys/libkern.h>
+#include <sys/malloc.h>
+#include <sys/module.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <net/if.h>
+#include <net/vnet.h>
+
+#include <netinet/cc.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+
+#include <netinet/cc/cc_module.h>
+
+/* Gains are fixed point with BBR_SCALE fractional bits. */
+#define	BBR_SCALE		8
+#define	BBR_UNIT		(1 << BBR_SCALE)
+#define	BBR_HIGH_GAIN		(BBR_UNIT * 2885 / 1000 + 1)	/* 2/ln(2) */
+#define	BBR_DRAIN_GAIN		(BBR_UNIT * 1000 / 2885)
+#define	BBR_CWND_GAIN		(BBR_UNIT * 2)
+
+/* Bottleneck bandwidth filter length, in round trips. */
+#define	BBR_BW_ROUNDS		10
+/* Rounds without 25% bandwidth growth before the pipe is deemed full. */
+#define	BBR_FULL_BW_ROUNDS	3
+#define	BBR_FULL_BW_THRESH	(BBR_UNIT * 5 / 4)
+/* Minimum cwnd, in segments, also used while probing for min RTT. */
+#define	BBR_MIN_CWND_SEGS	4
+#define	BBR_CYCLE_LEN		8
+
+#define	BBR_STARTUP		0
+#define	BBR_DRAIN		1
+#define	BBR_PROBE_BW		2
+#define	BBR_PROBE_RTT		3
+
+static const int bbr_pacing_gain[BBR_CYCLE_LEN] = {
+	BBR_UNIT * 5 / 4, BBR_UNIT * 3 / 4,
+	BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT
+};
+
+static void	bbr_ack_received(struct cc_var *ccv, uint16_t type);
+static void	bbr_after_idle(struct cc_var *ccv);
+static void	bbr_cb_destroy(struct cc_var *ccv);
+static int	bbr_cb_init(struct cc_var *ccv);
+static void	bbr_cong_signal(struct cc_var *ccv, uint32_t type);
+static void	bbr_conn_init(struct cc_var *ccv);
+static void	bbr_post_recovery(struct cc_var *ccv);
+static void	bbr_rate_sample(struct cc_var *ccv, struct cc_rate_sample *rs);
+
+struct bbr {
+	int		state;
+	int		pacing_gain;
+	int		cwnd_gain;
+	int		filled_pipe;
+	int		full_bw_cnt;
+	int		cycle_idx;
+	int		min_rtt_ticks;	/* when min_rtt_us was measured */
+	int		probe_rtt_done;	/* ticks at which PROBE_RTT may end */
+	uint32_t	round;		/* round trips since init */
+	uint64_t	next_round_delivered;
+	uint64_t	bw[BBR_BW_ROUNDS]; /* max delivery rate per round */
+	uint64_t	full_bw;
+	uint64_t	min_rtt_us;
+	uint64_t	cycle_start_us;
+	u_long		prior_cwnd;
+};
+
+static VNET_DEFINE(uint32_t, bbr_probe_rtt_interval) = 10000;
+static VNET_DEFINE(uint32_t, bbr_probe_rtt_time) = 200;
+#define	V_bbr_probe_rtt_interval	VNET(bbr_probe_rtt_interval)
+#define	V_bbr_probe_rtt_time		VNET(bbr_probe_rtt_time)
+
+static MALLOC_DEFINE(M_BBR, "bbr data",
+    "Per connection data required for the BBR congestion control algorithm");
+
+struct cc_algo bbr_cc_algo = {
+	.name = "bbr",
+	.ack_received = bbr_ack_received,
+	.after_idle = bbr_after_idle,
+	.cb_destroy = bbr_cb_destroy,
+	.cb_init = bbr_cb_init,
+	.cong_signal = bbr_cong_signal,
+	.conn_init = bbr_conn_init,
+	.post_recovery = bbr_post_recovery,
+	.rate_sample = bbr_rate_sample
+};
+
+static uint64_t
+bbr_max_bw(struct bbr *bbr)
+{
+	uint64_t bw;
+	int i;
+
+	bw = 0;
+	for (i = 0; i < BBR_BW_ROUNDS; i++)
+		if (bbr->bw[i] > bw)
+			bw = bbr->bw[i];
+
+	return (bw);
+}
+
+/*
+ * The estimated BDP scaled by gain, or 0 while there is no model yet.
+ */
+static u_long
+bbr_bdp(struct bbr *bbr, int gain)
+{
+	uint64_t bw;
+
+	bw = bbr_max_bw(bbr);
+	if (bw == 0 || bbr->min_rtt_us == UINT64_MAX)
+		return (0);
+
+	return ((bw * bbr->min_rtt_us / 1000000 * gain) >> BBR_SCALE);
+}
+
+static u_long
+bbr_target_cwnd(struct cc_var *ccv, struct bbr *bbr)
+{
+	u_long bdp;
+
+	bdp = bbr_bdp(bbr, bbr->cwnd_gain);
+	if (bdp == 0)
+		return (0);
+
+	/* Allow for delayed and stretched ACKs at the receiver. */
+	bdp += 3 * CCV(ccv, t_maxseg);
+
+	return (ulmax(bdp, BBR_MIN_CWND_SEGS * CCV(ccv, t_maxseg)));
+}
+
+static void
+bbr_set_pacing_rate(struct cc_var *ccv, struct bbr *bbr)
+{
+	uint64_t rate;
+
+	rate = (bbr_max_bw(bbr) * bbr->pacing_gain) >> BBR_SCALE;
+
+	/* Until the pipe is full, never slow down on a low sample. */
+	if (rate > 0 &&
+	    (bbr->filled_pipe || rate > CCV(ccv, t_pacing_rate)))
+		CCV(ccv, t_pacing_rate) = rate;
+}
+
+static void
+bbr_enter_probe_bw(struct bbr *bbr, uint64_t now)
+{
+
+	bbr->state = BBR_PROBE_BW;
+	bbr->cwnd_gain = BBR_CWND_GAIN;
+	/* Start anywhere in the cycle except the draining phase. */
+	bbr->cycle_idx = BBR_CYCLE_LEN - 1 - random() % (BBR_CYCLE_LEN - 1);
+	bbr->pacing_gain = bbr_pacing_gain[bbr->cycle_idx];
+	bbr->cycle_start_us = now;
+}
+
+static void
+bbr_check_full_pipe(struct bbr *bbr, struct cc_rate_sample *rs)
+{
+	uint64_t bw;
+
+	if (bbr->filled_pipe || rs->app_limited)
+		return;
+
+	bw = bbr_max_bw(bbr);
+	if (bw >= (bbr->full_bw * BBR_FULL_BW_THRESH) >> BBR_SCALE) {
+		bbr->full_bw = bw;
+		bbr->full_bw_cnt = 0;
+		return;
+	}
+	if (++bbr->full_bw_cnt >= BBR_FULL_BW_ROUNDS)
+		bbr->filled_pipe = 1;
+}
+
+static void
+bbr_update_cycle(struct cc_var *ccv, struct bbr *bbr, uint64_t now)
+{
+	u_long inflight;
+	int advance;
+
+	inflight = CCV(ccv, snd_max) - CCV(ccv, snd_una);
+	advance = now - bbr->cycle_start_us > bbr->min_rtt_us;
+
+	/*
+	 * Stay in the probing phase until the extra data is actually in
+	 * flight (bounded at two min RTTs for senders that can't fill it),
+	 * and leave the draining phase as soon as the queue built by
+	 * probing is gone.
+	 */
+	if (bbr->pacing_gain > BBR_UNIT)
+		advance = advance &&
+		    (inflight >= bbr_bdp(bbr, bbr->pacing_gain) ||
+		    now - bbr->cycle_start_us > 2 * bbr->min_rtt_us);
+	else if (bbr->pacing_gain < BBR_UNIT)
+		advance = advance || inflight <= bbr_bdp(bbr, BBR_UNIT);
+
+	if (advance) {
+		bbr->cycle_idx = (bbr->cycle_idx + 1) % BBR_CYCLE_LEN;
+		bbr->pacing_gain = bbr_pacing_gain[bbr->cycle_idx];
+		bbr->cycle_start_us = now;
+	}
+}
+
+static void
+bbr_rate_sample(struct cc_var *ccv, struct cc_rate_sample *rs)
+{
+	struct bbr *bbr;
+	uint64_t bw, now;
+	u_long inflight;
+	int round_start, rtt_expired;
+
+	bbr = ccv->cc_data;
+	now = tcp_rate_getus();
+	round_start = 0;
+
+	if (rs->prior_delivered >= bbr->next_round_delivered) {
+		bbr->next_round_delivered = CCV(ccv, t_delivered);
+		bbr->round++;
+		bbr->bw[bbr->round % BBR_BW_ROUNDS] = 0;
+		round_start = 1;
+	}
+
+	/*
+	 * App-limited samples understate the bottleneck, so only let them
+	 * raise the estimate.
+	 */
+	bw = rs->delivered * 1000000 / rs->interval_us;
+	if (!rs->app_limited || bw >= bbr_max_bw(bbr))
+		if (bw > bbr->bw[bbr->round % BBR_BW_ROUNDS])
+			bbr->bw[bbr->round % BBR_BW_ROUNDS] = bw;
+
+	rtt_expired = ticks - bbr->min_rtt_ticks >
+	    (int)(V_bbr_probe_rtt_interval * hz / 1000);
+	if (rs->rtt_us < bbr->min_rtt_us || rtt_expired) {
+		bbr->min_rtt_us = ulmax(rs->rtt_us, 1);
+		bbr->min_rtt_ticks = ticks;
+	}
+
+	if (round_start)
+		bbr_check_full_pipe(bbr, rs);
+
+	inflight = CCV(ccv, snd_max) - CCV(ccv, snd_una);
+	switch (bbr->state) {
+	case BBR_STARTUP:
+		if (bbr->filled_pipe) {
+			bbr->state = BBR_DRAIN;
+			bbr->pacing_gain = BBR_DRAIN_GAIN;
+		}
+		break;
+	case BBR_DRAIN:
+		if (inflight <= bbr_bdp(bbr, BBR_UNIT))
+			bbr_enter_probe_bw(bbr, now);
+		break;
+	case BBR_PROBE_BW:
+		bbr_update_cycle(ccv, bbr, now);
+		break;
+	case BBR_PROBE_RTT:
+		if (bbr->probe_rtt_done == 0 &&
+		    inflight <= BBR_MIN_CWND_SEGS * CCV(ccv, t_maxseg)) {
+			bbr->probe_rtt_done = ticks +
+			    V_bbr_probe_rtt_time * hz / 1000 + 1;
+		} else if (bbr->probe_rtt_done != 0 &&
+		    ticks - bbr->probe_rtt_done >= 0) {
+			bbr->min_rtt_ticks = ticks;
+			CCV(ccv, snd_cwnd) = ulmax(CCV(ccv, snd_cwnd),
+			    bbr->prior_cwnd);
+			if (bbr->filled_pipe)
+				bbr_enter_probe_bw(bbr, now);
+			else {
+				bbr->state = BBR_STARTUP;
+				bbr->pacing_gain = BBR_HIGH_GAIN;
+				bbr->cwnd_gain = BBR_HIGH_GAIN;
+			}
+		}
+		break;
+	}
+
+	/*
+	 * Drain the queue to measure the propagation delay if it has not
+	 * been seen for a while.
+	 */
+	if (rtt_expired && bbr->state != BBR_PROBE_RTT) {
+		bbr->prior_cwnd = CCV(ccv, snd_cwnd);
+		bbr->state = BBR_PROBE_RTT;
+		bbr->pacing_gain = BBR_UNIT;
+		bbr->probe_rtt_done = 0;
+	}
+
+	bbr_set_pacing_rate(ccv, bbr);
+}
+
+static void
+bbr_ack_received(struct cc_var *ccv, uint16_t type)
+{
+	struct bbr *bbr;
+	u_long cw, target;
+
+	bbr = ccv->cc_data;
+
+	/* The stack manages cwnd while recovering, see bbr_cong_signal(). */
+	if (type != CC_ACK || IN_RECOVERY(CCV(ccv, t_flags)))
+		return;
+
+	cw = CCV(ccv, snd_cwnd);
+	target = bbr_target_cwnd(ccv, bbr);
+
+	if (bbr->state == BBR_PROBE_RTT)
+		cw = ulmin(cw, BBR_MIN_CWND_SEGS * CCV(ccv, t_maxseg));
+	else if (bbr->filled_pipe)
+		cw = ulmin(cw + ccv->bytes_this_ack, target);
+	else if (target == 0 || cw < target)
+		cw += ccv->bytes_this_ack;
+
+	cw = ulmax(cw, BBR_MIN_CWND_SEGS * CCV(ccv, t_maxseg));
+	CCV(ccv, snd_cwnd) = ulmin(cw, TCP_MAXWIN << CCV(ccv, snd_scale));
+}
+
+/*
+ * Restart from idle at the estimated bottleneck rate rather than at the
+ * probing gain; cwnd is left alone as the model is still valid.
+ */
+static void
+bbr_after_idle(struct cc_var *ccv)
+{
+	struct bbr *bbr;
+
+	bbr = ccv->cc_data;
+	if (bbr->state == BBR_PROBE_BW) {
+		bbr->pacing_gain = BBR_UNIT;
+		bbr_set_pacing_rate(ccv, bbr);
+	}
+}
+
+static void
+bbr_cb_destroy(struct cc_var *ccv)
+{
+
+	if (ccv->cc_data != NULL)
+		free(ccv->cc_data, M_BBR);
+	CCV(ccv, t_pacing_rate) = 0;
+}
+
+static int
+bbr_cb_init(struct cc_var *ccv)
+{
+	struct bbr *bbr;
+
+	bbr = malloc(sizeof(struct bbr), M_BBR, M_NOWAIT|M_ZERO);
+	if (bbr == NULL)
+		return (ENOMEM);
+
+	bbr->state = BBR_STARTUP;
+	bbr->pacing_gain = BBR_HIGH_GAIN;
+	bbr->cwnd_gain = BBR_HIGH_GAIN;
+	bbr->min_rtt_us = UINT64_MAX;
+	bbr->min_rtt_ticks = ticks;
+	bbr->next_round_delivered = CCV(ccv, t_delivered);
+	ccv->cc_data = bbr;
+
+	return (0);
+}
+
+/*
+ * Loss is not treated as a congestion signal beyond keeping inflight near
+ * the model during recovery, which is what prevents the collapse loss-based
+ * algorithms suffer on shallow-buffered paths.
+ */
+static void
+bbr_cong_signal(struct cc_var *ccv, uint32_t type)
+{
+	struct bbr *bbr;
+	u_long target;
+
+	bbr = ccv->cc_data;
+	target = bbr_target_cwnd(ccv, bbr);
+
+	switch (type) {
+	case CC_NDUPACK:
+		if (!IN_FASTRECOVERY(CCV(ccv, t_flags))) {
+			bbr->prior_cwnd = CCV(ccv, snd_cwnd);
+			if (target == 0)
+				target = ulmax(CCV(ccv, snd_cwnd) / 2,
+				    BBR_MIN_CWND_SEGS * CCV(ccv, t_maxseg));
+			CCV(ccv, snd_ssthresh) = target;
+			ENTER_RECOVERY(CCV(ccv, t_flags));
+		}
+		break;
+	case CC_RTO:
+		bbr->prior_cwnd = ulmax(bbr->prior_cwnd, CCV(ccv, snd_cwnd));
+		break;
+	}
+}
+
+static void
+bbr_conn_init(struct cc_var *ccv)
+{
+	struct bbr *bbr;
+	uint64_t srtt_us;
+
+	bbr = ccv->cc_data;
+
+	/* Seed the pacing rate from the handshake RTT, if there is one. */
+	srtt_us = (uint64_t)(CCV(ccv, t_srtt) >> TCP_RTT_SHIFT) * tick;
+	if (srtt_us > 0)
+		CCV(ccv, t_pacing_rate) = ((uint64_t)CCV(ccv, snd_cwnd) *
+		    1000000 / srtt_us * bbr->pacing_gain) >> BBR_SCALE;
+}
+
+static void
+bbr_post_recovery(struct cc_var *ccv)
+{
+	struct bbr *bbr;
+
+	bbr = ccv->cc_data;
+	if (IN_FASTRECOVERY(CCV(ccv, t_flags)))
+		CCV(ccv, snd_cwnd) = ulmax(CCV(ccv, snd_ssthresh),
+		    bbr->prior_cwnd);
+}
+
+SYSCTL_DECL(_net_inet_tcp_cc_bbr);
+SYSCTL_NODE(_net_inet_tcp_cc, OID_AUTO, bbr, CTLFLAG_RW, NULL,
+    "BBR related settings");
+
+SYSCTL_VNET_UINT(_net_inet_tcp_cc_bbr, OID_AUTO, probe_rtt_interval,
+    CTLFLAG_RW, &VNET_NAME(bbr_probe_rtt_interval), 10000,
+    "Milliseconds without a new min RTT before draining to probe for one");
+
+SYSCTL_VNET_UINT(_net_inet_tcp_cc_bbr, OID_AUTO, probe_rtt_time,
+    CTLFLAG_RW, &VNET_NAME(bbr_probe_rtt_time), 200,
+    "Milliseconds spent at minimum cwnd when probing for min RTT");
+
+DECLARE_CC_MODULE(bbr, &bbr_cc_algo);
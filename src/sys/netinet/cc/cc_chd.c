@@ -77,7 +77,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/cc/cc_chd.c 220592 2011-04-13 11:2
 
 #include <netinet/khelp/h_ertt.h>
 
-#define	CAST_PTR_INT(X)	(*((int*)(X)))
+#define	CAST_PTR_INT(X)	(*((const int *)(X)))
 
 /*
  * Private signal type for rate based congestion signal.
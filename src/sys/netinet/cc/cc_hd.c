@@ -78,7 +78,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/cc/cc_hd.c 220560 2011-04-12 08:13
 
 #include <netinet/khelp/h_ertt.h>
 
-#define	CAST_PTR_INT(X)	(*((int*)(X)))
+#define	CAST_PTR_INT(X)	(*((const int *)(X)))
 
 /* Largest possible number returned by random(). */
 #define	RANDOM_MAX	INT_MAX
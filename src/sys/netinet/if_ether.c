@@ -42,6 +42,8 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/if_ether.c 233265 2012-03-21 07:22
 
 #include <sys/param.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
 #include <sys/queue.h>
 #include <sys/sysctl.h>
 #include <sys/systm.h>
@@ -51,6 +53,8 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/if_ether.c 233265 2012-03-21 07:22
 #include <sys/socket.h>
 #include <sys/syslog.h>
 
+#include <machine/atomic.h>
+
 #include <net/if.h>
 #include <net/if_dl.h>
 #include <net/if_types.h>
@@ -94,6 +98,9 @@ static VNET_DEFINE(int, arpt_down) = 20;      /* keep incomplete entries for
 VNET_DEFINE(struct arpstat, arpstat);  /* ARP statistics, see if_arp.h */
 
 static VNET_DEFINE(int, arp_maxhold) = 1;
+static VNET_DEFINE(int, arpt_refresh) = 60;	/* start refreshing a used
+						 * entry 60 seconds before
+						 * it expires */
 
 #define	V_arpt_keep		VNET(arpt_keep)
 #define	V_arpt_down		VNET(arpt_down)
@@ -101,6 +108,7 @@ static VNET_DEFINE(int, arp_maxhold) = 1;
 #define	V_arp_proxyall		VNET(arp_proxyall)
 #define	V_arpstat		VNET(arpstat)
 #define	V_arp_maxhold		VNET(arp_maxhold)
+#define	V_arpt_refresh		VNET(arpt_refresh)
 
 SYSCTL_VNET_INT(_net_link_ether_inet, OID_AUTO, max_age, CTLFLAG_RW,
 	&VNET_NAME(arpt_keep), 0,
@@ -123,6 +131,9 @@ SYSCTL_VNET_STRUCT(_net_link_ether_arp, OID_AUTO, stats, CTLFLAG_RW,
 SYSCTL_VNET_INT(_net_link_ether_inet, OID_AUTO, maxhold, CTLFLAG_RW,
 	&VNET_NAME(arp_maxhold), 0, 
 	"Number of packets to hold per ARP entry");
+SYSCTL_VNET_INT(_net_link_ether_inet, OID_AUTO, refresh, CTLFLAG_RW,
+	&VNET_NAME(arpt_refresh), 0,
+	"Seconds before expiry to start refreshing an entry in use, 0 to disable");
 
 static void	arp_init(void);
 void		arprequest(struct ifnet *,
@@ -140,6 +151,183 @@ static const struct netisr_handler arp_nh = {
 	.nh_policy = NETISR_POLICY_SOURCE,
 };
 
+/*
+ * Resolved entries are also published in a small direct-mapped cache per
+ * interface, which arpresolve() reads without taking any lock or doing
+ * any atomic operation.  Each slot carries a sequence number that is odd
+ * while the slot is being rewritten; a reader that sees it odd or changed
+ * falls back to the llentry table.  Slots are stored inline, so there is
+ * nothing to reclaim when an entry goes away.  Writers serialize on
+ * ac_mtx and always hold the llentry lock of the entry they publish or
+ * withdraw.
+ */
+#define	ARPC_BITS	8
+#define	ARPC_SIZE	(1 << ARPC_BITS)
+
+struct arpc_slot {
+	volatile u_int	as_seq;
+	in_addr_t	as_addr;
+	time_t		as_expire;
+	u_char		as_lladdr[ETHER_ADDR_LEN];
+	u_char		as_used;	/* hit since last published */
+};
+
+struct arp_cache {
+	struct mtx	ac_mtx;
+	struct arpc_slot ac_slot[ARPC_SIZE];
+};
+
+#define	ARPC_SLOT(ac, a)	\
+	(&(ac)->ac_slot[(ntohl(a) * 2654435761U) >> (32 - ARPC_BITS)])
+
+struct arp_cache *
+arp_cache_alloc(struct ifnet *ifp)
+{
+	struct arp_cache *ac;
+
+	if (ifp->if_addrlen == 0 || ifp->if_addrlen > ETHER_ADDR_LEN)
+		return (NULL);
+	ac = malloc(sizeof(*ac), M_LLTABLE, M_WAITOK | M_ZERO);
+	mtx_init(&ac->ac_mtx, "arp cache", NULL, MTX_DEF);
+	return (ac);
+}
+
+void
+arp_cache_free(struct arp_cache *ac)
+{
+
+	if (ac == NULL)
+		return;
+	mtx_destroy(&ac->ac_mtx);
+	free(ac, M_LLTABLE);
+}
+
+static __inline int
+arp_cache_lookup(struct arp_cache *ac, struct ifnet *ifp, in_addr_t addr,
+    u_char *desten)
+{
+	struct arpc_slot *as = ARPC_SLOT(ac, addr);
+	u_int seq;
+
+	seq = as->as_seq;
+	rmb();
+	if ((seq & 1) || as->as_addr != addr ||
+	    as->as_expire <= time_uptime)
+		return (0);
+	bcopy(as->as_lladdr, desten, ifp->if_addrlen);
+	rmb();
+	if (as->as_seq != seq)
+		return (0);
+	if (as->as_used == 0)
+		as->as_used = 1;
+	return (1);
+}
+
+static void
+arp_cache_write(struct arp_cache *ac, struct arpc_slot *as, in_addr_t addr,
+    time_t expire, const void *lladdr, int len, int used)
+{
+
+	mtx_lock(&ac->ac_mtx);
+	as->as_seq++;
+	wmb();
+	as->as_addr = addr;
+	as->as_expire = expire;
+	if (lladdr != NULL)
+		bcopy(lladdr, as->as_lladdr, len);
+	as->as_used = used;
+	wmb();
+	as->as_seq++;
+	mtx_unlock(&ac->ac_mtx);
+}
+
+/*
+ * Publish a resolved entry.  Static entries are republished every
+ * arpt_keep seconds, the first time arpresolve() sees them after that.
+ */
+static void
+arp_cache_publish(struct ifnet *ifp, struct llentry *la, int used)
+{
+	struct arp_cache *ac = ARPCACHE(ifp);
+	struct arpc_slot *as;
+	in_addr_t addr;
+	time_t expire;
+
+	if (ac == NULL || (la->la_flags & (LLE_VALID | LLE_IFADDR)) != LLE_VALID)
+		return;
+	addr = SIN(L3_ADDR(la))->sin_addr.s_addr;
+	as = ARPC_SLOT(ac, addr);
+	expire = (la->la_flags & LLE_STATIC) ? time_uptime + V_arpt_keep :
+	    la->la_expire;
+	/* Keep a hit that arp_entry_used() has not collected yet. */
+	if (as->as_addr == addr && as->as_used)
+		used = 1;
+	arp_cache_write(ac, as, addr, expire, &la->ll_addr, ifp->if_addrlen,
+	    used);
+}
+
+/*
+ * Publish from the arpresolve() slow path.  A live slot that holds
+ * another address is left alone, so that two destinations hashing to
+ * the same slot do not evict each other on every miss.
+ */
+static void
+arp_cache_refill(struct ifnet *ifp, struct llentry *la)
+{
+	struct arp_cache *ac = ARPCACHE(ifp);
+	struct arpc_slot *as;
+	in_addr_t addr;
+
+	if (ac == NULL)
+		return;
+	addr = SIN(L3_ADDR(la))->sin_addr.s_addr;
+	as = ARPC_SLOT(ac, addr);
+	if (as->as_addr != addr && as->as_expire > time_uptime)
+		return;
+	arp_cache_publish(ifp, la, 1);
+}
+
+void
+arp_cache_purge(struct ifnet *ifp, struct llentry *la)
+{
+	struct arp_cache *ac = ARPCACHE(ifp);
+	struct arpc_slot *as;
+	in_addr_t addr;
+
+	if (ac == NULL)
+		return;
+	addr = SIN(L3_ADDR(la))->sin_addr.s_addr;
+	as = ARPC_SLOT(ac, addr);
+	if (as->as_addr == addr)
+		arp_cache_write(ac, as, addr, 0, NULL, 0, 0);
+}
+
+/*
+ * Report whether the entry has been used since the last check, either
+ * from the cache or through an llentry reference held by the caller
+ * (flowtable, inpcb route cache), and start over.
+ */
+static int
+arp_entry_used(struct ifnet *ifp, struct llentry *la)
+{
+	struct arp_cache *ac = ARPCACHE(ifp);
+	struct arpc_slot *as;
+	in_addr_t addr;
+	int used;
+
+	used = la->la_used;
+	la->la_used = 0;
+	if (ac != NULL) {
+		addr = SIN(L3_ADDR(la))->sin_addr.s_addr;
+		as = ARPC_SLOT(ac, addr);
+		if (as->as_addr == addr && as->as_used) {
+			as->as_used = 0;
+			used = 1;
+		}
+	}
+	return (used);
+}
+
 #ifdef AF_INET
 void arp_ifscrub(struct ifnet *ifp, uint32_t addr);
 
@@ -171,7 +359,9 @@ arptimer(void *arg)
 {
 	struct ifnet *ifp;
 	struct llentry   *lle;
-	int pkts_dropped;
+	struct in_addr dst;
+	int pkts_dropped, refresh;
+	time_t left;
 
 	KASSERT(arg != NULL, ("%s: arg NULL", __func__));
 	lle = (struct llentry *)arg;
@@ -179,12 +369,35 @@ arptimer(void *arg)
 	CURVNET_SET(ifp->if_vnet);
 	IF_AFDATA_LOCK(ifp);
 	LLE_WLOCK(lle);
+	refresh = 0;
 	if (lle->la_flags & LLE_STATIC)
 		LLE_WUNLOCK(lle);
 	else {
 		if (!vnet_callout_pending(&lle->la_timer) &&
+		    vnet_callout_active(&lle->la_timer) &&
+		    (lle->la_flags & LLE_VALID) &&
+		    (left = lle->la_expire - time_uptime) > 0) {
+			/*
+			 * In the refresh window of a resolved entry.  Probe
+			 * it in the background while it is in use, so the
+			 * data path never sees it expire, otherwise let it
+			 * lapse.  The callout keeps its reference.
+			 */
+			if (lle->la_asked < V_arp_maxtries &&
+			    (lle->la_asked > 0 || arp_entry_used(ifp, lle))) {
+				refresh = 1;
+				lle->la_asked++;
+				left = lmin(left,
+				    lmax(1, V_arpt_refresh / V_arp_maxtries));
+			}
+			vnet_callout_reset(&lle->la_timer, hz * left,
+			    arptimer, lle);
+			dst = SIN(L3_ADDR(lle))->sin_addr;
+			LLE_WUNLOCK(lle);
+		} else if (!vnet_callout_pending(&lle->la_timer) &&
 		    vnet_callout_active(&lle->la_timer)) {
 			vnet_callout_stop(&lle->la_timer);
+			arp_cache_purge(ifp, lle);
 			LLE_REMREF(lle);
 			pkts_dropped = llentry_free(lle);
 			ARPSTAT_ADD(dropped, pkts_dropped);
@@ -201,6 +414,8 @@ arptimer(void *arg)
 		}
 	}
 	IF_AFDATA_UNLOCK(ifp);
+	if (refresh)
+		arprequest(ifp, NULL, &dst, IF_LLADDR(ifp));
 	CURVNET_RESTORE();
 }
 
@@ -304,6 +519,10 @@ arpresolve(struct ifnet *ifp, struct rtentry *rt0, struct mbuf *m,
 			return (0);
 		}
 	}
+	if (ARPCACHE(ifp) != NULL &&
+	    arp_cache_lookup(ARPCACHE(ifp), ifp, SIN(dst)->sin_addr.s_addr,
+	    desten))
+		return (0);
 retry:
 	IF_AFDATA_RLOCK(ifp);	
 	la = lla_lookup(LLTABLE(ifp), flags, dst);
@@ -327,19 +546,9 @@ retry:
 	if ((la->la_flags & LLE_VALID) &&
 	    ((la->la_flags & LLE_STATIC) || la->la_expire > time_uptime)) {
 		bcopy(&la->ll_addr, desten, ifp->if_addrlen);
-		/*
-		 * If entry has an expiry time and it is approaching,
-		 * see if we need to send an ARP request within this
-		 * arpt_down interval.
-		 */
-		if (!(la->la_flags & LLE_STATIC) &&
-		    time_uptime + la->la_preempt > la->la_expire) {
-			arprequest(ifp, NULL,
-			    &SIN(dst)->sin_addr, IF_LLADDR(ifp));
-
-			la->la_preempt--;
-		}
-		
+		/* arptimer() takes care of refreshing it before it expires. */
+		la->la_used = 1;
+		arp_cache_refill(ifp, la);
 		*lle = la;
 		error = 0;
 		goto done;
@@ -739,17 +948,20 @@ match:
 		EVENTHANDLER_INVOKE(arp_update_event, la);
 
 		if (!(la->la_flags & LLE_STATIC)) {
-			int canceled;
+			int canceled, delay;
 
+			delay = V_arpt_keep;
+			if (V_arpt_refresh > 0 && V_arpt_refresh < delay)
+				delay -= V_arpt_refresh;
 			LLE_ADDREF(la);
 			la->la_expire = time_uptime + V_arpt_keep;
 			canceled = vnet_callout_reset(&la->la_timer,
-			    hz * V_arpt_keep, arptimer, la);
+			    hz * delay, arptimer, la);
 			if (canceled)
 				LLE_REMREF(la);
 		}
 		la->la_asked = 0;
-		la->la_preempt = V_arp_maxtries;
+		arp_cache_publish(ifp, la, 0);
 		/* 
 		 * The packets are all freed within the call to the output
 		 * routine.
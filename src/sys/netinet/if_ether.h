@@ -111,12 +111,16 @@ extern u_char	ether_ipmulticast_max[ETHER_ADDR_LEN];
 
 struct llentry;
 struct ifaddr;
+struct arp_cache;
 
 int	arpresolve(struct ifnet *ifp, struct rtentry *rt,
 		    struct mbuf *m, struct sockaddr *dst, u_char *desten,
 		    struct llentry **lle);
 void	arp_ifinit(struct ifnet *, struct ifaddr *);
 void	arp_ifinit2(struct ifnet *, struct ifaddr *, u_char *);
+struct arp_cache *arp_cache_alloc(struct ifnet *);
+void	arp_cache_free(struct arp_cache *);
+void	arp_cache_purge(struct ifnet *, struct llentry *);
 
 #include <sys/eventhandler.h>
 typedef void (*llevent_arp_update_fn)(void *, struct llentry *);
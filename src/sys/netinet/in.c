@@ -1389,6 +1389,7 @@ in_lltable_prefix_free(struct lltable *llt,
 				LLE_WLOCK(lle);
 				if (canceled)
 					LLE_REMREF(lle);
+				arp_cache_purge(llt->llt_ifp, lle);
 				pkts_dropped = llentry_free(lle);
 				ARPSTAT_ADD(dropped, pkts_dropped);
 			}
@@ -1530,6 +1531,7 @@ in_lltable_lookup(struct lltable *llt, u_int flags, const struct sockaddr *l3add
 	} else if (flags & LLE_DELETE) {
 		if (!(lle->la_flags & LLE_IFADDR) || (flags & LLE_IFADDR)) {
 			LLE_WLOCK(lle);
+			arp_cache_purge(ifp, lle);
 			lle->la_flags = LLE_DELETED;
 			EVENTHANDLER_INVOKE(arp_update_event, lle);
 			LLE_WUNLOCK(lle);
@@ -1545,6 +1547,13 @@ in_lltable_lookup(struct lltable *llt, u_int flags, const struct sockaddr *l3add
 			LLE_WLOCK(lle);
 		else
 			LLE_RLOCK(lle);
+		/*
+		 * The caller may be about to rewrite an existing entry;
+		 * withdraw it from the lockless cache while we hold it.
+		 */
+		if ((flags & (LLE_CREATE | LLE_EXCLUSIVE)) ==
+		    (LLE_CREATE | LLE_EXCLUSIVE))
+			arp_cache_purge(ifp, lle);
 	}
 done:
 	return (lle);
@@ -1645,6 +1654,7 @@ in_domifattach(struct ifnet *ifp)
 		llt->llt_dump = in_lltable_dump;
 	}
 	ii->ii_llt = llt;
+	ii->ii_arpc = arp_cache_alloc(ifp);
 
 	ii->ii_igmp = igmp_domifattach(ifp);
 
@@ -1658,5 +1668,6 @@ in_domifdetach(struct ifnet *ifp, void *aux)
 
 	igmp_domifdetach(ifp);
 	lltable_free(ii->ii_llt);
+	arp_cache_free(ii->ii_arpc);
 	free(ii, M_IFADDR);
 }
@@ -0,0 +1,51 @@
+/*-
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _NETINET_IN_LPM_H_
+#define	_NETINET_IN_LPM_H_
+
+/*
+ * DIR-24-8 mirror of an AF_INET radix table.  The radix tree remains the
+ * routing information base; in_rmx.c replays every insertion and removal
+ * into the mirror, which then answers forwarding lookups in at most two
+ * memory accesses.  All entry points are called with the radix head
+ * locked, write-locked for the ones that modify the table.
+ */
+
+#ifdef _KERNEL
+struct radix_node_head;
+struct radix_node;
+struct rtentry;
+struct sockaddr_in;
+struct in_addr;
+
+void	in_lpm_addroute(struct radix_node_head *, struct rtentry *);
+void	in_lpm_delroute(struct radix_node_head *, struct rtentry *);
+void	in_lpm_detach(struct radix_node_head *);
+struct radix_node *
+	in_lpm_match(struct radix_node_head *, struct sockaddr_in *);
+int	in_lpm_match_bulk(struct radix_node_head *, const struct in_addr *,
+	    struct rtentry **, int);
+#endif
+
+#endif /* !_NETINET_IN_LPM_H_ */
@@ -45,6 +45,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/in_pcb.c 237910 2012-07-01 08:47:1
 #include "opt_pcbgroup.h"
 #include "opt_passiveinet.h"
 #include "opt_promiscinet.h"
+#include "opt_route.h"
 
 #include <sys/param.h>
 #include <sys/systm.h>
@@ -72,6 +73,9 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/in_pcb.c 237910 2012-07-01 08:47:1
 #include <net/if_types.h>
 #include <net/route.h>
 #include <net/vnet.h>
+#ifdef FLOWTABLE
+#include <net/flowtable.h>
+#endif
 
 #ifdef PROMISCUOUS_INET
 #include <net/if_promiscinet.h>
@@ -233,6 +237,91 @@ SYSCTL_VNET_INT(_net_inet_ip_portrange, OID_AUTO, randomtime, CTLFLAG_RW,
  * functions often modify hash chains or addresses in pcbs.
  */
 
+/*
+ * Return the pcbinfo lock partition used by the calling thread.  Threads
+ * are assigned partitions round-robin on first use, so that a thread always
+ * uses the same partition and concurrently running threads rarely share one.
+ */
+u_int
+in_pcbinfo_part(void)
+{
+#ifdef UINET
+	static volatile u_int next_part;
+	struct thread *td = curthread;
+
+	if (__predict_false(td->td_pcbinfo_part == 0))
+		td->td_pcbinfo_part =
+		    atomic_fetchadd_int(&next_part, 1) % INP_INFO_NPARTS + 1;
+	return (td->td_pcbinfo_part - 1);
+#else
+	return (((uintptr_t)curthread / sizeof(struct thread)) %
+	    INP_INFO_NPARTS);
+#endif
+}
+
+void
+in_pcbinfo_lock_init(struct inpcbinfo *pcbinfo, const char *name)
+{
+	int i;
+
+	for (i = 0; i < INP_INFO_NPARTS; i++)
+		VNET_RWLOCK_INIT(&pcbinfo->ipi_lock[i].ipp_lock, name,
+		    RW_RECURSE | RW_DUPOK);
+}
+
+void
+in_pcbinfo_lock_destroy(struct inpcbinfo *pcbinfo)
+{
+	int i;
+
+	for (i = 0; i < INP_INFO_NPARTS; i++)
+		VNET_RWLOCK_DESTROY(&pcbinfo->ipi_lock[i].ipp_lock);
+}
+
+void
+in_pcbinfo_wlock(struct inpcbinfo *pcbinfo)
+{
+	int i;
+
+	for (i = 0; i < INP_INFO_NPARTS; i++)
+		VNET_RWLOCK_WLOCK(&pcbinfo->ipi_lock[i].ipp_lock);
+}
+
+int
+in_pcbinfo_try_wlock(struct inpcbinfo *pcbinfo)
+{
+	int i;
+
+	for (i = 0; i < INP_INFO_NPARTS; i++)
+		if (!VNET_RWLOCK_TRY_WLOCK(&pcbinfo->ipi_lock[i].ipp_lock))
+			break;
+	if (i == INP_INFO_NPARTS)
+		return (1);
+	while (i-- > 0)
+		VNET_RWLOCK_WUNLOCK(&pcbinfo->ipi_lock[i].ipp_lock);
+	return (0);
+}
+
+void
+in_pcbinfo_wunlock(struct inpcbinfo *pcbinfo)
+{
+	int i;
+
+	for (i = INP_INFO_NPARTS - 1; i >= 0; i--)
+		VNET_RWLOCK_WUNLOCK(&pcbinfo->ipi_lock[i].ipp_lock);
+}
+
+#ifdef INVARIANTS
+void
+in_pcbinfo_wlock_assert(struct inpcbinfo *pcbinfo)
+{
+	int i;
+
+	for (i = 0; i < INP_INFO_NPARTS; i++)
+		VNET_RWLOCK_ASSERT(&pcbinfo->ipi_lock[i].ipp_lock, RA_WLOCKED);
+}
+#endif
+
 /*
  * Initialize an inpcbinfo -- we should be able to reduce the number of
  * arguments in time.
@@ -245,6 +334,7 @@ in_pcbinfo_init(struct inpcbinfo *pcbinfo, const char *name,
 {
 
 	INP_INFO_LOCK_INIT(pcbinfo, name);
+	INP_LIST_LOCK_INIT(pcbinfo, "pcbinfolist");
 	INP_HASH_LOCK_INIT(pcbinfo, "pcbinfohash");	/* XXXRW: argument? */
 #ifdef VIMAGE
 	pcbinfo->ipi_vnet = curvnet;
@@ -283,6 +373,7 @@ in_pcbinfo_destroy(struct inpcbinfo *pcbinfo)
 #endif
 	uma_zdestroy(pcbinfo->ipi_zone);
 	INP_HASH_LOCK_DESTROY(pcbinfo);
+	INP_LIST_LOCK_DESTROY(pcbinfo);
 	INP_INFO_LOCK_DESTROY(pcbinfo);
 }
 
@@ -340,12 +431,14 @@ in_pcballoc(struct socket *so, struct inpcbinfo *pcbinfo)
 	struct inpcb *inp;
 	int error;
 
-	INP_INFO_WLOCK_ASSERT(pcbinfo);
+	INP_INFO_LOCK_ASSERT(pcbinfo);
 	error = 0;
 	inp = uma_zalloc(pcbinfo->ipi_zone, M_NOWAIT);
 	if (inp == NULL)
 		return (ENOBUFS);
 	bzero(inp, inp_zero_size);
+	inp->inp_lle = NULL;
+	inp->inp_rt = NULL;
 	inp->inp_pcbinfo = pcbinfo;
 	inp->inp_socket = so;
 	inp->inp_cred = crhold(so->so_cred);
@@ -393,15 +486,17 @@ in_pcballoc(struct socket *so, struct inpcbinfo *pcbinfo)
 			inp->inp_flags |= IN6P_IPV6_V6ONLY;
 	}
 #endif
-	LIST_INSERT_HEAD(pcbinfo->ipi_listhead, inp, inp_list);
-	pcbinfo->ipi_count++;
 	so->so_pcb = (caddr_t)inp;
 #ifdef INET6
 	if (V_ip6_auto_flowlabel)
 		inp->inp_flags |= IN6P_AUTOFLOWLABEL;
 #endif
 	INP_WLOCK(inp);
+	INP_LIST_LOCK(pcbinfo);
+	LIST_INSERT_HEAD(pcbinfo->ipi_listhead, inp, inp_list);
+	pcbinfo->ipi_count++;
 	inp->inp_gencnt = ++pcbinfo->ipi_gencnt;
+	INP_LIST_UNLOCK(pcbinfo);
 	refcount_init(&inp->inp_refcount, 1);	/* Reference from inpcbinfo */
 #if 1
 out:
@@ -655,7 +750,6 @@ in_pcbbind_setup(struct inpcb *inp, struct sockaddr *nam, in_addr_t *laddrp,
 		laddr = sin->sin_addr;
 		if (lport) {
 			struct inpcb *t;
-			struct tcptw *tw;
 
 			/* GROSS */
 			if (ntohs(lport) <= V_ipport_reservedhigh &&
@@ -685,18 +779,7 @@ in_pcbbind_setup(struct inpcb *inp, struct sockaddr *nam, in_addr_t *laddrp,
 			}
 			t = in_pcblookup_local(pcbinfo, sin->sin_addr,
 			    lport, lookupflags, cred);
-			if (t && (t->inp_flags & INP_TIMEWAIT)) {
-				/*
-				 * XXXRW: If an incpb has had its timewait
-				 * state recycled, we treat the address as
-				 * being in use (for now).  This is better
-				 * than a panic, but not desirable.
-				 */
-				tw = intotw(t);
-				if (tw == NULL ||
-				    (reuseport & tw->tw_so_options) == 0)
-					return (EADDRINUSE);
-			} else if (t && (reuseport == 0 ||
+			if (t && (reuseport == 0 ||
 			    (t->inp_flags2 & INP_REUSEPORT) == 0)) {
 #ifdef INET6
 				if (ntohl(sin->sin_addr.s_addr) !=
@@ -1119,15 +1202,6 @@ in_pcbconnect_setup(struct inpcb *inp, struct sockaddr *nam,
 	if (inp->inp_flags2 & INP_PROMISC) {
 		oinp = in_pcblookup_hash_promisc_locked(inp->inp_pcbinfo, faddr, fport,
 		    laddr, lport, 0, NULL, NULL, inp);
-		if ((inp->inp_flags2 & INP_REUSEPORT) && (oinp != NULL) &&
-		    (oinp->inp_flags & INP_TIMEWAIT) && (oinp->inp_flags2 & INP_REUSEPORT)) {
-			struct tcptw *tw;
-
-			tw = intotw(oinp);
-			if (tw != NULL)
-				tcp_twclose(tw, 0);
-			oinp = NULL;
-		}
 	} else
 		oinp = in_pcblookup_hash_locked(inp->inp_pcbinfo, faddr, fport,
 		    laddr, lport, 0, NULL);
@@ -1272,6 +1346,50 @@ in_pcbrele(struct inpcb *inp)
 	return (in_pcbrele_wlocked(inp));
 }
 
+/*
+ * Reference every inpcb on the global list bound to local port lport, so
+ * that a caller without the pcbinfo lock can visit them all, as multicast
+ * and broadcast delivery must.  The list is walked under ipi_list_lock
+ * alone; inpcb locks order before it, so the caller locks each returned
+ * inpcb afterwards, rechecks its bindings and INP_FREED, and drops the
+ * reference with in_pcbrele_rlocked().
+ *
+ * The caller passes an array of *np entries, which is grown from M_TEMP if
+ * more inpcbs match; the caller frees the returned array if it differs
+ * from the one passed in.  If the allocation fails, only the inpcbs found
+ * so far are returned.  On return *np holds the number referenced.
+ */
+struct inpcb **
+in_pcbref_lport(struct inpcbinfo *pcbinfo, u_short lport,
+    struct inpcb **inp_list, int *np)
+{
+	struct inpcb **big, *inp;
+	int i, n;
+
+	n = *np;
+	i = 0;
+	INP_LIST_LOCK(pcbinfo);
+	LIST_FOREACH(inp, pcbinfo->ipi_listhead, inp_list) {
+		if (inp->inp_lport != lport)
+			continue;
+		if (i == n) {
+			/* ipi_count bounds the matches while the lock is held. */
+			big = malloc(pcbinfo->ipi_count * sizeof(*big), M_TEMP,
+			    M_NOWAIT);
+			if (big == NULL)
+				break;
+			bcopy(inp_list, big, n * sizeof(*big));
+			inp_list = big;
+			n = pcbinfo->ipi_count;
+		}
+		in_pcbref(inp);
+		inp_list[i++] = inp;
+	}
+	INP_LIST_UNLOCK(pcbinfo);
+	*np = i;
+	return (inp_list);
+}
+
 /*
  * Unconditionally schedule an inpcb to be freed by decrementing its
  * reference count, which should occur only after the inpcb has been detached
@@ -1284,11 +1402,10 @@ in_pcbrele(struct inpcb *inp)
 void
 in_pcbfree(struct inpcb *inp)
 {
-	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
 
 	KASSERT(inp->inp_socket == NULL, ("%s: inp_socket != NULL", __func__));
 
-	INP_INFO_WLOCK_ASSERT(pcbinfo);
+	INP_INFO_LOCK_ASSERT(inp->inp_pcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
 	/* XXXRW: Do as much as possible here. */
@@ -1296,8 +1413,10 @@ in_pcbfree(struct inpcb *inp)
 	if (inp->inp_sp != NULL)
 		ipsec_delete_pcbpolicy(inp);
 #endif /* IPSEC */
-	inp->inp_gencnt = ++pcbinfo->ipi_gencnt;
 	in_pcbremlists(inp);
+#if defined(INET) && defined(FLOWTABLE)
+	flowtable_inpcb_free(inp);
+#endif
 #ifdef INET6
 	if (inp->inp_vflag & INP_IPV6PROTO) {
 		ip6_freepcbopts(inp->in6p_outputopts);
@@ -1312,6 +1431,7 @@ in_pcbfree(struct inpcb *inp)
 		inp_freemoptions(inp->inp_moptions);
 #endif
 	inp->inp_vflag = 0;
+	inp->inp_flags2 |= INP_FREED;
 	crfree(inp->inp_cred);
 #ifdef PROMISCUOUS_INET
 	in_promisc_inpcb_destroy(inp);
@@ -1468,7 +1588,7 @@ in_pcbpurgeif0(struct inpcbinfo *pcbinfo, struct ifnet *ifp)
 	struct ip_moptions *imo;
 	int i, gap;
 
-	INP_INFO_RLOCK(pcbinfo);
+	INP_INFO_WLOCK(pcbinfo);
 	LIST_FOREACH(inp, pcbinfo->ipi_listhead, inp_list) {
 		INP_WLOCK(inp);
 		imo = inp->inp_moptions;
@@ -1498,7 +1618,7 @@ in_pcbpurgeif0(struct inpcbinfo *pcbinfo, struct ifnet *ifp)
 		}
 		INP_WUNLOCK(inp);
 	}
-	INP_INFO_RUNLOCK(pcbinfo);
+	INP_INFO_WUNLOCK(pcbinfo);
 }
 
 /*
@@ -1626,20 +1746,30 @@ in_pcblookup_local(struct inpcbinfo *pcbinfo, struct in_addr laddr,
 
 #ifdef PCBGROUP
 /*
- * Lookup PCB in hash list, using pcbgroup tables.
+ * Lookup PCB in hash list, using pcbgroup tables.  Only exact matches are
+ * found here; see in_pcblookup_mbuf().
  */
 static struct inpcb *
 in_pcblookup_group(struct inpcbinfo *pcbinfo, struct inpcbgroup *pcbgroup,
     struct in_addr faddr, u_int fport_arg, struct in_addr laddr,
-    u_int lport_arg, int lookupflags, struct ifnet *ifp)
+    u_int lport_arg, int lookupflags, struct ifnet *ifp, struct mbuf *m)
 {
 	struct inpcbhead *head;
 	struct inpcb *inp, *tmpinp;
 	u_short fport = fport_arg, lport = lport_arg;
+#ifdef PROMISCUOUS_INET
+	struct ifl2info *l2i_tag;
+	struct in_l2info *l2i = NULL;
+
+	if (ifp != NULL && (ifp->if_flags & IFF_PROMISCINET)) {
+		l2i_tag = (struct ifl2info *)m_tag_locate(m, MTAG_PROMISCINET,
+		    MTAG_PROMISCINET_L2INFO, NULL);
+		if (l2i_tag == NULL)
+			return (NULL);
+		l2i = &l2i_tag->ifl2i_info;
+	}
+#endif
 
-	/*
-	 * First look for an exact match.
-	 */
 	tmpinp = NULL;
 	INP_GROUP_LOCK(pcbgroup);
 	head = &pcbgroup->ipg_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
@@ -1650,102 +1780,35 @@ in_pcblookup_group(struct inpcbinfo *pcbinfo, struct inpcbgroup *pcbgroup,
 		if ((inp->inp_vflag & INP_IPV4) == 0)
 			continue;
 #endif
-		if (inp->inp_faddr.s_addr == faddr.s_addr &&
-		    inp->inp_laddr.s_addr == laddr.s_addr &&
-		    inp->inp_fport == fport &&
-		    inp->inp_lport == lport) {
-			/*
-			 * XXX We should be able to directly return
-			 * the inp here, without any checks.
-			 * Well unless both bound with SO_REUSEPORT?
-			 */
+		if (inp->inp_faddr.s_addr != faddr.s_addr ||
+		    inp->inp_laddr.s_addr != laddr.s_addr ||
+		    inp->inp_fport != fport ||
+		    inp->inp_lport != lport)
+			continue;
+#ifdef PROMISCUOUS_INET
+		if (l2i != NULL) {
 			if (prison_flag(inp->inp_cred, PR_IP4))
+				continue;
+			if (in_promisc_tagcmp(&inp->inp_l2info->inl2i_tagstack,
+			    &l2i->inl2i_tagstack) == 0)
 				goto found;
-			if (tmpinp == NULL)
-				tmpinp = inp;
+			continue;
 		}
+#endif
+		/*
+		 * XXX We should be able to directly return
+		 * the inp here, without any checks.
+		 * Well unless both bound with SO_REUSEPORT?
+		 */
+		if (prison_flag(inp->inp_cred, PR_IP4))
+			goto found;
+		if (tmpinp == NULL)
+			tmpinp = inp;
 	}
 	if (tmpinp != NULL) {
 		inp = tmpinp;
 		goto found;
 	}
-
-	/*
-	 * Then look for a wildcard match, if requested.
-	 */
-	if ((lookupflags & INPLOOKUP_WILDCARD) != 0) {
-		struct inpcb *local_wild = NULL, *local_exact = NULL;
-#ifdef INET6
-		struct inpcb *local_wild_mapped = NULL;
-#endif
-		struct inpcb *jail_wild = NULL;
-		struct inpcbhead *head;
-		int injail;
-
-		/*
-		 * Order of socket selection - we always prefer jails.
-		 *      1. jailed, non-wild.
-		 *      2. jailed, wild.
-		 *      3. non-jailed, non-wild.
-		 *      4. non-jailed, wild.
-		 */
-		head = &pcbinfo->ipi_wildbase[INP_PCBHASH(INADDR_ANY, lport,
-		    0, pcbinfo->ipi_wildmask)];
-		LIST_FOREACH(inp, head, inp_pcbgroup_wild) {
-#ifdef INET6
-			/* XXX inp locking */
-			if ((inp->inp_vflag & INP_IPV4) == 0)
-				continue;
-#endif
-			if (inp->inp_faddr.s_addr != INADDR_ANY ||
-			    inp->inp_lport != lport)
-				continue;
-
-			/* XXX inp locking */
-			if (ifp && ifp->if_type == IFT_FAITH &&
-			    (inp->inp_flags & INP_FAITH) == 0)
-				continue;
-
-			injail = prison_flag(inp->inp_cred, PR_IP4);
-			if (injail) {
-				if (prison_check_ip4(inp->inp_cred,
-				    &laddr) != 0)
-					continue;
-			} else {
-				if (local_exact != NULL)
-					continue;
-			}
-
-			if (inp->inp_laddr.s_addr == laddr.s_addr) {
-				if (injail)
-					goto found;
-				else
-					local_exact = inp;
-			} else if (inp->inp_laddr.s_addr == INADDR_ANY) {
-#ifdef INET6
-				/* XXX inp locking, NULL check */
-				if (inp->inp_vflag & INP_IPV6PROTO)
-					local_wild_mapped = inp;
-				else
-#endif /* INET6 */
-					if (injail)
-						jail_wild = inp;
-					else
-						local_wild = inp;
-			}
-		} /* LIST_FOREACH */
-		inp = jail_wild;
-		if (inp == NULL)
-			inp = local_exact;
-		if (inp == NULL)
-			inp = local_wild;
-#ifdef INET6
-		if (inp == NULL)
-			inp = local_wild_mapped;
-#endif /* defined(INET6) */
-		if (inp != NULL)
-			goto found;
-	} /* if (lookupflags & INPLOOKUP_WILDCARD) */
 	INP_GROUP_UNLOCK(pcbgroup);
 	return (NULL);
 
@@ -2120,22 +2183,74 @@ in_pcblookup_hash_promisc_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr
 }
 #endif /* defined(PROMISCUOUS_INET) */
 
+/*
+ * Several datagram sockets bound to the same wildcard address and port
+ * with SO_REUSEPORT share its traffic by flow: the packet's RSS hash, or a
+ * hash of the source when it has none, picks one of them, so that every
+ * datagram of a flow reaches the same socket.  With n sockets, the one
+ * bound i-th gets the flows whose hash is i modulo n, which is the RX
+ * queue a NIC's default indirection table gives them when n is the number
+ * of queues.  Caller must hold the hash lock.
+ */
+static int
+in_pcb_reuseport_peer(struct inpcb *inp, struct inpcb *match)
+{
+
+	return (inp->inp_lport == match->inp_lport &&
+	    inp->inp_laddr.s_addr == match->inp_laddr.s_addr &&
+	    inp->inp_faddr.s_addr == INADDR_ANY &&
+	    (inp->inp_vflag & (INP_IPV4 | INP_IPV6PROTO)) ==
+	    (match->inp_vflag & (INP_IPV4 | INP_IPV6PROTO)) &&
+	    inp->inp_cred->cr_prison == match->inp_cred->cr_prison &&
+	    inp->inp_socket != NULL &&
+	    (inp->inp_socket->so_options & SO_REUSEPORT) &&
+	    inp->inp_socket->so_type == SOCK_DGRAM);
+}
+
+static struct inpcb *
+in_pcblookup_reuseport(struct inpcbinfo *pcbinfo, struct inpcb *match,
+    struct in_addr faddr, u_short fport, struct mbuf *m)
+{
+	struct inpcbhead *head;
+	struct inpcb *inp;
+	uint32_t hash;
+	u_int n, i;
+
+	INP_HASH_LOCK_ASSERT(pcbinfo);
+
+	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY,
+	    match->inp_lport, 0, pcbinfo->ipi_hashmask)];
+	n = 0;
+	LIST_FOREACH(inp, head, inp_hash)
+		if (in_pcb_reuseport_peer(inp, match))
+			n++;
+	if (n < 2)
+		return (match);
+
+	if (m != NULL && M_HASHTYPE_GET(m) != M_HASHTYPE_NONE)
+		hash = m->m_pkthdr.flowid;
+	else {
+		hash = ntohl(faddr.s_addr) ^ ntohs(fport);
+		hash ^= hash >> 16;
+	}
+
+	/* The hash chain lists the most recently bound socket first. */
+	i = n - 1 - hash % n;
+	LIST_FOREACH(inp, head, inp_hash)
+		if (in_pcb_reuseport_peer(inp, match) && i-- == 0)
+			return (inp);
+	return (match);
+}
+
 /*
  * Lookup PCB in hash list, using pcbinfo tables.  This variation locks the
  * hash list lock, and will return the inpcb locked (i.e., requires
  * INPLOOKUP_LOCKPCB).
  */
-#ifdef PROMISCUOUS_INET
 static struct inpcb *
 in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport, struct in_addr laddr, u_int lport, int lookupflags,
-		  struct ifnet *ifp, struct mbuf *m)
-#else
-static struct inpcb *
-in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
-    u_int fport, struct in_addr laddr, u_int lport, int lookupflags,
-    struct ifnet *ifp)
-#endif
+    struct ifnet *ifp, struct mbuf *m)
 {
 	struct inpcb *inp;
 
@@ -2151,6 +2266,11 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	inp = in_pcblookup_hash_locked(pcbinfo, faddr, fport, laddr, lport,
 	    (lookupflags & ~(INPLOOKUP_RLOCKPCB | INPLOOKUP_WLOCKPCB)), ifp);
 #endif
+	if (inp != NULL && inp->inp_faddr.s_addr == INADDR_ANY &&
+	    inp->inp_socket != NULL &&
+	    (inp->inp_socket->so_options & SO_REUSEPORT) &&
+	    inp->inp_socket->so_type == SOCK_DGRAM)
+		inp = in_pcblookup_reuseport(pcbinfo, inp, faddr, fport, m);
 	if (inp != NULL) {
 		in_pcbref(inp);
 		INP_HASH_RUNLOCK(pcbinfo);
@@ -2179,30 +2299,14 @@ struct inpcb *
 in_pcblookup(struct inpcbinfo *pcbinfo, struct in_addr faddr, u_int fport,
     struct in_addr laddr, u_int lport, int lookupflags, struct ifnet *ifp)
 {
-#if defined(PCBGROUP)
-	struct inpcbgroup *pcbgroup;
-#endif
 
 	KASSERT((lookupflags & ~INPLOOKUP_MASK) == 0,
 	    ("%s: invalid lookup flags %d", __func__, lookupflags));
 	KASSERT((lookupflags & (INPLOOKUP_RLOCKPCB | INPLOOKUP_WLOCKPCB)) != 0,
 	    ("%s: LOCKPCB not set", __func__));
 
-#if defined(PCBGROUP)
-	if (in_pcbgroup_enabled(pcbinfo)) {
-		pcbgroup = in_pcbgroup_bytuple(pcbinfo, laddr, lport, faddr,
-		    fport);
-		return (in_pcblookup_group(pcbinfo, pcbgroup, faddr, fport,
-		    laddr, lport, lookupflags, ifp));
-	}
-#endif
-#ifdef PROMISCUOUS_INET
-	return (in_pcblookup_hash(pcbinfo, faddr, fport, laddr, lport,
-				  lookupflags, ifp, NULL));
-#else
 	return (in_pcblookup_hash(pcbinfo, faddr, fport, laddr, lport,
-	    lookupflags, ifp));
-#endif
+	    lookupflags, ifp, NULL));
 }
 
 struct inpcb *
@@ -2212,6 +2316,7 @@ in_pcblookup_mbuf(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 {
 #ifdef PCBGROUP
 	struct inpcbgroup *pcbgroup;
+	struct inpcb *inp;
 #endif
 
 	KASSERT((lookupflags & ~INPLOOKUP_MASK) == 0,
@@ -2220,26 +2325,25 @@ in_pcblookup_mbuf(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	    ("%s: LOCKPCB not set", __func__));
 
 #ifdef PCBGROUP
+	/*
+	 * A connection homed by the packet's RSS hash is found under its
+	 * group's lock alone.  Anything else falls through to the global
+	 * table, which holds every inpcb.
+	 */
 	if (in_pcbgroup_enabled(pcbinfo)) {
 		pcbgroup = in_pcbgroup_byhash(pcbinfo, M_HASHTYPE_GET(m),
 		    m->m_pkthdr.flowid);
-		if (pcbgroup != NULL)
-			return (in_pcblookup_group(pcbinfo, pcbgroup, faddr,
-			    fport, laddr, lport, lookupflags, ifp));
-		pcbgroup = in_pcbgroup_bytuple(pcbinfo, laddr, lport, faddr,
-		    fport);
-		return (in_pcblookup_group(pcbinfo, pcbgroup, faddr, fport,
-		    laddr, lport, lookupflags, ifp));
+		if (pcbgroup != NULL) {
+			inp = in_pcblookup_group(pcbinfo, pcbgroup, faddr,
+			    fport, laddr, lport, lookupflags, ifp, m);
+			if (inp != NULL)
+				return (inp);
+		}
 	}
 #endif
-	
-#ifdef PROMISCUOUS_INET
-	return (in_pcblookup_hash(pcbinfo, faddr, fport, laddr, lport,
-				  lookupflags, ifp, m));
-#else
+
 	return (in_pcblookup_hash(pcbinfo, faddr, fport, laddr, lport,
-	    lookupflags, ifp));
-#endif /* PROMISCUOUS_INET */
+	    lookupflags, ifp, m));
 }
 #endif /* INET */
 
@@ -2421,6 +2525,37 @@ in_pcbrehash(struct inpcb *inp)
 	in_pcbrehash_mbuf(inp, NULL);
 }
 
+/*
+ * Remove PCB from the hash and port lists, undoing in_pcbinshash().  The
+ * PCB stays on the global list, so it can be bound again.
+ */
+void
+in_pcbremhash(struct inpcb *inp)
+{
+	struct inpcbport *phd = inp->inp_phd;
+
+	INP_WLOCK_ASSERT(inp);
+	INP_HASH_WLOCK_ASSERT(inp->inp_pcbinfo);
+	KASSERT(inp->inp_flags & INP_INHASHLIST,
+	    ("in_pcbremhash: !INP_INHASHLIST"));
+
+#ifdef PROMISCUOUS_INET
+	if (inp == inp->inp_pcbinfo->ipi_catchall_listen)
+		inp->inp_pcbinfo->ipi_catchall_listen = NULL;
+#endif
+
+	LIST_REMOVE(inp, inp_hash);
+	LIST_REMOVE(inp, inp_portlist);
+	if (LIST_FIRST(&phd->phd_pcblist) == NULL) {
+		LIST_REMOVE(phd, phd_hash);
+		free(phd, M_PCB);
+	}
+	inp->inp_flags &= ~INP_INHASHLIST;
+#ifdef PCBGROUP
+	in_pcbgroup_remove(inp);
+#endif
+}
+
 /*
  * Remove PCB from various lists.
  */
@@ -2429,31 +2564,19 @@ in_pcbremlists(struct inpcb *inp)
 {
 	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
 
-	INP_INFO_WLOCK_ASSERT(pcbinfo);
+	INP_INFO_LOCK_ASSERT(pcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
-	inp->inp_gencnt = ++pcbinfo->ipi_gencnt;
 	if (inp->inp_flags & INP_INHASHLIST) {
-		struct inpcbport *phd = inp->inp_phd;
-
 		INP_HASH_WLOCK(pcbinfo);
-
-#ifdef PROMISCUOUS_INET
-	if (inp == pcbinfo->ipi_catchall_listen)
-		pcbinfo->ipi_catchall_listen = NULL;
-#endif
-
-		LIST_REMOVE(inp, inp_hash);
-		LIST_REMOVE(inp, inp_portlist);
-		if (LIST_FIRST(&phd->phd_pcblist) == NULL) {
-			LIST_REMOVE(phd, phd_hash);
-			free(phd, M_PCB);
-		}
+		in_pcbremhash(inp);
 		INP_HASH_WUNLOCK(pcbinfo);
-		inp->inp_flags &= ~INP_INHASHLIST;
 	}
+	INP_LIST_LOCK(pcbinfo);
+	inp->inp_gencnt = ++pcbinfo->ipi_gencnt;
 	LIST_REMOVE(inp, inp_list);
 	pcbinfo->ipi_count--;
+	INP_LIST_UNLOCK(pcbinfo);
 #ifdef PCBGROUP
 	in_pcbgroup_remove(inp);
 #endif
@@ -2591,13 +2714,13 @@ inp_apply_all(void (*func)(struct inpcb *, void *), void *arg)
 {
 	struct inpcb *inp;
 
-	INP_INFO_RLOCK(&V_tcbinfo);
+	INP_INFO_WLOCK(&V_tcbinfo);
 	LIST_FOREACH(inp, V_tcbinfo.ipi_listhead, inp_list) {
 		INP_WLOCK(inp);
 		func(inp, arg);
 		INP_WUNLOCK(inp);
 	}
-	INP_INFO_RUNLOCK(&V_tcbinfo);
+	INP_INFO_WUNLOCK(&V_tcbinfo);
 }
 
 struct socket *
@@ -242,6 +242,7 @@ struct inpcb {
 	inp_gen_t	inp_gencnt;	/* (c) generation count */
 	struct llentry	*inp_lle;	/* cached L2 information */
 	struct rtentry	*inp_rt;	/* cached L3 information */
+	u_int		inp_flowgen;	/* flowtable generation of the above */
 	struct rwlock	inp_lock;
 };
 #define	inp_fibnum	inp_inc.inc_fibnum
@@ -299,41 +300,67 @@ struct inpcbport {
 	u_short phd_port;
 };
 
+/*
+ * The pcbinfo lock is split into INP_INFO_NPARTS partitions.  A read lock
+ * acquires only the partition assigned to the calling thread, so threads
+ * setting up and tearing down unrelated connections do not contend with
+ * each other.  A write lock acquires every partition, in index order, and
+ * so excludes all readers.
+ */
+#define	INP_INFO_NPARTS		16
+
+struct inpcbinfo_part {
+	struct rwlock		 ipp_lock;
+} __aligned(CACHE_LINE_SIZE);
+
 /*-
  * Global data structure for each high-level protocol (UDP, TCP, ...) in both
  * IPv4 and IPv6.  Holds inpcb lists and information for managing them.
  *
- * Each pcbinfo is protected by two locks: ipi_lock and ipi_hash_lock,
- * the former covering mutable global fields (such as the global pcb list),
- * and the latter covering the hashed lookup tables.  The lock order is:
+ * Each pcbinfo is protected by three locks: ipi_lock, ipi_list_lock and
+ * ipi_hash_lock.  ipi_lock is held (read-locked is sufficient) across
+ * operations that create or destroy inpcbs, and write-locked by operations
+ * that need a stable view of every inpcb, such as walking the global list
+ * while locking each inpcb.  ipi_list_lock covers the global pcb list and
+ * its counters, and ipi_hash_lock covers the hashed lookup tables.  The
+ * lock order is:
  *
- *    ipi_lock (before) inpcb locks (before) {ipi_hash_lock, pcbgroup locks}
+ *    ipi_lock (before) inpcb locks (before) ipi_list_lock
+ *    inpcb locks (before) {ipi_hash_lock, pcbgroup locks}
  *
  * Locking key:
  *
  * (c) Constant or nearly constant after initialisation
  * (g) Locked by ipi_lock
+ * (l) Modified with ipi_lock held and ipi_list_lock held; read using
+ *     either ipi_list_lock or a write lock on ipi_lock
  * (h) Read using either ipi_hash_lock or inpcb lock; write requires both
  * (p) Protected by one or more pcbgroup locks
  * (x) Synchronisation properties poorly defined
  */
 struct inpcbinfo {
+	/*
+	 * Partitioned global lock serializing inpcb creation and
+	 * destruction against operations on all inpcbs.
+	 */
+	struct inpcbinfo_part	 ipi_lock[INP_INFO_NPARTS];
+
 	/*
 	 * Global lock protecting global inpcb list, inpcb count, etc.
 	 */
-	struct rwlock		 ipi_lock;
+	struct mtx		 ipi_list_lock;
 
 	/*
 	 * Global list of inpcbs on the protocol.
 	 */
-	struct inpcbhead	*ipi_listhead;		/* (g) */
-	u_int			 ipi_count;		/* (g) */
+	struct inpcbhead	*ipi_listhead;		/* (l) */
+	u_int			 ipi_count;		/* (l) */
 
 	/*
 	 * Generation count -- incremented each time a connection is allocated
 	 * or freed.
 	 */
-	u_quad_t		 ipi_gencnt;		/* (g) */
+	u_quad_t		 ipi_gencnt;		/* (l) */
 
 	/*
 	 * Fields associated with port lookup and allocation.
@@ -479,20 +506,43 @@ void 	inp_4tuple_get(struct inpcb *inp, uint32_t *laddr, uint16_t *lp,
 
 #endif /* _KERNEL */
 
-#define INP_INFO_LOCK_INIT(ipi, d) \
-	VNET_RWLOCK_INIT(&(ipi)->ipi_lock, (d), RW_RECURSE)
-#define INP_INFO_LOCK_DESTROY(ipi)  VNET_RWLOCK_DESTROY(&(ipi)->ipi_lock)
-#define INP_INFO_RLOCK(ipi)	VNET_RWLOCK_RLOCK(&(ipi)->ipi_lock)
-#define INP_INFO_WLOCK(ipi)	VNET_RWLOCK_WLOCK(&(ipi)->ipi_lock)
-#define INP_INFO_TRY_RLOCK(ipi)	VNET_RWLOCK_TRY_RLOCK(&(ipi)->ipi_lock)
-#define INP_INFO_TRY_WLOCK(ipi)	VNET_RWLOCK_TRY_WLOCK(&(ipi)->ipi_lock)
-#define INP_INFO_TRY_UPGRADE(ipi)	VNET_RWLOCK_TRY_UPGRADE(&(ipi)->ipi_lock)
-#define INP_INFO_RUNLOCK(ipi)	VNET_RWLOCK_RUNLOCK(&(ipi)->ipi_lock)
-#define INP_INFO_WUNLOCK(ipi)	VNET_RWLOCK_WUNLOCK(&(ipi)->ipi_lock)
-#define	INP_INFO_LOCK_ASSERT(ipi)	VNET_RWLOCK_ASSERT(&(ipi)->ipi_lock, RA_LOCKED)
-#define INP_INFO_RLOCK_ASSERT(ipi)	VNET_RWLOCK_ASSERT(&(ipi)->ipi_lock, RA_RLOCKED)
-#define INP_INFO_WLOCK_ASSERT(ipi)	VNET_RWLOCK_ASSERT(&(ipi)->ipi_lock, RA_WLOCKED)
-#define INP_INFO_UNLOCK_ASSERT(ipi)	VNET_RWLOCK_ASSERT(&(ipi)->ipi_lock, RA_UNLOCKED)
+#ifdef _KERNEL
+u_int	in_pcbinfo_part(void);
+void	in_pcbinfo_lock_init(struct inpcbinfo *, const char *);
+void	in_pcbinfo_lock_destroy(struct inpcbinfo *);
+void	in_pcbinfo_wlock(struct inpcbinfo *);
+int	in_pcbinfo_try_wlock(struct inpcbinfo *);
+void	in_pcbinfo_wunlock(struct inpcbinfo *);
+#ifdef INVARIANTS
+void	in_pcbinfo_wlock_assert(struct inpcbinfo *);
+#endif
+#endif
+
+#define	INP_INFO_PART_LOCK(ipi)	(&(ipi)->ipi_lock[in_pcbinfo_part()].ipp_lock)
+
+#define INP_INFO_LOCK_INIT(ipi, d)	in_pcbinfo_lock_init((ipi), (d))
+#define INP_INFO_LOCK_DESTROY(ipi)	in_pcbinfo_lock_destroy(ipi)
+#define INP_INFO_RLOCK(ipi)	VNET_RWLOCK_RLOCK(INP_INFO_PART_LOCK(ipi))
+#define INP_INFO_WLOCK(ipi)	in_pcbinfo_wlock(ipi)
+#define INP_INFO_TRY_RLOCK(ipi)	VNET_RWLOCK_TRY_RLOCK(INP_INFO_PART_LOCK(ipi))
+#define INP_INFO_TRY_WLOCK(ipi)	in_pcbinfo_try_wlock(ipi)
+#define INP_INFO_RUNLOCK(ipi)	VNET_RWLOCK_RUNLOCK(INP_INFO_PART_LOCK(ipi))
+#define INP_INFO_WUNLOCK(ipi)	in_pcbinfo_wunlock(ipi)
+#define	INP_INFO_LOCK_ASSERT(ipi)	VNET_RWLOCK_ASSERT(INP_INFO_PART_LOCK(ipi), RA_LOCKED)
+#define INP_INFO_RLOCK_ASSERT(ipi)	VNET_RWLOCK_ASSERT(INP_INFO_PART_LOCK(ipi), RA_LOCKED)
+#ifdef INVARIANTS
+#define INP_INFO_WLOCK_ASSERT(ipi)	in_pcbinfo_wlock_assert(ipi)
+#else
+#define INP_INFO_WLOCK_ASSERT(ipi)	(void)0
+#endif
+#define INP_INFO_UNLOCK_ASSERT(ipi)	VNET_RWLOCK_ASSERT(INP_INFO_PART_LOCK(ipi), RA_UNLOCKED)
+
+#define	INP_LIST_LOCK_INIT(ipi, d) \
+	VNET_MTX_INIT(&(ipi)->ipi_list_lock, (d), NULL, MTX_DEF)
+#define	INP_LIST_LOCK_DESTROY(ipi)	VNET_MTX_DESTROY(&(ipi)->ipi_list_lock)
+#define	INP_LIST_LOCK(ipi)		VNET_MTX_LOCK(&(ipi)->ipi_list_lock)
+#define	INP_LIST_UNLOCK(ipi)		VNET_MTX_UNLOCK(&(ipi)->ipi_list_lock)
+#define	INP_LIST_LOCK_ASSERT(ipi)	VNET_MTX_ASSERT(&(ipi)->ipi_list_lock, MA_OWNED)
 
 #define	INP_HASH_LOCK_INIT(ipi, d) \
 	VNET_RWLOCK_INIT(&(ipi)->ipi_hash_lock, (d), 0)
@@ -579,6 +629,7 @@ void 	inp_4tuple_get(struct inpcb *inp, uint32_t *laddr, uint16_t *lp,
 #define	INP_PASSIVE		0x00000010 /* passive inet mode enabled */
 #define	INP_PROMISC		0x00000020 /* promiscuous inet mode enabled */
 #define	INP_SYNFILTER		0x00000040 /* a SYN filter has been attached */
+#define	INP_FREED		0x00000080 /* in_pcbfree() has been called */
 
 /*
  * Flags passed to in_pcblookup*() functions.
@@ -691,7 +742,10 @@ struct inpcb *
 void	in_pcbnotifyall(struct inpcbinfo *pcbinfo, struct in_addr,
 	    int, struct inpcb *(*)(struct inpcb *, int));
 void	in_pcbref(struct inpcb *);
+struct inpcb **
+	in_pcbref_lport(struct inpcbinfo *, u_short, struct inpcb **, int *);
 void	in_pcbrehash(struct inpcb *);
+void	in_pcbremhash(struct inpcb *);
 void	in_pcbrehash_mbuf(struct inpcb *, struct mbuf *);
 int	in_pcbrele(struct inpcb *);
 int	in_pcbrele_rlocked(struct inpcb *);
@@ -76,6 +76,15 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/in_pcbgroup.c 222748 2011-06-06 12
  * connection group lookup is implemented in in_pcb.c alongside reservation
  * table lookups -- see in_pcblookup_group().
  *
+ * In this stack, a connection is homed in the group selected by the
+ * hardware RSS hash of the first packet that carries one (the final ACK of
+ * an inbound handshake, or the SYN|ACK of an outbound one), so the receive
+ * queue a flow is steered to and the group its inpcb lives in always agree,
+ * whatever tuple the NIC hashed.  Groups are consulted for exact matches
+ * only; wildcard and promiscuous-listen matching, and connections that have
+ * not yet seen a hashed packet, are resolved in the global reservation
+ * table, so no per-group wildcard table is maintained.
+ *
  * TODO:
  *
  * Implement dynamic rebalancing of buckets with connection groups; when
@@ -136,8 +145,6 @@ in_pcbgroup_init(struct inpcbinfo *pcbinfo, u_int hashfields,
 	pcbinfo->ipi_pcbgroups = malloc(numpcbgroups *
 	    sizeof(*pcbinfo->ipi_pcbgroups), M_PCB, M_WAITOK | M_ZERO);
 	pcbinfo->ipi_npcbgroups = numpcbgroups;
-	pcbinfo->ipi_wildbase = hashinit(hash_nelements, M_PCB,
-	    &pcbinfo->ipi_wildmask);
 	for (pgn = 0; pgn < pcbinfo->ipi_npcbgroups; pgn++) {
 		pcbgroup = &pcbinfo->ipi_pcbgroups[pgn];
 		pcbgroup->ipg_hashbase = hashinit(hash_nelements, M_PCB,
@@ -170,7 +177,6 @@ in_pcbgroup_destroy(struct inpcbinfo *pcbinfo)
 		hashdestroy(pcbgroup->ipg_hashbase, M_PCB,
 		    pcbgroup->ipg_hashmask);
 	}
-	hashdestroy(pcbinfo->ipi_wildbase, M_PCB, pcbinfo->ipi_wildmask);
 	free(pcbinfo->ipi_pcbgroups, M_PCB);
 	pcbinfo->ipi_pcbgroups = NULL;
 	pcbinfo->ipi_npcbgroups = 0;
@@ -196,7 +202,18 @@ struct inpcbgroup *
 in_pcbgroup_byhash(struct inpcbinfo *pcbinfo, u_int hashtype, uint32_t hash)
 {
 
-	return (NULL);
+	switch (hashtype) {
+	case M_HASHTYPE_RSS_IPV4:
+	case M_HASHTYPE_RSS_TCP_IPV4:
+	case M_HASHTYPE_RSS_IPV6:
+	case M_HASHTYPE_RSS_TCP_IPV6:
+	case M_HASHTYPE_RSS_IPV6_EX:
+	case M_HASHTYPE_RSS_TCP_IPV6_EX:
+		return (&pcbinfo->ipi_pcbgroups[in_pcbgroup_getbucket(pcbinfo,
+		    hash)]);
+	default:
+		return (NULL);
+	}
 }
 
 static struct inpcbgroup *
@@ -237,47 +254,6 @@ in_pcbgroup_byinpcb(struct inpcb *inp)
 	    inp->inp_lport, inp->inp_faddr, inp->inp_fport));
 }
 
-static void
-in_pcbwild_add(struct inpcb *inp)
-{
-	struct inpcbinfo *pcbinfo;
-	struct inpcbhead *head;
-	u_int pgn;
-
-	INP_WLOCK_ASSERT(inp);
-	KASSERT(!(inp->inp_flags2 & INP_PCBGROUPWILD),
-	    ("%s: is wild",__func__));
-
-	pcbinfo = inp->inp_pcbinfo;
-	for (pgn = 0; pgn < pcbinfo->ipi_npcbgroups; pgn++)
-		INP_GROUP_LOCK(&pcbinfo->ipi_pcbgroups[pgn]);
-	head = &pcbinfo->ipi_wildbase[INP_PCBHASH(INADDR_ANY, inp->inp_lport,
-	    0, pcbinfo->ipi_wildmask)];
-	LIST_INSERT_HEAD(head, inp, inp_pcbgroup_wild);
-	inp->inp_flags2 |= INP_PCBGROUPWILD;
-	for (pgn = 0; pgn < pcbinfo->ipi_npcbgroups; pgn++)
-		INP_GROUP_UNLOCK(&pcbinfo->ipi_pcbgroups[pgn]);
-}
-
-static void
-in_pcbwild_remove(struct inpcb *inp)
-{
-	struct inpcbinfo *pcbinfo;
-	u_int pgn;
-
-	INP_WLOCK_ASSERT(inp);
-	KASSERT((inp->inp_flags2 & INP_PCBGROUPWILD),
-	    ("%s: not wild", __func__));
-
-	pcbinfo = inp->inp_pcbinfo;
-	for (pgn = 0; pgn < pcbinfo->ipi_npcbgroups; pgn++)
-		INP_GROUP_LOCK(&pcbinfo->ipi_pcbgroups[pgn]);
-	LIST_REMOVE(inp, inp_pcbgroup_wild);
-	for (pgn = 0; pgn < pcbinfo->ipi_npcbgroups; pgn++)
-		INP_GROUP_UNLOCK(&pcbinfo->ipi_pcbgroups[pgn]);
-	inp->inp_flags2 &= ~INP_PCBGROUPWILD;
-}
-
 static __inline int
 in_pcbwild_needed(struct inpcb *inp)
 {
@@ -290,23 +266,20 @@ in_pcbwild_needed(struct inpcb *inp)
 		return (inp->inp_faddr.s_addr == htonl(INADDR_ANY));
 }
 
-static void
-in_pcbwild_update_internal(struct inpcb *inp)
+/*
+ * Only connected, live inpcbs are placed in a pcbgroup.
+ */
+static __inline int
+in_pcbgroup_homeable(struct inpcb *inp)
 {
-	int wildcard_needed;
 
-	wildcard_needed = in_pcbwild_needed(inp);
-	if (wildcard_needed && !(inp->inp_flags2 & INP_PCBGROUPWILD))
-		in_pcbwild_add(inp);
-	else if (!wildcard_needed && (inp->inp_flags2 & INP_PCBGROUPWILD))
-		in_pcbwild_remove(inp);
+	return (!in_pcbwild_needed(inp) && !(inp->inp_flags & INP_DROPPED));
 }
 
 /*
  * Update the pcbgroup of an inpcb, which might include removing an old
- * pcbgroup reference and/or adding a new one.  Wildcard processing is not
- * performed here, although ideally we'll never install a pcbgroup for a
- * wildcard inpcb (asserted below).
+ * pcbgroup reference and/or adding a new one.  We never install a pcbgroup
+ * for a wildcard inpcb (asserted below).
  */
 static void
 in_pcbgroup_update_internal(struct inpcbinfo *pcbinfo,
@@ -347,15 +320,13 @@ in_pcbgroup_update_internal(struct inpcbinfo *pcbinfo,
 
 /*
  * Two update paths: one in which the 4-tuple on an inpcb has been updated
- * and therefore connection groups may need to change (or a wildcard entry
- * may needed to be installed), and another in which the 4-tuple has been
- * set as a result of a packet received, in which case we may be able to use
- * the hash on the mbuf to avoid doing a software hash calculation for RSS.
+ * and therefore connection groups may need to change, and another in which
+ * the 4-tuple has been set as a result of a packet received, in which case
+ * the hash on the mbuf selects the pcbgroup.
  *
- * In each case: first, let the wildcard code have a go at placing it as a
- * wildcard socket.  If it was a wildcard, or if the connection has been
- * dropped, then no pcbgroup is required (so potentially clear it);
- * otherwise, calculate and update the pcbgroup for the inpcb.
+ * A software hash of the tuple would not in general match the RSS hash the
+ * NIC computes, so without an mbuf an inpcb keeps whatever group it already
+ * has; it is removed from it if it is no longer connected.
  */
 void
 in_pcbgroup_update(struct inpcb *inp)
@@ -369,16 +340,9 @@ in_pcbgroup_update(struct inpcb *inp)
 	if (!in_pcbgroup_enabled(pcbinfo))
 		return;
 
-	in_pcbwild_update_internal(inp);
-	if (!(inp->inp_flags2 & INP_PCBGROUPWILD) &&
-	    !(inp->inp_flags & INP_DROPPED)) {
-#ifdef INET6
-		if (inp->inp_vflag & INP_IPV6)
-			newpcbgroup = in6_pcbgroup_byinpcb(inp);
-		else
-#endif
-			newpcbgroup = in_pcbgroup_byinpcb(inp);
-	} else
+	if (in_pcbgroup_homeable(inp))
+		newpcbgroup = inp->inp_pcbgroup;
+	else
 		newpcbgroup = NULL;
 	in_pcbgroup_update_internal(pcbinfo, newpcbgroup, inp);
 }
@@ -395,33 +359,17 @@ in_pcbgroup_update_mbuf(struct inpcb *inp, struct mbuf *m)
 	if (!in_pcbgroup_enabled(pcbinfo))
 		return;
 
-	/*
-	 * Possibly should assert !INP_PCBGROUPWILD rather than testing for
-	 * it; presumably this function should never be called for anything
-	 * other than non-wildcard socket?
-	 */
-	in_pcbwild_update_internal(inp);
-	if (!(inp->inp_flags2 & INP_PCBGROUPWILD) &&
-	    !(inp->inp_flags & INP_DROPPED)) {
+	if (in_pcbgroup_homeable(inp)) {
 		newpcbgroup = in_pcbgroup_bymbuf(pcbinfo, m);
-#ifdef INET6
-		if (inp->inp_vflag & INP_IPV6) {
-			if (newpcbgroup == NULL)
-				newpcbgroup = in6_pcbgroup_byinpcb(inp);
-		} else {
-#endif
-			if (newpcbgroup == NULL)
-				newpcbgroup = in_pcbgroup_byinpcb(inp);
-#ifdef INET6
-		}
-#endif
+		if (newpcbgroup == NULL)
+			newpcbgroup = inp->inp_pcbgroup;
 	} else
 		newpcbgroup = NULL;
 	in_pcbgroup_update_internal(pcbinfo, newpcbgroup, inp);
 }
 
 /*
- * Remove pcbgroup entry and optional pcbgroup wildcard entry for this inpcb.
+ * Remove pcbgroup entry for this inpcb.
  */
 void
 in_pcbgroup_remove(struct inpcb *inp)
@@ -433,9 +381,6 @@ in_pcbgroup_remove(struct inpcb *inp)
 	if (!in_pcbgroup_enabled(inp->inp_pcbinfo))
 		return;
 
-	if (inp->inp_flags2 & INP_PCBGROUPWILD)
-		in_pcbwild_remove(inp);
-
 	pcbgroup = inp->inp_pcbgroup;
 	if (pcbgroup != NULL) {
 		INP_GROUP_LOCK(pcbgroup);
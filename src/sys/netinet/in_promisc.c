@@ -732,11 +732,11 @@ syn_filter_setopt(struct socket *so, struct sockopt *sopt)
 			INP_WUNLOCK(inp);
 			break;
 		case SYNF_ACCEPT:
-			INP_INFO_WLOCK(&V_tcbinfo);
+			INP_INFO_RLOCK(&V_tcbinfo);
 			INP_WLOCK(inp);
 			syncache_add(&cbarg.inc, &cbarg.to, &cbarg.th, inp, &so, cbarg.m, cbarg.initial_timeout);
 		
-			/* syncache_add performs the INP_WUNLOCK(inp) and INP_INFO_WUNLOCK(&V_tcbinfo) */
+			/* syncache_add performs the INP_WUNLOCK(inp) and INP_INFO_RUNLOCK(&V_tcbinfo) */
 			break;
 		default:
 			error = EINVAL;
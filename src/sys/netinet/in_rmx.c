@@ -43,6 +43,8 @@
 #include <sys/cdefs.h>
 __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/in_rmx.c 215701 2010-11-22 19:32:54Z dim $");
 
+#include "opt_route.h"
+
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/kernel.h>
@@ -59,6 +61,9 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/in_rmx.c 215701 2010-11-22 19:32:5
 #include <netinet/in.h>
 #include <netinet/in_var.h>
 #include <netinet/ip_var.h>
+#ifdef INET_LPM
+#include <netinet/in_lpm.h>
+#endif
 
 extern int	in_inithead(void **head, int off);
 #ifdef VIMAGE
@@ -76,6 +81,7 @@ in_addroute(void *v_arg, void *n_arg, struct radix_node_head *head,
 {
 	struct rtentry *rt = (struct rtentry *)treenodes;
 	struct sockaddr_in *sin = (struct sockaddr_in *)rt_key(rt);
+	struct radix_node *rn;
 
 	RADIX_NODE_HEAD_WLOCK_ASSERT(head);
 	/*
@@ -107,8 +113,27 @@ in_addroute(void *v_arg, void *n_arg, struct radix_node_head *head,
 	if (!rt->rt_rmx.rmx_mtu && rt->rt_ifp)
 		rt->rt_rmx.rmx_mtu = rt->rt_ifp->if_mtu;
 
-	return (rn_addroute(v_arg, n_arg, head, treenodes));
+	rn = rn_addroute(v_arg, n_arg, head, treenodes);
+#ifdef INET_LPM
+	if (rn != NULL)
+		in_lpm_addroute(head, rt);
+#endif
+	return (rn);
+}
+
+#ifdef INET_LPM
+static struct radix_node *
+in_delroute(void *v_arg, void *netmask_arg, struct radix_node_head *head)
+{
+	struct radix_node *rn;
+
+	RADIX_NODE_HEAD_WLOCK_ASSERT(head);
+	rn = rn_delete(v_arg, netmask_arg, head);
+	if (rn != NULL)
+		in_lpm_delroute(head, (struct rtentry *)rn);
+	return (rn);
 }
+#endif
 
 /*
  * This code is the inverse of in_clsroute: on first reference, if we
@@ -118,8 +143,16 @@ in_addroute(void *v_arg, void *n_arg, struct radix_node_head *head,
 static struct radix_node *
 in_matroute(void *v_arg, struct radix_node_head *head)
 {
-	struct radix_node *rn = rn_match(v_arg, head);
-	struct rtentry *rt = (struct rtentry *)rn;
+	struct radix_node *rn;
+	struct rtentry *rt;
+
+#ifdef INET_LPM
+	if (head->rnh_lpm != NULL)
+		rn = in_lpm_match(head, v_arg);
+	else
+#endif
+		rn = rn_match(v_arg, head);
+	rt = (struct rtentry *)rn;
 
 	if (rt) {
 		RT_LOCK(rt);
@@ -357,6 +390,9 @@ in_inithead(void **head, int off)
 
 	rnh = *head;
 	rnh->rnh_addaddr = in_addroute;
+#ifdef INET_LPM
+	rnh->rnh_deladdr = in_delroute;
+#endif
 	rnh->rnh_matchaddr = in_matroute;
 	rnh->rnh_close = in_clsroute;
 	if (_in_rt_was_here == 0 ) {
@@ -373,6 +409,9 @@ in_detachhead(void **head, int off)
 {
 
 	vnet_callout_drain(&V_rtq_timer);
+#ifdef INET_LPM
+	in_lpm_detach(*head);
+#endif
 	return (1);
 }
 #endif
@@ -497,6 +536,52 @@ in_rtalloc(struct route *ro, u_int fibnum)
 	rtalloc_ign_fib(ro, 0UL, fibnum);
 }
 
+/*
+ * Look up a burst of destinations under a single acquisition of the
+ * table lock.  Each route found is returned referenced and unlocked,
+ * misses as NULL.  Returns the number of routes found.
+ */
+int
+in_rtalloc_bulk(const struct in_addr *dst, struct rtentry **rt, int n,
+    u_int fibnum)
+{
+	struct radix_node_head *rnh;
+	struct radix_node *rn;
+	struct sockaddr_in sin;
+	int i, found;
+
+	rnh = rt_tables_get_rnh(fibnum, AF_INET);
+	RADIX_NODE_HEAD_RLOCK(rnh);
+#ifdef INET_LPM
+	if (in_lpm_match_bulk(rnh, dst, rt, n) != 0)
+#endif
+	{
+		bzero(&sin, sizeof(sin));
+		sin.sin_len = sizeof(sin);
+		sin.sin_family = AF_INET;
+		for (i = 0; i < n; i++) {
+			sin.sin_addr = dst[i];
+			rn = rn_match(&sin, rnh);
+			rt[i] = (rn != NULL && !(rn->rn_flags & RNF_ROOT)) ?
+			    (struct rtentry *)rn : NULL;
+		}
+	}
+	for (found = 0, i = 0; i < n; i++) {
+		if (rt[i] == NULL)
+			continue;
+		RT_LOCK(rt[i]);
+		if (rt[i]->rt_flags & RTPRF_OURS) {
+			rt[i]->rt_flags &= ~RTPRF_OURS;
+			rt[i]->rt_rmx.rmx_expire = 0;
+		}
+		RT_ADDREF(rt[i]);
+		RT_UNLOCK(rt[i]);
+		found++;
+	}
+	RADIX_NODE_HEAD_RUNLOCK(rnh);
+	return (found);
+}
+
 #if 0
 int	 in_rt_getifa(struct rt_addrinfo *, u_int fibnum);
 int	 in_rtioctl(u_long, caddr_t, u_int);
@@ -37,6 +37,7 @@
 #include <sys/fnv_hash.h>
 #include <sys/tree.h>
 
+struct arp_cache;
 struct igmp_ifinfo;
 struct in_multi;
 struct lltable;
@@ -46,6 +47,7 @@ struct lltable;
  */
 struct in_ifinfo {
 	struct lltable		*ii_llt;	/* ARP state */
+	struct arp_cache	*ii_arpc;	/* lockless view of resolved ARP state */
 	struct igmp_ifinfo	*ii_igmp;	/* IGMP state */
 	struct in_multi		*ii_allhosts;	/* 224.0.0.1 membership */
 };
@@ -94,6 +96,8 @@ extern	u_char	inetctlerrmap[];
 
 #define LLTABLE(ifp)	\
 	((struct in_ifinfo *)(ifp)->if_afdata[AF_INET])->ii_llt
+#define ARPCACHE(ifp)	\
+	((struct in_ifinfo *)(ifp)->if_afdata[AF_INET])->ii_arpc
 /*
  * Hash table for IP addresses.
  */
@@ -463,6 +467,7 @@ void	in_domifdetach(struct ifnet *, void *);
 void	 in_rtalloc_ign(struct route *ro, u_long ignflags, u_int fibnum);
 void	 in_rtalloc(struct route *ro, u_int fibnum);
 struct rtentry *in_rtalloc1(struct sockaddr *, int, u_long, u_int);
+int	 in_rtalloc_bulk(const struct in_addr *, struct rtentry **, int, u_int);
 void	 in_rtredirect(struct sockaddr *, struct sockaddr *,
 	    struct sockaddr *, int, struct sockaddr *, u_int);
 int	 in_rtrequest(int, struct sockaddr *,
@@ -202,15 +202,26 @@ ip_output(struct mbuf *m, struct mbuf *opt, struct route *ro, int flags,
 		{
 			struct flentry *fle;
 			
+			/*
+			 * Connected sockets carry their own reference to the
+			 * route and L2 entry of the flow; fall back to the
+			 * flow table otherwise, refilling the socket's copy
+			 * when the caller holds the inpcb write lock.
+			 */
+			if (inp != NULL && inpcb_to_route(V_ip_ft, inp,
+			    mtod(m, struct ip *)->ip_dst, ro))
+				nortfree = 1;
 			/*
 			 * The flow table returns route entries valid for up to 30
 			 * seconds; we rely on the remainder of ip_output() taking no
 			 * longer than that long for the stability of ro_rt.  The
 			 * flow ID assignment must have happened before this point.
 			 */
-			if ((fle = flowtable_lookup_mbuf(V_ip_ft, m, AF_INET)) != NULL) {
+			else if ((fle = flowtable_lookup_mbuf(V_ip_ft, m, AF_INET)) != NULL) {
 				flow_to_route(fle, ro);
 				nortfree = 1;
+				if (inp != NULL && (flags & IP_INPWLOCKED))
+					flow_to_inpcb(V_ip_ft, fle, inp);
 			}
 		}
 #endif
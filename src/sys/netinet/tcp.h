@@ -97,10 +97,15 @@ struct tcphdr {
 #define    TCPOLEN_TSTAMP_APPA		(TCPOLEN_TIMESTAMP+2) /* appendix A */
 #define	TCPOPT_SIGNATURE	19		/* Keyed MD5: RFC 2385 */
 #define	   TCPOLEN_SIGNATURE		18
+#define	TCPOPT_FAST_OPEN	34		/* TCP Fast Open: RFC 7413 */
+#define	   TCPOLEN_FAST_OPEN_EMPTY	2
 
 /* Miscellaneous constants */
 #define	MAX_SACK_BLKS	6	/* Max # SACK blocks stored at receiver side */
 #define	TCP_MAX_SACK	4	/* MAX # SACKs sent in any segment */
+#define	TCP_FASTOPEN_MIN_COOKIE_LEN	4	/* shortest Fast Open cookie */
+#define	TCP_FASTOPEN_MAX_COOKIE_LEN	16	/* longest Fast Open cookie */
+#define	TCP_FASTOPEN_COOKIE_LEN		8	/* length of cookies we issue */
 
 
 /*
@@ -166,6 +171,8 @@ struct tcphdr {
 #define	TCP_REASSDL	0x800	/* wait this long for missing segments */
 #define	TCP_TRIVIAL_ISN	0x1000	/* use cheap, insecure ISN */
 #define	TCP_NOTIMEWAIT	0x2000	/* skip TIMEWAIT state */
+#define	TCP_RACK	0x4000	/* RACK loss detection and tail loss probes */
+#define	TCP_FASTOPEN	0x8000	/* TCP Fast Open (RFC 7413) */
 	
 #define	TCP_CA_NAME_MAX	16	/* max congestion control name length */
 
@@ -500,6 +500,60 @@ tcp_hc_updatemtu(struct in_conninfo *inc, u_long mtu)
 	THC_UNLOCK(&hc_entry->rmx_head->hch_mtx);
 }
 
+/*
+ * External function: look up an entry in the hostcache and copy out the
+ * TCP Fast Open cookie the host gave us.  Returns the cookie length, or 0
+ * if no entry is found or no cookie is known.
+ */
+int
+tcp_hc_gettfo(struct in_conninfo *inc, uint8_t *cookie)
+{
+	struct hc_metrics *hc_entry;
+	int len;
+
+	hc_entry = tcp_hc_lookup(inc);
+	if (hc_entry == NULL)
+		return (0);
+	hc_entry->rmx_hits++;
+	hc_entry->rmx_expire = V_tcp_hostcache.expire; /* start over again */
+
+	len = hc_entry->rmx_tfo_cookie_len;
+	bcopy(hc_entry->rmx_tfo_cookie, cookie, len);
+	THC_UNLOCK(&hc_entry->rmx_head->hch_mtx);
+	return (len);
+}
+
+/*
+ * External function: update the TCP Fast Open cookie of an entry in the
+ * hostcache.  A length of 0 forgets the cookie.  Creates a new entry if
+ * none was found.
+ */
+void
+tcp_hc_updatetfo(struct in_conninfo *inc, const uint8_t *cookie, int len)
+{
+	struct hc_metrics *hc_entry;
+
+	KASSERT(len >= 0 && len <= TCP_FASTOPEN_MAX_COOKIE_LEN,
+	    ("%s: bad cookie length %d", __func__, len));
+
+	hc_entry = tcp_hc_lookup(inc);
+	if (hc_entry == NULL) {
+		if (len == 0)
+			return;
+		hc_entry = tcp_hc_insert(inc);
+		if (hc_entry == NULL)
+			return;
+	}
+	hc_entry->rmx_updates++;
+	hc_entry->rmx_expire = V_tcp_hostcache.expire; /* start over again */
+
+	hc_entry->rmx_tfo_cookie_len = len;
+	if (len > 0)
+		bcopy(cookie, hc_entry->rmx_tfo_cookie, len);
+
+	THC_UNLOCK(&hc_entry->rmx_head->hch_mtx);
+}
+
 /*
  * External function: update the TCP metrics of an entry in the hostcache.
  * Creates a new entry if none was found.
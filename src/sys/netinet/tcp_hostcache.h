@@ -60,6 +60,9 @@ struct hc_metrics {
 	u_long	rmx_cwnd;	/* congestion window */
 	u_long	rmx_sendpipe;	/* outbound delay-bandwidth product */
 	u_long	rmx_recvpipe;	/* inbound delay-bandwidth product */
+	/* TCP Fast Open cookie issued by this host */
+	u_int8_t rmx_tfo_cookie_len;
+	u_int8_t rmx_tfo_cookie[TCP_FASTOPEN_MAX_COOKIE_LEN];
 	/* TCP hostcache internal data */
 	int	rmx_expire;	/* lifetime for object */
 	u_long	rmx_hits;	/* number of hits */
@@ -56,6 +56,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_input.c 238247 2012-07-08 14:2
 #include "opt_inet6.h"
 #include "opt_ipsec.h"
 #include "opt_passiveinet.h"
+#include "opt_pcbgroup.h"
 #include "opt_promiscinet.h"
 #include "opt_tcpdebug.h"
 
@@ -238,6 +239,9 @@ static void inline	cc_ack_received(struct tcpcb *tp, struct tcphdr *th,
 			    uint16_t type);
 static void inline	cc_conn_init(struct tcpcb *tp);
 static void inline	cc_post_recovery(struct tcpcb *tp, struct tcphdr *th);
+static void inline	tcp_rate_acked(struct tcpcb *tp, struct tcphdr *th);
+static int inline	tcp_rack_input(struct tcpcb *tp, struct tcphdr *th,
+			    struct tcpopt *to);
 static void inline	hhook_run_tcp_est_in(struct tcpcb *tp,
 			    struct tcphdr *th, struct tcpopt *to);
 
@@ -299,6 +303,7 @@ cc_ack_received(struct tcpcb *tp, struct tcphdr *th, uint16_t type)
 				tp->ccv->flags &= ~CCF_ABC_SENTAWND;
 				tp->t_bytes_acked = 0;
 		}
+		tcp_rate_acked(tp, th);
 	}
 
 	if (CC_ALGO(tp)->ack_received != NULL) {
@@ -308,6 +313,41 @@ cc_ack_received(struct tcpcb *tp, struct tcphdr *th, uint16_t type)
 	}
 }
 
+/*
+ * Account newly acknowledged bytes and, once the segment timed by
+ * tcp_rate_sent() is covered, hand the resulting delivery rate sample to the
+ * CC algorithm.
+ */
+static void inline
+tcp_rate_acked(struct tcpcb *tp, struct tcphdr *th)
+{
+	struct cc_rate_sample rs;
+	uint64_t now;
+
+	now = tcp_rate_getus();
+	tp->t_delivered += tp->ccv->bytes_this_ack;
+	tp->t_delivered_us = now;
+
+	if ((tp->t_rs_flags & TRS_TIMING) == 0 ||
+	    SEQ_LT(th->th_ack, tp->t_rs_seq))
+		return;
+	tp->t_rs_flags &= ~TRS_TIMING;
+
+	/*
+	 * The interval runs from the delivery preceding the send of the
+	 * timed segment to its acknowledgement, which bounds the rate from
+	 * below when ACKs are compressed or delayed.
+	 */
+	rs.delivered = tp->t_delivered - tp->t_rs_delivered;
+	rs.interval_us = now - tp->t_rs_delivered_us;
+	rs.rtt_us = now - tp->t_rs_sent_us;
+	rs.prior_delivered = tp->t_rs_delivered;
+	rs.app_limited = (tp->t_rs_flags & TRS_APPLIMITED) != 0;
+
+	if (CC_ALGO(tp)->rate_sample != NULL && rs.interval_us > 0)
+		CC_ALGO(tp)->rate_sample(tp->ccv, &rs);
+}
+
 static void inline
 cc_conn_init(struct tcpcb *tp)
 {
@@ -465,6 +505,28 @@ cc_post_recovery(struct tcpcb *tp, struct tcphdr *th)
 	tp->t_bytes_acked = 0;
 }
 
+/*
+ * Feed an ACK to RACK and update the SACK scoreboard.  Returns non-zero if
+ * RACK found outstanding data to be lost.
+ */
+static inline int
+tcp_rack_input(struct tcpcb *tp, struct tcphdr *th, struct tcpopt *to)
+{
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+
+	if (tcp_rack_ack(tp, to, th->th_ack)) {
+		/* A probe repaired a tail loss; reduce cwnd as for one. */
+		cc_cong_signal(tp, th, CC_NDUPACK);
+		cc_post_recovery(tp, th);
+		EXIT_RECOVERY(tp->t_flags);
+	}
+	if ((tp->t_flags & TF_SACK_PERMIT) == 0)
+		return (0);
+	if ((to->to_flags & TOF_SACK) || !TAILQ_EMPTY(&tp->snd_holes))
+		tcp_sack_doack(tp, to, th->th_ack);
+	return (tcp_rack_detect(tp));
+}
+
 static inline void
 tcp_fields_copy_to_host(struct tcphdr *th, const struct tcphdr *mbuf_th)
 {
@@ -790,21 +852,22 @@ tcp_input(struct mbuf *m, int off0)
 
 	/*
 	 * Locate pcb for segment; if we're likely to add or remove a
-	 * connection then first acquire pcbinfo lock.  There are two cases
-	 * where we might discover later we need a write lock despite the
-	 * flags: ACKs moving a connection out of the syncache, and ACKs for
-	 * a connection in TIMEWAIT.
+	 * connection then first acquire pcbinfo lock.  A read lock suffices,
+	 * as the global pcb list has its own lock.  There are two cases
+	 * where we might discover later we need the lock despite the flags:
+	 * ACKs moving a connection out of the syncache, and ACKs for a
+	 * connection in TIMEWAIT.
 	 */
 	if ((thflags & (TH_SYN | TH_FIN | TH_RST)) != 0) {
-		INP_INFO_WLOCK(&V_tcbinfo);
-		ti_locked = TI_WLOCKED;
+		INP_INFO_RLOCK(&V_tcbinfo);
+		ti_locked = TI_RLOCKED;
 	} else
 		ti_locked = TI_UNLOCKED;
 
 findpcb:
 #ifdef INVARIANTS
-	if (ti_locked == TI_WLOCKED) {
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	if (ti_locked == TI_RLOCKED) {
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 	} else {
 		INP_INFO_UNLOCK_ASSERT(&V_tcbinfo);
 	}
@@ -924,6 +987,46 @@ findpcb:
 #endif /* PASSIVE_INET */
 #endif /* INET */
 
+	/*
+	 * A connection in TIME_WAIT has no INPCB, only a compressed entry
+	 * that is supposed to catch stray or duplicate segments arriving
+	 * late.  Consult it whenever no connection was found.  If this
+	 * segment is a legitimate new connection attempt the entry is
+	 * removed and we carry on to the listening socket, if any.
+	 */
+	if (inp == NULL || (inp->inp_socket != NULL &&
+	    (inp->inp_socket->so_options & (SO_ACCEPTCONN|SO_PASSIVE)) ==
+	    SO_ACCEPTCONN)) {
+		struct in_conninfo twinc;
+
+		bzero(&twinc, sizeof(twinc));
+#ifdef INET6
+		if (isipv6) {
+			twinc.inc_flags |= INC_ISIPV6;
+			twinc.inc6_faddr = ip6->ip6_src;
+			twinc.inc6_laddr = ip6->ip6_dst;
+		} else
+#endif
+		{
+			twinc.inc_faddr = ip->ip_src;
+			twinc.inc_laddr = ip->ip_dst;
+		}
+		twinc.inc_fport = th->th_sport;
+		twinc.inc_lport = th->th_dport;
+		if (thflags & TH_SYN)
+			tcp_dooptions(&to, optp, optlen, TO_SYN);
+		/*
+		 * NB: tcp_twcheck frees the mbuf if it consumes the segment.
+		 */
+		if (tcp_twcheck(&twinc, &to, th, m, tlen)) {
+			if (inp != NULL)
+				INP_WUNLOCK(inp);
+			if (ti_locked == TI_RLOCKED)
+				INP_INFO_RUNLOCK(&V_tcbinfo);
+			return;
+		}
+	}
+
 	/*
 	 * If the INPCB does not exist then all data in the incoming
 	 * segment is discarded and an appropriate RST is sent back.
@@ -995,50 +1098,7 @@ findpcb:
 			goto dropunlock;
 	}
 
-	/*
-	 * A previous connection in TIMEWAIT state is supposed to catch stray
-	 * or duplicate segments arriving late.  If this segment was a
-	 * legitimate new connection attempt the old INPCB gets removed and
-	 * we can try again to find a listening socket.
-	 *
-	 * At this point, due to earlier optimism, we may hold only an inpcb
-	 * lock, and not the inpcbinfo write lock.  If so, we need to try to
-	 * acquire it, or if that fails, acquire a reference on the inpcb,
-	 * drop all locks, acquire a global write lock, and then re-acquire
-	 * the inpcb lock.  We may at that point discover that another thread
-	 * has tried to free the inpcb, in which case we need to loop back
-	 * and try to find a new inpcb to deliver to.
-	 *
-	 * XXXRW: It may be time to rethink timewait locking.
-	 */
 relocked:
-	if (inp->inp_flags & INP_TIMEWAIT) {
-		if (ti_locked == TI_UNLOCKED) {
-			if (INP_INFO_TRY_WLOCK(&V_tcbinfo) == 0) {
-				in_pcbref(inp);
-				INP_WUNLOCK(inp);
-				INP_INFO_WLOCK(&V_tcbinfo);
-				ti_locked = TI_WLOCKED;
-				INP_WLOCK(inp);
-				if (in_pcbrele_wlocked(inp)) {
-					inp = NULL;
-					goto findpcb;
-				}
-			} else
-				ti_locked = TI_WLOCKED;
-		}
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-
-		if (thflags & TH_SYN)
-			tcp_dooptions(&to, optp, optlen, TO_SYN);
-		/*
-		 * NB: tcp_twcheck unlocks the INP and frees the mbuf.
-		 */
-		if (tcp_twcheck(inp, &to, th, m, tlen))
-			goto findpcb;
-		INP_INFO_WUNLOCK(&V_tcbinfo);
-		return;
-	}
 	/*
 	 * The TCPCB may no longer exist if the connection is winding
 	 * down or it is in the CLOSED state.  Either way we drop the
@@ -1052,22 +1112,23 @@ relocked:
 
 	/*
 	 * We've identified a valid inpcb, but it could be that we need an
-	 * inpcbinfo write lock but don't hold it.  In this case, attempt to
-	 * acquire using the same strategy as the TIMEWAIT case above.  If we
-	 * relock, we have to jump back to 'relocked' as the connection might
-	 * now be in TIMEWAIT.
+	 * inpcbinfo lock but don't hold it.  In this case, attempt to
+	 * acquire it, or if that fails, acquire a reference on the inpcb,
+	 * drop all locks, acquire the inpcbinfo lock, and then re-acquire
+	 * the inpcb lock.  If we relock, we have to jump back to 'relocked'
+	 * as the connection might have changed state meanwhile.
 	 */
 #ifdef INVARIANTS
 	if ((thflags & (TH_SYN | TH_FIN | TH_RST)) != 0)
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 #endif
 	if (tp->t_state != TCPS_ESTABLISHED) {
 		if (ti_locked == TI_UNLOCKED) {
-			if (INP_INFO_TRY_WLOCK(&V_tcbinfo) == 0) {
+			if (INP_INFO_TRY_RLOCK(&V_tcbinfo) == 0) {
 				in_pcbref(inp);
 				INP_WUNLOCK(inp);
-				INP_INFO_WLOCK(&V_tcbinfo);
-				ti_locked = TI_WLOCKED;
+				INP_INFO_RLOCK(&V_tcbinfo);
+				ti_locked = TI_RLOCKED;
 				INP_WLOCK(inp);
 				if (in_pcbrele_wlocked(inp)) {
 					inp = NULL;
@@ -1075,9 +1136,9 @@ relocked:
 				}
 				goto relocked;
 			} else
-				ti_locked = TI_WLOCKED;
+				ti_locked = TI_RLOCKED;
 		}
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 	}
 
 #ifdef MAC
@@ -1111,7 +1172,7 @@ relocked:
 
 		KASSERT(tp->t_state == TCPS_LISTEN, ("%s: so accepting but "
 		    "tp not listening", __func__));
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 
 		bzero(&inc, sizeof(inc));
 #ifdef INET6
@@ -1242,11 +1303,7 @@ relocked:
 		 * causes.
 		 */
 		if (thflags & TH_RST) {
-#ifdef PROMISCUOUS_INET
 			syncache_chkrst(&inc, th, m);
-#else
-			syncache_chkrst(&inc, th);
-#endif /* PROMISCUOUS_INET */
 			goto dropunlock;
 		}
 		/*
@@ -1280,11 +1337,7 @@ relocked:
 				log(LOG_DEBUG, "%s; %s: Listen socket: "
 				    "SYN|ACK invalid, segment rejected\n",
 				    s, __func__);
-#ifdef PROMISCUOUS_INET
 			syncache_badack(&inc, m);	/* XXX: Not needed! */
-#else
-			syncache_badack(&inc);	/* XXX: Not needed! */
-#endif /* PROMISCUOUS_INET */
 			TCPSTAT_INC(tcps_badsyn);
 			rstreason = BANDLIM_RST_OPENPORT;
 			goto dropwithreset;
@@ -1443,7 +1496,28 @@ relocked:
 			    (void *)tcp_saveipgen, &tcp_savetcp, 0);
 #endif
 		tcp_dooptions(&to, optp, optlen, TO_SYN);
-		syncache_add(&inc, &to, th, inp, &so, m, -1);
+		if (syncache_add(&inc, &to, th, inp, &so, m, -1)) {
+			/*
+			 * A valid TCP Fast Open cookie created the
+			 * connection right away, in state SYN_RECEIVED.
+			 * As after syncache_expand(), unlock the listen
+			 * socket and let the new one process the SYN and
+			 * the data it carries.
+			 */
+			INP_WUNLOCK(inp);	/* listen socket */
+			inp = sotoinpcb(so);
+			INP_WLOCK(inp);		/* new connection */
+			tp = intotcpcb(inp);
+			/* Allow a response before the 3WHS completes. */
+			tp->snd_wnd = th->th_win;	/* never scaled */
+#ifdef INET_COPY
+			in_copy(inp, m);
+#endif
+			tcp_do_segment(m, th, optp, so, tp, drop_hdrlen, tlen,
+			    iptos, ti_locked, 0);
+			INP_INFO_UNLOCK_ASSERT(&V_tcbinfo);
+			return;
+		}
 		/*
 		 * Entry added to syncache and mbuf consumed.
 		 * Everything already unlocked by syncache_add().
@@ -1486,8 +1560,8 @@ relocked:
 	return;
 
 dropwithreset:
-	if (ti_locked == TI_WLOCKED) {
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+	if (ti_locked == TI_RLOCKED) {
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 		ti_locked = TI_UNLOCKED;
 	}
 #ifdef INVARIANTS
@@ -1507,8 +1581,8 @@ dropwithreset:
 	goto drop;
 
 dropunlock:
-	if (ti_locked == TI_WLOCKED) {
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+	if (ti_locked == TI_RLOCKED) {
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 		ti_locked = TI_UNLOCKED;
 	}
 #ifdef INVARIANTS
@@ -1553,7 +1627,7 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
     uint8_t iptos, int ti_locked, int no_unlock)
 {
 	int thflags, acked, ourfinisacked, needoutput = 0;
-	int rstreason, todrop, win;
+	int rstreason, todrop, win, rack_lost = 0;
 	u_long tiwin;
 	struct tcpopt to;
 
@@ -1571,26 +1645,20 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 
 	/*
 	 * If this is either a state-changing packet or current state isn't
-	 * established, we require a write lock on tcbinfo.  Otherwise, we
-	 * allow either a read lock or a write lock, as we may have acquired
-	 * a write lock due to a race.
-	 *
-	 * Require a global write lock for SYN/FIN/RST segments or
-	 * non-established connections; otherwise accept either a read or
-	 * write lock, as we may have conservatively acquired a write lock in
-	 * certain cases in tcp_input() (is this still true?).  Currently we
-	 * will never enter with no lock, so we try to drop it quickly in the
-	 * common pure ack/pure data cases.
+	 * established, we require a read lock on tcbinfo.  Otherwise, we
+	 * allow the lock to be held or not, as we may have acquired it
+	 * conservatively in tcp_input(), and we try to drop it quickly in
+	 * the common pure ack/pure data cases.
 	 */
 	if ((thflags & (TH_SYN | TH_FIN | TH_RST)) != 0 ||
 	    tp->t_state != TCPS_ESTABLISHED) {
-		KASSERT(ti_locked == TI_WLOCKED, ("%s ti_locked %d for "
+		KASSERT(ti_locked == TI_RLOCKED, ("%s ti_locked %d for "
 		    "SYN/FIN/RST/!EST", __func__, ti_locked));
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 	} else {
 #ifdef INVARIANTS
-		if (ti_locked == TI_WLOCKED)
-			INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		if (ti_locked == TI_RLOCKED)
+			INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 		else {
 			KASSERT(ti_locked == TI_UNLOCKED, ("%s: EST "
 			    "ti_locked: %d", __func__, ti_locked));
@@ -1716,7 +1784,7 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 	    tp->snd_nxt == tp->snd_max &&
 	    tiwin && tiwin == tp->snd_wnd && 
 	    ((tp->t_flags & (TF_NEEDSYN|TF_NEEDFIN)) == 0) &&
-	    LIST_EMPTY(&tp->t_segq) &&
+	    RB_EMPTY(&tp->t_segq) &&
 	    ((to.to_flags & TOF_TS) == 0 ||
 	     TSTMP_GEQ(to.to_tsval, tp->ts_recent)) ) {
 
@@ -1741,8 +1809,8 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 				/*
 				 * This is a pure ack for outstanding data.
 				 */
-				if (ti_locked == TI_WLOCKED)
-					INP_INFO_WUNLOCK(&V_tcbinfo);
+				if (ti_locked == TI_RLOCKED)
+					INP_INFO_RUNLOCK(&V_tcbinfo);
 				ti_locked = TI_UNLOCKED;
 
 				TCPSTAT_INC(tcps_predack);
@@ -1782,6 +1850,8 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 							ticks - tp->t_rtttime);
 				}
 				acked = BYTES_THIS_ACK(tp, th);
+				if (tp->t_rack != NULL)
+					(void) tcp_rack_input(tp, th, &to);
 
 				/* Run HHOOK_TCP_ESTABLISHED_IN helper hooks. */
 				hhook_run_tcp_est_in(tp, th, &to);
@@ -1831,6 +1901,8 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 				else if (!tcp_timer_active(tp, TT_PERSIST))
 					tcp_timer_activate(tp, TT_REXMT,
 						      tp->t_rxtcur);
+				if (tp->t_rack != NULL)
+					tcp_rack_timer_update(tp);
 				sowwakeup(so);
 				if (so->so_snd.sb_cc)
 					(void) tcp_output(tp);
@@ -1845,8 +1917,8 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 			 * nothing on the reassembly queue and we have enough
 			 * buffer space to take it.
 			 */
-			if (ti_locked == TI_WLOCKED)
-				INP_INFO_WUNLOCK(&V_tcbinfo);
+			if (ti_locked == TI_RLOCKED)
+				INP_INFO_RUNLOCK(&V_tcbinfo);
 			ti_locked = TI_UNLOCKED;
 
 			/* Clean receiver SACK report if present */
@@ -2019,6 +2091,13 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 			soisconnected(so);
 #ifdef MAC
 			mac_socketpeer_set_from_mbuf(m, so);
+#endif
+#ifdef PCBGROUP
+			/*
+			 * Home the connection in the pcbgroup selected by the
+			 * RSS hash its peer's segments arrive with.
+			 */
+			in_pcbgroup_update_mbuf(tp->t_inpcb, m);
 #endif
 			/* Do window scaling on this connection? */
 			if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
@@ -2028,6 +2107,29 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 			tp->rcv_adv += imin(tp->rcv_wnd,
 			    TCP_MAXWIN << tp->rcv_scale);
 			tp->snd_una++;		/* SYN is acked */
+			/*
+			 * TCP Fast Open: keep any cookie the server sent.
+			 * If it did not take the data in our SYN, send that
+			 * data again now, and forget a cookie that it turned
+			 * down without handing out a new one.
+			 */
+			if (tp->t_tfo_flags & TFO_CLIENT) {
+				if ((to.to_flags & TOF_FASTOPEN) &&
+				    to.to_tfo_len > 0)
+					tcp_hc_updatetfo(&tp->t_inpcb->inp_inc,
+					    to.to_tfo_cookie, to.to_tfo_len);
+				if (SEQ_GEQ(th->th_ack, tp->snd_max)) {
+					if (SEQ_GT(tp->snd_max, tp->snd_una))
+						TCPSTAT_INC(tcps_tfo_syn_data_acked);
+				} else {
+					tp->snd_nxt = th->th_ack;
+					if (tp->t_rxtshift == 0 &&
+					    !(to.to_flags & TOF_FASTOPEN))
+						tcp_hc_updatetfo(
+						    &tp->t_inpcb->inp_inc,
+						    NULL, 0);
+				}
+			}
 			/*
 			 * If there's data, delay ACK; if there's also a FIN
 			 * ACKNOW will be turned on later.
@@ -2076,9 +2178,9 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 			tp->t_state = TCPS_SYN_RECEIVED;
 		}
 
-		KASSERT(ti_locked == TI_WLOCKED, ("%s: trimthenstep6: "
+		KASSERT(ti_locked == TI_RLOCKED, ("%s: trimthenstep6: "
 		    "ti_locked %d", __func__, ti_locked));
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 		INP_WLOCK_ASSERT(tp->t_inpcb);
 
 		/*
@@ -2206,10 +2308,10 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 			case TCPS_CLOSE_WAIT:
 				so->so_error = ECONNRESET;
 			close:
-				KASSERT(ti_locked == TI_WLOCKED,
+				KASSERT(ti_locked == TI_RLOCKED,
 				    ("tcp_do_segment: TH_RST 1 ti_locked %d",
 				    ti_locked));
-				INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+				INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 
 				tp->t_state = TCPS_CLOSED;
 				TCPSTAT_INC(tcps_drops);
@@ -2218,10 +2320,10 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 
 			case TCPS_CLOSING:
 			case TCPS_LAST_ACK:
-				KASSERT(ti_locked == TI_WLOCKED,
+				KASSERT(ti_locked == TI_RLOCKED,
 				    ("tcp_do_segment: TH_RST 2 ti_locked %d",
 				    ti_locked));
-				INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+				INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 
 				tp = tcp_close(tp);
 				break;
@@ -2329,9 +2431,9 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 	    tp->t_state > TCPS_CLOSE_WAIT && tlen) {
 		char *s;
 
-		KASSERT(ti_locked == TI_WLOCKED, ("%s: SS_NOFDEREF && "
+		KASSERT(ti_locked == TI_RLOCKED, ("%s: SS_NOFDEREF && "
 		    "CLOSE_WAIT && tlen ti_locked %d", __func__, ti_locked));
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 
 		if ((s = tcp_log_addrs(&tp->t_inpcb->inp_inc, th, NULL, NULL))) {
 			log(LOG_DEBUG, "%s; %s: %s: Received %d bytes of data after socket "
@@ -2410,9 +2512,9 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 	 * error and we send an RST and drop the connection.
 	 */
 	if (thflags & TH_SYN) {
-		KASSERT(ti_locked == TI_WLOCKED,
+		KASSERT(ti_locked == TI_RLOCKED,
 		    ("tcp_do_segment: TH_SYN ti_locked %d", ti_locked));
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+		INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 
 		tp = tcp_drop(tp, ECONNRESET);
 		rstreason = BANDLIM_UNLIMITED;
@@ -2450,6 +2552,17 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 
 		TCPSTAT_INC(tcps_connects);
 		soisconnected(so);
+		/*
+		 * A Fast Open connection was created before its SYN|ACK
+		 * went out.  Account for the ACK of that SYN here so that
+		 * it is not taken out of the send buffer below.
+		 */
+		if (tp->t_tfo_flags & TFO_PENDING) {
+			tp->t_tfo_flags &= ~TFO_PENDING;
+			tp->snd_una++;
+			if (tp->snd_una == tp->snd_max)
+				tcp_timer_activate(tp, TT_REXMT, 0);
+		}
 		/* Do window scaling? */
 		if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
 			(TF_RCVD_SCALE|TF_REQ_SCALE)) {
@@ -2506,7 +2619,9 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 				printf(">>>>>>. drop after ack (4)\n");
 			goto dropafterack;
 		}
-		if ((tp->t_flags & TF_SACK_PERMIT) &&
+		if (tp->t_rack != NULL)
+			rack_lost = tcp_rack_input(tp, th, &to);
+		else if ((tp->t_flags & TF_SACK_PERMIT) &&
 		    ((to.to_flags & TOF_SACK) ||
 		     !TAILQ_EMPTY(&tp->snd_holes)))
 			tcp_sack_doack(tp, &to, th->th_ack);
@@ -2571,7 +2686,8 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 						tp->snd_cwnd += tp->t_maxseg;
 					(void) tcp_output(tp);
 					goto drop;
-				} else if (tp->t_dupacks == tcprexmtthresh) {
+				} else if (tp->t_dupacks == tcprexmtthresh ||
+				    rack_lost) {
 					tcp_seq onxt = tp->snd_nxt;
 
 					/*
@@ -2601,6 +2717,9 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 					if (tp->t_flags & TF_SACK_PERMIT) {
 						TCPSTAT_INC(
 						    tcps_sack_recovery_episode);
+						if (tp->t_dupacks < tcprexmtthresh)
+							TCPSTAT_INC(
+							    tcps_rack_recovery);
 						tp->sack_newdata = tp->snd_nxt;
 						tp->snd_cwnd = tp->t_maxseg;
 						(void) tcp_output(tp);
@@ -2793,6 +2912,8 @@ process_ACK:
 		}
 		if (SEQ_LT(tp->snd_nxt, tp->snd_una))
 			tp->snd_nxt = tp->snd_una;
+		if (tp->t_rack != NULL)
+			tcp_rack_timer_update(tp);
 
 		switch (tp->t_state) {
 
@@ -2833,9 +2954,9 @@ process_ACK:
 		 */
 		case TCPS_CLOSING:
 			if (ourfinisacked) {
-				INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+				INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 				tcp_twstart(tp);
-				INP_INFO_WUNLOCK(&V_tcbinfo);
+				INP_INFO_RUNLOCK(&V_tcbinfo);
 				m_freem(m);
 				if (V_tcp_passive_trace)
 					printf(">>>>>>>>>>>>>>>>>>> CLOSING finisacked tlen=%u\n", tlen);
@@ -2851,7 +2972,7 @@ process_ACK:
 		 */
 		case TCPS_LAST_ACK:
 			if (ourfinisacked) {
-				INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+				INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
 				tp = tcp_close(tp);
 				goto drop;
 			}
@@ -2862,6 +2983,10 @@ process_ACK:
 step6:
 	INP_WLOCK_ASSERT(tp->t_inpcb);
 
+	/* RACK found a loss on an ACK that was not a plain duplicate. */
+	if (rack_lost && !IN_FASTRECOVERY(tp->t_flags))
+		tcp_rack_recover(tp);
+
 	/*
 	 * Update window information.
 	 * Don't look at window if no ACK: TAC's send garbage on first SYN.
@@ -2972,10 +3097,15 @@ dodata:							/* XXX */
 		 * immediately when segments are out of order (so
 		 * fast retransmit can work).
 		 */
+		/*
+		 * Data in a Fast Open SYN is delivered right away, and
+		 * the SYN|ACK that acknowledges it goes out immediately.
+		 */
 		if (th->th_seq == tp->rcv_nxt &&
-		    LIST_EMPTY(&tp->t_segq) &&
-		    TCPS_HAVEESTABLISHED(tp->t_state)) {
-			if (DELAY_ACK(tp))
+		    RB_EMPTY(&tp->t_segq) &&
+		    (TCPS_HAVEESTABLISHED(tp->t_state) ||
+		     (tp->t_tfo_flags & TFO_PENDING))) {
+			if (DELAY_ACK(tp) && TCPS_HAVEESTABLISHED(tp->t_state))
 				tp->t_flags |= TF_DELACK;
 			else
 				tp->t_flags |= TF_ACKNOW;
@@ -3067,18 +3197,18 @@ dodata:							/* XXX */
 		 * standard timers.
 		 */
 		case TCPS_FIN_WAIT_2:
-			INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-			KASSERT(ti_locked == TI_WLOCKED, ("%s: dodata "
+			INP_INFO_RLOCK_ASSERT(&V_tcbinfo);
+			KASSERT(ti_locked == TI_RLOCKED, ("%s: dodata "
 			    "TCP_FIN_WAIT_2 ti_locked: %d", __func__,
 			    ti_locked));
 
 			tcp_twstart(tp);
-			INP_INFO_WUNLOCK(&V_tcbinfo);
+			INP_INFO_RUNLOCK(&V_tcbinfo);
 			return;
 		}
 	}
-	if (no_unlock == 0 && ti_locked == TI_WLOCKED) {
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+	if (no_unlock == 0 && ti_locked == TI_RLOCKED) {
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 		ti_locked = TI_UNLOCKED;
 	}
 
@@ -3148,8 +3278,8 @@ dropafterack:
 		tcp_trace(TA_DROP, ostate, tp, (void *)tcp_saveipgen,
 			  &tcp_savetcp, 0);
 #endif
-	if (ti_locked == TI_WLOCKED)
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+	if (ti_locked == TI_RLOCKED)
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 	ti_locked = TI_UNLOCKED;
 
 	tp->t_flags |= TF_ACKNOW;
@@ -3164,8 +3294,8 @@ dropwithreset:
 		if (thflags & TH_FIN)
 			printf (">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>. DROPPING FIN (2)\n");
 	}
-	if (ti_locked == TI_WLOCKED)
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+	if (ti_locked == TI_RLOCKED)
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 	ti_locked = TI_UNLOCKED;
 
 	if (tp != NULL) {
@@ -3186,8 +3316,8 @@ drop:
 		if (thflags & TH_FIN)
 			printf (">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>. DROPPING FIN (3)\n");
 	}
-	if (ti_locked == TI_WLOCKED) {
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+	if (ti_locked == TI_RLOCKED) {
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 		ti_locked = TI_UNLOCKED;
 	}
 #ifdef INVARIANTS
@@ -3363,6 +3493,23 @@ tcp_dooptions(struct tcpopt *to, const uint8_t *cp, int cnt, int flags)
 			to->to_sacks = cp + 2;
 			TCPSTAT_INC(tcps_sack_rcv_blocks);
 			break;
+		case TCPOPT_FAST_OPEN:
+			/*
+			 * A zero-length cookie is a cookie request; anything
+			 * else must be a cookie of a plausible length.
+			 */
+			if (optlen != TCPOLEN_FAST_OPEN_EMPTY &&
+			    (optlen < TCPOLEN_FAST_OPEN_EMPTY +
+			     TCP_FASTOPEN_MIN_COOKIE_LEN ||
+			     optlen > TCPOLEN_FAST_OPEN_EMPTY +
+			     TCP_FASTOPEN_MAX_COOKIE_LEN))
+				continue;
+			if (!(flags & TO_SYN))
+				continue;
+			to->to_flags |= TOF_FASTOPEN;
+			to->to_tfo_len = optlen - TCPOLEN_FAST_OPEN_EMPTY;
+			to->to_tfo_cookie = cp + 2;
+			break;
 		default:
 			continue;
 		}
@@ -109,20 +109,20 @@ void
 tcp_offload_twstart(struct tcpcb *tp)
 {
 
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	INP_WLOCK(tp->t_inpcb);
 	tcp_twstart(tp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 }
 
 struct tcpcb *
 tcp_offload_close(struct tcpcb *tp)
 {
 
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	INP_WLOCK(tp->t_inpcb);
 	tp = tcp_close(tp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 	if (tp)
 		INP_WUNLOCK(tp->t_inpcb);
 
@@ -133,10 +133,10 @@ struct tcpcb *
 tcp_offload_drop(struct tcpcb *tp, int error)
 {
 
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	INP_WLOCK(tp->t_inpcb);
 	tp = tcp_drop(tp, error);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 	if (tp)
 		INP_WUNLOCK(tp->t_inpcb);
 
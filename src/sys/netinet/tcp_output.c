@@ -104,6 +104,12 @@ SYSCTL_VNET_INT(_net_inet_tcp, OID_AUTO, local_slowstart_flightsize,
 	CTLFLAG_RW, &VNET_NAME(ss_fltsz_local), 1,
 	"Slow start flight size for local networks");
 
+VNET_DEFINE(int, tcp_pace_horizon) = 20000;
+#define	V_tcp_pace_horizon	VNET(tcp_pace_horizon)
+SYSCTL_VNET_INT(_net_inet_tcp, OID_AUTO, pace_horizon, CTLFLAG_RW,
+	&VNET_NAME(tcp_pace_horizon), 0,
+	"How far ahead of real time (us) paced segments may be queued");
+
 VNET_DEFINE(int, tcp_do_tso) = 1;
 #define	V_tcp_do_tso		VNET(tcp_do_tso)
 SYSCTL_VNET_INT(_net_inet_tcp, OID_AUTO, tso, CTLFLAG_RW,
@@ -132,6 +138,9 @@ static void inline	hhook_run_tcp_est_out(struct tcpcb *tp,
 			    struct tcphdr *th, struct tcpopt *to,
 			    long len, int tso);
 static void inline	cc_after_idle(struct tcpcb *tp);
+static void inline	tcp_rate_sent(struct tcpcb *tp, tcp_seq startseq,
+			    long len, int app_limited);
+static uint64_t inline	tcp_pacing_rate(struct tcpcb *tp);
 
 /*
  * Wrapper for the TCP established ouput helper hook.
@@ -166,6 +175,51 @@ cc_after_idle(struct tcpcb *tp)
 		CC_ALGO(tp)->after_idle(tp->ccv);
 }
 
+/*
+ * Start a delivery rate sample on a newly sent segment.  As with RTT timing,
+ * only one segment per connection is sampled at a time; tcp_rate_acked()
+ * completes the sample when the segment is cumulatively acknowledged.
+ */
+static void inline
+tcp_rate_sent(struct tcpcb *tp, tcp_seq startseq, long len, int app_limited)
+{
+	uint64_t now;
+
+	now = tcp_rate_getus();
+
+	/*
+	 * Nothing was in flight, so the delivery clock starts now rather
+	 * than at the last ACK before the idle period.
+	 */
+	if (startseq == tp->snd_una)
+		tp->t_delivered_us = now;
+
+	tp->t_rs_seq = startseq + len;
+	tp->t_rs_sent_us = now;
+	tp->t_rs_delivered = tp->t_delivered;
+	tp->t_rs_delivered_us = tp->t_delivered_us;
+	tp->t_rs_flags = TRS_TIMING;
+	if (app_limited)
+		tp->t_rs_flags |= TRS_APPLIMITED;
+}
+
+/*
+ * The rate to pace this connection at in bytes per second: the CC
+ * algorithm's rate, capped by SO_MAX_PACING_RATE.  Zero means unpaced.
+ */
+static uint64_t inline
+tcp_pacing_rate(struct tcpcb *tp)
+{
+	uint64_t rate, max_rate;
+
+	rate = tp->t_pacing_rate;
+	max_rate = tp->t_inpcb->inp_socket->so_max_pacing_rate;
+	if (max_rate != 0 && (rate == 0 || rate > max_rate))
+		rate = max_rate;
+
+	return (rate);
+}
+
 /*
  * Tcp output routine: figure out what should be sent and send it.
  */
@@ -184,9 +238,10 @@ tcp_output(struct tcpcb *tp)
 	unsigned ipsec_optlen = 0;
 #endif
 	int idle, sendalot;
+	uint64_t pacing_rate, now_us;
 	int sack_rxmit, sack_bytes_rxmt;
 	struct sackhole *p;
-	int tso;
+	int tso, tfo_syn;
 	struct tcpopt to;
 #if 0
 	int maxburst = TCP_MAXBURST;
@@ -388,9 +443,12 @@ after_sack_rexmit:
 	 * Lop off SYN bit if it has already been sent.  However, if this
 	 * is SYN-SENT state and if segment contains data and if we don't
 	 * know that foreign host supports TAO, suppress sending segment.
+	 * A Fast Open server sends its data after the SYN|ACK without
+	 * waiting for the handshake to complete.
 	 */
 	if ((flags & TH_SYN) && SEQ_GT(tp->snd_nxt, tp->snd_una)) {
-		if (tp->t_state != TCPS_SYN_RECEIVED)
+		if (tp->t_state != TCPS_SYN_RECEIVED ||
+		    (tp->t_tfo_flags & TFO_PENDING))
 			flags &= ~TH_SYN;
 		off--, len++;
 	}
@@ -405,6 +463,24 @@ after_sack_rexmit:
 		flags &= ~TH_FIN;
 	}
 
+	/*
+	 * TCP Fast Open: only the first transmission of a client SYN
+	 * carries data, one segment of it, and only when we hold a cookie
+	 * for the peer.  Without one the SYN asks for a cookie instead.
+	 * Nothing else goes out before the SYN|ACK, and a SYN|ACK never
+	 * carries data.
+	 */
+	tfo_syn = 0;
+	if ((tp->t_tfo_flags & TFO_CLIENT) && tp->t_state == TCPS_SYN_SENT) {
+		if (!(flags & TH_SYN) || tp->t_rxtshift > 0 ||
+		    tp->t_tfo_cookie_len == 0)
+			len = 0;
+		else if (len > tp->t_maxseg)
+			len = tp->t_maxseg;
+		tfo_syn = (flags & TH_SYN) != 0;
+	} else if ((tp->t_tfo_flags & TFO_PENDING) && (flags & TH_SYN))
+		len = 0;
+
 	if (len < 0) {
 		/*
 		 * If FIN has been sent but not acked,
@@ -659,6 +735,27 @@ just_return:
 
 send:
 	SOCKBUF_LOCK_ASSERT(&so->so_snd);
+	/*
+	 * Paced data segments carry their departure time down to the
+	 * interface.  Stop queueing once departures run more than the
+	 * horizon ahead of real time and let the pace timer resume output;
+	 * segments that must go out now (ACKs owed, SYN, FIN, RST) are
+	 * never held.
+	 */
+	pacing_rate = 0;
+	now_us = 0;
+	if (len > 0 && (pacing_rate = tcp_pacing_rate(tp)) != 0) {
+		now_us = tcp_rate_getus();
+		if ((tp->t_flags & TF_ACKNOW) == 0 &&
+		    (flags & (TH_SYN|TH_FIN|TH_RST)) == 0 &&
+		    tp->t_pace_next_us > now_us + V_tcp_pace_horizon) {
+			if (!tcp_timer_active(tp, TT_PACE))
+				tcp_timer_activate(tp, TT_PACE,
+				    (tp->t_pace_next_us - now_us -
+				    V_tcp_pace_horizon) / tick + 1);
+			goto just_return;
+		}
+	}
 	/*
 	 * Before ESTABLISHED, force sending of initial options
 	 * unless TCP set not to do any options.
@@ -717,6 +814,12 @@ send:
 				to.to_sacks = (u_char *)tp->sackblks;
 			}
 		}
+		/* TCP Fast Open cookie, or a request for one. */
+		if (tfo_syn) {
+			to.to_tfo_len = tp->t_tfo_cookie_len;
+			to.to_tfo_cookie = tp->t_tfo_cookie;
+			to.to_flags |= TOF_FASTOPEN;
+		}
 #ifdef TCP_SIGNATURE
 		/* TCP-MD5 (RFC2385). */
 		if (tp->t_flags & TF_SIGNATURE)
@@ -725,6 +828,13 @@ send:
 
 		/* Processing the options. */
 		hdrlen += optlen = tcp_addoptions(&to, opt);
+
+		if (tfo_syn) {
+			if ((to.to_flags & TOF_FASTOPEN) == 0)
+				len = 0;
+			else if (len > 0)
+				TCPSTAT_INC(tcps_tfo_syn_data_sent);
+		}
 	}
 
 #ifdef INET6
@@ -904,6 +1014,12 @@ send:
 	}
 	SOCKBUF_UNLOCK_ASSERT(&so->so_snd);
 	m->m_pkthdr.rcvif = (struct ifnet *)0;
+	if (pacing_rate != 0) {
+		m->m_pkthdr.txtime = tp->t_pace_next_us > now_us ?
+		    tp->t_pace_next_us : now_us;
+		tp->t_pace_next_us = m->m_pkthdr.txtime +
+		    (uint64_t)(len + hdrlen + ipoptlen) * 1000000 / pacing_rate;
+	}
 #ifdef MAC
 	mac_inpcb_create_mbuf(tp->t_inpcb, m);
 #endif
@@ -1145,6 +1261,10 @@ send:
 				tp->t_rtseq = startseq;
 				TCPSTAT_INC(tcps_segstimed);
 			}
+			if ((tp->t_rs_flags & TRS_TIMING) == 0 && len > 0)
+				tcp_rate_sent(tp, startseq, len,
+				    off + len >= so->so_snd.sb_cc &&
+				    tp->snd_max - tp->snd_una < tp->snd_cwnd);
 		}
 
 		/*
@@ -1156,6 +1276,8 @@ send:
 		 * of retransmit time.
 		 */
 timer:
+		if (tp->t_rack != NULL && len > 0)
+			tcp_rack_sent(tp, sack_rxmit ? p : NULL, startseq, len);
 		if (!tcp_timer_active(tp, TT_REXMT) &&
 		    ((sack_rxmit && tp->snd_nxt != tp->snd_max) ||
 		     (tp->snd_nxt != tp->snd_una))) {
@@ -1254,8 +1376,8 @@ timer:
 		ip->ip_off |= htons(IP_DF);
 
 	error = ip_output(m, tp->t_inpcb->inp_options, NULL,
-	    ((so->so_options & SO_DONTROUTE) ? IP_ROUTETOIF : 0), 0,
-	    tp->t_inpcb);
+	    ((so->so_options & SO_DONTROUTE) ? IP_ROUTETOIF : 0) |
+	    IP_INPWLOCKED, 0, tp->t_inpcb);
     }
 #endif /* INET */
 	if (error) {
@@ -1388,6 +1510,8 @@ tcp_setpersist(struct tcpcb *tp)
  * The optimal order for a SYN/SYN-ACK segment is:
  *   MSS (4) + NOP (1) + Window scale (3) + SACK permitted (2) +
  *   Timestamp (10) + Signature (18) = 38 bytes out of a maximum of 40.
+ * A Fast Open cookie (2 + 4..16) goes last and is dropped if it does
+ * not fit, which it never does alongside a signature.
  *
  * The SACK options should be last.  SACK blocks consume 8*n+2 bytes.
  * So a full size SACK blocks option is 34 bytes (with 4 SACK blocks).
@@ -1508,6 +1632,25 @@ tcp_addoptions(struct tcpopt *to, u_char *optp)
 			TCPSTAT_INC(tcps_sack_send_blocks);
 			break;
 			}
+		case TOF_FASTOPEN:
+			{
+			int tfolen = TCPOLEN_FAST_OPEN_EMPTY + to->to_tfo_len;
+
+			/*
+			 * Clear the flag when the cookie does not fit so
+			 * that the caller knows not to put data in the SYN.
+			 */
+			if (TCP_MAXOLEN - optlen < tfolen) {
+				to->to_flags &= ~TOF_FASTOPEN;
+				continue;
+			}
+			optlen += tfolen;
+			*optp++ = TCPOPT_FAST_OPEN;
+			*optp++ = tfolen;
+			bcopy(to->to_tfo_cookie, optp, to->to_tfo_len);
+			optp += to->to_tfo_len;
+			break;
+			}
 		default:
 			panic("%s: unknown TCP option type", __func__);
 			break;
@@ -0,0 +1,631 @@
+/*-
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * RACK loss detection and Tail Loss Probes (RFC 8985).
+ *
+ * Instead of counting duplicate ACKs, RACK deems a segment lost once a
+ * segment sent after it has been delivered and a reordering window has
+ * passed since.  Send times of original transmissions are kept in a small
+ * per-connection log in sequence order; retransmissions are timestamped on
+ * the SACK scoreboard hole they were sent from, so that a lost
+ * retransmission can be detected and its hole rewound.  The recovery itself
+ * is still carried out by the SACK code in tcp_input() and tcp_output().
+ *
+ * While not in recovery, TLP arms a probe timeout of about two SRTTs.  When
+ * it fires, one new segment, or failing that the last segment again, is
+ * sent so that a tail loss draws a SACK and is repaired by RACK rather than
+ * by the retransmit timer.
+ */
+
+#include <sys/cdefs.h>
+
+#include "opt_inet.h"
+#include "opt_inet6.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/libkern.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+#include <sys/sysctl.h>
+
+#include <net/if.h>
+#include <net/route.h>
+#include <net/vnet.h>
+
+#include <netinet/cc.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcpip.h>
+
+/* Number of original transmissions remembered per connection. */
+#define	TCP_RACK_NSENT		64
+
+/* Upper bound on the reordering window multiplier grown by DSACKs. */
+#define	TCP_RACK_REO_MULT_MAX	16
+
+struct tcp_rack_sent {
+	tcp_seq		end;		/* range starts at the previous end */
+	int		flags;
+	uint64_t	xmit_us;	/* last send time, 0 if unknown */
+};
+
+#define	RACK_SENT_RXMIT		0x01	/* range was sent more than once */
+
+struct tcp_rack {
+	uint64_t	xmit_us;	/* send time of latest delivered seg */
+	tcp_seq		end_seq;	/* ... its end */
+	uint32_t	rtt_us;		/* ... and its RTT */
+	tcp_seq		fack;		/* highest delivered sequence */
+	uint32_t	min_rtt_us;
+	uint32_t	srtt_us;
+	int		reo_mult;	/* reordering window, in min_rtt/4 */
+	int		flags;
+	tcp_seq		tlp_high_seq;	/* snd_max when the probe was sent */
+
+	tcp_seq		sent_start;	/* start of the oldest logged range */
+	int		sent_head;
+	int		sent_count;
+	struct tcp_rack_sent sent[TCP_RACK_NSENT];
+};
+
+#define	RACK_REORDER	0x01		/* reordering has been observed */
+#define	RACK_REO_TIMER	0x02		/* TT_RACK is a reordering timeout */
+#define	RACK_TLP_TIMER	0x04		/* TT_RACK is a probe timeout */
+#define	RACK_TLP_OUT	0x08		/* a probe is outstanding */
+#define	RACK_TLP_RXMIT	0x10		/* ... and it was a retransmission */
+
+#define	RACK_SENT(rack, i)						\
+	(&(rack)->sent[((rack)->sent_head + (i)) % TCP_RACK_NSENT])
+
+static MALLOC_DEFINE(M_TCPRACK, "tcprack", "TCP RACK/TLP state");
+
+SYSCTL_NODE(_net_inet_tcp, OID_AUTO, rack, CTLFLAG_RW, 0, "TCP RACK/TLP");
+
+VNET_DEFINE(int, tcp_do_rack) = 0;
+SYSCTL_VNET_INT(_net_inet_tcp_rack, OID_AUTO, enable, CTLFLAG_RW,
+    &VNET_NAME(tcp_do_rack), 0,
+    "Use RACK loss detection on new connections");
+
+static VNET_DEFINE(int, tcp_rack_tlp) = 1;
+#define	V_tcp_rack_tlp			VNET(tcp_rack_tlp)
+SYSCTL_VNET_INT(_net_inet_tcp_rack, OID_AUTO, tlp, CTLFLAG_RW,
+    &VNET_NAME(tcp_rack_tlp), 0,
+    "Send tail loss probes on RACK connections");
+
+int
+tcp_rack_init(struct tcpcb *tp)
+{
+	struct tcp_rack *rack;
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	if (tp->t_rack != NULL)
+		return (0);
+	rack = malloc(sizeof(*rack), M_TCPRACK, M_NOWAIT | M_ZERO);
+	if (rack == NULL)
+		return (ENOMEM);
+	rack->reo_mult = 1;
+	rack->sent_start = tp->snd_una;
+	rack->fack = tp->snd_una;
+	tp->t_rack = rack;
+	return (0);
+}
+
+void
+tcp_rack_discard(struct tcpcb *tp)
+{
+
+	if (tp->t_rack == NULL)
+		return;
+	tcp_timer_activate(tp, TT_RACK, 0);
+	free(tp->t_rack, M_TCPRACK);
+	tp->t_rack = NULL;
+}
+
+static void
+tcp_rack_log_append(struct tcp_rack *rack, tcp_seq end, int flags,
+    uint64_t xmit_us)
+{
+	struct tcp_rack_sent *rs;
+
+	/*
+	 * When the log is full, fold the new range into the newest entry.
+	 * That only makes the folded data look more recently sent, which
+	 * delays rather than hastens declaring it lost.
+	 */
+	if (rack->sent_count == TCP_RACK_NSENT) {
+		rs = RACK_SENT(rack, rack->sent_count - 1);
+		rs->flags |= flags;
+	} else {
+		rs = RACK_SENT(rack, rack->sent_count);
+		rack->sent_count++;
+		rs->flags = flags;
+	}
+	rs->end = end;
+	rs->xmit_us = xmit_us;
+}
+
+static void
+tcp_rack_log(struct tcp_rack *rack, tcp_seq start, tcp_seq end, uint64_t now)
+{
+	struct tcp_rack_sent *rs;
+	tcp_seq tail, prev;
+	int flags;
+
+	flags = 0;
+	if (rack->sent_count == 0) {
+		rack->sent_start = start;
+		/* First transmission, nothing delivered yet. */
+		if (rack->xmit_us == 0)
+			rack->fack = start;
+	} else {
+		tail = RACK_SENT(rack, rack->sent_count - 1)->end;
+		if (SEQ_LT(start, tail)) {
+			/*
+			 * Resending below the tail (after a timeout or for a
+			 * probe): drop what the log says about the data from
+			 * here on, it is being sent again.
+			 */
+			flags = RACK_SENT_RXMIT;
+			while (rack->sent_count > 0) {
+				rs = RACK_SENT(rack, rack->sent_count - 1);
+				prev = (rack->sent_count > 1) ?
+				    RACK_SENT(rack, rack->sent_count - 2)->end :
+				    rack->sent_start;
+				if (SEQ_LT(prev, start)) {
+					rs->end = start;
+					break;
+				}
+				rack->sent_count--;
+			}
+			if (rack->sent_count == 0)
+				rack->sent_start = start;
+		} else if (SEQ_GT(start, tail))
+			tcp_rack_log_append(rack, start, 0, 0);
+	}
+	tcp_rack_log_append(rack, end, flags, now);
+}
+
+/*
+ * Find the log entry covering seq.
+ */
+static struct tcp_rack_sent *
+tcp_rack_lookup(struct tcp_rack *rack, tcp_seq seq)
+{
+	int lo, hi, mid;
+
+	if (rack->sent_count == 0 || SEQ_LT(seq, rack->sent_start))
+		return (NULL);
+	lo = 0;
+	hi = rack->sent_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (SEQ_GT(RACK_SENT(rack, mid)->end, seq))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if (lo == rack->sent_count)
+		return (NULL);
+	return (RACK_SENT(rack, lo));
+}
+
+/*
+ * Record the transmission of [start, start + len), either from the SACK
+ * hole p or, if p is NULL, in sequence.
+ */
+void
+tcp_rack_sent(struct tcpcb *tp, struct sackhole *p, tcp_seq start, long len)
+{
+	struct tcp_rack *rack = tp->t_rack;
+	uint64_t now;
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	now = tcp_rate_getus();
+	if (p != NULL)
+		p->rxmit_us = now;
+	else
+		tcp_rack_log(rack, start, start + len, now);
+	if ((rack->flags & RACK_REO_TIMER) == 0)
+		tcp_rack_timer_update(tp);
+}
+
+/*
+ * Update the RACK state for delivery of data sent at xmit_us and ending at
+ * end (RFC 8985, section 6.2).
+ */
+static void
+tcp_rack_advance(struct tcp_rack *rack, uint64_t xmit_us, tcp_seq end,
+    int rxmit, uint64_t now)
+{
+	uint32_t rtt;
+
+	if (xmit_us == 0 || xmit_us > now)
+		return;
+	rtt = now - xmit_us;
+	if (rxmit) {
+		/*
+		 * An RTT below the minimum means it was probably the
+		 * original transmission that got through.
+		 */
+		if (rtt < rack->min_rtt_us)
+			return;
+	} else {
+		if (rack->min_rtt_us == 0 || rtt < rack->min_rtt_us)
+			rack->min_rtt_us = rtt;
+		if (rack->srtt_us == 0)
+			rack->srtt_us = rtt;
+		else
+			rack->srtt_us += ((int64_t)rtt - rack->srtt_us) / 8;
+		if (SEQ_LT(end, rack->fack))
+			rack->flags |= RACK_REORDER;
+	}
+	if (SEQ_GT(end, rack->fack))
+		rack->fack = end;
+	if (xmit_us > rack->xmit_us ||
+	    (xmit_us == rack->xmit_us && SEQ_GT(end, rack->end_seq))) {
+		rack->xmit_us = xmit_us;
+		rack->end_seq = end;
+		rack->rtt_us = rtt;
+	}
+}
+
+/*
+ * Account for the ACK or SACK of [s, e), considering only the parts that
+ * were not already SACKed, i.e. that overlap a hole or lie beyond the
+ * scoreboard.  Must be called before tcp_sack_doack() updates it.
+ */
+static void
+tcp_rack_delivered(struct tcpcb *tp, struct tcp_rack *rack, tcp_seq s,
+    tcp_seq e, uint64_t now)
+{
+	struct sackhole *p;
+	struct tcp_rack_sent *rs;
+	tcp_seq a, b, fack;
+
+	TAILQ_FOREACH(p, &tp->snd_holes, scblink) {
+		if (SEQ_LEQ(p->end, s))
+			continue;
+		if (SEQ_GEQ(p->start, e))
+			break;
+		a = SEQ_MAX(s, p->start);
+		b = SEQ_MIN(e, p->rxmit);
+		if (SEQ_LT(a, b))
+			tcp_rack_advance(rack, p->rxmit_us, b, 1, now);
+		a = SEQ_MAX(s, p->rxmit);
+		b = SEQ_MIN(e, p->end);
+		if (SEQ_LT(a, b) && (rs = tcp_rack_lookup(rack, b - 1)) != NULL)
+			tcp_rack_advance(rack, rs->xmit_us, b,
+			    rs->flags & RACK_SENT_RXMIT, now);
+	}
+	fack = TAILQ_EMPTY(&tp->snd_holes) ? tp->snd_una : tp->snd_fack;
+	if (SEQ_GT(e, fack) && (rs = tcp_rack_lookup(rack, e - 1)) != NULL)
+		tcp_rack_advance(rack, rs->xmit_us, e,
+		    rs->flags & RACK_SENT_RXMIT, now);
+}
+
+/*
+ * Process the cumulative ACK and SACK blocks of an incoming segment.
+ * Returns non-zero if it ends a probe episode in which the probe
+ * retransmission repaired a loss, so that the caller applies the
+ * congestion response (RFC 8985, section 7.4).
+ */
+int
+tcp_rack_ack(struct tcpcb *tp, struct tcpopt *to, tcp_seq th_ack)
+{
+	struct tcp_rack *rack = tp->t_rack;
+	struct sackblk sack;
+	uint64_t now;
+	int i, dsack, repaired;
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	now = tcp_rate_getus();
+	if (SEQ_GT(th_ack, tp->snd_una))
+		tcp_rack_delivered(tp, rack, tp->snd_una, th_ack, now);
+	dsack = 0;
+	if (to->to_flags & TOF_SACK) {
+		for (i = 0; i < to->to_nsacks; i++) {
+			bcopy((to->to_sacks + i * TCPOLEN_SACK),
+			    &sack, sizeof(sack));
+			sack.start = ntohl(sack.start);
+			sack.end = ntohl(sack.end);
+			if (i == 0 && SEQ_LEQ(sack.end, th_ack)) {
+				dsack = 1;
+				continue;
+			}
+			if (SEQ_GT(sack.end, sack.start) &&
+			    SEQ_GT(sack.start, tp->snd_una) &&
+			    SEQ_GT(sack.start, th_ack) &&
+			    SEQ_LEQ(sack.end, tp->snd_max))
+				tcp_rack_delivered(tp, rack, sack.start,
+				    sack.end, now);
+		}
+	}
+
+	/*
+	 * A DSACK means something was delivered twice, most likely because
+	 * of reordering; widen the reordering window.
+	 */
+	if (dsack) {
+		rack->flags |= RACK_REORDER;
+		if (rack->reo_mult < TCP_RACK_REO_MULT_MAX)
+			rack->reo_mult++;
+	}
+
+	while (rack->sent_count > 0 &&
+	    SEQ_LEQ(RACK_SENT(rack, 0)->end, th_ack)) {
+		rack->sent_start = RACK_SENT(rack, 0)->end;
+		rack->sent_head = (rack->sent_head + 1) % TCP_RACK_NSENT;
+		rack->sent_count--;
+	}
+	if (SEQ_LT(rack->sent_start, th_ack))
+		rack->sent_start = th_ack;
+
+	repaired = 0;
+	if ((rack->flags & RACK_TLP_OUT) &&
+	    SEQ_GEQ(th_ack, rack->tlp_high_seq)) {
+		if ((rack->flags & RACK_TLP_RXMIT) && !dsack &&
+		    !IN_RECOVERY(tp->t_flags)) {
+			TCPSTAT_INC(tcps_tlp_recovered);
+			repaired = 1;
+		}
+		rack->flags &= ~(RACK_TLP_OUT | RACK_TLP_RXMIT);
+	}
+	return (repaired);
+}
+
+static uint64_t
+tcp_rack_reo_wnd(struct tcpcb *tp, struct tcp_rack *rack)
+{
+	uint64_t reo;
+
+	if ((rack->flags & RACK_REORDER) == 0 && IN_FASTRECOVERY(tp->t_flags))
+		return (0);
+	reo = (uint64_t)rack->min_rtt_us / 4 * rack->reo_mult;
+	if (rack->srtt_us != 0 && reo > rack->srtt_us)
+		reo = rack->srtt_us;
+	return (reo);
+}
+
+/*
+ * Walk the scoreboard after it has been updated for an ACK and mark lost
+ * whatever was sent more than a reordering window before the most recently
+ * delivered segment (RFC 8985, section 6.2, step 5).  A lost retransmission
+ * rewinds its hole so that tcp_output() sends it again.  Returns non-zero
+ * if anything was found lost; if some data is not yet overdue, the
+ * reordering timer is armed for it.
+ */
+int
+tcp_rack_detect(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = tp->t_rack;
+	struct tcp_rack_sent *rs;
+	struct sackhole *p;
+	uint64_t now, reo, deadline, wait;
+	int lost, hint_seen;
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	lost = 0;
+	wait = 0;
+	if (rack->xmit_us == 0 || TAILQ_EMPTY(&tp->snd_holes))
+		goto out;
+
+	now = tcp_rate_getus();
+	reo = tcp_rack_reo_wnd(tp, rack);
+	hint_seen = 0;
+	TAILQ_FOREACH(p, &tp->snd_holes, scblink) {
+		if (p == tp->sackhint.nexthole)
+			hint_seen = 1;
+		if (SEQ_GT(p->rxmit, p->start) &&
+		    p->rxmit_us < rack->xmit_us) {
+			deadline = p->rxmit_us + rack->rtt_us + reo;
+			if (deadline <= now) {
+				tp->sackhint.sack_bytes_rexmit -=
+				    (p->rxmit - p->start);
+				p->rxmit = p->start;
+				if (!hint_seen) {
+					tp->sackhint.nexthole = p;
+					hint_seen = 1;
+				}
+				TCPSTAT_INC(tcps_rack_rexmit_lost);
+				lost = 1;
+			} else if (wait == 0 || deadline - now < wait)
+				wait = deadline - now;
+		}
+		if (SEQ_LT(p->rxmit, p->end) &&
+		    (rs = tcp_rack_lookup(rack, p->rxmit)) != NULL &&
+		    rs->xmit_us != 0 && rs->xmit_us < rack->xmit_us) {
+			deadline = rs->xmit_us + rack->rtt_us + reo;
+			if (deadline <= now)
+				lost = 1;
+			else if (wait == 0 || deadline - now < wait)
+				wait = deadline - now;
+		}
+	}
+
+out:
+	if (wait != 0) {
+		rack->flags &= ~RACK_TLP_TIMER;
+		rack->flags |= RACK_REO_TIMER;
+		tcp_timer_activate(tp, TT_RACK, howmany(wait, tick));
+	} else if (rack->flags & RACK_REO_TIMER) {
+		rack->flags &= ~RACK_REO_TIMER;
+		tcp_timer_activate(tp, TT_RACK, 0);
+	}
+	return (lost);
+}
+
+/*
+ * Enter SACK recovery on a loss found by RACK rather than by the duplicate
+ * ACK threshold.
+ */
+void
+tcp_rack_recover(struct tcpcb *tp)
+{
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	cc_cong_signal(tp, NULL, CC_NDUPACK);
+	tcp_timer_activate(tp, TT_REXMT, 0);
+	tp->t_rtttime = 0;
+	TCPSTAT_INC(tcps_sack_recovery_episode);
+	TCPSTAT_INC(tcps_rack_recovery);
+	tp->sack_newdata = tp->snd_nxt;
+	tp->snd_cwnd = tp->t_maxseg;
+	(void) tcp_output(tp);
+}
+
+/*
+ * (Re)arm the probe timeout, or cancel it when there is nothing to probe
+ * for (RFC 8985, section 7.2).
+ */
+void
+tcp_rack_timer_update(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = tp->t_rack;
+	uint64_t pto;
+	u_int delta;
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	if (rack->flags & RACK_REO_TIMER) {
+		if (tp->snd_una != tp->snd_max)
+			return;
+		rack->flags &= ~RACK_REO_TIMER;
+		tcp_timer_activate(tp, TT_RACK, 0);
+		return;
+	}
+
+	pto = 0;
+	if (V_tcp_rack_tlp && tp->snd_una != tp->snd_max &&
+	    (tp->t_flags & TF_SACK_PERMIT) && !IN_RECOVERY(tp->t_flags) &&
+	    (rack->flags & RACK_TLP_OUT) == 0 && tp->t_rxtshift == 0 &&
+	    TCPS_HAVEESTABLISHED(tp->t_state) &&
+	    !tcp_timer_active(tp, TT_PERSIST)) {
+		if (rack->srtt_us != 0)
+			pto = 2 * (uint64_t)rack->srtt_us;
+		else
+			pto = 2 * (uint64_t)(tp->t_srtt >> TCP_RTT_SHIFT) *
+			    tick;
+		/* Allow for a delayed ACK of a lone segment. */
+		if (pto != 0 && tp->snd_max - tp->snd_una <= tp->t_maxseg)
+			pto += (uint64_t)tcp_delacktime * tick;
+	}
+	delta = howmany(pto, tick);
+	/* No point in probing when the retransmit timer fires first. */
+	if (delta == 0 || delta >= (u_int)tp->t_rxtcur) {
+		if (rack->flags & RACK_TLP_TIMER) {
+			rack->flags &= ~RACK_TLP_TIMER;
+			tcp_timer_activate(tp, TT_RACK, 0);
+		}
+		return;
+	}
+	rack->flags |= RACK_TLP_TIMER;
+	tcp_timer_activate(tp, TT_RACK, delta);
+}
+
+/*
+ * Send the tail loss probe (RFC 8985, section 7.3).
+ */
+static void
+tcp_rack_probe(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = tp->t_rack;
+	struct socket *so = tp->t_inpcb->inp_socket;
+	tcp_seq osnd_max;
+	u_long ocwnd, flight;
+
+	flight = tp->snd_max - tp->snd_una;
+	osnd_max = tp->snd_max;
+	ocwnd = tp->snd_cwnd;
+	rack->flags |= RACK_TLP_OUT;
+	TCPSTAT_INC(tcps_tlp_probes);
+
+	/* Prefer new data, sent regardless of cwnd. */
+	if (so->so_snd.sb_cc > flight && tp->snd_wnd > flight) {
+		tp->snd_cwnd = flight + tp->t_maxseg;
+		(void) tcp_output(tp);
+		tp->snd_cwnd = ocwnd;
+	}
+	if (tp->snd_max == osnd_max) {
+		tp->snd_nxt = tp->snd_max - ulmin(tp->t_maxseg, flight);
+		tp->snd_cwnd = ulmax(ocwnd, flight);
+		rack->flags |= RACK_TLP_RXMIT;
+		(void) tcp_output(tp);
+		tp->snd_cwnd = ocwnd;
+		if (SEQ_LT(tp->snd_nxt, tp->snd_max))
+			tp->snd_nxt = tp->snd_max;
+	}
+	rack->tlp_high_seq = tp->snd_max;
+	tcp_timer_activate(tp, TT_REXMT, tp->t_rxtcur);
+}
+
+/*
+ * TT_RACK expired: either the reordering window of some outstanding data
+ * has passed, or it is time for a tail loss probe.
+ */
+void
+tcp_rack_timeout(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = tp->t_rack;
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	if (rack == NULL)
+		return;
+	if (rack->flags & RACK_REO_TIMER) {
+		rack->flags &= ~RACK_REO_TIMER;
+		if (tcp_rack_detect(tp) && !IN_FASTRECOVERY(tp->t_flags))
+			tcp_rack_recover(tp);
+		else
+			(void) tcp_output(tp);
+		tcp_rack_timer_update(tp);
+	} else if (rack->flags & RACK_TLP_TIMER) {
+		rack->flags &= ~RACK_TLP_TIMER;
+		if (tp->snd_una != tp->snd_max && !IN_RECOVERY(tp->t_flags))
+			tcp_rack_probe(tp);
+	}
+}
+
+/*
+ * The retransmit timer fired, which ends any probe episode.
+ */
+void
+tcp_rack_rto(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = tp->t_rack;
+
+	INP_WLOCK_ASSERT(tp->t_inpcb);
+	rack->flags &= ~(RACK_REO_TIMER | RACK_TLP_TIMER | RACK_TLP_OUT |
+	    RACK_TLP_RXMIT);
+	tcp_timer_activate(tp, TT_RACK, 0);
+}
@@ -74,19 +74,11 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_reass.c 228058 2011-11-28 11:1
 #include <netinet/tcp_debug.h>
 #endif /* TCPDEBUG */
 
-static int tcp_reass_sysctl_maxseg(SYSCTL_HANDLER_ARGS);
 static int tcp_reass_sysctl_qsize(SYSCTL_HANDLER_ARGS);
 
 SYSCTL_NODE(_net_inet_tcp, OID_AUTO, reass, CTLFLAG_RW, 0,
     "TCP Segment Reassembly Queue");
 
-static VNET_DEFINE(int, tcp_reass_maxseg) = 0;
-#define	V_tcp_reass_maxseg		VNET(tcp_reass_maxseg)
-SYSCTL_VNET_PROC(_net_inet_tcp_reass, OID_AUTO, maxsegments,
-    CTLTYPE_INT | CTLFLAG_RDTUN,
-    &VNET_NAME(tcp_reass_maxseg), 0, &tcp_reass_sysctl_maxseg, "I",
-    "Global maximum number of TCP Segments in Reassembly Queue");
-
 static VNET_DEFINE(int, tcp_reass_qsize) = 0;
 #define	V_tcp_reass_qsize		VNET(tcp_reass_qsize)
 SYSCTL_VNET_PROC(_net_inet_tcp_reass, OID_AUTO, cursegments,
@@ -104,27 +96,32 @@ SYSCTL_VNET_INT(_net_inet_tcp_reass, OID_AUTO, overflows,
 static VNET_DEFINE(uma_zone_t, tcp_reass_zone);
 #define	V_tcp_reass_zone		VNET(tcp_reass_zone)
 
-/* Initialize TCP reassembly queue */
-static void
-tcp_reass_zone_change(void *tag)
+/*
+ * Queue entries are ordered by sequence number.  All of them lie within
+ * the receive window, so SEQ_LT() is a total order over the queue.
+ */
+static __inline int
+tcp_reass_cmp(struct tseg_qent *a, struct tseg_qent *b)
 {
 
-	V_tcp_reass_maxseg = nmbclusters / 16;
-	uma_zone_set_max(V_tcp_reass_zone, V_tcp_reass_maxseg);
+	if (SEQ_LT(a->tqe_seq, b->tqe_seq))
+		return (-1);
+	return (SEQ_GT(a->tqe_seq, b->tqe_seq));
 }
 
+RB_GENERATE(tsegqe_head, tseg_qent, tqe_q, tcp_reass_cmp);
+
+/* Initialize TCP reassembly queue */
 void
 tcp_reass_init(void)
 {
 
-	V_tcp_reass_maxseg = nmbclusters / 16;
-	TUNABLE_INT_FETCH("net.inet.tcp.reass.maxsegments",
-	    &V_tcp_reass_maxseg);
+	/*
+	 * There is no global limit; each connection's queue is bounded by
+	 * the mbuf storage its receive buffer would allow, see tcp_reass().
+	 */
 	V_tcp_reass_zone = uma_zcreate("tcpreass", sizeof (struct tseg_qent),
 	    NULL, NULL, NULL, NULL, UMA_ALIGN_PTR, UMA_ZONE_NOFREE);
-	uma_zone_set_max(V_tcp_reass_zone, V_tcp_reass_maxseg);
-	EVENTHANDLER_REGISTER(nmbclusters_change,
-	    tcp_reass_zone_change, NULL, EVENTHANDLER_PRI_ANY);
 }
 
 #ifdef VIMAGE
@@ -136,6 +133,19 @@ tcp_reass_destroy(void)
 }
 #endif
 
+static void
+tcp_reass_free(struct tcpcb *tp, struct tseg_qent *q)
+{
+
+	RB_REMOVE(tsegqe_head, &tp->t_segq, q);
+#ifdef PASSIVE_INET
+	TAILQ_REMOVE(&tp->t_segageq, q, tqe_ageq);
+#endif
+	tp->t_segqmbcnt -= q->tqe_mbcnt;
+	tp->t_segqlen--;
+	uma_zfree(V_tcp_reass_zone, q);
+}
+
 void
 tcp_reass_flush(struct tcpcb *tp)
 {
@@ -143,11 +153,9 @@ tcp_reass_flush(struct tcpcb *tp)
 
 	INP_WLOCK_ASSERT(tp->t_inpcb);
 
-	while ((qe = LIST_FIRST(&tp->t_segq)) != NULL) {
-		LIST_REMOVE(qe, tqe_q);
+	while ((qe = RB_MIN(tsegqe_head, &tp->t_segq)) != NULL) {
 		m_freem(qe->tqe_m);
-		uma_zfree(V_tcp_reass_zone, qe);
-		tp->t_segqlen--;
+		tcp_reass_free(tp, qe);
 	}
 
 	KASSERT((tp->t_segqlen == 0),
@@ -156,17 +164,56 @@ tcp_reass_flush(struct tcpcb *tp)
 }
 
 static int
-tcp_reass_sysctl_maxseg(SYSCTL_HANDLER_ARGS)
+tcp_reass_sysctl_qsize(SYSCTL_HANDLER_ARGS)
 {
-	V_tcp_reass_maxseg = uma_zone_get_max(V_tcp_reass_zone);
+	V_tcp_reass_qsize = uma_zone_get_cur(V_tcp_reass_zone);
 	return (sysctl_handle_int(oidp, arg1, arg2, req));
 }
 
-static int
-tcp_reass_sysctl_qsize(SYSCTL_HANDLER_ARGS)
+/*
+ * Return the last mbuf of a chain and the storage the chain holds,
+ * counted the way the socket buffer counts it.
+ */
+static struct mbuf *
+tcp_reass_mbinfo(struct mbuf *m, int *mbcnt)
 {
-	V_tcp_reass_qsize = uma_zone_get_cur(V_tcp_reass_zone);
-	return (sysctl_handle_int(oidp, arg1, arg2, req));
+
+	*mbcnt = 0;
+	for (;; m = m->m_next) {
+		*mbcnt += MSIZE;
+		if (m->m_flags & M_EXT)
+			*mbcnt += m->m_ext.ext_size;
+		if (m->m_next == NULL)
+			return (m);
+	}
+}
+
+/*
+ * Append the data of q, which must directly follow p in sequence space,
+ * to p and release q.
+ */
+static void
+tcp_reass_merge(struct tcpcb *tp, struct tseg_qent *p, struct tseg_qent *q)
+{
+
+	KASSERT(p->tqe_seq + p->tqe_len == q->tqe_seq,
+	    ("%s: %p and %p are not adjacent", __func__, p, q));
+
+	p->tqe_last->m_next = q->tqe_m;
+	p->tqe_last = q->tqe_last;
+	p->tqe_len += q->tqe_len;
+	p->tqe_flags |= q->tqe_flags;
+	p->tqe_mbcnt += q->tqe_mbcnt;
+#ifdef PASSIVE_INET
+	/* The merged range is as old as its oldest part. */
+	if (q->tqe_ticks - p->tqe_ticks < 0) {
+		p->tqe_ticks = q->tqe_ticks;
+		TAILQ_REMOVE(&tp->t_segageq, p, tqe_ageq);
+		TAILQ_INSERT_BEFORE(q, p, tqe_ageq);
+	}
+#endif
+	q->tqe_mbcnt = 0;
+	tcp_reass_free(tp, q);
 }
 
 #ifdef PASSIVE_INET
@@ -195,7 +242,7 @@ void
 tcp_reass_deliver_holes(struct tcpcb *tp)
 {
 	struct socket *so = tp->t_inpcb->inp_socket;
-	struct tseg_qent *q, *p, *qtmp;
+	struct tseg_qent *q, *p;
 	int delta;
 	int hole_size;
 	struct mbuf *m_hole;
@@ -205,7 +252,7 @@ tcp_reass_deliver_holes(struct tcpcb *tp)
 
 	/* Search into the sequence space for the furthest expired segment. */
 	p = NULL;
-	LIST_FOREACH(q, &tp->t_segq, tqe_q) {
+	RB_FOREACH(q, tsegqe_head, &tp->t_segq) {
 		delta = ticks - q->tqe_ticks;
 		if (delta >= TP_REASSDL(tp))
 			p = q;
@@ -213,7 +260,7 @@ tcp_reass_deliver_holes(struct tcpcb *tp)
 
 	if (p) {
 		contiguous = 0;
-		LIST_FOREACH_SAFE(q, &tp->t_segq, tqe_q, qtmp) {
+		while ((q = RB_MIN(tsegqe_head, &tp->t_segq)) != NULL) {
 			if (contiguous && q->tqe_seq != tp->rcv_nxt)
 				break;
 
@@ -238,9 +285,6 @@ tcp_reass_deliver_holes(struct tcpcb *tp)
 
 			tp->rcv_nxt = q->tqe_seq + q->tqe_len;
 
-			LIST_REMOVE(q, tqe_q);
-			TAILQ_REMOVE(&tp->t_segageq, q, tqe_ageq);
-
 			if (so->so_rcv.sb_state & SBS_CANTRCVMORE)
 				m_freem(q->tqe_m);
 			else
@@ -264,14 +308,14 @@ tcp_reass_deliver_holes(struct tcpcb *tp)
 					break;
 				case TCPS_FIN_WAIT_2:
 #if 0
-					INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-					KASSERT(ti_locked == TI_WLOCKED,
+					INP_INFO_LOCK_ASSERT(&V_tcbinfo);
+					KASSERT(ti_locked == TI_RLOCKED,
 						("%s: dodata "
 						 "TCP_FIN_WAIT_2 ti_locked: %d", __func__,
 						 ti_locked));
 					
 					tcp_twstart(tp);
-					INP_INFO_WUNLOCK(&V_tcbinfo);
+					INP_INFO_RUNLOCK(&V_tcbinfo);
 #else
 					printf(">>>>>>>>>>>>>>>> enter TIME WAIT\n");
 #endif
@@ -279,12 +323,11 @@ tcp_reass_deliver_holes(struct tcpcb *tp)
 				}
 			}
 
-			tp->t_segqlen--;
 			if (q == p) {
 				contiguous = 1;
 			}
 
-			uma_zfree(V_tcp_reass_zone, q);
+			tcp_reass_free(tp, q);
 		}
 
 		tcp_timer_activate(tp, TT_REASSDL, tcp_reass_next_hole_deadline(tp));
@@ -302,17 +345,16 @@ tcp_reass(struct tcpcb *tp, struct tcphdr *th, int *tlenp, struct mbuf *m)
 	struct tseg_qent *p = NULL;
 	struct tseg_qent *nq;
 	struct tseg_qent *te = NULL;
+	struct tseg_qent key;
 	struct socket *so = tp->t_inpcb->inp_socket;
+	struct mbuf *mlast;
 	char *s = NULL;
-	int flags;
-	struct tseg_qent tqs;
+	int flags, i, mbcnt;
 #ifdef PASSIVE_INET
 	int deliver_leading_hole = 0;
-	int replace_tqs_in_list = 0;
 	int passive;
 	int hole_size;
 	struct mbuf *m_hole;
-	struct tseg_qent *reclaimed_tqe = NULL;
 #endif
 
 	INP_WLOCK_ASSERT(tp->t_inpcb);
@@ -321,11 +363,6 @@ tcp_reass(struct tcpcb *tp, struct tcphdr *th, int *tlenp, struct mbuf *m)
 	passive = tp->t_inpcb->inp_flags2 & INP_PASSIVE;
 #endif
 
-	/*
-	 * XXX: tcp_reass() is rather inefficient with its data structures
-	 * and should be rewritten (see NetBSD for optimizations).
-	 */
-
 	/*
 	 * Call with th==NULL after become established to
 	 * force pre-ESTABLISHED data up to user socket.
@@ -333,25 +370,20 @@ tcp_reass(struct tcpcb *tp, struct tcphdr *th, int *tlenp, struct mbuf *m)
 	if (th == NULL)
 		goto present;
 
+	mlast = tcp_reass_mbinfo(m, &mbcnt);
+
 	/*
-	 * Limit the number of segments that can be queued to reduce the
-	 * potential for mbuf exhaustion. For best performance, we want to be
-	 * able to queue a full window's worth of segments. The size of the
-	 * socket receive buffer determines our advertised window and grows
-	 * automatically when socket buffer autotuning is enabled. Use it as the
-	 * basis for our queue limit.
+	 * Limit the mbuf storage each connection may hold in its queue to
+	 * what its receive buffer would accept, which grows automatically
+	 * with socket buffer autotuning.  This keeps a full window's worth
+	 * of segments queueable while bounding mbuf exhaustion per
+	 * connection rather than globally.
 	 * Always let the missing segment through which caused this queue.
 	 * NB: Access to the socket buffer is left intentionally unlocked as we
 	 * can tolerate stale information here.
-	 *
-	 * XXXLAS: Using sbspace(so->so_rcv) instead of so->so_rcv.sb_hiwat
-	 * should work but causes packets to be dropped when they shouldn't.
-	 * Investigate why and re-evaluate the below limit after the behaviour
-	 * is understood.
 	 */
-
 	if ((th->th_seq != tp->rcv_nxt || !TCPS_HAVEESTABLISHED(tp->t_state)) &&
-	    tp->t_segqlen >= (so->so_rcv.sb_hiwat / tp->t_maxseg) + 1) {
+	    tp->t_segqmbcnt + mbcnt > so->so_rcv.sb_mbmax) {
 		V_tcp_reass_overflows++;
 #ifdef PASSIVE_INET
 		/*
@@ -381,64 +413,15 @@ tcp_reass(struct tcpcb *tp, struct tcphdr *th, int *tlenp, struct mbuf *m)
 	}
 
 	/*
-	 * Allocate a new queue entry. If we can't, or hit the zone limit
-	 * just drop the pkt.
-	 *
-	 * Use a temporary structure on the stack for the missing segment
-	 * when the zone is exhausted. Otherwise we may get stuck.
-	 */
-	te = uma_zalloc(V_tcp_reass_zone, M_NOWAIT);
-	if (te == NULL) {
-		if (th->th_seq != tp->rcv_nxt || !TCPS_HAVEESTABLISHED(tp->t_state)) {
-#ifdef PASSIVE_INET
-			/*
-			 * In the passive case, we will deliver the leading
-			 * hole and the first queue entry in response to the
-			 * resource shortage, instead of dropping the
-			 * current packet.  Dropping the current packet
-			 * isn't a winning strategy here - as passive
-			 * observers of the packet stream, retransmits will
-			 * not occur due to our drops.
-			 */
-			if (passive)
-				deliver_leading_hole = 1;
-			else {
-#endif
-				TCPSTAT_INC(tcps_rcvmemdrop);
-				m_freem(m);
-				*tlenp = 0;
-				if ((s = tcp_log_addrs(&tp->t_inpcb->inp_inc, th, NULL,
-						       NULL))) {
-					log(LOG_DEBUG, "%s; %s: global zone limit "
-					    "reached, segment dropped\n", s, __func__);
-					free(s, M_TCPLOG);
-				}
-				return (0);
-#ifdef PASSIVE_INET
-			}
-#endif
-		}
-		
-		bzero(&tqs, sizeof(struct tseg_qent));
-		te = &tqs;
-		if ((s = tcp_log_addrs(&tp->t_inpcb->inp_inc, th, NULL,
-				       NULL))) {
-			log(LOG_DEBUG,
-			    "%s; %s: global zone limit reached, using "
-			    "stack for missing segment\n", s, __func__);
-			free(s, M_TCPLOG);
-		}
-	}
-	tp->t_segqlen++;
-
-	/*
-	 * Find a segment which begins after this one does.
+	 * Find the first segment which begins after this one does, and
+	 * the one before it.
 	 */
-	LIST_FOREACH(q, &tp->t_segq, tqe_q) {
-		if (SEQ_GT(q->tqe_seq, th->th_seq))
-			break;
-		p = q;
-	}
+	key.tqe_seq = th->th_seq + 1;
+	q = RB_NFIND(tsegqe_head, &tp->t_segq, &key);
+	if (q != NULL)
+		p = RB_PREV(tsegqe_head, &tp->t_segq, q);
+	else
+		p = RB_MAX(tsegqe_head, &tp->t_segq);
 
 	/*
 	 * If there is a preceding segment, it may provide some of
@@ -446,7 +429,6 @@ tcp_reass(struct tcpcb *tp, struct tcphdr *th, int *tlenp, struct mbuf *m)
 	 * segment.  If it provides all of our data, drop us.
 	 */
 	if (p != NULL) {
-		int i;
 		/* conversion to int (in i) handles seq wraparound */
 		i = p->tqe_seq + p->tqe_len - th->th_seq;
 		if (i > 0) {
@@ -454,9 +436,6 @@ tcp_reass(struct tcpcb *tp, struct tcphdr *th, int *tlenp, struct mbuf *m)
 				TCPSTAT_INC(tcps_rcvduppack);
 				TCPSTAT_ADD(tcps_rcvdupbyte, *tlenp);
 				m_freem(m);
-				if (te != &tqs)
-					uma_zfree(V_tcp_reass_zone, te);
-				tp->t_segqlen--;
 				/*
 				 * Try to present any queued data
 				 * at the left window edge to the user.
@@ -479,50 +458,90 @@ tcp_reass(struct tcpcb *tp, struct tcphdr *th, int *tlenp, struct mbuf *m)
 	 * if they are completely covered, dequeue them.
 	 */
 	while (q) {
-		int i = (th->th_seq + *tlenp) - q->tqe_seq;
+		i = (th->th_seq + *tlenp) - q->tqe_seq;
 		if (i <= 0)
 			break;
 		if (i < q->tqe_len) {
+			/* Stays ahead of its successor, so the tree order holds. */
 			q->tqe_seq += i;
 			q->tqe_len -= i;
 			m_adj(q->tqe_m, i);
 			break;
 		}
 
-		nq = LIST_NEXT(q, tqe_q);
-		LIST_REMOVE(q, tqe_q);
+		nq = RB_NEXT(tsegqe_head, &tp->t_segq, q);
 		m_freem(q->tqe_m);
-		uma_zfree(V_tcp_reass_zone, q);
-		tp->t_segqlen--;
+		tcp_reass_free(tp, q);
 		q = nq;
 	}
 
-	/* Insert the new segment queue entry into place. */
-	te->tqe_m = m;
-	te->tqe_seq = th->th_seq;
-	te->tqe_flags = th->th_flags;
-	te->tqe_len = *tlenp;
-#ifdef PASSIVE_INET
-	te->tqe_ticks = ticks;
-
-	TAILQ_INSERT_TAIL(&tp->t_segageq, te, tqe_ageq);
-#endif
+	/*
+	 * The segment that fills the hole at the left window edge goes
+	 * straight to the socket together with whatever queued data now
+	 * follows it; it never needs a queue entry.
+	 */
+	if (th->th_seq == tp->rcv_nxt && TCPS_HAVEESTABLISHED(tp->t_state)) {
+		SOCKBUF_LOCK(&so->so_rcv);
+		tp->rcv_nxt += *tlenp;
+		flags = th->th_flags & TH_FIN;
+		if (so->so_rcv.sb_state & SBS_CANTRCVMORE)
+			m_freem(m);
+		else
+			sbappendstream_locked(&so->so_rcv, m);
+		q = RB_MIN(tsegqe_head, &tp->t_segq);
+		goto deliver;
+	}
 
-	if (p == NULL) {
-		LIST_INSERT_HEAD(&tp->t_segq, te, tqe_q);
+	/*
+	 * A segment that directly follows its predecessor is appended to
+	 * that entry's chain; otherwise it gets an entry of its own.
+	 */
+	if (p != NULL && p->tqe_seq + p->tqe_len == th->th_seq &&
+	    !(p->tqe_flags & TH_FIN)) {
+		p->tqe_last->m_next = m;
+		p->tqe_last = mlast;
+		p->tqe_len += *tlenp;
+		p->tqe_flags |= th->th_flags;
+		p->tqe_mbcnt += mbcnt;
+		te = p;
 	} else {
-#ifdef PASSIVE_INET
-		if (passive && te == &tqs)
-			replace_tqs_in_list = 1;
-		else {
-#endif
-			KASSERT(te != &tqs, ("%s: temporary stack based entry not "
-					     "first element in queue", __func__));
-#ifdef PASSIVE_INET
+		te = uma_zalloc(V_tcp_reass_zone, M_NOWAIT);
+		if (te == NULL) {
+			TCPSTAT_INC(tcps_rcvmemdrop);
+			m_freem(m);
+			*tlenp = 0;
+			if ((s = tcp_log_addrs(&tp->t_inpcb->inp_inc, th, NULL,
+			    NULL))) {
+				log(LOG_DEBUG, "%s; %s: queue entry allocation "
+				    "failed, segment dropped\n", s, __func__);
+				free(s, M_TCPLOG);
+			}
+			return (0);
+		}
+		te->tqe_m = m;
+		te->tqe_last = mlast;
+		te->tqe_seq = th->th_seq;
+		te->tqe_flags = th->th_flags;
+		te->tqe_len = *tlenp;
+		te->tqe_mbcnt = mbcnt;
+		/* Only a bare FIN can share its start with another entry. */
+		if (RB_INSERT(tsegqe_head, &tp->t_segq, te) != NULL) {
+			uma_zfree(V_tcp_reass_zone, te);
+			m_freem(m);
+			*tlenp = 0;
+			goto present;
 		}
+#ifdef PASSIVE_INET
+		te->tqe_ticks = ticks;
+		TAILQ_INSERT_TAIL(&tp->t_segageq, te, tqe_ageq);
 #endif
-		LIST_INSERT_AFTER(p, te, tqe_q);
+		tp->t_segqlen++;
 	}
+	tp->t_segqmbcnt += mbcnt;
+
+	if (q != NULL && te->tqe_seq + te->tqe_len == q->tqe_seq &&
+	    !(te->tqe_flags & TH_FIN))
+		tcp_reass_merge(tp, te, q);
 
 present:
 	/*
@@ -531,7 +550,7 @@ present:
 	 */
 	if (!TCPS_HAVEESTABLISHED(tp->t_state))
 		return (0);
-	q = LIST_FIRST(&tp->t_segq);
+	q = RB_MIN(tsegqe_head, &tp->t_segq);
 #ifdef PASSIVE_INET
 	if (!q || (q->tqe_seq != tp->rcv_nxt && !deliver_leading_hole)) {
 		if (passive && q && q->tqe_seq != tp->rcv_nxt) {
@@ -543,6 +562,7 @@ present:
 	if (!q || q->tqe_seq != tp->rcv_nxt)
 		return (0);
 #endif
+	flags = 0;
 	SOCKBUF_LOCK(&so->so_rcv);
 #ifdef PASSIVE_INET
 	if (deliver_leading_hole) {
@@ -560,43 +580,19 @@ present:
 		tp->rcv_nxt = q->tqe_seq;
 	}	
 #endif
-	do {
+deliver:
+	while (q != NULL && q->tqe_seq == tp->rcv_nxt) {
 		tp->rcv_nxt += q->tqe_len;
 		flags = q->tqe_flags & TH_FIN;
-		nq = LIST_NEXT(q, tqe_q);
-		LIST_REMOVE(q, tqe_q);
-#ifdef PASSIVE_INET
-		TAILQ_REMOVE(&tp->t_segageq, q, tqe_ageq);
-#endif
+		nq = RB_NEXT(tsegqe_head, &tp->t_segq, q);
 		if (so->so_rcv.sb_state & SBS_CANTRCVMORE)
 			m_freem(q->tqe_m);
 		else
 			sbappendstream_locked(&so->so_rcv, q->tqe_m);
-		if (q != &tqs) {
-#ifdef PASSIVE_INET
-			if (replace_tqs_in_list && !reclaimed_tqe)
-				reclaimed_tqe = q;
-			else
-#endif
-				uma_zfree(V_tcp_reass_zone, q);
-		}
-#ifdef PASSIVE_INET
-		else
-			replace_tqs_in_list = 0;
-#endif
-		tp->t_segqlen--;
+		tcp_reass_free(tp, q);
 		q = nq;
-	} while (q && q->tqe_seq == tp->rcv_nxt);
-#ifdef PASSIVE_INET
-	if (replace_tqs_in_list) {
-		*reclaimed_tqe = tqs;
-		LIST_INSERT_AFTER(&tqs, reclaimed_tqe, tqe_q);
-		LIST_REMOVE(&tqs, tqe_q);
-
-		TAILQ_INSERT_AFTER(&tp->t_segageq, &tqs, reclaimed_tqe, tqe_ageq);
-		TAILQ_REMOVE(&tp->t_segageq, &tqs, tqe_ageq);
 	}
-
+#ifdef PASSIVE_INET
 	int next_deadline = tcp_reass_next_hole_deadline(tp);
 	if (!tcp_timer_active(tp, TT_REASSDL) || next_deadline == 0)
 		tcp_timer_activate(tp, TT_REASSDL, next_deadline);
@@ -272,6 +272,7 @@ tcp_sackhole_alloc(struct tcpcb *tp, tcp_seq start, tcp_seq end)
 	hole->start = start;
 	hole->end = end;
 	hole->rxmit = start;
+	hole->rxmit_us = 0;
 
 	tp->snd_numholes++;
 	atomic_add_int(&V_tcp_sack_globalholes, 1);
@@ -519,6 +520,7 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, tcp_seq th_ack)
 				if (temp != NULL) {
 					if (SEQ_GT(cur->rxmit, temp->rxmit)) {
 						temp->rxmit = cur->rxmit;
+						temp->rxmit_us = cur->rxmit_us;
 						tp->sackhint.sack_bytes_rexmit
 						    += (temp->rxmit
 						    - temp->start);
@@ -90,6 +90,21 @@ tcp_ts_getticks(void)
 
 	return (ms);
 }
+
+/*
+ * tcp_rate_getus() in us, for delivery rate sampling.  Unlike
+ * tcp_ts_getticks() this reads the timecounter, as RTTs on local links are
+ * well below a tick.
+ */
+static __inline uint64_t
+tcp_rate_getus(void)
+{
+	struct timeval tv;
+
+	microuptime(&tv);
+
+	return ((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
 #endif /* _KERNEL */
 
 #endif /* _NETINET_TCP_SEQ_H_ */
@@ -770,7 +770,7 @@ tcp_newtcpcb(struct inpcb *inp)
 	tp->t_vnet = inp->inp_vnet;
 #endif
 	tp->t_timers = &tm->tt;
-	/*	LIST_INIT(&tp->t_segq); */	/* XXX covered by M_ZERO */
+	/*	RB_INIT(&tp->t_segq); */	/* XXX covered by M_ZERO */
 #ifdef PASSIVE_INET
 	TAILQ_INIT(&tp->t_segageq);
 #endif
@@ -789,6 +789,8 @@ tcp_newtcpcb(struct inpcb *inp)
 #ifdef PASSIVE_INET
 	vnet_callout_init(&tp->t_timers->tt_reassdl, CALLOUT_MPSAFE);
 #endif
+	vnet_callout_init(&tp->t_timers->tt_pace, CALLOUT_MPSAFE);
+	vnet_callout_init(&tp->t_timers->tt_rack, CALLOUT_MPSAFE);
 
 	if (V_tcp_do_rfc1323)
 		tp->t_flags = (TF_REQ_SCALE|TF_REQ_TSTMP);
@@ -808,6 +810,8 @@ tcp_newtcpcb(struct inpcb *inp)
 	tp->snd_cwnd = TCP_MAXWIN << TCP_MAX_WINSHIFT;
 	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
 	tp->t_rcvtime = ticks;
+	if (V_tcp_do_rack)
+		(void) tcp_rack_init(tp);
 	/*
 	 * IPv4 TTL initialization is necessary for an IPv6 socket as well,
 	 * because the socket may be bound to an IPv6 wildcard address,
@@ -848,19 +852,17 @@ tcp_ccalgounload(struct cc_algo *unload_algo)
 			sts_count++;
 			continue;
 		}
-		INP_INFO_RLOCK(&V_tcbinfo);
+		INP_INFO_WLOCK(&V_tcbinfo);
 		/*
 		 * New connections already part way through being initialised
 		 * with the CC algo we're removing will not race with this code
-		 * because the INP_INFO_WLOCK is held during initialisation. We
+		 * because the INP_INFO lock is held during initialisation. We
 		 * therefore don't enter the loop below until the connection
 		 * list has stabilised.
 		 */
 		LIST_FOREACH(inp, &V_tcb, inp_list) {
 			INP_WLOCK(inp);
-			/* Important to skip tcptw structs. */
-			if (!(inp->inp_flags & INP_TIMEWAIT) &&
-			    (tp = intotcpcb(inp)) != NULL) {
+			if ((tp = intotcpcb(inp)) != NULL) {
 				/*
 				 * By holding INP_WLOCK here, we are assured
 				 * that the connection is not currently
@@ -878,7 +880,7 @@ tcp_ccalgounload(struct cc_algo *unload_algo)
 			}
 			INP_WUNLOCK(inp);
 		}
-		INP_INFO_RUNLOCK(&V_tcbinfo);
+		INP_INFO_WUNLOCK(&V_tcbinfo);
 		CURVNET_RESTORE();
 	}
 	VNET_LIST_RUNLOCK();
@@ -896,7 +898,7 @@ tcp_drop(struct tcpcb *tp, int errno)
 {
 	struct socket *so = tp->t_inpcb->inp_socket;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(tp->t_inpcb);
 
 	if (TCPS_HAVERCVDSYN(tp->t_state)) {
@@ -945,6 +947,8 @@ tcp_discardcb(struct tcpcb *tp)
 #ifdef PASSIVE_INET
 	vnet_callout_stop(&tp->t_timers->tt_reassdl);
 #endif
+	vnet_callout_stop(&tp->t_timers->tt_pace);
+	vnet_callout_stop(&tp->t_timers->tt_rack);
 
 	/*
 	 * If we got enough samples through the srtt filter,
@@ -1008,6 +1012,7 @@ tcp_discardcb(struct tcpcb *tp)
 	tcp_offload_detach(tp);
 		
 	tcp_free_sackholes(tp);
+	tcp_rack_discard(tp);
 
 	/* Allow the CC algorithm to clean up after itself. */
 	if (CC_ALGO(tp)->cb_destroy != NULL)
@@ -1033,7 +1038,7 @@ tcp_close(struct tcpcb *tp)
 	struct inpcb *inp = tp->t_inpcb;
 	struct socket *so;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
 	/* Notify any offload devices of listener close */
@@ -1080,7 +1085,7 @@ tcp_drain(void)
 	 *	where we're really low on mbufs, this is potentially
 	 *	usefull.
 	 */
-	INP_INFO_RLOCK(&V_tcbinfo);
+	INP_INFO_WLOCK(&V_tcbinfo);
 	LIST_FOREACH(inpb, V_tcbinfo.ipi_listhead, inp_list) {
 		if (inpb->inp_flags & INP_TIMEWAIT)
 			continue;
@@ -1091,7 +1096,7 @@ tcp_drain(void)
 		}
 		INP_WUNLOCK(inpb);
 	}
-	INP_INFO_RUNLOCK(&V_tcbinfo);
+	INP_INFO_WUNLOCK(&V_tcbinfo);
 }
 
 /*
@@ -1107,7 +1112,7 @@ tcp_notify(struct inpcb *inp, int error)
 {
 	struct tcpcb *tp;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
 	if ((inp->inp_flags & INP_TIMEWAIT) ||
@@ -1149,7 +1154,7 @@ tcp_notify(struct inpcb *inp, int error)
 static int
 tcp_pcblist(SYSCTL_HANDLER_ARGS)
 {
-	int error, i, m, n, pcb_count;
+	int error, i, m, n, pcb_count, tw, tw_count;
 	struct inpcb *inp, **inp_list;
 	inp_gen_t gencnt;
 	struct xinpgen xig;
@@ -1159,7 +1164,8 @@ tcp_pcblist(SYSCTL_HANDLER_ARGS)
 	 * resource-intensive to repeat twice on every request.
 	 */
 	if (req->oldptr == NULL) {
-		n = V_tcbinfo.ipi_count + syncache_pcbcount();
+		n = V_tcbinfo.ipi_count + syncache_pcbcount() +
+		    tcp_tw_pcbcount();
 		n += imax(n / 8, 10);
 		req->oldidx = 2 * (sizeof xig) + n * sizeof(struct xtcpcb);
 		return (0);
@@ -1171,20 +1177,21 @@ tcp_pcblist(SYSCTL_HANDLER_ARGS)
 	/*
 	 * OK, now we're committed to doing something.
 	 */
-	INP_INFO_RLOCK(&V_tcbinfo);
+	INP_LIST_LOCK(&V_tcbinfo);
 	gencnt = V_tcbinfo.ipi_gencnt;
 	n = V_tcbinfo.ipi_count;
-	INP_INFO_RUNLOCK(&V_tcbinfo);
+	INP_LIST_UNLOCK(&V_tcbinfo);
 
 	m = syncache_pcbcount();
+	tw = tcp_tw_pcbcount();
 
 	error = sysctl_wire_old_buffer(req, 2 * (sizeof xig)
-		+ (n + m) * sizeof(struct xtcpcb));
+		+ (n + m + tw) * sizeof(struct xtcpcb));
 	if (error != 0)
 		return (error);
 
 	xig.xig_len = sizeof xig;
-	xig.xig_count = n + m;
+	xig.xig_count = n + m + tw;
 	xig.xig_gen = gencnt;
 	xig.xig_sogen = V_so_gencnt;
 	error = SYSCTL_OUT(req, &xig, sizeof xig);
@@ -1195,43 +1202,40 @@ tcp_pcblist(SYSCTL_HANDLER_ARGS)
 	if (error)
 		return (error);
 
+	error = tcp_tw_pcblist(req, tw, &tw_count);
+	if (error)
+		return (error);
+
 	inp_list = malloc(n * sizeof *inp_list, M_TEMP, M_WAITOK);
 	if (inp_list == NULL)
 		return (ENOMEM);
 
-	INP_INFO_RLOCK(&V_tcbinfo);
+	/*
+	 * inpcb locks order before the list lock, so only reference the
+	 * pcbs here and check visibility once each is locked below.
+	 */
+	INP_LIST_LOCK(&V_tcbinfo);
 	for (inp = LIST_FIRST(V_tcbinfo.ipi_listhead), i = 0;
 	    inp != NULL && i < n; inp = LIST_NEXT(inp, inp_list)) {
-		INP_WLOCK(inp);
 		if (inp->inp_gencnt <= gencnt) {
-			/*
-			 * XXX: This use of cr_cansee(), introduced with
-			 * TCP state changes, is not quite right, but for
-			 * now, better than nothing.
-			 */
-			if (inp->inp_flags & INP_TIMEWAIT) {
-				if (intotw(inp) != NULL)
-					error = cr_cansee(req->td->td_ucred,
-					    intotw(inp)->tw_cred);
-				else
-					error = EINVAL;	/* Skip this inp. */
-			} else
-				error = cr_canseeinpcb(req->td->td_ucred, inp);
-			if (error == 0) {
-				in_pcbref(inp);
-				inp_list[i++] = inp;
-			}
+			in_pcbref(inp);
+			inp_list[i++] = inp;
 		}
-		INP_WUNLOCK(inp);
 	}
-	INP_INFO_RUNLOCK(&V_tcbinfo);
+	INP_LIST_UNLOCK(&V_tcbinfo);
 	n = i;
 
 	error = 0;
 	for (i = 0; i < n; i++) {
 		inp = inp_list[i];
 		INP_RLOCK(inp);
-		if (inp->inp_gencnt <= gencnt) {
+		/*
+		 * XXX: This use of cr_cansee(), introduced with
+		 * TCP state changes, is not quite right, but for
+		 * now, better than nothing.
+		 */
+		if (inp->inp_gencnt <= gencnt &&
+		    cr_canseeinpcb(req->td->td_ucred, inp) == 0) {
 			struct xtcpcb xt;
 			void *inp_ppcb;
 
@@ -1242,10 +1246,7 @@ tcp_pcblist(SYSCTL_HANDLER_ARGS)
 			inp_ppcb = inp->inp_ppcb;
 			if (inp_ppcb == NULL)
 				bzero((char *) &xt.xt_tp, sizeof xt.xt_tp);
-			else if (inp->inp_flags & INP_TIMEWAIT) {
-				bzero((char *) &xt.xt_tp, sizeof xt.xt_tp);
-				xt.xt_tp.t_state = TCPS_TIME_WAIT;
-			} else {
+			else {
 				bcopy(inp_ppcb, &xt.xt_tp, sizeof xt.xt_tp);
 				if (xt.xt_tp.t_timers)
 					tcp_timer_to_xtimer(&xt.xt_tp, xt.xt_tp.t_timers, &xt.xt_timer);
@@ -1262,14 +1263,14 @@ tcp_pcblist(SYSCTL_HANDLER_ARGS)
 		} else
 			INP_RUNLOCK(inp);
 	}
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	for (i = 0; i < n; i++) {
 		inp = inp_list[i];
 		INP_RLOCK(inp);
 		if (!in_pcbrele_rlocked(inp))
 			INP_RUNLOCK(inp);
 	}
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 
 	if (!error) {
 		/*
@@ -1279,11 +1280,11 @@ tcp_pcblist(SYSCTL_HANDLER_ARGS)
 		 * while we were processing this request, and it
 		 * might be necessary to retry.
 		 */
-		INP_INFO_RLOCK(&V_tcbinfo);
+		INP_LIST_LOCK(&V_tcbinfo);
 		xig.xig_gen = V_tcbinfo.ipi_gencnt;
 		xig.xig_sogen = V_so_gencnt;
-		xig.xig_count = V_tcbinfo.ipi_count + pcb_count;
-		INP_INFO_RUNLOCK(&V_tcbinfo);
+		xig.xig_count = V_tcbinfo.ipi_count + pcb_count + tw_count;
+		INP_LIST_UNLOCK(&V_tcbinfo);
 		error = SYSCTL_OUT(req, &xig, sizeof xig);
 	}
 	free(inp_list, M_TEMP);
@@ -1444,7 +1445,7 @@ tcp_ctlinput(int cmd, struct sockaddr *sa, void *vip)
 				      - offsetof(struct icmp, icmp_ip));
 		th = (struct tcphdr *)((caddr_t)ip
 				       + (ip->ip_hl << 2));
-		INP_INFO_WLOCK(&V_tcbinfo);
+		INP_INFO_RLOCK(&V_tcbinfo);
 		inp = in_pcblookup(&V_tcbinfo, faddr, th->th_dport,
 		    ip->ip_src, th->th_sport, INPLOOKUP_WLOCKPCB, NULL);
 		if (inp != NULL)  {
@@ -1509,7 +1510,7 @@ tcp_ctlinput(int cmd, struct sockaddr *sa, void *vip)
 			syncache_unreach(&inc, th);
 #endif /* PROMISCUOUS_INET */
 		}
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 	} else
 		in_pcbnotifyall(&V_tcbinfo, faddr, inetctlerrmap[cmd], notify);
 }
@@ -1582,14 +1583,14 @@ tcp6_ctlinput(int cmd, struct sockaddr *sa, void *d)
 		inc.inc6_faddr = ((struct sockaddr_in6 *)sa)->sin6_addr;
 		inc.inc6_laddr = ip6cp->ip6c_src->sin6_addr;
 		inc.inc_flags |= INC_ISIPV6;
-		INP_INFO_WLOCK(&V_tcbinfo);
+		INP_INFO_RLOCK(&V_tcbinfo);
 #ifdef PROMISCUOUS_INET
 		/* XXX need to pass mbuf here */
 		syncache_unreach(&inc, &th, NULL);
 #else
 		syncache_unreach(&inc, &th);
 #endif /* PROMISCUOUS_INET */
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 	} else
 		in6_pcbnotify(&V_tcbinfo, sa, 0, (const struct sockaddr *)sa6_src,
 			      0, cmd, NULL, notify);
@@ -1730,7 +1731,7 @@ tcp_drop_syn_sent(struct inpcb *inp, int errno)
 {
 	struct tcpcb *tp;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
 	if ((inp->inp_flags & INP_TIMEWAIT) ||
@@ -2207,7 +2208,7 @@ sysctl_drop(SYSCTL_HANDLER_ARGS)
 	struct sockaddr_storage addrs[2];
 	struct inpcb *inp;
 	struct tcpcb *tp;
-	struct tcptw *tw;
+	struct in_conninfo inc;
 	struct sockaddr_in *fin, *lin;
 #ifdef INET6
 	struct sockaddr_in6 *fin6, *lin6;
@@ -2268,7 +2269,7 @@ sysctl_drop(SYSCTL_HANDLER_ARGS)
 	default:
 		return (EINVAL);
 	}
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	switch (addrs[0].ss_family) {
 #ifdef INET6
 	case AF_INET6:
@@ -2285,29 +2286,40 @@ sysctl_drop(SYSCTL_HANDLER_ARGS)
 #endif
 	}
 	if (inp != NULL) {
-		if (inp->inp_flags & INP_TIMEWAIT) {
-			/*
-			 * XXXRW: There currently exists a state where an
-			 * inpcb is present, but its timewait state has been
-			 * discarded.  For now, don't allow dropping of this
-			 * type of inpcb.
-			 */
-			tw = intotw(inp);
-			if (tw != NULL)
-				tcp_twclose(tw, 0);
-			else
-				INP_WUNLOCK(inp);
-		} else if (!(inp->inp_flags & INP_DROPPED) &&
-			   !(inp->inp_socket->so_options & SO_ACCEPTCONN)) {
+		if (!(inp->inp_flags & INP_DROPPED) &&
+		    !(inp->inp_socket->so_options & SO_ACCEPTCONN)) {
 			tp = intotcpcb(inp);
 			tp = tcp_drop(tp, ECONNABORTED);
 			if (tp != NULL)
 				INP_WUNLOCK(inp);
 		} else
 			INP_WUNLOCK(inp);
-	} else
-		error = ESRCH;
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	} else {
+		/* Connections in TIME_WAIT have no inpcb. */
+		bzero(&inc, sizeof(inc));
+		switch (addrs[0].ss_family) {
+#ifdef INET6
+		case AF_INET6:
+			inc.inc_flags = INC_ISIPV6;
+			inc.inc6_faddr = fin6->sin6_addr;
+			inc.inc6_laddr = lin6->sin6_addr;
+			inc.inc_fport = fin6->sin6_port;
+			inc.inc_lport = lin6->sin6_port;
+			break;
+#endif
+#ifdef INET
+		case AF_INET:
+			inc.inc_faddr = fin->sin_addr;
+			inc.inc_laddr = lin->sin_addr;
+			inc.inc_fport = fin->sin_port;
+			inc.inc_lport = lin->sin_port;
+			break;
+#endif
+		}
+		if (tcp_twdrop(&inc) == 0)
+			error = ESRCH;
+	}
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 	return (error);
 }
 
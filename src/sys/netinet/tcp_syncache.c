@@ -52,6 +52,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_syncache.c 238247 2012-07-08 1
 #include <sys/md5.h>
 #include <sys/proc.h>		/* for proc0 declaration */
 #include <sys/random.h>
+#include <sys/smp.h>
 #include <sys/socket.h>
 #include <sys/socketvar.h>
 #include <sys/syslog.h>
@@ -151,11 +152,10 @@ VNET_DEFINE(void *, syncache_event_cb_arg);
 static void	 syncache_drop(struct syncache *, struct syncache_head *);
 static void	 syncache_free(struct syncache *);
 static void	 syncache_insert(struct syncache *, struct syncache_head *, int);
-#ifdef PROMISCUOUS_INET
-struct syncache *syncache_lookup(struct in_conninfo *, struct syncache_head **, struct mbuf *);
-#else
-struct syncache *syncache_lookup(struct in_conninfo *, struct syncache_head **);
-#endif /* PROMISCUOUS_INET */
+static struct syncache *syncache_lookup(struct in_conninfo *,
+		    struct syncache_head **, struct mbuf *);
+static struct syncache *syncache_lookup_shard(struct in_conninfo *, u_int,
+		    struct syncache_head **, struct mbuf *);
 static int	 syncache_respond(struct syncache *);
 static struct	 socket *syncache_socket(struct syncache *, struct socket *,
 		    struct mbuf *m, struct tcpopt *to);
@@ -164,6 +164,9 @@ static void	 syncache_timeout(struct syncache *sc, struct syncache_head *sch,
 static void	 syncache_timer(void *);
 static void	 syncookie_generate(struct syncache_head *, struct syncache *,
 		    u_int32_t *);
+static void	 syncache_tfo_cookie(struct in_conninfo *, uint8_t *);
+static int	 syncache_tfo_cookie_check(struct in_conninfo *,
+		    struct tcpopt *);
 static struct syncache
 		*syncookie_lookup(struct in_conninfo *, struct syncache_head *,
 		    struct syncache *, struct tcpopt *, struct tcphdr *,
@@ -193,13 +196,18 @@ SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, cachelimit, CTLFLAG_RDTUN,
     &VNET_NAME(tcp_syncache.cache_limit), 0,
     "Overall entry limit for syncache");
 
-SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, count, CTLFLAG_RD,
-    &VNET_NAME(tcp_syncache.cache_count), 0,
+static int	sysctl_syncache_count(SYSCTL_HANDLER_ARGS);
+SYSCTL_VNET_PROC(_net_inet_tcp_syncache, OID_AUTO, count,
+    CTLTYPE_UINT|CTLFLAG_RD, NULL, 0, &sysctl_syncache_count, "IU",
     "Current number of entries in syncache");
 
 SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, hashsize, CTLFLAG_RDTUN,
     &VNET_NAME(tcp_syncache.hashsize), 0,
-    "Size of TCP syncache hashtable");
+    "Size of each TCP syncache shard hashtable");
+
+SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, shards, CTLFLAG_RDTUN,
+    &VNET_NAME(tcp_syncache.nshards), 0,
+    "Number of syncache shards, 0 for one per CPU");
 
 SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, rexmtlimit, CTLFLAG_RW,
     &VNET_NAME(tcp_syncache.rexmt_limit), 0,
@@ -210,6 +218,20 @@ SYSCTL_VNET_INT(_net_inet_tcp_syncache, OID_AUTO, rst_on_sock_fail,
     CTLFLAG_RW, &VNET_NAME(tcp_sc_rst_sock_fail), 0,
     "Send reset on socket allocation failure");
 
+SYSCTL_NODE(_net_inet_tcp, OID_AUTO, fastopen, CTLFLAG_RW, 0,
+    "TCP Fast Open");
+
+static VNET_DEFINE(int, tcp_fastopen_server_enable) = 1;
+#define	V_tcp_fastopen_server_enable	VNET(tcp_fastopen_server_enable)
+SYSCTL_VNET_INT(_net_inet_tcp_fastopen, OID_AUTO, server_enable, CTLFLAG_RW,
+    &VNET_NAME(tcp_fastopen_server_enable), 0,
+    "Accept data in SYNs on TCP_FASTOPEN listeners");
+
+VNET_DEFINE(int, tcp_fastopen_client_enable) = 1;
+SYSCTL_VNET_INT(_net_inet_tcp_fastopen, OID_AUTO, client_enable, CTLFLAG_RW,
+    &VNET_NAME(tcp_fastopen_client_enable), 0,
+    "Send data in SYNs on TCP_FASTOPEN sockets");
+
 static MALLOC_DEFINE(M_SYNCACHE, "syncache", "TCP syncache");
 
 #define SYNCACHE_HASH(inc, mask)					\
@@ -270,18 +292,25 @@ syncache_free(struct syncache *sc)
 void
 syncache_init(void)
 {
-	int i;
+	struct syncache_head *sch;
+	u_int i;
 
-	V_tcp_syncache.cache_count = 0;
+	V_tcp_syncache.nshards = 0;
 	V_tcp_syncache.hashsize = TCP_SYNCACHE_HASHSIZE;
 	V_tcp_syncache.bucket_limit = TCP_SYNCACHE_BUCKETLIMIT;
 	V_tcp_syncache.rexmt_limit = SYNCACHE_MAXREXMTS;
 	V_tcp_syncache.hash_secret = arc4random();
+	for (i = 0; i < SYNCOOKIE_SECRET_SIZE; i++)
+		V_tcp_syncache.tfo_secbits[i] = arc4random();
 
 	TUNABLE_INT_FETCH("net.inet.tcp.syncache.hashsize",
 	    &V_tcp_syncache.hashsize);
 	TUNABLE_INT_FETCH("net.inet.tcp.syncache.bucketlimit",
 	    &V_tcp_syncache.bucket_limit);
+	TUNABLE_INT_FETCH("net.inet.tcp.syncache.shards",
+	    &V_tcp_syncache.nshards);
+	if (V_tcp_syncache.nshards == 0 || V_tcp_syncache.nshards > mp_ncpus)
+		V_tcp_syncache.nshards = mp_ncpus;
 	if (!powerof2(V_tcp_syncache.hashsize) ||
 	    V_tcp_syncache.hashsize == 0) {
 		printf("WARNING: syncache hash size is not a power of 2.\n");
@@ -290,26 +319,34 @@ syncache_init(void)
 	V_tcp_syncache.hashmask = V_tcp_syncache.hashsize - 1;
 
 	/* Set limits. */
-	V_tcp_syncache.cache_limit =
+	V_tcp_syncache.cache_limit = V_tcp_syncache.nshards *
 	    V_tcp_syncache.hashsize * V_tcp_syncache.bucket_limit;
 	TUNABLE_INT_FETCH("net.inet.tcp.syncache.cachelimit",
 	    &V_tcp_syncache.cache_limit);
 
-	/* Allocate the hash table. */
-	V_tcp_syncache.hashbase = malloc(V_tcp_syncache.hashsize *
-	    sizeof(struct syncache_head), M_SYNCACHE, M_WAITOK | M_ZERO);
+	/* Allocate the shards and their hash tables. */
+	V_tcp_syncache.shards = malloc(V_tcp_syncache.nshards *
+	    sizeof(struct syncache_shard), M_SYNCACHE, M_WAITOK | M_ZERO);
+	for (i = 0; i < V_tcp_syncache.nshards; i++)
+		V_tcp_syncache.shards[i].sh_limit =
+		    imax(V_tcp_syncache.cache_limit / V_tcp_syncache.nshards, 1);
+	V_tcp_syncache.hashbase = malloc(V_tcp_syncache.nshards *
+	    V_tcp_syncache.hashsize * sizeof(struct syncache_head),
+	    M_SYNCACHE, M_WAITOK | M_ZERO);
 
 	/* Initialize the hash buckets. */
-	for (i = 0; i < V_tcp_syncache.hashsize; i++) {
+	for (i = 0; i < V_tcp_syncache.nshards * V_tcp_syncache.hashsize;
+	    i++) {
+		sch = &V_tcp_syncache.hashbase[i];
 #ifdef VIMAGE
-		V_tcp_syncache.hashbase[i].sch_vnet = curvnet;
+		sch->sch_vnet = curvnet;
 #endif
-		TAILQ_INIT(&V_tcp_syncache.hashbase[i].sch_bucket);
-		mtx_init(&V_tcp_syncache.hashbase[i].sch_mtx, "tcp_sc_head",
-			 NULL, MTX_DEF);
-		vnet_callout_init_mtx(&V_tcp_syncache.hashbase[i].sch_timer,
-			 &V_tcp_syncache.hashbase[i].sch_mtx, 0);
-		V_tcp_syncache.hashbase[i].sch_length = 0;
+		sch->sch_shard =
+		    &V_tcp_syncache.shards[i / V_tcp_syncache.hashsize];
+		TAILQ_INIT(&sch->sch_bucket);
+		mtx_init(&sch->sch_mtx, "tcp_sc_head", NULL, MTX_DEF);
+		vnet_callout_init_mtx(&sch->sch_timer, &sch->sch_mtx, 0);
+		sch->sch_length = 0;
 	}
 
 	/* Create the syncache entry zone. */
@@ -324,10 +361,11 @@ syncache_destroy(void)
 {
 	struct syncache_head *sch;
 	struct syncache *sc, *nsc;
-	int i;
+	u_int i;
 
 	/* Cleanup hash buckets: stop timers, free entries, destroy locks. */
-	for (i = 0; i < V_tcp_syncache.hashsize; i++) {
+	for (i = 0; i < V_tcp_syncache.nshards * V_tcp_syncache.hashsize;
+	    i++) {
 
 		sch = &V_tcp_syncache.hashbase[i];
 		vnet_callout_drain(&sch->sch_timer);
@@ -343,12 +381,15 @@ syncache_destroy(void)
 		mtx_destroy(&sch->sch_mtx);
 	}
 
-	KASSERT(V_tcp_syncache.cache_count == 0, ("%s: cache_count %d not 0",
-	    __func__, V_tcp_syncache.cache_count));
+	for (i = 0; i < V_tcp_syncache.nshards; i++)
+		KASSERT(V_tcp_syncache.shards[i].sh_count == 0,
+		    ("%s: shard %d count %d not 0", __func__, i,
+		    V_tcp_syncache.shards[i].sh_count));
 
 	/* Free the allocated global resources. */
 	uma_zdestroy(V_tcp_syncache.zone);
 	free(V_tcp_syncache.hashbase, M_SYNCACHE);
+	free(V_tcp_syncache.shards, M_SYNCACHE);
 }
 #endif
 
@@ -387,7 +428,7 @@ syncache_insert(struct syncache *sc, struct syncache_head *sch, int initial_time
 
 	SCH_UNLOCK(sch);
 
-	V_tcp_syncache.cache_count++;
+	atomic_add_int(&sch->sch_shard->sh_count, 1);
 	TCPSTAT_INC(tcps_sc_added);
 }
 
@@ -409,7 +450,7 @@ syncache_drop(struct syncache *sc, struct syncache_head *sch)
 		sc->sc_tu->tu_syncache_event(TOE_SC_DROP, sc->sc_toepcb);
 #endif		    
 	syncache_free(sc);
-	V_tcp_syncache.cache_count--;
+	atomic_subtract_int(&sch->sch_shard->sh_count, 1);
 }
 
 /*
@@ -562,19 +603,63 @@ syncache_hash_promisc6(struct in_conninfo *inc, struct in_l2info *l2i, uint32_t
 #endif /* PROMISCUOUS_INET */
 
 
+/*
+ * Pick the shard holding a connection's entry.  A segment carrying an RSS
+ * hash is mapped the way in_pcbgroup_byhash() maps it, so that the entry
+ * is handled on the CPU its pcbgroup will live on; anything else uses the
+ * tuple hash.  Every segment of a flow must arrive with the same kind of
+ * hash for this to be stable.
+ */
+static u_int
+syncache_shard(struct in_conninfo *inc, struct mbuf *m)
+{
+	uint32_t hash;
+
+	if (V_tcp_syncache.nshards == 1)
+		return (0);
+
+	if (m != NULL && (m->m_flags & M_PKTHDR)) {
+		switch (M_HASHTYPE_GET(m)) {
+		case M_HASHTYPE_RSS_IPV4:
+		case M_HASHTYPE_RSS_TCP_IPV4:
+		case M_HASHTYPE_RSS_IPV6:
+		case M_HASHTYPE_RSS_TCP_IPV6:
+		case M_HASHTYPE_RSS_IPV6_EX:
+		case M_HASHTYPE_RSS_TCP_IPV6_EX:
+			return (m->m_pkthdr.flowid % V_tcp_syncache.nshards);
+		default:
+			break;
+		}
+	}
+
+#ifdef INET6
+	if (inc->inc_flags & INC_ISIPV6)
+		hash = SYNCACHE_HASH6(inc, 0xffffffff);
+	else
+#endif
+		hash = SYNCACHE_HASH(inc, 0xffffffff);
+	/* The low bits pick the bucket; mix them all into the high ones. */
+	return (((hash * 2654435761U) >> 16) % V_tcp_syncache.nshards);
+}
+
 /*
  * Find an entry in the syncache.
  * Returns always with locked syncache_head plus a matching entry or NULL.
  */
-struct syncache *
-#ifdef PROMISCUOUS_INET
-syncache_lookup(struct in_conninfo *inc, struct syncache_head **schp, struct mbuf *m)
-#else
-syncache_lookup(struct in_conninfo *inc, struct syncache_head **schp)
-#endif /* PROMISCUOUS_INET */
+static struct syncache *
+syncache_lookup(struct in_conninfo *inc, struct syncache_head **schp,
+    struct mbuf *m)
+{
+
+	return (syncache_lookup_shard(inc, syncache_shard(inc, m), schp, m));
+}
+
+static struct syncache *
+syncache_lookup_shard(struct in_conninfo *inc, u_int shard,
+    struct syncache_head **schp, struct mbuf *m)
 {
 	struct syncache *sc;
-	struct syncache_head *sch;
+	struct syncache_head *sch, *hashbase;
 	uint32_t hashkey;
 #ifdef PROMISCUOUS_INET
 	struct ifl2info *l2i_tag;
@@ -596,6 +681,7 @@ syncache_lookup(struct in_conninfo *inc, struct syncache_head **schp)
 	ts = l2i ? &l2i->inl2i_tagstack : NULL;
 #endif /* PROMISCUOUS_INET */
 
+	hashbase = &V_tcp_syncache.hashbase[shard * V_tcp_syncache.hashsize];
 #ifdef INET6
 	if (inc->inc_flags & INC_ISIPV6) {
 #ifdef PROMISCUOUS_INET
@@ -603,7 +689,7 @@ syncache_lookup(struct in_conninfo *inc, struct syncache_head **schp)
 #else
 		hashkey = SYNCACHE_HASH6(inc, V_tcp_syncache.hashmask);
 #endif /* PROMISCUOUS_INET */
-		sch = &V_tcp_syncache.hashbase[hashkey];
+		sch = &hashbase[hashkey];
 		*schp = sch;
 
 		SCH_LOCK(sch);
@@ -633,7 +719,7 @@ syncache_lookup(struct in_conninfo *inc, struct syncache_head **schp)
 #else
 		hashkey = SYNCACHE_HASH(inc, V_tcp_syncache.hashmask);
 #endif /* PROMISCUOUS_INET */
-		sch = &V_tcp_syncache.hashbase[hashkey];
+		sch = &hashbase[hashkey];
 		*schp = sch;
 
 		SCH_LOCK(sch);
@@ -671,21 +757,13 @@ syncache_lookup(struct in_conninfo *inc, struct syncache_head **schp)
  * connection is in the syn cache.  If it is, zap it.
  */
 void
-#ifdef PROMISCUOUS_INET
 syncache_chkrst(struct in_conninfo *inc, struct tcphdr *th, struct mbuf *m)
-#else
-syncache_chkrst(struct in_conninfo *inc, struct tcphdr *th)
-#endif /* PROMISCUOUS_INET */
 {
 	struct syncache *sc;
 	struct syncache_head *sch;
 	char *s = NULL;
 
-#ifdef PROMISCUOUS_INET
 	sc = syncache_lookup(inc, &sch, m);	/* returns locked sch */
-#else
-	sc = syncache_lookup(inc, &sch);	/* returns locked sch */
-#endif /* PROMISCUOUS_INET */
 	SCH_LOCK_ASSERT(sch);
 
 	/*
@@ -754,20 +832,12 @@ done:
 }
 
 void
-#ifdef PROMISCUOUS_INET
 syncache_badack(struct in_conninfo *inc, struct mbuf *m)
-#else
-syncache_badack(struct in_conninfo *inc)
-#endif /* PROMISCUOUS_INET */
 {
 	struct syncache *sc;
 	struct syncache_head *sch;
 
-#ifdef PROMISCUOUS_INET
 	sc = syncache_lookup(inc, &sch, m);	/* returns locked sch */
-#else
-	sc = syncache_lookup(inc, &sch);	/* returns locked sch */
-#endif /* PROMISCUOUS_INET */
 	SCH_LOCK_ASSERT(sch);
 	if (sc != NULL) {
 		SYNCACHE_REPORT_EVENT(SYNCACHE_EVENT_DROP_BAD_ACK, sc);
@@ -816,11 +886,7 @@ syncache_passive_synack(struct in_conninfo *inc, struct tcpopt *to,
 	inc->inc_fport = inc->inc_lport;
 	inc->inc_lport = porttmp;
 
-#ifdef PROMISCUOUS_INET
 	sc = syncache_lookup(inc, &sch, m);	/* returns locked sch */
-#else
-	sc = syncache_lookup(inc, &sch);	/* returns locked sch */
-#endif /* PROMISCUOUS_INET */
 	SCH_LOCK_ASSERT(sch);
 
 	if (sc && (sc->sc_flags & SCF_PASSIVE)) {
@@ -891,12 +957,21 @@ syncache_unreach(struct in_conninfo *inc, struct tcphdr *th)
 {
 	struct syncache *sc;
 	struct syncache_head *sch;
+#ifndef PROMISCUOUS_INET
+	struct mbuf *m = NULL;
+#endif
+	u_int i;
 
-#ifdef PROMISCUOUS_INET
-	sc = syncache_lookup(inc, &sch, m);	/* returns locked sch */
-#else
-	sc = syncache_lookup(inc, &sch);	/* returns locked sch */
-#endif /* PROMISCUOUS_INET */
+	/*
+	 * The ICMP error does not tell which hash the connection's own
+	 * segments carried, so look in every shard.
+	 */
+	for (i = 0; ; i++) {
+		sc = syncache_lookup_shard(inc, i, &sch, m); /* locks sch */
+		if (sc != NULL || i == V_tcp_syncache.nshards - 1)
+			break;
+		SCH_UNLOCK(sch);
+	}
 	SCH_LOCK_ASSERT(sch);
 	if (sc == NULL)
 		goto done;
@@ -1303,6 +1378,8 @@ syncache_passive_client_socket(struct syncache *sc, struct socket *lso, struct m
 	tp->t_keepintvl = sototcpcb(lso)->t_keepintvl;
 	tp->t_keepcnt = sototcpcb(lso)->t_keepcnt;
 	tp->t_reassdl = sototcpcb(lso)->t_reassdl;
+	if (sototcpcb(lso)->t_rack != NULL)
+		(void) tcp_rack_init(tp);
 
 	/*
 	 * XXX we should probably just allocate an mbuf on the stack and
@@ -1332,7 +1409,7 @@ syncache_passive_client_socket(struct syncache *sc, struct socket *lso, struct m
 	th->th_urp = ntohs(th->th_urp);
 
 	tcp_do_segment(m1, th, (const uint8_t *)(th + 1),
-		       so, tp, 0, 0, IPTOS_ECN_NOTECT, TI_WLOCKED, 1);
+		       so, tp, 0, 0, IPTOS_ECN_NOTECT, TI_RLOCKED, 1);
 
 	/* return with inp locked */
 	return (so);
@@ -1363,7 +1440,7 @@ syncache_socket(struct syncache *sc, struct socket *lso, struct mbuf *m, struct
 	int error;
 	char *s;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 
 #ifdef PASSIVE_INET
 	if (sc->sc_flags & SCF_PASSIVE) {
@@ -1583,8 +1660,14 @@ syncache_socket(struct syncache *sc, struct socket *lso, struct mbuf *m, struct
 	tcp_rcvseqinit(tp);
 	tcp_sendseqinit(tp);
 	tp->snd_wl1 = sc->sc_irs;
-	tp->snd_max = tp->iss + 1;
-	tp->snd_nxt = tp->iss + 1;
+	if (sc->sc_flags & SCF_TFO) {
+		/* The SYN|ACK is still owed; tcp_output() sends it. */
+		tp->snd_max = tp->iss;
+		tp->snd_nxt = tp->iss;
+	} else {
+		tp->snd_max = tp->iss + 1;
+		tp->snd_nxt = tp->iss + 1;
+	}
 	tp->rcv_up = sc->sc_irs + 1;
 	tp->rcv_wnd = sc->sc_wnd;
 	tp->rcv_adv += tp->rcv_wnd;
@@ -1616,6 +1699,11 @@ syncache_socket(struct syncache *sc, struct socket *lso, struct mbuf *m, struct
 	if (sc->sc_flags & SCF_ECN)
 		tp->t_flags |= TF_ECN_PERMIT;
 
+	if (sc->sc_flags & SCF_TFO) {
+		tp->t_tfo_flags |= TFO_PENDING;
+		tp->t_flags |= TF_ACKNOW;
+	}
+
 	/*
 	 * Set up MSS and get cached values from tcp_hostcache.
 	 * This might overwrite some of the defaults we just set.
@@ -1639,6 +1727,8 @@ syncache_socket(struct syncache *sc, struct socket *lso, struct mbuf *m, struct
 #ifdef PASSIVE_INET
 	tp->t_reassdl = sototcpcb(lso)->t_reassdl;
 #endif
+	if (sototcpcb(lso)->t_rack != NULL)
+		(void) tcp_rack_init(tp);
 	tcp_timer_activate(tp, TT_KEEP, TP_KEEPINIT(tp));
 
 #if defined(PROMISCUOUS_INET) || defined(PASSIVE_INET) || defined(INET_COPY)
@@ -1704,15 +1794,11 @@ syncache_expand(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 	 * Global TCP locks are held because we manipulate the PCB lists
 	 * and create a new socket.
 	 */
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	KASSERT((th->th_flags & (TH_RST|TH_ACK|TH_SYN)) == TH_ACK,
 	    ("%s: can handle only ACK", __func__));
 
-#ifdef PROMISCUOUS_INET
 	sc = syncache_lookup(inc, &sch, m);	/* returns locked sch */
-#else
-	sc = syncache_lookup(inc, &sch);	/* returns locked sch */
-#endif /* PROMISCUOUS_INET */
 	SCH_LOCK_ASSERT(sch);
 	if (sc == NULL) {
 		/*
@@ -1753,7 +1839,7 @@ syncache_expand(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 		/* Pull out the entry to unlock the bucket row. */
 		TAILQ_REMOVE(&sch->sch_bucket, sc, sc_hash);
 		sch->sch_length--;
-		V_tcp_syncache.cache_count--;
+		atomic_subtract_int(&sch->sch_shard->sh_count, 1);
 		SCH_UNLOCK(sch);
 	}
 
@@ -1818,8 +1904,13 @@ syncache_expand(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 
 	if (*lsop == NULL)
 		TCPSTAT_INC(tcps_sc_aborted);
-	else
+	else {
 		TCPSTAT_INC(tcps_sc_completed);
+		if (sc == &scs)
+			TCPSTAT_INC(tcps_sc_cookiehit);
+		else
+			TCPSTAT_INC(tcps_sc_cachehit);
+	}
 
 /* how do we find the inp for the new socket? */
 	if (sc != &scs)
@@ -1846,9 +1937,9 @@ tcp_offload_syncache_expand(struct in_conninfo *inc, struct toeopt *toeo,
 	to.to_wscale = toeo->to_wscale;
 	to.to_flags = toeo->to_flags;
 	
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	rc = syncache_expand(inc, &to, th, lsop, m);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 
 	return (rc);
 }
@@ -1865,8 +1956,14 @@ tcp_offload_syncache_expand(struct in_conninfo *inc, struct toeopt *toeo,
  * DoS attack, an attacker could send data which would eventually
  * consume all available buffer space if it were ACKed.  By not ACKing
  * the data, we avoid this DoS scenario.
+ *
+ * The exception is a SYN carrying a valid TCP Fast Open cookie, which
+ * proves that the peer received a SYN|ACK from us at its address.  The
+ * connection is then created at once and returned in *lsop, the listen
+ * socket and tcbinfo stay locked, m is not consumed and 1 is returned;
+ * the caller processes the segment on the new socket.
  */
-static void
+static int
 _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
     struct inpcb *inp, struct socket **lsop, struct mbuf *m,
     struct toe_usrreqs *tu, void *toepcb, int initial_timeout)
@@ -1896,8 +1993,9 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 #endif
 	struct syncache scs;
 	struct ucred *cred;
+	int tfo_cookie_ok, tfo_cookie_req, cache_full;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(inp);			/* listen socket */
 	KASSERT((th->th_flags & (TH_RST|TH_ACK|TH_SYN)) == TH_SYN,
 	    ("%s: unexpected tcp flags", __func__));
@@ -1929,6 +2027,31 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 	txif = m->m_pkthdr.rcvif;
 #endif
 
+	/*
+	 * TCP Fast Open (RFC 7413).  A SYN with an empty cookie, or one
+	 * we did not issue, gets a fresh cookie in the SYN|ACK.
+	 */
+	tfo_cookie_ok = tfo_cookie_req = 0;
+	if ((tp->t_tfo_flags & TFO_ENABLED) && V_tcp_fastopen_server_enable &&
+	    (to->to_flags & TOF_FASTOPEN) && !(ltflags & TF_NOOPT) &&
+	    m != NULL) {
+		if (to->to_tfo_len == 0)
+			TCPSTAT_INC(tcps_tfo_cookie_req);
+		else if (syncache_tfo_cookie_check(inc, to))
+			tfo_cookie_ok = 1;
+		else
+			TCPSTAT_INC(tcps_tfo_cookie_bad);
+		tfo_cookie_req = !tfo_cookie_ok;
+#ifdef PASSIVE_INET
+		if (passive)
+			tfo_cookie_ok = tfo_cookie_req = 0;
+#endif
+#ifdef PROMISCUOUS_INET
+		if (promisc_listen)
+			tfo_cookie_ok = tfo_cookie_req = 0;
+#endif
+	}
+
 	/* By the time we drop the lock these should no longer be used. */
 	so = NULL;
 	tp = NULL;
@@ -1936,18 +2059,24 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 #ifdef MAC
 	if (mac_syncache_init(&maclabel) != 0) {
 		INP_WUNLOCK(inp);
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 		goto done;
 	} else
 		mac_syncache_create(maclabel, inp);
 #endif
+	/*
+	 * A connection opened by a Fast Open cookie is created below,
+	 * while the listen socket is still locked.
+	 */
+	if (!tfo_cookie_ok) {
 #ifdef PROMISCUOUS_INET
-	if (synfilter)
-		INP_DOWNGRADE(inp);
-	else
+		if (synfilter)
+			INP_DOWNGRADE(inp);
+		else
 #endif
-		INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+			INP_WUNLOCK(inp);
+		INP_INFO_RUNLOCK(&V_tcbinfo);
+	}
 
 	/*
 	 * Remember the IP options, if any.
@@ -1973,11 +2102,7 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 	 * how to handle such a case; either ignore it as spoofed, or
 	 * drop the current entry and create a new one?
 	 */
-#ifdef PROMISCUOUS_INET
 	sc = syncache_lookup(inc, &sch, m);	/* returns locked entry */
-#else
-	sc = syncache_lookup(inc, &sch);	/* returns locked entry */
-#endif /* PROMISCUOUS_INET */
 	SCH_LOCK_ASSERT(sch);
 	if (sc != NULL) {
 #ifndef TCP_OFFLOAD_DISABLE
@@ -2030,6 +2155,10 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 		if (synfilter)
 			INP_RUNLOCK(inp);
 #endif
+		if (tfo_cookie_ok) {
+			INP_WUNLOCK(inp);
+			INP_INFO_RUNLOCK(&V_tcbinfo);
+		}
 		goto done;
 	}
 
@@ -2101,6 +2230,34 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 	}
 #endif /* PROMISCUOUS_INET */
 
+	if (tfo_cookie_ok) {
+		/* Never enters the cache. */
+		bzero(&scs, sizeof(scs));
+		sc = &scs;
+		goto skip_alloc;
+	}
+
+	/*
+	 * Once the shard is full, as under a SYN flood, or when only
+	 * cookies are wanted, answer from an entry on the stack.  The
+	 * cookie carries all the returning ACK needs, so nothing is
+	 * allocated or inserted.
+	 */
+	cache_full = (sch->sch_shard->sh_count >= sch->sch_shard->sh_limit);
+	if (cache_full)
+		TCPSTAT_INC(tcps_sc_cacheoverflow);
+#ifdef PASSIVE_INET
+	if (V_tcp_syncookies && !passive && tu == NULL &&
+#else
+	if (V_tcp_syncookies && tu == NULL &&
+#endif
+	    (V_tcp_syncookiesonly || cache_full)) {
+		bzero(&scs, sizeof(scs));
+		sc = &scs;
+		TCPSTAT_INC(tcps_sc_cookieonly);
+		goto skip_alloc;
+	}
+
 	sc = uma_zalloc(V_tcp_syncache.zone, M_NOWAIT | M_ZERO);
 	if (sc == NULL) {
 		/*
@@ -2134,7 +2291,8 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 			}
 		}
 	}
-	
+
+skip_alloc:
 	/*
 	 * Fill in the syncache values.
 	 */
@@ -2244,11 +2402,15 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 		sc->sc_flags |= SCF_NOOPT;
 	if ((th->th_flags & (TH_ECE|TH_CWR)) && V_tcp_do_ecn)
 		sc->sc_flags |= SCF_ECN;
+	if (tfo_cookie_req)
+		sc->sc_flags |= SCF_TFO_COOKIE;
+	if (tfo_cookie_ok)
+		sc->sc_flags |= SCF_TFO;
 
 #ifdef PASSIVE_INET
-	if (V_tcp_syncookies && !passive) {
+	if (V_tcp_syncookies && !passive && !tfo_cookie_ok) {
 #else
-	if (V_tcp_syncookies) {
+	if (V_tcp_syncookies && !tfo_cookie_ok) {
 #endif
 		syncookie_generate(sch, sc, &flowtmp);
 #ifdef INET6
@@ -2275,22 +2437,38 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 	if (synfilter)
 		INP_RUNLOCK(inp);
 #endif
+
+	if (tfo_cookie_ok) {
+		so = syncache_socket(sc, *lsop, m, to);
+		if (sc->sc_ipopts)
+			(void) m_free(sc->sc_ipopts);
+		if (sc->sc_cred)
+			crfree(sc->sc_cred);
+		if (so == NULL) {
+			TCPSTAT_INC(tcps_sc_aborted);
+			INP_WUNLOCK(inp);
+			INP_INFO_RUNLOCK(&V_tcbinfo);
+			goto done;
+		}
+		/* Hand the connection to accept() before the 3WHS ends. */
+		soisconnected(so);
+		TCPSTAT_INC(tcps_tfo_syn_data);
+		*lsop = so;
+		return (1);
+	}
+
 #ifdef INET_COPY
-	sc->sc_syn = m;
-	m = NULL; /* don't free m below */
+	if (sc != &scs) {
+		sc->sc_syn = m;
+		m = NULL; /* don't free m below */
+	}
 #endif
 
 	/*
 	 * Do a standard 3-way handshake.
 	 */
 	if (TOEPCB_ISSET(sc) || syncache_respond(sc) == 0) {
-#ifdef PASSIVE_INET
-		if (V_tcp_syncookies && V_tcp_syncookiesonly && sc != &scs && !passive)
-#else
-		if (V_tcp_syncookies && V_tcp_syncookiesonly && sc != &scs)
-#endif
-			syncache_free(sc);
-		else if (sc != &scs)
+		if (sc != &scs)
 			syncache_insert(sc, sch, initial_timeout);   /* locks and unlocks sch */
 		TCPSTAT_INC(tcps_sndacks);
 		TCPSTAT_INC(tcps_sndtotal);
@@ -2299,6 +2477,12 @@ _syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
 			syncache_free(sc);
 		TCPSTAT_INC(tcps_sc_dropped);
 	}
+	if (sc == &scs) {
+		if (sc->sc_ipopts)
+			(void) m_free(sc->sc_ipopts);
+		if (sc->sc_cred)
+			crfree(sc->sc_cred);
+	}
 
 done:
 	if (cred != NULL)
@@ -2312,6 +2496,7 @@ done:
 		*lsop = NULL;
 		m_freem(m);
 	}
+	return (0);
 }
 
 static int
@@ -2323,6 +2508,7 @@ syncache_respond(struct syncache *sc)
 	int optlen, error = 0;	/* Make compiler happy */
 	u_int16_t hlen, tlen, mssopt;
 	struct tcpopt to;
+	uint8_t tfo_cookie[TCP_FASTOPEN_COOKIE_LEN];
 #ifdef INET6
 	struct ip6_hdr *ip6 = NULL;
 #endif
@@ -2458,6 +2644,12 @@ syncache_respond(struct syncache *sc)
 		if (sc->sc_flags & SCF_SIGNATURE)
 			to.to_flags |= TOF_SIGNATURE;
 #endif
+		if (sc->sc_flags & SCF_TFO_COOKIE) {
+			syncache_tfo_cookie(&sc->sc_inc, tfo_cookie);
+			to.to_tfo_cookie = tfo_cookie;
+			to.to_tfo_len = TCP_FASTOPEN_COOKIE_LEN;
+			to.to_flags |= TOF_FASTOPEN;
+		}
 		optlen = tcp_addoptions(&to, (u_char *)(th + 1));
 
 		/* Adjust headers by option size. */
@@ -2504,11 +2696,12 @@ syncache_respond(struct syncache *sc)
 	return (error);
 }
 
-void
+int
 syncache_add(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
      struct inpcb *inp, struct socket **lsop, struct mbuf *m, int initial_timeout)
 {
-	_syncache_add(inc, to, th, inp, lsop, m, NULL, NULL, initial_timeout);
+	return (_syncache_add(inc, to, th, inp, lsop, m, NULL, NULL,
+	    initial_timeout));
 }
 
 void
@@ -2523,10 +2716,10 @@ tcp_offload_syncache_add(struct in_conninfo *inc, struct toeopt *toeo,
 	to.to_wscale = toeo->to_wscale;
 	to.to_flags = toeo->to_flags;
 
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	INP_WLOCK(inp);
 
-	_syncache_add(inc, &to, th, inp, lsop, NULL, tu, toepcb, -1);
+	(void) _syncache_add(inc, &to, th, inp, lsop, NULL, tu, toepcb, -1);
 }
 
 /*
@@ -2783,6 +2976,42 @@ syncookie_lookup(struct in_conninfo *inc, struct syncache_head *sch,
 	return (sc);
 }
 
+/*
+ * TCP Fast Open cookie (RFC 7413 section 4.1.2): the leading bytes of an
+ * MD5 digest over a per-vnet secret and the client's address.  Unlike
+ * the SYN cookie it does not depend on the ports or sequence numbers,
+ * so a client can reuse it for later connections.
+ */
+static void
+syncache_tfo_cookie(struct in_conninfo *inc, uint8_t *cookie)
+{
+	MD5_CTX ctx;
+	u_int8_t md5_buffer[MD5_DIGEST_LENGTH];
+
+	MD5Init(&ctx);
+	MD5Update(&ctx, V_tcp_syncache.tfo_secbits,
+	    sizeof(V_tcp_syncache.tfo_secbits));
+#ifdef INET6
+	if (inc->inc_flags & INC_ISIPV6)
+		MD5Update(&ctx, &inc->inc6_faddr, sizeof(inc->inc6_faddr));
+	else
+#endif
+		MD5Update(&ctx, &inc->inc_faddr, sizeof(inc->inc_faddr));
+	MD5Final(md5_buffer, &ctx);
+	bcopy(md5_buffer, cookie, TCP_FASTOPEN_COOKIE_LEN);
+}
+
+static int
+syncache_tfo_cookie_check(struct in_conninfo *inc, struct tcpopt *to)
+{
+	uint8_t cookie[TCP_FASTOPEN_COOKIE_LEN];
+
+	if (to->to_tfo_len != TCP_FASTOPEN_COOKIE_LEN)
+		return (0);
+	syncache_tfo_cookie(inc, cookie);
+	return (bcmp(cookie, to->to_tfo_cookie, sizeof(cookie)) == 0);
+}
+
 /*
  * Returns the current number of syncache entries.  This number
  * will probably change before you get around to calling 
@@ -2792,17 +3021,24 @@ syncookie_lookup(struct in_conninfo *inc, struct syncache_head *sch,
 int
 syncache_pcbcount(void)
 {
-	struct syncache_head *sch;
-	int count, i;
+	int count;
+	u_int i;
 
-	for (count = 0, i = 0; i < V_tcp_syncache.hashsize; i++) {
-		/* No need to lock for a read. */
-		sch = &V_tcp_syncache.hashbase[i];
-		count += sch->sch_length;
-	}
+	/* No need to lock for a read. */
+	for (count = 0, i = 0; i < V_tcp_syncache.nshards; i++)
+		count += V_tcp_syncache.shards[i].sh_count;
 	return count;
 }
 
+static int
+sysctl_syncache_count(SYSCTL_HANDLER_ARGS)
+{
+	u_int count;
+
+	count = syncache_pcbcount();
+	return (sysctl_handle_int(oidp, &count, 0, req));
+}
+
 /*
  * Exports the syncache entries to userland so that netstat can display
  * them alongside the other sockets.  This function is intended to be
@@ -2820,7 +3056,8 @@ syncache_pcblist(struct sysctl_req *req, int max_pcbs, int *pcbs_exported)
 	struct syncache_head *sch;
 	int count, error, i;
 
-	for (count = 0, error = 0, i = 0; i < V_tcp_syncache.hashsize; i++) {
+	for (count = 0, error = 0, i = 0;
+	    i < V_tcp_syncache.nshards * V_tcp_syncache.hashsize; i++) {
 		sch = &V_tcp_syncache.hashbase[i];
 		SCH_LOCK(sch);
 		TAILQ_FOREACH(sc, &sch->sch_bucket, sc_hash) {
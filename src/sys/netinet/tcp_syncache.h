@@ -53,20 +53,15 @@ int	 syncache_expand(struct in_conninfo *, struct tcpopt *,
 	     struct tcphdr *, struct socket **, struct mbuf *);
 int	 tcp_offload_syncache_expand(struct in_conninfo *inc, struct toeopt *toeo,
              struct tcphdr *th, struct socket **lsop, struct mbuf *m);
-void	 syncache_add(struct in_conninfo *, struct tcpopt *,
+int	 syncache_add(struct in_conninfo *, struct tcpopt *,
 		      struct tcphdr *, struct inpcb *, struct socket **, struct mbuf *,
 		      int);
 void	 tcp_offload_syncache_add(struct in_conninfo *, struct toeopt *,
              struct tcphdr *, struct inpcb *, struct socket **,
              struct toe_usrreqs *tu, void *toepcb);
 
-#ifdef PROMISCUOUS_INET
 void	 syncache_chkrst(struct in_conninfo *, struct tcphdr *, struct mbuf *);
 void	 syncache_badack(struct in_conninfo *, struct mbuf *);
-#else
-void	 syncache_chkrst(struct in_conninfo *, struct tcphdr *);
-void	 syncache_badack(struct in_conninfo *);
-#endif /* PROMISCUOUS_INET */
 #ifdef PASSIVE_INET
 int	 syncache_passive_synack(struct in_conninfo *, struct tcpopt *,
 	     struct tcphdr *, struct mbuf *);
@@ -130,12 +125,15 @@ struct syncache {
 #define SCF_PASSIVE_SYNACK	0x400			/* SYN|ACK captured in passive mode */
 #define SCF_NO_TIMEOUT_RESET	0x800			/* don't reset timeout on dup SYN */ 
 #define SCF_CONVERT_ON_TIMEOUT	0x1000			/* convert from passive to active on timeout */
+#define SCF_TFO_COOKIE		0x2000			/* send a Fast Open cookie */
+#define SCF_TFO			0x4000			/* opened by a Fast Open cookie */
 
 #define	SYNCOOKIE_SECRET_SIZE	8	/* dwords */
 #define	SYNCOOKIE_LIFETIME	16	/* seconds */
 
 struct syncache_head {
 	struct vnet	*sch_vnet;
+	struct syncache_shard *sch_shard;
 	struct mtx	sch_mtx;
 	TAILQ_HEAD(sch_head, syncache)	sch_bucket;
 	struct vnet_callout sch_timer;
@@ -147,16 +145,27 @@ struct syncache_head {
 	u_int		sch_reseed;		/* time_uptime, seconds */
 };
 
+/*
+ * The cache is split into shards, normally one per CPU, each owning
+ * hashsize consecutive buckets of hashbase.
+ */
+struct syncache_shard {
+	u_int	sh_count;		/* entries in the shard */
+	u_int	sh_limit;		/* entries before cookies take over */
+} __aligned(CACHE_LINE_SIZE);
+
 struct tcp_syncache {
 	struct	syncache_head *hashbase;
+	struct	syncache_shard *shards;
 	uma_zone_t zone;
-	u_int	hashsize;
+	u_int	nshards;
+	u_int	hashsize;		/* buckets per shard */
 	u_int	hashmask;
 	u_int	bucket_limit;
-	u_int	cache_count;		/* XXX: unprotected */
 	u_int	cache_limit;
 	u_int	rexmt_limit;
 	u_int	hash_secret;
+	u_int32_t tfo_secbits[SYNCOOKIE_SECRET_SIZE]; /* Fast Open cookie key */
 };
 
 #ifdef UINET
@@ -153,6 +153,8 @@ struct tcp_timer {
 #ifdef PASSIVE_INET
 	struct	vnet_callout tt_reassdl;/* reassmbly deadline timer */
 #endif
+	struct	vnet_callout tt_pace;	/* paced output resume timer */
+	struct	vnet_callout tt_rack;	/* RACK reordering / loss probe */
 };
 #define TT_DELACK	0x01
 #define TT_REXMT	0x02
@@ -162,6 +164,8 @@ struct tcp_timer {
 #ifdef PASSIVE_INET
 #define TT_REASSDL	0x20
 #endif
+#define TT_PACE		0x40
+#define TT_RACK		0x80
 
 #define	TP_KEEPINIT(tp)	((tp)->t_keepinit ? (tp)->t_keepinit : tcp_keepinit)
 #define	TP_KEEPIDLE(tp)	((tp)->t_keepidle ? (tp)->t_keepidle : tcp_keepidle)
@@ -192,12 +196,13 @@ extern int tcp_fast_finwait2_recycle;
 
 void	tcp_timer_init(void);
 void	tcp_timer_2msl(void *xtp);
-struct tcptw *
-	tcp_tw_2msl_scan(int _reuse);		/* XXX temporary */
+void	tcp_tw_2msl_scan(void);
 void	tcp_timer_keep(void *xtp);
 void	tcp_timer_persist(void *xtp);
 void	tcp_timer_rexmt(void *xtp);
 void	tcp_timer_delack(void *xtp);
+void	tcp_timer_pace(void *xtp);
+void	tcp_timer_rack(void *xtp);
 void	tcp_timer_to_xtimer(struct tcpcb *tp, struct tcp_timer *timer,
 	struct xtcp_timer *xtimer);
 #ifdef PASSIVE_INET
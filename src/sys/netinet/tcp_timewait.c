@@ -36,6 +36,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_timewait.c 238247 2012-07-08 1
 #include "opt_inet6.h"
 #include "opt_tcpdebug.h"
 #include "opt_passiveinet.h"
+#include "opt_promiscinet.h"
 
 #include <sys/param.h>
 #include <sys/systm.h>
@@ -55,6 +56,9 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_timewait.c 238247 2012-07-08 1
 
 #include <net/route.h>
 #include <net/if.h>
+#ifdef PROMISCUOUS_INET
+#include <net/if_promiscinet.h>
+#endif
 #include <net/vnet.h>
 
 #include <netinet/in.h>
@@ -62,6 +66,9 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_timewait.c 238247 2012-07-08 1
 #include <netinet/in_passive.h>
 #endif
 #include <netinet/in_pcb.h>
+#ifdef PROMISCUOUS_INET
+#include <netinet/in_promisc.h>
+#endif
 #include <netinet/in_systm.h>
 #include <netinet/in_var.h>
 #include <netinet/ip.h>
@@ -96,37 +103,110 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_timewait.c 238247 2012-07-08 1
 #include <security/mac/mac_framework.h>
 #endif /* MAC */
 
+/*
+ * A connection in TIME_WAIT keeps neither its inpcb nor its socket.  All
+ * that remains is a struct tcptw, found by 4-tuple through a hash table
+ * with a mutex per bucket, and expired from a timing wheel of
+ * TW_WHEEL_SIZE slots, each one slow timeout wide, that tcp_slowtimo()
+ * advances.  Neither path takes the tcbinfo lock.
+ *
+ * Locks are ordered inpcb, then hash bucket, then tw_lock (the wheel).
+ * An entry is freed by whoever removes it from the wheel; a thread that
+ * finds an entry still hashed but already claimed by the wheel scan only
+ * unhashes it.
+ */
+#define	TCP_TW_HASHSIZE		2048
+#define	TW_WHEEL_SIZE		128
+#define	TW_SLOT_NONE		(-1)
+#define	TW_SLOT_TICKS		imax(hz / PR_SLOWHZ, 1)
+#define	TW_SLOT(t)		(((u_int)(t) / TW_SLOT_TICKS) & (TW_WHEEL_SIZE - 1))
+
+struct tcp_tw_head {
+	struct mtx	th_mtx;
+	LIST_HEAD(, tcptw) th_list;
+	u_int		th_length;
+};
+
+struct tcp_tw_table {
+	struct tcp_tw_head *hashbase;
+	u_int		hashsize;
+	u_int		hashmask;
+	u_int		hash_secret;
+	u_int		count;		/* entries hashed, updated atomically */
+	int		wheel_time;	/* start of the next slot to expire */
+	TAILQ_HEAD(, tcptw) wheel[TW_WHEEL_SIZE];
+};
+
+static VNET_DEFINE(struct tcp_tw_table, tcp_tw);
+#define	V_tcp_tw			VNET(tcp_tw)
+
 static VNET_DEFINE(uma_zone_t, tcptw_zone);
 #define	V_tcptw_zone			VNET(tcptw_zone)
 static int	maxtcptw;
 
+static VNET_DEFINE(struct mtx, tw_lock);
+#define	V_tw_lock			VNET(tw_lock)
+
+#define	TW_LOCK_INIT()		VNET_MTX_INIT(&V_tw_lock, "tcptw", NULL, MTX_DEF)
+#define	TW_LOCK_DESTROY()	VNET_MTX_DESTROY(&V_tw_lock)
+#define	TW_LOCK()		VNET_MTX_LOCK(&V_tw_lock)
+#define	TW_UNLOCK()		VNET_MTX_UNLOCK(&V_tw_lock)
+
+#define	TWH_LOCK(th)		VNET_MTX_LOCK(&(th)->th_mtx)
+#define	TWH_UNLOCK(th)		VNET_MTX_UNLOCK(&(th)->th_mtx)
+#define	TWH_LOCK_ASSERT(th)	VNET_MTX_ASSERT(&(th)->th_mtx, MA_OWNED)
+
+#define	TW_HASH(inc)							\
+	((V_tcp_tw.hash_secret ^					\
+	  (inc)->inc_faddr.s_addr ^					\
+	  ((inc)->inc_faddr.s_addr >> 16) ^				\
+	  (inc)->inc_laddr.s_addr ^					\
+	  (inc)->inc_fport ^ ((inc)->inc_lport << 16)) & V_tcp_tw.hashmask)
+
+#define	TW_HASH6(inc)							\
+	((V_tcp_tw.hash_secret ^					\
+	  (inc)->inc6_faddr.s6_addr32[0] ^				\
+	  (inc)->inc6_faddr.s6_addr32[3] ^				\
+	  (inc)->inc6_laddr.s6_addr32[3] ^				\
+	  (inc)->inc_fport ^ ((inc)->inc_lport << 16)) & V_tcp_tw.hashmask)
+
+#ifdef PROMISCUOUS_INET
 /*
- * The timed wait queue contains references to each of the TCP sessions
- * currently in the TIME_WAIT state.  The queue pointers, including the
- * queue pointers in each tcptw structure, are protected using the global
- * tcbinfo lock, which must be held over queue iteration and modification.
+ * A promiscuous connection is also identified by its VLAN tag stack,
+ * which its entry keeps in the L2 info tag that its replies carry.
  */
-static VNET_DEFINE(TAILQ_HEAD(, tcptw), twq_2msl);
-#define	V_twq_2msl			VNET(twq_2msl)
+#define	TW_L2TS(tw)							\
+	((tw)->tw_l2tag != NULL ?					\
+	 &((struct ifl2info *)(tw)->tw_l2tag)->ifl2i_info.inl2i_tagstack : NULL)
+#else
+#define	TW_L2TS(tw)		NULL
+#endif
 
-static void	tcp_tw_2msl_reset(struct tcptw *, int);
-static void	tcp_tw_2msl_stop(struct tcptw *);
+struct in_l2tagstack;
+
+static struct tcp_tw_head *
+		tcp_tw_head(struct in_conninfo *);
+static struct tcptw *
+		tcp_tw_lookup(struct tcp_tw_head *, struct in_conninfo *,
+		    const struct in_l2tagstack *);
+static void	tcp_tw_insert(struct tcp_tw_head *, struct tcptw *);
+static void	tcp_tw_unhash(struct tcp_tw_head *, struct tcptw *);
+static void	tcp_tw_kill(struct tcp_tw_head *, struct tcptw *);
+static void	tcp_tw_free(struct tcptw *);
+static struct tcptw *
+		tcp_tw_reclaim(void);
+static void	tcp_tw_2msl_reset(struct tcptw *);
 
 static int
 tcptw_auto_size(void)
 {
-	int halfrange;
 
 	/*
-	 * Max out at half the ephemeral port range so that TIME_WAIT
-	 * sockets don't tie up too many ephemeral ports.
+	 * TIME_WAIT entries hold neither a socket nor a local port, so the
+	 * only thing they cost is their own memory.  Allow as many as there
+	 * may be sockets.
 	 */
-	if (V_ipport_lastauto > V_ipport_firstauto)
-		halfrange = (V_ipport_lastauto - V_ipport_firstauto) / 2;
-	else
-		halfrange = (V_ipport_firstauto - V_ipport_lastauto) / 2;
-	/* Protect against goofy port ranges smaller than 32. */
-	return (imin(imax(halfrange, 32), maxsockets / 5));
+	return (imax(maxsockets, 32));
 }
 
 static int
@@ -151,12 +231,27 @@ SYSCTL_PROC(_net_inet_tcp, OID_AUTO, maxtcptw, CTLTYPE_INT|CTLFLAG_RW,
     &maxtcptw, 0, sysctl_maxtcptw, "IU",
     "Maximum number of compressed TCP TIME_WAIT entries");
 
+SYSCTL_VNET_UINT(_net_inet_tcp, OID_AUTO, tw_count, CTLFLAG_RD,
+    &VNET_NAME(tcp_tw.count), 0,
+    "Current number of compressed TCP TIME_WAIT entries");
+
+SYSCTL_VNET_UINT(_net_inet_tcp, OID_AUTO, tw_hashsize, CTLFLAG_RDTUN,
+    &VNET_NAME(tcp_tw.hashsize), 0,
+    "Size of TCP TIME_WAIT hashtable");
+
 VNET_DEFINE(int, nolocaltimewait) = 0;
 #define	V_nolocaltimewait	VNET(nolocaltimewait)
 SYSCTL_VNET_INT(_net_inet_tcp, OID_AUTO, nolocaltimewait, CTLFLAG_RW,
     &VNET_NAME(nolocaltimewait), 0,
     "Do not create compressed TCP TIME_WAIT entries for local connections");
 
+static VNET_DEFINE(int, tcp_tw_reuse) = 1;
+#define	V_tcp_tw_reuse		VNET(tcp_tw_reuse)
+SYSCTL_VNET_INT(_net_inet_tcp, OID_AUTO, tw_reuse, CTLFLAG_RW,
+    &VNET_NAME(tcp_tw_reuse), 0,
+    "Let outgoing connections reuse a 4-tuple in TIME_WAIT when timestamps "
+    "protect it");
+
 void
 tcp_tw_zone_change(void)
 {
@@ -168,6 +263,7 @@ tcp_tw_zone_change(void)
 void
 tcp_tw_init(void)
 {
+	int i;
 
 	V_tcptw_zone = uma_zcreate("tcptw", sizeof(struct tcptw),
 	    NULL, NULL, NULL, NULL, UMA_ALIGN_PTR, UMA_ZONE_NOFREE);
@@ -176,24 +272,224 @@ tcp_tw_init(void)
 		uma_zone_set_max(V_tcptw_zone, tcptw_auto_size());
 	else
 		uma_zone_set_max(V_tcptw_zone, maxtcptw);
-	TAILQ_INIT(&V_twq_2msl);
+
+	V_tcp_tw.count = 0;
+	V_tcp_tw.hashsize = TCP_TW_HASHSIZE;
+	V_tcp_tw.hash_secret = arc4random();
+	TUNABLE_INT_FETCH("net.inet.tcp.tw_hashsize", &V_tcp_tw.hashsize);
+	if (!powerof2(V_tcp_tw.hashsize) || V_tcp_tw.hashsize == 0) {
+		printf("WARNING: TIME_WAIT hash size is not a power of 2.\n");
+		V_tcp_tw.hashsize = TCP_TW_HASHSIZE;
+	}
+	V_tcp_tw.hashmask = V_tcp_tw.hashsize - 1;
+	V_tcp_tw.hashbase = malloc(V_tcp_tw.hashsize *
+	    sizeof(struct tcp_tw_head), M_PCB, M_WAITOK | M_ZERO);
+	for (i = 0; i < V_tcp_tw.hashsize; i++) {
+		LIST_INIT(&V_tcp_tw.hashbase[i].th_list);
+		VNET_MTX_INIT(&V_tcp_tw.hashbase[i].th_mtx, "tcptw_head",
+		    NULL, MTX_DEF);
+	}
+
+	for (i = 0; i < TW_WHEEL_SIZE; i++)
+		TAILQ_INIT(&V_tcp_tw.wheel[i]);
+	V_tcp_tw.wheel_time = ticks - ticks % TW_SLOT_TICKS;
+	TW_LOCK_INIT();
 }
 
 #ifdef VIMAGE
 void
 tcp_tw_destroy(void)
 {
+	struct tcp_tw_head *th;
 	struct tcptw *tw;
+	int i;
+
+	for (i = 0; i < V_tcp_tw.hashsize; i++) {
+		th = &V_tcp_tw.hashbase[i];
+		TWH_LOCK(th);
+		while ((tw = LIST_FIRST(&th->th_list)) != NULL)
+			tcp_tw_kill(th, tw);
+		TWH_UNLOCK(th);
+		VNET_MTX_DESTROY(&th->th_mtx);
+	}
+	free(V_tcp_tw.hashbase, M_PCB);
 
-	INP_INFO_WLOCK(&V_tcbinfo);
-	while((tw = TAILQ_FIRST(&V_twq_2msl)) != NULL)
-		tcp_twclose(tw, 0);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
-
+	TW_LOCK_DESTROY();
 	uma_zdestroy(V_tcptw_zone);
 }
 #endif
 
+static struct tcp_tw_head *
+tcp_tw_head(struct in_conninfo *inc)
+{
+
+#ifdef INET6
+	if (inc->inc_flags & INC_ISIPV6)
+		return (&V_tcp_tw.hashbase[TW_HASH6(inc)]);
+#endif
+	return (&V_tcp_tw.hashbase[TW_HASH(inc)]);
+}
+
+/*
+ * Find the entry for a 4-tuple.  ts is the VLAN tag stack of a
+ * promiscuous connection, NULL otherwise.
+ */
+static struct tcptw *
+tcp_tw_lookup(struct tcp_tw_head *th, struct in_conninfo *inc,
+    const struct in_l2tagstack *ts)
+{
+	struct tcptw *tw;
+
+	TWH_LOCK_ASSERT(th);
+	LIST_FOREACH(tw, &th->th_list, tw_hash) {
+		if ((tw->tw_inc.inc_flags & INC_ISIPV6) !=
+		    (inc->inc_flags & INC_ISIPV6))
+			continue;
+		if (tw->tw_inc.inc_fport != inc->inc_fport ||
+		    tw->tw_inc.inc_lport != inc->inc_lport)
+			continue;
+#ifdef PROMISCUOUS_INET
+		if (in_promisc_tagcmp(ts, TW_L2TS(tw)) != 0)
+			continue;
+#endif
+#ifdef INET6
+		if (inc->inc_flags & INC_ISIPV6) {
+			if (IN6_ARE_ADDR_EQUAL(&tw->tw_inc.inc6_faddr,
+			    &inc->inc6_faddr) &&
+			    IN6_ARE_ADDR_EQUAL(&tw->tw_inc.inc6_laddr,
+			    &inc->inc6_laddr))
+				return (tw);
+			continue;
+		}
+#endif
+		if (tw->tw_inc.inc_faddr.s_addr == inc->inc_faddr.s_addr &&
+		    tw->tw_inc.inc_laddr.s_addr == inc->inc_laddr.s_addr)
+			return (tw);
+	}
+	return (NULL);
+}
+
+/*
+ * Hash a new entry and put it on the wheel.
+ */
+static void
+tcp_tw_insert(struct tcp_tw_head *th, struct tcptw *tw)
+{
+
+	TWH_LOCK_ASSERT(th);
+	LIST_INSERT_HEAD(&th->th_list, tw, tw_hash);
+	th->th_length++;
+	tw->tw_flags |= TWF_HASHED;
+	atomic_add_int(&V_tcp_tw.count, 1);
+
+	TW_LOCK();
+	tw->tw_time = ticks + 2 * tcp_msl;
+	tw->tw_slot = TW_SLOT(tw->tw_time);
+	TAILQ_INSERT_TAIL(&V_tcp_tw.wheel[tw->tw_slot], tw, tw_wheel);
+	TW_UNLOCK();
+}
+
+static void
+tcp_tw_unhash(struct tcp_tw_head *th, struct tcptw *tw)
+{
+
+	TWH_LOCK_ASSERT(th);
+	LIST_REMOVE(tw, tw_hash);
+	th->th_length--;
+	tw->tw_flags &= ~TWF_HASHED;
+	atomic_subtract_int(&V_tcp_tw.count, 1);
+}
+
+/*
+ * Remove a hashed entry before it expires.  If the wheel scan has
+ * already claimed it, the scan frees it once it sees it unhashed.
+ */
+static void
+tcp_tw_kill(struct tcp_tw_head *th, struct tcptw *tw)
+{
+	int owned;
+
+	tcp_tw_unhash(th, tw);
+	TW_LOCK();
+	owned = (tw->tw_slot != TW_SLOT_NONE);
+	if (owned) {
+		TAILQ_REMOVE(&V_tcp_tw.wheel[tw->tw_slot], tw, tw_wheel);
+		tw->tw_slot = TW_SLOT_NONE;
+	}
+	TW_UNLOCK();
+	if (owned)
+		tcp_tw_free(tw);
+}
+
+static void
+tcp_tw_free(struct tcptw *tw)
+{
+
+#ifdef PROMISCUOUS_INET
+	if (tw->tw_l2tag != NULL)
+		m_tag_free(tw->tw_l2tag);
+#endif
+	uma_zfree(V_tcptw_zone, tw);
+}
+
+/*
+ * Rearm the 2MSL timer of a hashed entry.
+ */
+static void
+tcp_tw_2msl_reset(struct tcptw *tw)
+{
+
+	TW_LOCK();
+	if (tw->tw_slot != TW_SLOT_NONE) {
+		TAILQ_REMOVE(&V_tcp_tw.wheel[tw->tw_slot], tw, tw_wheel);
+		tw->tw_time = ticks + 2 * tcp_msl;
+		tw->tw_slot = TW_SLOT(tw->tw_time);
+		TAILQ_INSERT_TAIL(&V_tcp_tw.wheel[tw->tw_slot], tw, tw_wheel);
+	}
+	TW_UNLOCK();
+}
+
+/*
+ * Take the entry closest to expiry off the wheel for reuse when the zone
+ * is exhausted.
+ */
+static struct tcptw *
+tcp_tw_reclaim(void)
+{
+	struct tcp_tw_head *th;
+	struct tcptw *tw;
+	int i, slot;
+
+	tw = NULL;
+	TW_LOCK();
+	slot = TW_SLOT(V_tcp_tw.wheel_time);
+	for (i = 0; i < TW_WHEEL_SIZE; i++) {
+		tw = TAILQ_FIRST(&V_tcp_tw.wheel[(slot + i) &
+		    (TW_WHEEL_SIZE - 1)]);
+		if (tw != NULL) {
+			TAILQ_REMOVE(&V_tcp_tw.wheel[tw->tw_slot], tw,
+			    tw_wheel);
+			tw->tw_slot = TW_SLOT_NONE;
+			break;
+		}
+	}
+	TW_UNLOCK();
+	if (tw == NULL)
+		return (NULL);
+	TCPSTAT_INC(tcps_tw_reclaimed);
+
+	th = tcp_tw_head(&tw->tw_inc);
+	TWH_LOCK(th);
+	if (tw->tw_flags & TWF_HASHED)
+		tcp_tw_unhash(th, tw);
+	TWH_UNLOCK(th);
+#ifdef PROMISCUOUS_INET
+	if (tw->tw_l2tag != NULL)
+		m_tag_free(tw->tw_l2tag);
+#endif
+	return (tw);
+}
+
 /*
  * Move a TCP connection into TIME_WAIT state.
  *    tcbinfo is locked.
@@ -202,10 +498,10 @@ tcp_tw_destroy(void)
 void
 tcp_twstart(struct tcpcb *tp)
 {
-	struct tcptw *tw;
+	struct tcp_tw_head *th;
+	struct tcptw *tw, *otw;
 	struct inpcb *inp = tp->t_inpcb;
 	int acknow;
-	struct socket *so;
 #ifdef INET6
 	int isipv6 = inp->inp_inc.inc_flags & INC_ISIPV6;
 #endif
@@ -214,18 +510,17 @@ tcp_twstart(struct tcpcb *tp)
 #endif
 #ifdef PROMISCUOUS_INET
 	int notimewait = tp->t_flags & TF_NO_TIMEWAIT;
+	struct m_tag *l2tag;
 #else
 	int notimewait = 0;
 #endif
-	struct tcptw local_tw;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);	/* tcp_tw_2msl_reset(). */
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
 #ifdef PASSIVE_INET
 	notimewait = (notimewait || ispassive);
 #endif
-
 	if (V_nolocaltimewait && !notimewait) {
 #ifdef INET6
 		if (isipv6)
@@ -239,7 +534,33 @@ tcp_twstart(struct tcpcb *tp)
 #endif
 	}
 
-	if (notimewait) {
+	tw = NULL;
+	if (!notimewait) {
+		tw = uma_zalloc(V_tcptw_zone, M_NOWAIT);
+		if (tw == NULL)
+			tw = tcp_tw_reclaim();
+	}
+#ifdef PROMISCUOUS_INET
+	l2tag = NULL;
+	if (tw != NULL && (inp->inp_flags2 & INP_PROMISC)) {
+		/*
+		 * Keep the connection's L2 info, both to match segments
+		 * and to address the replies sent from TIME_WAIT.
+		 */
+		l2tag = m_tag_alloc(MTAG_PROMISCINET, MTAG_PROMISCINET_L2INFO,
+		    MTAG_PROMISCINET_L2INFO_LEN, M_NOWAIT);
+		if (l2tag == NULL) {
+			uma_zfree(V_tcptw_zone, tw);
+			tw = NULL;
+		} else {
+			((struct ifl2info *)l2tag)->rcvif = inp->inp_txif;
+			in_promisc_l2info_copy(
+			    &((struct ifl2info *)l2tag)->ifl2i_info,
+			    inp->inp_l2info);
+		}
+	}
+#endif
+	if (tw == NULL) {
 		/* XXX Under what circumstances would we enter timewait and
 		 * want to delay an ack? In this case, we are not going to
 		 * hang around in timewait, so if any ack was to be sent,
@@ -250,32 +571,28 @@ tcp_twstart(struct tcpcb *tp)
 #else
 		acknow = tp->t_flags & (TF_ACKNOW|TF_DELACK);
 #endif
-		if (!acknow) {
-			tp = tcp_close(tp);
-			if (tp != NULL)
-				INP_WUNLOCK(inp);
-			return;
-		}
-		tw = &local_tw;
-	} else {
-		/*
-		 * XXX if TF_DELACK is set, should the timer be stopped and
-		 * the ack sent now?
-		 */
-		acknow = tp->t_flags & TF_ACKNOW;
-
-		tw = uma_zalloc(V_tcptw_zone, M_NOWAIT);
-		if (tw == NULL) {
-			tw = tcp_tw_2msl_scan(1);
-			if (tw == NULL) {
-				tp = tcp_close(tp);
-				if (tp != NULL)
-					INP_WUNLOCK(inp);
-				return;
-			}
+		if (acknow) {
+			tp->t_flags |= TF_ACKNOW;
+			(void) tcp_output(tp);
 		}
+		tp = tcp_close(tp);
+		if (tp != NULL)
+			INP_WUNLOCK(inp);
+		return;
 	}
-	tw->tw_inpcb = inp;
+
+	/*
+	 * XXX if TF_DELACK is set, should the timer be stopped and
+	 * the ack sent now?
+	 */
+	acknow = tp->t_flags & TF_ACKNOW;
+
+	bzero(tw, sizeof(*tw));
+	tw->tw_inc = inp->inp_inc;
+	tw->tw_slot = TW_SLOT_NONE;
+#ifdef PROMISCUOUS_INET
+	tw->tw_l2tag = l2tag;
+#endif
 
 	/*
 	 * Recover last window size sent.
@@ -292,17 +609,22 @@ tcp_twstart(struct tcpcb *tp)
 	    (TF_REQ_TSTMP|TF_RCVD_TSTMP)) {
 		tw->t_recent = tp->ts_recent;
 		tw->ts_offset = tp->ts_offset;
-	} else {
-		tw->t_recent = 0;
-		tw->ts_offset = 0;
 	}
 
 	tw->snd_nxt = tp->snd_nxt;
 	tw->rcv_nxt = tp->rcv_nxt;
-	tw->iss     = tp->iss;
-	tw->irs     = tp->irs;
-	tw->t_starttime = tp->t_starttime;
-	tw->tw_time = 0;
+	tw->tw_start = ticks;
+#ifdef INET6
+	if (isipv6)
+		tw->tw_ip_ttl = in6_selecthlim(inp, NULL);
+	else
+#endif
+	{
+		tw->tw_ip_ttl = inp->inp_ip_ttl;
+		tw->tw_ip_tos = inp->inp_ip_tos;
+	}
+	if (inp->inp_socket->so_options & SO_DONTROUTE)
+		tw->tw_flags |= TWF_DONTROUTE;
 
 /* XXX
  * If this code will
@@ -310,113 +632,76 @@ tcp_twstart(struct tcpcb *tp)
  * a ts_recent from the last segment.
  */
 
-	/*
-	 * First, discard tcpcb state, which includes stopping its timers and
-	 * freeing it.  tcp_discardcb() used to also release the inpcb, but
-	 * that work is now done in the caller.
-	 *
-	 * Note: soisdisconnected() call used to be made in tcp_discardcb(),
-	 * and might not be needed here any longer.
-	 */
-	tcp_discardcb(tp);
-	so = inp->inp_socket;
-	soisdisconnected(so);
-	tw->tw_cred = crhold(so->so_cred);
-	SOCK_LOCK(so);
-	tw->tw_so_options = so->so_options;
-	SOCK_UNLOCK(so);
 	if (acknow)
 		tcp_twrespond(tw, TH_ACK);
-	if (notimewait) {
-		inp->inp_ppcb = NULL;
-		tcp_twclose(tw, 0);
-		return;
-	} else {
-		inp->inp_ppcb = tw;
-		inp->inp_flags |= INP_TIMEWAIT;
-		tcp_tw_2msl_reset(tw, 0);
-	}
+
+	th = tcp_tw_head(&tw->tw_inc);
+	TWH_LOCK(th);
+	if ((otw = tcp_tw_lookup(th, &tw->tw_inc, TW_L2TS(tw))) != NULL)
+		tcp_tw_kill(th, otw);
+	tcp_tw_insert(th, tw);
+	TWH_UNLOCK(th);
 
 	/*
-	 * If the inpcb owns the sole reference to the socket, then we can
-	 * detach and free the socket as it is not needed in time wait.
+	 * The connection itself is finished; release the inpcb, the
+	 * socket's protocol reference and the local port.
 	 */
-	if (inp->inp_flags & INP_SOCKREF) {
-		KASSERT(so->so_state & SS_PROTOREF,
-			("tcp_twstart: !SS_PROTOREF"));
-		inp->inp_flags &= ~INP_SOCKREF;
-		INP_WUNLOCK(inp);
-		ACCEPT_LOCK();
-#ifdef PASSIVE_INET
-		if (so->so_passive_peer)
-			in_passive_acquire_sock_locks(so);
-		else
-#endif
-			SOCK_LOCK(so);
-		so->so_state &= ~SS_PROTOREF;
-		sofree(so);
-	} else
+	tp = tcp_close(tp);
+	if (tp != NULL)
 		INP_WUNLOCK(inp);
 }
 
-#if 0
-/*
- * The appromixate rate of ISN increase of Microsoft TCP stacks;
- * the actual rate is slightly higher due to the addition of
- * random positive increments.
- *
- * Most other new OSes use semi-randomized ISN values, so we
- * do not need to worry about them.
- */
-#define MS_ISN_BYTES_PER_SECOND		250000
-
 /*
- * Determine if the ISN we will generate has advanced beyond the last
- * sequence number used by the previous connection.  If so, indicate
- * that it is safe to recycle this tw socket by returning 1.
+ * Decide whether a SYN may start a new incarnation of a connection in
+ * TIME_WAIT (RFC 6191): if both carry timestamps, the SYN's must be
+ * newer than the last one seen, otherwise its sequence number must lie
+ * beyond the old connection's.
  */
-int
-tcp_twrecycleable(struct tcptw *tw)
+static int
+tcp_tw_syn_ok(struct tcptw *tw, struct tcpopt *to, struct tcphdr *th)
 {
-	tcp_seq new_iss = tw->iss;
-	tcp_seq new_irs = tw->irs;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-	new_iss += (ticks - tw->t_starttime) * (ISN_BYTES_PER_SECOND / hz);
-	new_irs += (ticks - tw->t_starttime) * (MS_ISN_BYTES_PER_SECOND / hz);
-
-	if (SEQ_GT(new_iss, tw->snd_nxt) && SEQ_GT(new_irs, tw->rcv_nxt))
-		return (1);
-	else
-		return (0);
+	if (tw->t_recent != 0 && (to->to_flags & TOF_TS))
+		return (TSTMP_GT(to->to_tsval, tw->t_recent));
+	return (SEQ_GT(th->th_seq, tw->rcv_nxt));
 }
-#endif
 
 /*
- * Returns 1 if the TIME_WAIT state was killed and we should start over,
- * looking for a pcb in the listen state.  Returns 0 otherwise.
+ * Handle a segment that may belong to a connection in TIME_WAIT.  Returns
+ * 1 if the segment was consumed, in which case the mbuf has been freed.
+ * Returns 0 if there is no such connection or if the segment is a SYN
+ * allowed to replace it; the caller then processes it as usual.
  */
 int
-tcp_twcheck(struct inpcb *inp, struct tcpopt *to, struct tcphdr *th,
+tcp_twcheck(struct in_conninfo *inc, struct tcpopt *to, struct tcphdr *th,
     struct mbuf *m, int tlen)
 {
+	const struct in_l2tagstack *ts;
+	struct tcp_tw_head *twh;
 	struct tcptw *tw;
 	int thflags;
 	tcp_seq seq;
+#ifdef PROMISCUOUS_INET
+	struct ifl2info *l2i_tag;
+#endif
 
-	/* tcbinfo lock required for tcp_twclose(), tcp_tw_2msl_reset(). */
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-	INP_WLOCK_ASSERT(inp);
+	if (V_tcp_tw.count == 0)
+		return (0);
 
-	/*
-	 * XXXRW: Time wait state for inpcb has been recycled, but inpcb is
-	 * still present.  This is undesirable, but temporarily necessary
-	 * until we work out how to handle inpcb's who's timewait state has
-	 * been removed.
-	 */
-	tw = intotw(inp);
-	if (tw == NULL)
-		goto drop;
+#ifdef PROMISCUOUS_INET
+	l2i_tag = (struct ifl2info *)m_tag_locate(m, MTAG_PROMISCINET,
+	    MTAG_PROMISCINET_L2INFO, NULL);
+	ts = l2i_tag != NULL ? &l2i_tag->ifl2i_info.inl2i_tagstack : NULL;
+#else
+	ts = NULL;
+#endif
+	twh = tcp_tw_head(inc);
+	TWH_LOCK(twh);
+	tw = tcp_tw_lookup(twh, inc, ts);
+	if (tw == NULL) {
+		TWH_UNLOCK(twh);
+		return (0);
+	}
 
 	thflags = th->th_flags;
 
@@ -433,32 +718,18 @@ tcp_twcheck(struct inpcb *inp, struct tcpopt *to, struct tcphdr *th,
 	if (thflags & TH_RST)
 		goto drop;
 
-#if 0
-/* PAWS not needed at the moment */
-	/*
-	 * RFC 1323 PAWS: If we have a timestamp reply on this segment
-	 * and it's less than ts_recent, drop it.
-	 */
-	if ((to.to_flags & TOF_TS) != 0 && tp->ts_recent &&
-	    TSTMP_LT(to.to_tsval, tp->ts_recent)) {
-		if ((thflags & TH_ACK) == 0)
-			goto drop;
-		goto ack;
-	}
-	/*
-	 * ts_recent is never updated because we never accept new segments.
-	 */
-#endif
-
 	/*
 	 * If a new connection request is received
 	 * while in TIME_WAIT, drop the old connection
-	 * and start over if the sequence numbers
-	 * are above the previous ones.
+	 * and start over if the timestamps or sequence
+	 * numbers are above the previous ones.
 	 */
-	if ((thflags & TH_SYN) && SEQ_GT(th->th_seq, tw->rcv_nxt)) {
-		tcp_twclose(tw, 0);
-		return (1);
+	if ((thflags & (TH_SYN|TH_ACK)) == TH_SYN &&
+	    tcp_tw_syn_ok(tw, to, th)) {
+		tcp_tw_kill(twh, tw);
+		TWH_UNLOCK(twh);
+		TCPSTAT_INC(tcps_tw_recycled);
+		return (0);
 	}
 
 	/*
@@ -473,7 +744,7 @@ tcp_twcheck(struct inpcb *inp, struct tcpopt *to, struct tcphdr *th,
 	if (thflags & TH_FIN) {
 		seq = th->th_seq + tlen + (thflags & TH_SYN ? 1 : 0);
 		if (seq + 1 == tw->rcv_nxt)
-			tcp_tw_2msl_reset(tw, 1);
+			tcp_tw_2msl_reset(tw);
 	}
 
 	/*
@@ -483,87 +754,74 @@ tcp_twcheck(struct inpcb *inp, struct tcpopt *to, struct tcphdr *th,
 	    th->th_seq != tw->rcv_nxt || th->th_ack != tw->snd_nxt)
 		tcp_twrespond(tw, TH_ACK);
 drop:
-	INP_WUNLOCK(inp);
+	TWH_UNLOCK(twh);
 	m_freem(m);
-	return (0);
+	return (1);
 }
 
-void
-tcp_twclose(struct tcptw *tw, int reuse)
+/*
+ * Called by an outgoing connection inp whose 4-tuple inc may still be in
+ * TIME_WAIT.  The old incarnation is discarded if timestamps will keep
+ * its stray segments out of the new one: it used them, its timestamps
+ * are ours unoffset (an active open), and the clock has moved on since.
+ * Returns EADDRINUSE if the 4-tuple must stay reserved.
+ */
+int
+tcp_twreuse(struct inpcb *inp, struct in_conninfo *inc)
 {
-	struct socket *so;
-	struct inpcb *inp;
-	int timewait_skipped;
-
-	/*
-	 * At this point, we are in one of two situations:
-	 *
-	 * (1) We have no socket, just an inpcb<->twtcp pair.  We can free
-	 *     all state.
-	 *
-	 * (2) We have a socket -- if we own a reference, release it and
-	 *     notify the socket layer.
-	 */
-	inp = tw->tw_inpcb;
-	timewait_skipped = (intotw(inp) == NULL) && !(inp->inp_flags & INP_TIMEWAIT);
-	KASSERT(timewait_skipped ||
-		(inp->inp_flags & INP_TIMEWAIT), ("tcp_twclose: !timewait"));
-	KASSERT(timewait_skipped || (intotw(inp) == tw), ("tcp_twclose: inp_ppcb != tw"));
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);	/* tcp_tw_2msl_stop(). */
-	INP_WLOCK_ASSERT(inp);
+	const struct in_l2tagstack *ts;
+	struct tcp_tw_head *th;
+	struct tcptw *tw;
+	int error;
 
-	tw->tw_inpcb = NULL;
-	if (!timewait_skipped)
-		tcp_tw_2msl_stop(tw);
-	else
-		inp->inp_flags |= INP_TIMEWAIT; /* all further processing should be aware we came through the TIMEWAIT path */
-	inp->inp_ppcb = NULL;
-	in_pcbdrop(inp);
+	if (V_tcp_tw.count == 0)
+		return (0);
 
-	so = inp->inp_socket;
-	if (so != NULL) {
-		/*
-		 * If there's a socket, handle two cases: first, we own a
-		 * strong reference, which we will now release, or we don't
-		 * in which case another reference exists (XXXRW: think
-		 * about this more), and we don't need to take action.
-		 */
-		if (inp->inp_flags & INP_SOCKREF) {
-			inp->inp_flags &= ~INP_SOCKREF;
-			INP_WUNLOCK(inp);
-			ACCEPT_LOCK();
-#ifdef PASSIVE_INET
-			if (so->so_passive_peer)
-				in_passive_acquire_sock_locks(so);
-			else
+#ifdef PROMISCUOUS_INET
+	ts = (inp->inp_flags2 & INP_PROMISC) ?
+	    &inp->inp_l2info->inl2i_tagstack : NULL;
+#else
+	ts = NULL;
 #endif
-				SOCK_LOCK(so);
-			KASSERT(so->so_state & SS_PROTOREF,
-			    ("tcp_twclose: INP_SOCKREF && !SS_PROTOREF"));
-			so->so_state &= ~SS_PROTOREF;
-			sofree(so);
-		} else {
-			/*
-			 * If we don't own the only reference, the socket and
-			 * inpcb need to be left around to be handled by
-			 * tcp_usr_detach() later.
-			 */
-			INP_WUNLOCK(inp);
-		}
+	th = tcp_tw_head(inc);
+	TWH_LOCK(th);
+	tw = tcp_tw_lookup(th, inc, ts);
+	if (tw == NULL)
+		error = 0;
+	else if (V_tcp_tw_reuse && tw->t_recent != 0 &&
+	    tw->ts_offset == 0 && ticks - tw->tw_start >= hz) {
+		tcp_tw_kill(th, tw);
+		TCPSTAT_INC(tcps_tw_recycled);
+		error = 0;
 	} else
-		in_pcbfree(inp);
-	TCPSTAT_INC(tcps_closed);
-	crfree(tw->tw_cred);
-	tw->tw_cred = NULL;
-	if (reuse || timewait_skipped)
-		return;
-	uma_zfree(V_tcptw_zone, tw);
+		error = EADDRINUSE;
+	TWH_UNLOCK(th);
+	return (error);
+}
+
+/*
+ * Discard the TIME_WAIT entry for a 4-tuple, if any.  Only untagged
+ * connections can be named this way.  Returns 1 if one was found.
+ */
+int
+tcp_twdrop(struct in_conninfo *inc)
+{
+	struct tcp_tw_head *th;
+	struct tcptw *tw;
+
+	th = tcp_tw_head(inc);
+	TWH_LOCK(th);
+	tw = tcp_tw_lookup(th, inc, NULL);
+	if (tw != NULL)
+		tcp_tw_kill(th, tw);
+	TWH_UNLOCK(th);
+	return (tw != NULL);
 }
 
 int
 tcp_twrespond(struct tcptw *tw, int flags)
 {
-	struct inpcb *inp = tw->tw_inpcb;
+	struct in_conninfo *inc = &tw->tw_inc;
 #if defined(INET6) || defined(INET)
 	struct tcphdr *th = NULL;
 #endif
@@ -576,26 +834,37 @@ tcp_twrespond(struct tcptw *tw, int flags)
 	struct tcpopt to;
 #ifdef INET6
 	struct ip6_hdr *ip6 = NULL;
-	int isipv6 = inp->inp_inc.inc_flags & INC_ISIPV6;
+	int isipv6 = inc->inc_flags & INC_ISIPV6;
 #endif
 
-	INP_WLOCK_ASSERT(inp);
-
 	m = m_gethdr(M_DONTWAIT, MT_DATA);
 	if (m == NULL)
 		return (ENOBUFS);
-	m->m_data += max_linkhdr;
+#ifdef PROMISCUOUS_INET
+	if (tw->tw_l2tag != NULL) {
+		struct m_tag *tagcopy;
 
-#ifdef MAC
-	mac_inpcb_create_mbuf(inp, m);
+		tagcopy = m_tag_copy(tw->tw_l2tag, M_NOWAIT);
+		if (tagcopy == NULL) {
+			m_freem(m);
+			return (ENOBUFS);
+		}
+		m_tag_prepend(m, tagcopy);
+	}
 #endif
+	m->m_data += max_linkhdr;
+	m->m_pkthdr.rcvif = NULL;
 
 #ifdef INET6
 	if (isipv6) {
 		hdrlen = sizeof(struct ip6_hdr) + sizeof(struct tcphdr);
 		ip6 = mtod(m, struct ip6_hdr *);
+		ip6->ip6_flow = 0;
+		ip6->ip6_vfc = IPV6_VERSION;
+		ip6->ip6_nxt = IPPROTO_TCP;
+		ip6->ip6_src = inc->inc6_laddr;
+		ip6->ip6_dst = inc->inc6_faddr;
 		th = (struct tcphdr *)(ip6 + 1);
-		tcpip_fillheaders(inp, ip6, th);
 	}
 #endif
 #if defined(INET6) && defined(INET)
@@ -605,10 +874,24 @@ tcp_twrespond(struct tcptw *tw, int flags)
 	{
 		hdrlen = sizeof(struct tcpiphdr);
 		ip = mtod(m, struct ip *);
+		ip->ip_v = IPVERSION;
+		ip->ip_hl = sizeof(struct ip) >> 2;
+		ip->ip_id = 0;
+		ip->ip_off = 0;
+		ip->ip_sum = 0;
+		ip->ip_p = IPPROTO_TCP;
+		ip->ip_src = inc->inc_laddr;
+		ip->ip_dst = inc->inc_faddr;
+		ip->ip_ttl = tw->tw_ip_ttl;
+		ip->ip_tos = tw->tw_ip_tos;
 		th = (struct tcphdr *)(ip + 1);
-		tcpip_fillheaders(inp, ip, th);
 	}
 #endif
+	th->th_sport = inc->inc_lport;
+	th->th_dport = inc->inc_fport;
+	th->th_x2 = 0;
+	th->th_urp = 0;
+	th->th_sum = 0;
 	to.to_flags = 0;
 
 	/*
@@ -633,15 +916,16 @@ tcp_twrespond(struct tcptw *tw, int flags)
 	th->th_flags = flags;
 	th->th_win = htons(tw->last_win);
 
+	M_SETFIB(m, inc->inc_fibnum);
 	m->m_pkthdr.csum_data = offsetof(struct tcphdr, th_sum);
 #ifdef INET6
 	if (isipv6) {
 		m->m_pkthdr.csum_flags = CSUM_TCP_IPV6;
+		ip6->ip6_plen = htons(sizeof(struct tcphdr) + optlen);
 		th->th_sum = in6_cksum_pseudo(ip6,
 		    sizeof(struct tcphdr) + optlen, IPPROTO_TCP, 0);
-		ip6->ip6_hlim = in6_selecthlim(inp, NULL);
-		error = ip6_output(m, inp->in6p_outputopts, NULL,
-		    (tw->tw_so_options & SO_DONTROUTE), NULL, NULL, inp);
+		ip6->ip6_hlim = tw->tw_ip_ttl;
+		error = ip6_output(m, NULL, NULL, 0, NULL, NULL, NULL);
 	}
 #endif
 #if defined(INET6) && defined(INET)
@@ -655,9 +939,9 @@ tcp_twrespond(struct tcptw *tw, int flags)
 		ip->ip_len = htons(m->m_pkthdr.len);
 		if (V_path_mtu_discovery)
 			ip->ip_off |= htons(IP_DF);
-		error = ip_output(m, inp->inp_options, NULL,
-		    ((tw->tw_so_options & SO_DONTROUTE) ? IP_ROUTETOIF : 0),
-		    NULL, inp);
+		error = ip_output(m, NULL, NULL,
+		    ((tw->tw_flags & TWF_DONTROUTE) ? IP_ROUTETOIF : 0),
+		    NULL, NULL);
 	}
 #endif
 	if (flags & TH_ACK)
@@ -668,40 +952,105 @@ tcp_twrespond(struct tcptw *tw, int flags)
 	return (error);
 }
 
-static void
-tcp_tw_2msl_reset(struct tcptw *tw, int rearm)
+/*
+ * Expire the TIME_WAIT entries that have come due.  Each slow timeout
+ * sweeps the slots whose interval has passed, normally one.  Entries
+ * further than a turn of the wheel away are left in their slot for a
+ * later pass.
+ */
+void
+tcp_tw_2msl_scan(void)
 {
-
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-	INP_WLOCK_ASSERT(tw->tw_inpcb);
-	if (rearm)
-		TAILQ_REMOVE(&V_twq_2msl, tw, tw_2msl);
-	tw->tw_time = ticks + 2 * tcp_msl;
-	TAILQ_INSERT_TAIL(&V_twq_2msl, tw, tw_2msl);
+	TAILQ_HEAD(, tcptw) expired;
+	struct tcp_tw_head *th;
+	struct tcptw *tw, *ntw;
+	int n, slot;
+
+	TAILQ_INIT(&expired);
+	TW_LOCK();
+	for (n = 0; n < TW_WHEEL_SIZE &&
+	    ticks - V_tcp_tw.wheel_time >= TW_SLOT_TICKS; n++) {
+		slot = TW_SLOT(V_tcp_tw.wheel_time);
+		TAILQ_FOREACH_SAFE(tw, &V_tcp_tw.wheel[slot], tw_wheel, ntw) {
+			if (tw->tw_time - ticks > 0)
+				continue;
+			TAILQ_REMOVE(&V_tcp_tw.wheel[slot], tw, tw_wheel);
+			tw->tw_slot = TW_SLOT_NONE;
+			TAILQ_INSERT_TAIL(&expired, tw, tw_wheel);
+		}
+		V_tcp_tw.wheel_time += TW_SLOT_TICKS;
+	}
+	if (n == TW_WHEEL_SIZE)
+		V_tcp_tw.wheel_time = ticks - ticks % TW_SLOT_TICKS;
+	TW_UNLOCK();
+
+	TAILQ_FOREACH_SAFE(tw, &expired, tw_wheel, ntw) {
+		th = tcp_tw_head(&tw->tw_inc);
+		TWH_LOCK(th);
+		if (tw->tw_flags & TWF_HASHED)
+			tcp_tw_unhash(th, tw);
+		TWH_UNLOCK(th);
+		tcp_tw_free(tw);
+	}
 }
 
-static void
-tcp_tw_2msl_stop(struct tcptw *tw)
+/*
+ * Returns the current number of TIME_WAIT entries.
+ */
+int
+tcp_tw_pcbcount(void)
 {
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-	TAILQ_REMOVE(&V_twq_2msl, tw, tw_2msl);
+	return (V_tcp_tw.count);
 }
 
-struct tcptw *
-tcp_tw_2msl_scan(int reuse)
+/*
+ * Exports the TIME_WAIT entries to userland so that netstat can display
+ * them alongside the other sockets.  This function is intended to be
+ * called only from tcp_pcblist.
+ */
+int
+tcp_tw_pcblist(struct sysctl_req *req, int max_pcbs, int *pcbs_exported)
 {
+	struct xtcpcb xt;
 	struct tcptw *tw;
-
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-	for (;;) {
-		tw = TAILQ_FIRST(&V_twq_2msl);
-		if (tw == NULL || (!reuse && (tw->tw_time - ticks) > 0))
-			break;
-		INP_WLOCK(tw->tw_inpcb);
-		tcp_twclose(tw, reuse);
-		if (reuse)
-			return (tw);
+	struct tcp_tw_head *th;
+	int count, error, i;
+
+	for (count = 0, error = 0, i = 0; i < V_tcp_tw.hashsize; i++) {
+		th = &V_tcp_tw.hashbase[i];
+		if (th->th_length == 0)
+			continue;
+		TWH_LOCK(th);
+		LIST_FOREACH(tw, &th->th_list, tw_hash) {
+			if (count >= max_pcbs) {
+				TWH_UNLOCK(th);
+				goto exit;
+			}
+			bzero(&xt, sizeof(xt));
+			xt.xt_len = sizeof(xt);
+			if (tw->tw_inc.inc_flags & INC_ISIPV6)
+				xt.xt_inp.inp_vflag = INP_IPV6;
+			else
+				xt.xt_inp.inp_vflag = INP_IPV4;
+			bcopy(&tw->tw_inc, &xt.xt_inp.inp_inc,
+			    sizeof(struct in_conninfo));
+			xt.xt_tp.t_inpcb = &xt.xt_inp;
+			xt.xt_tp.t_state = TCPS_TIME_WAIT;
+			xt.xt_socket.xso_protocol = IPPROTO_TCP;
+			xt.xt_socket.xso_len = sizeof (struct xsocket);
+			xt.xt_socket.so_type = SOCK_STREAM;
+			xt.xt_socket.so_state = SS_ISDISCONNECTED;
+			error = SYSCTL_OUT(req, &xt, sizeof xt);
+			if (error) {
+				TWH_UNLOCK(th);
+				goto exit;
+			}
+			count++;
+		}
+		TWH_UNLOCK(th);
 	}
-	return (NULL);
+exit:
+	*pcbs_exported = count;
+	return (error);
 }
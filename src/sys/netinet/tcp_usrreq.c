@@ -106,6 +106,7 @@ static int	tcp_connect(struct tcpcb *, struct sockaddr *,
 static int	tcp6_connect(struct tcpcb *, struct sockaddr *,
 		    struct thread *td);
 #endif /* INET6 */
+static int	tcp_connect_nextport(struct inpcb *, struct ucred *, int *);
 static void	tcp_disconnect(struct tcpcb *);
 static void	tcp_usrclosed(struct tcpcb *);
 static void	tcp_fill_info(struct tcpcb *, struct tcp_info *);
@@ -155,8 +156,7 @@ out:
 /*
  * tcp_detach is called when the socket layer loses its final reference
  * to the socket, be it a file descriptor reference, a reference from TCP,
- * etc.  At this point, there is only one case in which we will keep around
- * inpcb state: time wait.
+ * etc.  TIME_WAIT keeps no inpcb state, see tcp_twstart().
  *
  * This function can probably be re-absorbed back into tcp_usr_detach() now
  * that there is a single detach path.
@@ -166,7 +166,7 @@ tcp_detach(struct socket *so, struct inpcb *inp)
 {
 	struct tcpcb *tp;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
 	KASSERT(so->so_pcb == inp, ("tcp_detach: so_pcb != inp"));
@@ -174,47 +174,22 @@ tcp_detach(struct socket *so, struct inpcb *inp)
 
 	tp = intotcpcb(inp);
 
-	if (inp->inp_flags & INP_TIMEWAIT) {
-		/*
-		 * There are two cases to handle: one in which the time wait
-		 * state is being discarded (INP_DROPPED), and one in which
-		 * this connection will remain in timewait.  In the former,
-		 * it is time to discard all state (except tcptw, which has
-		 * already been discarded by the timewait close code, which
-		 * should be further up the call stack somewhere).  In the
-		 * latter case, we detach from the socket, but leave the pcb
-		 * present until timewait ends.
-		 *
-		 * XXXRW: Would it be cleaner to free the tcptw here?
-		 */
-		if (inp->inp_flags & INP_DROPPED) {
-			KASSERT(tp == NULL, ("tcp_detach: INP_TIMEWAIT && "
-			    "INP_DROPPED && tp != NULL"));
-			in_pcbdetach(inp);
-			in_pcbfree(inp);
-		} else {
-			in_pcbdetach(inp);
-			INP_WUNLOCK(inp);
-		}
+	/*
+	 * Either no further processing is necessary (dropped, which
+	 * includes connections that have moved to TIME_WAIT, or embryonic),
+	 * or TCP is not yet done, but no longer requires the socket, so the
+	 * pcb will persist for the time being.
+	 *
+	 * XXXRW: Does the second case still occur?
+	 */
+	if (inp->inp_flags & INP_DROPPED ||
+	    tp->t_state < TCPS_SYN_SENT) {
+		tcp_discardcb(tp);
+		in_pcbdetach(inp);
+		in_pcbfree(inp);
 	} else {
-		/*
-		 * If the connection is not in timewait, we consider two
-		 * two conditions: one in which no further processing is
-		 * necessary (dropped || embryonic), and one in which TCP is
-		 * not yet done, but no longer requires the socket, so the
-		 * pcb will persist for the time being.
-		 *
-		 * XXXRW: Does the second case still occur?
-		 */
-		if (inp->inp_flags & INP_DROPPED ||
-		    tp->t_state < TCPS_SYN_SENT) {
-			tcp_discardcb(tp);
-			in_pcbdetach(inp);
-			in_pcbfree(inp);
-		} else {
-			in_pcbdetach(inp);
-			INP_WUNLOCK(inp);
-		}
+		in_pcbdetach(inp);
+		INP_WUNLOCK(inp);
 	}
 }
 
@@ -232,12 +207,12 @@ tcp_usr_detach(struct socket *so)
 
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("tcp_usr_detach: inp == NULL"));
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	INP_WLOCK(inp);
 	KASSERT(inp->inp_socket != NULL,
 	    ("tcp_usr_detach: inp_socket == NULL"));
 	tcp_detach(so, inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 }
 
 #ifdef INET
@@ -568,7 +543,7 @@ tcp_usr_disconnect(struct socket *so)
 	int error = 0;
 
 	TCPDEBUG0;
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("tcp_usr_disconnect: inp == NULL"));
 	INP_WLOCK(inp);
@@ -582,7 +557,7 @@ tcp_usr_disconnect(struct socket *so)
 out:
 	TCPDEBUG2(PRU_DISCONNECT);
 	INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 	return (error);
 }
 
@@ -706,7 +681,7 @@ tcp_usr_shutdown(struct socket *so)
 	struct tcpcb *tp = NULL;
 
 	TCPDEBUG0;
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("inp == NULL"));
 	INP_WLOCK(inp);
@@ -724,7 +699,7 @@ tcp_usr_shutdown(struct socket *so)
 out:
 	TCPDEBUG2(PRU_SHUTDOWN);
 	INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 
 	return (error);
 }
@@ -782,7 +757,7 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 	 * this call.
 	 */
 	if (flags & PRUS_EOF) {
-		INP_INFO_WLOCK(&V_tcbinfo);
+		INP_INFO_RLOCK(&V_tcbinfo);
 		info_locked = 1;
 	}
 	inp = sotoinpcb(so);
@@ -790,7 +765,7 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 #ifdef PASSIVE_INET
 	if (inp->inp_flags2 & INP_PASSIVE) {
 		if (!info_locked) {
-			INP_INFO_WLOCK(&V_tcbinfo);
+			INP_INFO_RLOCK(&V_tcbinfo);
 			info_locked = 1;
 		}
 		in_passive_acquire_locks(so);
@@ -833,8 +808,11 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 			 * Do implied connect if not yet connected,
 			 * initialize window to default value, and
 			 * initialize maxseg/maxopd using peer's cached
-			 * MSS.
+			 * MSS.  With PRUS_FASTOPEN the data goes out in
+			 * the SYN if we hold a cookie for the peer.
 			 */
+			if (flags & PRUS_FASTOPEN)
+				tp->t_tfo_flags |= TFO_ENABLED;
 #ifdef INET6
 			if (isipv6)
 				error = tcp6_connect(tp, nam, td);
@@ -855,7 +833,7 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 			 * Close the send side of the connection after
 			 * the data is sent.
 			 */
-			INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+			INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 			socantsendmore(so);
 			tcp_usrclosed(tp);
 		}
@@ -924,7 +902,7 @@ out:
 #endif
 	INP_WUNLOCK(inp);
 	if (info_locked)
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 	return (error);
 }
 
@@ -941,7 +919,7 @@ tcp_usr_abort(struct socket *so)
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("tcp_usr_abort: inp == NULL"));
 
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	INP_WLOCK(inp);
 	KASSERT(inp->inp_socket != NULL,
 	    ("tcp_usr_abort: inp_socket == NULL"));
@@ -963,7 +941,7 @@ tcp_usr_abort(struct socket *so)
 		inp->inp_flags |= INP_SOCKREF;
 	}
 	INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 }
 
 /*
@@ -979,7 +957,7 @@ tcp_usr_close(struct socket *so)
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("tcp_usr_close: inp == NULL"));
 
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	INP_WLOCK(inp);
 	KASSERT(inp->inp_socket != NULL,
 	    ("tcp_usr_close: inp_socket == NULL"));
@@ -1002,7 +980,7 @@ tcp_usr_close(struct socket *so)
 		inp->inp_flags |= INP_SOCKREF;
 	}
 	INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 }
 
 /*
@@ -1091,15 +1069,45 @@ struct pr_usrreqs tcp6_usrreqs = {
 };
 #endif /* INET6 */
 
+/*
+ * TIME_WAIT entries are not inpcbs, so the ephemeral port picked by an
+ * implicit bind may still be reserved toward the peer being connected to.
+ * Move the inpcb to the next ephemeral port instead of failing the
+ * connect, trying at most once per port in the range.
+ */
+static int
+tcp_connect_nextport(struct inpcb *inp, struct ucred *cred, int *tries)
+{
+
+	INP_WLOCK_ASSERT(inp);
+	INP_HASH_WLOCK_ASSERT(inp->inp_pcbinfo);
+
+	if (++*tries > abs(V_ipport_lastauto - V_ipport_firstauto))
+		return (EADDRINUSE);
+	in_pcbremhash(inp);
+	inp->inp_lport = 0;
+	inp->inp_flags &= ~INP_ANONPORT;
+#ifdef INET6
+	if (inp->inp_vflag & INP_IPV6)
+		return (in6_pcbbind(inp, NULL, cred));
+#endif
+#ifdef INET
+	inp->inp_faddr.s_addr = INADDR_ANY;
+	inp->inp_fport = 0;
+	return (in_pcbbind(inp, NULL, cred));
+#else
+	return (EADDRINUSE);
+#endif
+}
+
 #ifdef INET
 /*
  * Common subroutine to open a TCP connection to remote host specified
  * by struct sockaddr_in in mbuf *nam.  Call in_pcbbind to assign a local
  * port number if needed.  Call in_pcbconnect_setup to do the routing and
  * to choose a local host address (interface).  If there is an existing
- * incarnation of the same connection in TIME-WAIT state and if the remote
- * host was sending CC options and if the connection duration was < MSL, then
- * truncate the previous TIME-WAIT state and proceed.
+ * incarnation of the same connection in TIME-WAIT state, tcp_twreuse()
+ * decides whether it may be truncated or the connect must fail.
  * Initialize connection parameters and enter SYN-SENT state.
  */
 static int
@@ -1107,17 +1115,21 @@ tcp_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 {
 	struct inpcb *inp = tp->t_inpcb, *oinp;
 	struct socket *so = inp->inp_socket;
+	struct in_conninfo inc;
 	struct in_addr laddr;
 	u_short lport;
-	int error;
+	int anonport, error, tries;
 
 	INP_WLOCK_ASSERT(inp);
 	INP_HASH_WLOCK(&V_tcbinfo);
 
+	anonport = 0;
+	tries = 0;
 	if (inp->inp_lport == 0) {
 		error = in_pcbbind(inp, (struct sockaddr *)0, td->td_ucred);
 		if (error)
 			goto out;
+		anonport = 1;
 	}
 
 	/*
@@ -1125,6 +1137,7 @@ tcp_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 	 * earlier incarnation of this same connection still in
 	 * TIME_WAIT state, creating an ADDRINUSE error.
 	 */
+again:
 	laddr = inp->inp_laddr;
 	lport = inp->inp_lport;
 	error = in_pcbconnect_setup(inp, nam, &laddr.s_addr, &lport,
@@ -1135,6 +1148,19 @@ tcp_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 		error = EADDRINUSE;
 		goto out;
 	}
+	bzero(&inc, sizeof(inc));
+	inc.inc_laddr = laddr;
+	inc.inc_lport = lport;
+	inc.inc_faddr = inp->inp_faddr;
+	inc.inc_fport = inp->inp_fport;
+	error = tcp_twreuse(inp, &inc);
+	if (error == EADDRINUSE && anonport) {
+		error = tcp_connect_nextport(inp, td->td_ucred, &tries);
+		if (error == 0)
+			goto again;
+	}
+	if (error)
+		goto out;
 	inp->inp_laddr = laddr;
 	in_pcbrehash(inp);
 	INP_HASH_WUNLOCK(&V_tcbinfo);
@@ -1154,6 +1180,11 @@ tcp_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 	tcp_timer_activate(tp, TT_KEEP, TP_KEEPINIT(tp));
 	tp->iss = tcp_new_isn(tp);
 	tcp_sendseqinit(tp);
+	if ((tp->t_tfo_flags & TFO_ENABLED) && V_tcp_fastopen_client_enable) {
+		tp->t_tfo_flags |= TFO_CLIENT;
+		tp->t_tfo_cookie_len = tcp_hc_gettfo(&inp->inp_inc,
+		    tp->t_tfo_cookie);
+	}
 
 	return 0;
 
@@ -1170,16 +1201,20 @@ tcp6_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 	struct inpcb *inp = tp->t_inpcb, *oinp;
 	struct socket *so = inp->inp_socket;
 	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)nam;
+	struct in_conninfo inc;
 	struct in6_addr addr6;
-	int error;
+	int anonport, error, tries;
 
 	INP_WLOCK_ASSERT(inp);
 	INP_HASH_WLOCK(&V_tcbinfo);
 
+	anonport = 0;
+	tries = 0;
 	if (inp->inp_lport == 0) {
 		error = in6_pcbbind(inp, (struct sockaddr *)0, td->td_ucred);
 		if (error)
 			goto out;
+		anonport = 1;
 	}
 
 	/*
@@ -1191,6 +1226,7 @@ tcp6_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 	 * XXXRW: We wouldn't need to expose in6_pcblookup_hash_locked()
 	 * outside of in6_pcb.c if there were an in6_pcbconnect_setup().
 	 */
+again:
 	error = in6_pcbladdr(inp, nam, &addr6);
 	if (error)
 		goto out;
@@ -1204,6 +1240,21 @@ tcp6_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 		error = EADDRINUSE;
 		goto out;
 	}
+	bzero(&inc, sizeof(inc));
+	inc.inc_flags = INC_ISIPV6;
+	inc.inc6_laddr = IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_laddr) ?
+	    addr6 : inp->in6p_laddr;
+	inc.inc_lport = inp->inp_lport;
+	inc.inc6_faddr = sin6->sin6_addr;
+	inc.inc_fport = sin6->sin6_port;
+	error = tcp_twreuse(inp, &inc);
+	if (error == EADDRINUSE && anonport) {
+		error = tcp_connect_nextport(inp, td->td_ucred, &tries);
+		if (error == 0)
+			goto again;
+	}
+	if (error)
+		goto out;
 	if (IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_laddr))
 		inp->in6p_laddr = addr6;
 	inp->in6p_faddr = sin6->sin6_addr;
@@ -1227,6 +1278,11 @@ tcp6_connect(struct tcpcb *tp, struct sockaddr *nam, struct thread *td)
 	tcp_timer_activate(tp, TT_KEEP, TP_KEEPINIT(tp));
 	tp->iss = tcp_new_isn(tp);
 	tcp_sendseqinit(tp);
+	if ((tp->t_tfo_flags & TFO_ENABLED) && V_tcp_fastopen_client_enable) {
+		tp->t_tfo_flags |= TFO_CLIENT;
+		tp->t_tfo_cookie_len = tcp_hc_gettfo(&inp->inp_inc,
+		    tp->t_tfo_cookie);
+	}
 
 	return 0;
 
@@ -1571,6 +1627,36 @@ tcp_ctloutput(struct socket *so, struct sockopt *sopt)
 			break;
 #endif
 
+		case TCP_RACK:
+			INP_WUNLOCK(inp);
+			error = sooptcopyin(sopt, &optval, sizeof optval,
+			    sizeof optval);
+			if (error)
+				return (error);
+
+			INP_WLOCK_RECHECK(inp);
+			if (optval > 0)
+				error = tcp_rack_init(tp);
+			else
+				tcp_rack_discard(tp);
+			INP_WUNLOCK(inp);
+			break;
+
+		case TCP_FASTOPEN:
+			INP_WUNLOCK(inp);
+			error = sooptcopyin(sopt, &optval, sizeof optval,
+			    sizeof optval);
+			if (error)
+				return (error);
+
+			INP_WLOCK_RECHECK(inp);
+			if (optval > 0)
+				tp->t_tfo_flags |= TFO_ENABLED;
+			else
+				tp->t_tfo_flags &= ~TFO_ENABLED;
+			INP_WUNLOCK(inp);
+			break;
+
 		case TCP_KEEPCNT:
 			INP_WUNLOCK(inp);
 			error = sooptcopyin(sopt, &ui, sizeof(ui), sizeof(ui));
@@ -1641,6 +1727,16 @@ tcp_ctloutput(struct socket *so, struct sockopt *sopt)
 			error = sooptcopyout(sopt, &optval, sizeof optval);
 			break;
 #endif
+		case TCP_RACK:
+			optval = (tp->t_rack != NULL) ? 1 : 0;
+			INP_WUNLOCK(inp);
+			error = sooptcopyout(sopt, &optval, sizeof optval);
+			break;
+		case TCP_FASTOPEN:
+			optval = (tp->t_tfo_flags & TFO_ENABLED) ? 1 : 0;
+			INP_WUNLOCK(inp);
+			error = sooptcopyout(sopt, &optval, sizeof optval);
+			break;
 
 		case TCP_CONGESTION:
 			bzero(buf, sizeof(buf));
@@ -1693,10 +1789,10 @@ tcp_attach(struct socket *so)
 	}
 	so->so_rcv.sb_flags |= SB_AUTOSIZE;
 	so->so_snd.sb_flags |= SB_AUTOSIZE;
-	INP_INFO_WLOCK(&V_tcbinfo);
+	INP_INFO_RLOCK(&V_tcbinfo);
 	error = in_pcballoc(so, &V_tcbinfo);
 	if (error) {
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 		return (error);
 	}
 	inp = sotoinpcb(so);
@@ -1726,12 +1822,12 @@ tcp_attach(struct socket *so)
 	if (tp == NULL) {
 		in_pcbdetach(inp);
 		in_pcbfree(inp);
-		INP_INFO_WUNLOCK(&V_tcbinfo);
+		INP_INFO_RUNLOCK(&V_tcbinfo);
 		return (ENOBUFS);
 	}
 	tp->t_state = TCPS_CLOSED;
 	INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
+	INP_INFO_RUNLOCK(&V_tcbinfo);
 	return (0);
 }
 
@@ -1749,14 +1845,16 @@ tcp_disconnect(struct tcpcb *tp)
 	struct inpcb *inp = tp->t_inpcb;
 	struct socket *so = inp->inp_socket;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(inp);
 
 	/*
 	 * Neither tcp_close() nor tcp_drop() should return NULL, as the
-	 * socket is still open.
+	 * socket is still open.  A Fast Open connection may already hold
+	 * data for the peer, so it is shut down like an established one.
 	 */
-	if (tp->t_state < TCPS_ESTABLISHED) {
+	if (tp->t_state < TCPS_ESTABLISHED &&
+	    !(tp->t_tfo_flags & TFO_PENDING)) {
 		tp = tcp_close(tp);
 		KASSERT(tp != NULL,
 		    ("tcp_disconnect: tcp_close() returned NULL"));
@@ -1787,7 +1885,7 @@ static void
 tcp_usrclosed(struct tcpcb *tp)
 {
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_INFO_LOCK_ASSERT(&V_tcbinfo);
 	INP_WLOCK_ASSERT(tp->t_inpcb);
 #ifdef PASSIVE_INET
 again:
@@ -2036,7 +2134,7 @@ db_print_tcpcb(struct tcpcb *tp, const char *name, int indent)
 
 	db_print_indent(indent);
 	db_printf("t_segq first: %p   t_segqlen: %d   t_dupacks: %d\n",
-	   LIST_FIRST(&tp->t_segq), tp->t_segqlen, tp->t_dupacks);
+	   RB_MIN(tsegqe_head, &tp->t_segq), tp->t_segqlen, tp->t_dupacks);
 
 	db_print_indent(indent);
 	db_printf("tt_rexmt: %p   tt_persist: %p   tt_keep: %p\n",
@@ -34,6 +34,7 @@
 #define _NETINET_TCP_VAR_H_
 
 #include <netinet/tcp.h>
+#include <sys/tree.h>
 
 #ifdef _KERNEL
 #include "opt_inet.h"
@@ -49,19 +50,24 @@ VNET_DECLARE(int, tcp_do_rfc1323);
 
 #endif /* _KERNEL */
 
-/* TCP segment queue entry */
+/*
+ * TCP segment queue entry.  Each entry covers one contiguous range of
+ * sequence space; adjacent segments are merged into a single mbuf chain.
+ */
 struct tseg_qent {
-	LIST_ENTRY(tseg_qent) tqe_q;
+	RB_ENTRY(tseg_qent) tqe_q;
 	int	tqe_len;		/* TCP segment data length */
 	uint32_t tqe_seq;		/* copy of TCP sequence no. */
 	uint8_t	tqe_flags;		/* copy of TCP header flags */
 	struct	mbuf	*tqe_m;		/* mbuf contains packet */
+	struct	mbuf	*tqe_last;	/* last mbuf of the chain */
+	int	tqe_mbcnt;		/* mbuf storage held by the chain */
 #ifdef PASSIVE_INET
 	TAILQ_ENTRY(tseg_qent) tqe_ageq;
 	int tqe_ticks;			/* ticks when queued */
 #endif
 };
-LIST_HEAD(tsegqe_head, tseg_qent);
+RB_HEAD(tsegqe_head, tseg_qent);
 #ifdef PASSIVE_INET
 TAILQ_HEAD(tsegageqe_head, tseg_qent);
 #endif
@@ -75,6 +81,7 @@ struct sackhole {
 	tcp_seq start;		/* start seq no. of hole */
 	tcp_seq end;		/* end seq no. */
 	tcp_seq rxmit;		/* next seq. no in hole to be retransmitted */
+	uint64_t rxmit_us;	/* uptime of last retransmission (us) */
 	TAILQ_ENTRY(sackhole) scblink;	/* scoreboard linkage */
 };
 
@@ -118,6 +125,7 @@ struct tcpcb {
 	void	*t_pspare[2];		/* new reassembly queue */
 	
 	int	t_segqlen;		/* segment reassembly queue length */
+	int	t_segqmbcnt;		/* mbuf storage in reassembly queue */
 	int	t_dupacks;		/* consecutive dup acks recd */
 
 	struct tcp_timer *t_timers;	/* All the TCP timers in one struct */
@@ -223,6 +231,20 @@ struct tcpcb {
 	u_int	t_keepintvl;		/* interval between keepalives */
 	u_int	t_keepcnt;		/* number of keepalives before close */
 
+	uint64_t t_delivered;		/* bytes cumulatively acked */
+	uint64_t t_delivered_us;	/* uptime of latest delivery (us) */
+	uint64_t t_rs_delivered;	/* t_delivered when sample was sent */
+	uint64_t t_rs_delivered_us;	/* t_delivered_us when sample was sent */
+	uint64_t t_rs_sent_us;		/* uptime sample was sent (us) */
+	tcp_seq	t_rs_seq;		/* end of delivery rate sample segment */
+	int	t_rs_flags;		/* delivery rate sample state */
+	uint64_t t_pacing_rate;		/* CC pacing rate (bytes/s), 0 if none */
+	uint64_t t_pace_next_us;	/* earliest departure of next segment */
+	struct tcp_rack *t_rack;	/* RACK/TLP state, NULL if not in use */
+	int	t_tfo_flags;		/* TCP Fast Open state */
+	u_int8_t t_tfo_cookie_len;	/* length of client cookie, 0 if none */
+	u_int8_t t_tfo_cookie[TCP_FASTOPEN_MAX_COOKIE_LEN]; /* client cookie */
+
 #ifdef PASSIVE_INET
 	uint32_t t_reassdl;
 #endif
@@ -231,6 +253,19 @@ struct tcpcb {
 	uint64_t _pad[6];		/* 6 TBD (1-2 CC/RTT?) */
 };
 
+/*
+ * Flags for the t_rs_flags field.
+ */
+#define	TRS_TIMING	0x01		/* t_rs_seq is being timed */
+#define	TRS_APPLIMITED	0x02		/* sender was application limited */
+
+/*
+ * Flags for the t_tfo_flags field.
+ */
+#define	TFO_ENABLED	0x01		/* TCP_FASTOPEN set on the socket */
+#define	TFO_CLIENT	0x02		/* active open sends cookie in SYN */
+#define	TFO_PENDING	0x04		/* passive open, SYN|ACK not acked */
+
 /*
  * Flags and utility macros for the t_flags field.
  */
@@ -316,7 +351,8 @@ struct tcpopt {
 #define	TOF_TS		0x0010		/* timestamp */
 #define	TOF_SIGNATURE	0x0040		/* TCP-MD5 signature option (RFC2385) */
 #define	TOF_SACK	0x0080		/* Peer sent SACK option */
-#define	TOF_MAXOPT	0x0100
+#define	TOF_FASTOPEN	0x0100		/* TCP Fast Open cookie (RFC 7413) */
+#define	TOF_MAXOPT	0x0200
 	u_int32_t	to_tsval;	/* new timestamp */
 	u_int32_t	to_tsecr;	/* reflected timestamp */
 	const uint8_t	*to_sacks;	/* pointer to the first SACK blocks */
@@ -324,6 +360,8 @@ struct tcpopt {
 	u_int16_t	to_mss;		/* maximum segment size */
 	u_int8_t	to_wscale;	/* window scaling */
 	u_int8_t	to_nsacks;	/* number of SACK blocks */
+	u_int8_t	to_tfo_len;	/* Fast Open cookie length */
+	const uint8_t	*to_tfo_cookie;	/* pointer to the Fast Open cookie */
 	u_int32_t	to_spare;	/* UTO */
 };
 
@@ -346,25 +384,39 @@ struct hc_metrics_lite {	/* must stay in sync with hc_metrics */
 #ifndef _NETINET_IN_PCB_H_
 struct in_conninfo;
 #endif /* _NETINET_IN_PCB_H_ */
+struct tcptw;
 
+#ifdef _NETINET_IN_PCB_H_
+/*
+ * Compressed TIME_WAIT state.  The inpcb and socket are released when a
+ * connection enters TIME_WAIT; this is all that remains, hashed by
+ * 4-tuple and expired from a timing wheel (see tcp_timewait.c).
+ */
 struct tcptw {
-	struct inpcb	*tw_inpcb;	/* XXX back pointer to internet pcb */
+	LIST_ENTRY(tcptw) tw_hash;	/* hash bucket chain */
+	TAILQ_ENTRY(tcptw) tw_wheel;	/* timing wheel slot */
+	struct in_conninfo tw_inc;	/* addresses and ports */
 	tcp_seq		snd_nxt;
 	tcp_seq		rcv_nxt;
-	tcp_seq		iss;
-	tcp_seq		irs;
-	u_short		last_win;	/* cached window value */
-	u_short		tw_so_options;	/* copy of so_options */
-	struct ucred	*tw_cred;	/* user credentials */
 	u_int32_t	t_recent;
 	u_int32_t	ts_offset;	/* our timestamp offset */
-	u_int		t_starttime;
-	int		tw_time;
-	TAILQ_ENTRY(tcptw) tw_2msl;
+	int		tw_time;	/* expiry, in ticks */
+	int		tw_start;	/* entered TIME_WAIT, in ticks */
+	short		tw_slot;	/* wheel slot, -1 if off the wheel */
+	u_short		last_win;	/* cached window value */
+	u_char		tw_ip_ttl;	/* TTL or hop limit of replies */
+	u_char		tw_ip_tos;
+	u_char		tw_flags;
+#ifdef PROMISCUOUS_INET
+	struct m_tag	*tw_l2tag;	/* L2 info of a promiscuous connection */
+#endif
 };
 
+#define	TWF_HASHED	0x01		/* on a hash chain */
+#define	TWF_DONTROUTE	0x02		/* SO_DONTROUTE was set */
+#endif /* _NETINET_IN_PCB_H_ */
+
 #define	intotcpcb(ip)	((struct tcpcb *)(ip)->inp_ppcb)
-#define	intotw(ip)	((struct tcptw *)(ip)->inp_ppcb)
 #define	sototcpcb(so)	(intotcpcb(sotoinpcb(so)))
 
 /*
@@ -518,7 +570,29 @@ struct	tcpstat {
 	u_long	tcps_sig_err_sigopt;	/* No signature expected by socket */
 	u_long	tcps_sig_err_nosigopt;	/* No signature provided by segment */
 
-	u_long	_pad[12];		/* 6 UTO, 6 TBD */
+	/* RACK/TLP related stats */
+	u_long	tcps_rack_recovery;	/* recoveries entered by RACK */
+	u_long	tcps_rack_rexmit_lost;	/* lost retransmissions detected */
+	u_long	tcps_tlp_probes;	/* tail loss probes sent */
+	u_long	tcps_tlp_recovered;	/* tail losses repaired by a probe */
+
+	/* TCP Fast Open related stats */
+	u_long	tcps_tfo_cookie_req;	/* cookie requests received */
+	u_long	tcps_tfo_cookie_bad;	/* invalid cookies received */
+	u_long	tcps_tfo_syn_data;	/* connections opened by a cookie */
+	u_long	tcps_tfo_syn_data_sent;	/* SYNs sent carrying data */
+	u_long	tcps_tfo_syn_data_acked; /* data in our SYN acked by SYN|ACK */
+
+	/* TIME_WAIT related stats */
+	u_long	tcps_tw_recycled;	/* TIME_WAIT ended early by a new SYN */
+	u_long	tcps_tw_reclaimed;	/* TIME_WAIT ended early for lack of space */
+
+	/* Syncache related stats */
+	u_long	tcps_sc_cachehit;	/* handshakes completed from an entry */
+	u_long	tcps_sc_cookiehit;	/* handshakes completed from a cookie */
+	u_long	tcps_sc_cookieonly;	/* SYN|ACKs sent without an entry */
+
+	u_long	_pad[6];		/* 6 UTO */
 };
 
 #ifdef _KERNEL
@@ -653,7 +727,11 @@ VNET_DECLARE(int, tcp_abc_l_var);
 
 VNET_DECLARE(int, tcp_do_sack);			/* SACK enabled/disabled */
 VNET_DECLARE(int, tcp_sc_rst_sock_fail);	/* RST on sock alloc failure */
+VNET_DECLARE(int, tcp_do_rack);			/* RACK on new connections */
+VNET_DECLARE(int, tcp_fastopen_client_enable);	/* TFO on active opens */
 #define	V_tcp_do_sack		VNET(tcp_do_sack)
+#define	V_tcp_do_rack		VNET(tcp_do_rack)
+#define	V_tcp_fastopen_client_enable	VNET(tcp_fastopen_client_enable)
 #define	V_tcp_sc_rst_sock_fail	VNET(tcp_sc_rst_sock_fail)
 
 VNET_DECLARE(int, tcp_do_ecn);			/* TCP ECN enabled/disabled */
@@ -670,10 +748,6 @@ struct tcpcb *
 	 tcp_close(struct tcpcb *);
 void	 tcp_discardcb(struct tcpcb *);
 void	 tcp_twstart(struct tcpcb *);
-#if 0
-int	 tcp_twrecycleable(struct tcptw *tw);
-#endif
-void	 tcp_twclose(struct tcptw *_tw, int _reuse);
 void	 tcp_ctlinput(int, struct sockaddr *, void *);
 int	 tcp_ctloutput(struct socket *, struct sockopt *);
 struct tcpcb *
@@ -698,10 +772,11 @@ void	 tcp_reass_deliver_holes(struct tcpcb *tp);
 #ifdef VIMAGE
 void	 tcp_reass_destroy(void);
 #endif
+RB_PROTOTYPE(tsegqe_head, tseg_qent, tqe_q, tcp_reass_cmp);
 
 void	 tcp_input(struct mbuf *, int);
 #define	TI_UNLOCKED	1
-#define	TI_WLOCKED	2
+#define	TI_RLOCKED	2
 void	 tcp_do_segment(struct mbuf *m, struct tcphdr *th, const uint8_t *optp,
 	     struct socket *so, struct tcpcb *tp, int drop_hdrlen, int tlen,
 	     uint8_t iptos, int ti_locked, int no_unlock);
@@ -725,9 +800,13 @@ void	 tcp_tw_init(void);
 void	 tcp_tw_destroy(void);
 #endif
 void	 tcp_tw_zone_change(void);
-int	 tcp_twcheck(struct inpcb *, struct tcpopt *, struct tcphdr *,
+int	 tcp_twcheck(struct in_conninfo *, struct tcpopt *, struct tcphdr *,
 	    struct mbuf *, int);
 int	 tcp_twrespond(struct tcptw *, int);
+int	 tcp_twreuse(struct inpcb *, struct in_conninfo *);
+int	 tcp_twdrop(struct in_conninfo *);
+int	 tcp_tw_pcbcount(void);
+int	 tcp_tw_pcblist(struct sysctl_req *, int, int *);
 void	 tcp_setpersist(struct tcpcb *);
 #ifdef TCP_SIGNATURE
 int	 tcp_signature_compute(struct mbuf *, int, int, int, u_char *, u_int);
@@ -752,6 +831,8 @@ void	 tcp_hc_get(struct in_conninfo *, struct hc_metrics_lite *);
 u_long	 tcp_hc_getmtu(struct in_conninfo *);
 void	 tcp_hc_updatemtu(struct in_conninfo *, u_long);
 void	 tcp_hc_update(struct in_conninfo *, struct hc_metrics_lite *);
+int	 tcp_hc_gettfo(struct in_conninfo *, uint8_t *);
+void	 tcp_hc_updatetfo(struct in_conninfo *, const uint8_t *, int);
 
 extern	struct pr_usrreqs tcp_usrreqs;
 extern	u_long tcp_sendspace;
@@ -765,6 +846,16 @@ void	 tcp_sack_adjust(struct tcpcb *tp);
 struct sackhole *tcp_sack_output(struct tcpcb *tp, int *sack_bytes_rexmt);
 void	 tcp_sack_partialack(struct tcpcb *, struct tcphdr *);
 void	 tcp_free_sackholes(struct tcpcb *tp);
+int	 tcp_rack_init(struct tcpcb *tp);
+void	 tcp_rack_discard(struct tcpcb *tp);
+void	 tcp_rack_sent(struct tcpcb *tp, struct sackhole *p, tcp_seq start,
+	    long len);
+int	 tcp_rack_ack(struct tcpcb *tp, struct tcpopt *to, tcp_seq th_ack);
+int	 tcp_rack_detect(struct tcpcb *tp);
+void	 tcp_rack_recover(struct tcpcb *tp);
+void	 tcp_rack_timer_update(struct tcpcb *tp);
+void	 tcp_rack_timeout(struct tcpcb *tp);
+void	 tcp_rack_rto(struct tcpcb *tp);
 int	 tcp_newreno(struct tcpcb *, struct tcphdr *);
 u_long	 tcp_seq_subtract(u_long, u_long );
 
@@ -49,6 +49,12 @@ struct udphdr {
  * User-settable options (used with setsockopt).
  */
 #define	UDP_ENCAP			0x01
+#define	UDP_SEGMENT			0x02	/* u_int16_t; send in this size */
+#define	UDP_GRO				0x03	/* coalesce received datagrams */
+#define	UDP_RING			0x04	/* u_int; lockless receive slots */
+
+/* Most datagrams a UDP_SEGMENT send may be split into. */
+#define	UDP_MAX_SEGMENTS		64
 
 
 /*
@@ -42,6 +42,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/udp_usrreq.c 238240 2012-07-08 12:
 #include "opt_inet.h"
 #include "opt_inet6.h"
 #include "opt_ipsec.h"
+#include "opt_route.h"
 
 #include <sys/param.h>
 #include <sys/domain.h>
@@ -61,11 +62,15 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/udp_usrreq.c 238240 2012-07-08 12:
 #include <sys/sysctl.h>
 #include <sys/syslog.h>
 #include <sys/systm.h>
+#include <sys/uio.h>
 
 #include <vm/uma.h>
 
 #include <net/if.h>
 #include <net/route.h>
+#ifdef FLOWTABLE
+#include <net/flowtable.h>
+#endif
 
 #include <netinet/in.h>
 #include <netinet/in_pcb.h>
@@ -90,6 +95,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/udp_usrreq.c 238240 2012-07-08 12:
 #include <netipsec/esp.h>
 #endif
 
+#include <machine/atomic.h>
 #include <machine/in_cksum.h>
 
 #ifdef MAC
@@ -150,6 +156,7 @@ SYSCTL_VNET_STRUCT(_net_inet_udp, UDPCTL_STATS, stats, CTLFLAG_RW,
     &VNET_NAME(udpstat), udpstat,
     "UDP statistics (struct udpstat, netinet/udp_var.h)");
 
+static void	udp_ring_free(struct udp_ring *);
 #ifdef INET
 static void	udp_detach(struct socket *so);
 static int	udp_output(struct inpcb *, struct mbuf *, struct sockaddr *,
@@ -227,6 +234,8 @@ void
 udp_discardcb(struct udpcb *up)
 {
 
+	if (up->u_ring != NULL)
+		udp_ring_free(up->u_ring);
 	uma_zfree(V_udpcb_zone, up);
 }
 
@@ -240,7 +249,295 @@ udp_destroy(void)
 }
 #endif
 
+/*
+ * UDP_RING: datagrams bypass the receive socket buffer and reach the reader
+ * through a single-producer, single-consumer ring of mbufs and source
+ * addresses.  udp_append() is the producer and always runs with the inpcb
+ * locked; uinet's inpcb read lock is exclusive, so there is one producer at
+ * a time.  A ring socket must only be read from one thread at a time.  The
+ * socket buffer lock is taken only to sleep, and to wake up a reader that
+ * sleeps, selects or has an upcall registered.  As with the socket
+ * buffer, sb_hiwat bounds the data and sb_mbmax the mbuf storage that the
+ * ring holds, so that a large ring cannot pin the driver's receive pool.
+ */
+#define	UDP_RING_MAXSLOTS	65536
+
+static MALLOC_DEFINE(M_UDPRING, "udpring", "UDP receive rings");
+
+struct udp_ring_slot {
+	struct mbuf		*us_m;
+	struct sockaddr_in	 us_from;
+	u_int			 us_cc;		/* data bytes in us_m */
+	u_int			 us_mbcnt;	/* mbuf storage of us_m */
+};
+
+struct udp_ring {
+	u_int			 ur_mask;
+	volatile u_int		 ur_head __aligned(CACHE_LINE_SIZE);
+	volatile u_int		 ur_tail __aligned(CACHE_LINE_SIZE);
+	volatile u_int		 ur_cc __aligned(CACHE_LINE_SIZE);
+	volatile u_int		 ur_mbcnt;
+	struct udp_ring_slot	 ur_slot[] __aligned(CACHE_LINE_SIZE);
+};
+
+static int
+udp_ring_alloc(struct udpcb *up, u_int slots)
+{
+	struct udp_ring *ur;
+	u_int n;
+
+	if (slots == 0 || slots > UDP_RING_MAXSLOTS)
+		return (EINVAL);
+	for (n = 1; n < slots; n <<= 1)
+		;
+	ur = malloc(sizeof(*ur) + n * sizeof(ur->ur_slot[0]), M_UDPRING,
+	    M_NOWAIT | M_ZERO);
+	if (ur == NULL)
+		return (ENOBUFS);
+	ur->ur_mask = n - 1;
+	up->u_ring = ur;
+	return (0);
+}
+
+static void
+udp_ring_free(struct udp_ring *ur)
+{
+	u_int i;
+
+	for (i = ur->ur_tail; i != ur->ur_head; i++)
+		m_freem(ur->ur_slot[i & ur->ur_mask].us_m);
+	free(ur, M_UDPRING);
+}
+
+static void
+udp_ring_put(struct socket *so, struct udp_ring *ur, struct mbuf *n,
+    struct sockaddr_in *from)
+{
+	struct udp_ring_slot *us;
+	struct mbuf *m;
+	u_int cc, head, mbcnt;
+
+	cc = mbcnt = 0;
+	for (m = n; m != NULL; m = m->m_next) {
+		cc += m->m_len;
+		mbcnt += MSIZE;
+		if (m->m_flags & M_EXT)
+			mbcnt += m->m_ext.ext_size;
+	}
+	head = ur->ur_head;
+	if (head - atomic_load_acq_int(&ur->ur_tail) > ur->ur_mask ||
+	    ur->ur_cc + cc > so->so_rcv.sb_hiwat ||
+	    ur->ur_mbcnt + mbcnt > so->so_rcv.sb_mbmax) {
+		m_freem(n);
+		UDPSTAT_INC(udps_fullsock);
+		return;
+	}
+	us = &ur->ur_slot[head & ur->ur_mask];
+	us->us_m = n;
+	us->us_from = *from;
+	us->us_cc = cc;
+	us->us_mbcnt = mbcnt;
+	atomic_add_int(&ur->ur_cc, cc);
+	atomic_add_int(&ur->ur_mbcnt, mbcnt);
+	atomic_store_rel_int(&ur->ur_head, head + 1);
+
+	/* Pairs with the barrier in udp_ring_get() before it sleeps. */
+	mb();
+	if (sb_notify(&so->so_rcv)) {
+		SOCKBUF_LOCK(&so->so_rcv);
+		sorwakeup_locked(so);
+	}
+}
+
+/*
+ * Take the next datagram off the receive ring of so, sleeping for one
+ * unless the socket or flags ask for non-blocking I/O.  Returns
+ * EOPNOTSUPP if so has no ring, and 0 with *mp set to NULL once the
+ * socket can receive no more.
+ */
+int
+udp_ring_get(struct socket *so, struct mbuf **mp, struct sockaddr_in *from,
+    int flags)
+{
+	struct sockbuf *sb = &so->so_rcv;
+	struct udp_ring_slot *us;
+	struct udp_ring *ur;
+	u_int tail;
+	int error;
+
+	ur = sotoudpcb(so)->u_ring;
+	if (ur == NULL)
+		return (EOPNOTSUPP);
+	*mp = NULL;
+	tail = ur->ur_tail;
+	while (tail == atomic_load_acq_int(&ur->ur_head)) {
+		if (((so->so_state & SS_NBIO) ||
+		    (flags & (MSG_DONTWAIT | MSG_NBIO))) &&
+		    so->so_error == 0 && !(sb->sb_state & SBS_CANTRCVMORE))
+			return (EWOULDBLOCK);
+		SOCKBUF_LOCK(sb);
+		if (so->so_error) {
+			error = so->so_error;
+			so->so_error = 0;
+			SOCKBUF_UNLOCK(sb);
+			return (error);
+		}
+		if (sb->sb_state & SBS_CANTRCVMORE) {
+			SOCKBUF_UNLOCK(sb);
+			return (0);
+		}
+		if ((so->so_state & SS_NBIO) ||
+		    (flags & (MSG_DONTWAIT | MSG_NBIO))) {
+			SOCKBUF_UNLOCK(sb);
+			return (EWOULDBLOCK);
+		}
+		sb->sb_flags |= SB_WAIT;
+		mb();
+		error = 0;
+		if (tail == ur->ur_head)
+			error = sbwait(sb);
+		SOCKBUF_UNLOCK(sb);
+		if (error)
+			return (error);
+	}
+	us = &ur->ur_slot[tail & ur->ur_mask];
+	*mp = us->us_m;
+	if (from != NULL)
+		*from = us->us_from;
+	atomic_subtract_int(&ur->ur_cc, us->us_cc);
+	atomic_subtract_int(&ur->ur_mbcnt, us->us_mbcnt);
+	atomic_store_rel_int(&ur->ur_tail, tail + 1);
+	return (0);
+}
+
+/*
+ * Number of datagrams waiting on the receive ring of so, or -1 if it has
+ * no ring.
+ */
+int
+udp_ring_count(struct socket *so)
+{
+	struct udp_ring *ur;
+
+	ur = sotoudpcb(so)->u_ring;
+	if (ur == NULL)
+		return (-1);
+	return (atomic_load_acq_int(&ur->ur_head) - ur->ur_tail);
+}
+
+static int
+udp_soreceive(struct socket *so, struct sockaddr **psa, struct uio *uio,
+    struct mbuf **mp0, struct mbuf **controlp, int *flagsp)
+{
+	struct sockaddr_in from;
+	struct mbuf *m;
+	ssize_t len;
+	int error, flags;
+
+	if (sotoudpcb(so)->u_ring == NULL)
+		return (soreceive_dgram(so, psa, uio, mp0, controlp, flagsp));
+
+	if (psa != NULL)
+		*psa = NULL;
+	if (controlp != NULL)
+		*controlp = NULL;
+	flags = flagsp != NULL ? *flagsp & ~MSG_EOR : 0;
+	if (mp0 != NULL || (flags & (MSG_PEEK | MSG_OOB)))
+		return (EOPNOTSUPP);
+	if (uio->uio_resid == 0)
+		return (0);
+
+	error = udp_ring_get(so, &m, &from, flags);
+	if (error != 0 || m == NULL)
+		return (error);
+	if (psa != NULL)
+		*psa = sodupsockaddr((struct sockaddr *)&from, M_NOWAIT);
+	while (m != NULL && uio->uio_resid > 0) {
+		len = min(uio->uio_resid, m->m_len);
+		error = uiomove(mtod(m, char *), (int)len, uio);
+		if (error) {
+			m_freem(m);
+			return (error);
+		}
+		if (len == m->m_len)
+			m = m_free(m);
+		else {
+			m->m_data += len;
+			m->m_len -= len;
+		}
+	}
+	if (m != NULL)
+		flags |= MSG_TRUNC;
+	m_freem(m);
+	if (flagsp != NULL)
+		*flagsp |= flags;
+	return (0);
+}
+
 #ifdef INET
+/*
+ * UDP_GRO: fold datagram n into the last record of the receive buffer when
+ * it comes from the same source and the record is a train of equal sized
+ * datagrams that n can extend.  The record carries a UDP_GRO control
+ * message holding the size of its datagrams.  Returns 1 if n was consumed.
+ */
+static int
+udp_gro_append(struct sockbuf *sb, struct sockaddr *sa, struct mbuf *n)
+{
+	struct mbuf *rec, *m0, *ctl, *m;
+	struct cmsghdr *cm;
+	int segsz;
+
+	SOCKBUF_LOCK_ASSERT(sb);
+
+	rec = sb->sb_lastrecord;
+	if (rec == NULL || rec->m_type != MT_SONAME ||
+	    rec->m_len != sa->sa_len ||
+	    bcmp(mtod(rec, void *), sa, sa->sa_len) != 0)
+		return (0);
+	m0 = rec->m_next;
+	ctl = NULL;
+	if (m0 != NULL && m0->m_type == MT_CONTROL) {
+		cm = mtod(m0, struct cmsghdr *);
+		if (m0->m_len != CMSG_SPACE(sizeof(int)) ||
+		    cm->cmsg_level != IPPROTO_UDP || cm->cmsg_type != UDP_GRO)
+			return (0);
+		ctl = m0;
+		m0 = m0->m_next;
+		segsz = *(int *)CMSG_DATA(cm);
+	} else if (m0 != NULL)
+		segsz = m0->m_pkthdr.len;
+	if (m0 == NULL || m0->m_type != MT_DATA ||
+	    (m0->m_flags & M_PKTHDR) == 0)
+		return (0);
+
+	if (n->m_pkthdr.len == 0 || n->m_pkthdr.len > segsz ||
+	    m0->m_pkthdr.len % segsz != 0 ||
+	    m0->m_pkthdr.len / segsz >= UDP_MAX_SEGMENTS ||
+	    m0->m_pkthdr.len + n->m_pkthdr.len > IP_MAXPACKET ||
+	    n->m_pkthdr.len + (ctl == NULL ? MLEN : 0) > sbspace(sb))
+		return (0);
+
+	if (ctl == NULL) {
+		ctl = sbcreatecontrol((caddr_t)&segsz, sizeof(segsz), UDP_GRO,
+		    IPPROTO_UDP);
+		if (ctl == NULL)
+			return (0);
+		ctl->m_next = m0;
+		rec->m_next = ctl;
+		sballoc(sb, ctl);
+	}
+	m0->m_pkthdr.len += n->m_pkthdr.len;
+	m_demote(n, 0);
+	sb->sb_mbtail->m_next = n;
+	for (m = n; m->m_next != NULL; m = m->m_next)
+		sballoc(sb, m);
+	sballoc(sb, m);
+	sb->sb_mbtail = m;
+	SBLASTMBUFCHK(sb);
+	return (1);
+}
+
 /*
  * Subroutine of udp_input(), which appends the provided mbuf chain to the
  * passed pcb/socket.  The caller must provide a sockaddr_in via udp_in that
@@ -299,6 +596,12 @@ udp_append(struct inpcb *inp, struct ip *ip, struct mbuf *n, int off,
 		return;
 	}
 #endif /* MAC */
+	so = inp->inp_socket;
+	if (up->u_ring != NULL) {
+		m_adj(n, off);
+		udp_ring_put(so, up->u_ring, n, udp_in);
+		return;
+	}
 	if (inp->inp_flags & INP_CONTROLOPTS ||
 	    inp->inp_socket->so_options & (SO_TIMESTAMP | SO_BINTIME)) {
 #ifdef INET6
@@ -320,9 +623,11 @@ udp_append(struct inpcb *inp, struct ip *ip, struct mbuf *n, int off,
 		append_sa = (struct sockaddr *)udp_in;
 	m_adj(n, off);
 
-	so = inp->inp_socket;
 	SOCKBUF_LOCK(&so->so_rcv);
-	if (sbappendaddr_locked(&so->so_rcv, append_sa, n, opts) == 0) {
+	if ((up->u_flags & UF_GRO) && opts == NULL &&
+	    udp_gro_append(&so->so_rcv, append_sa, n))
+		sorwakeup_locked(so);
+	else if (sbappendaddr_locked(&so->so_rcv, append_sa, n, opts) == 0) {
 		SOCKBUF_UNLOCK(&so->so_rcv);
 		m_freem(n);
 		if (opts)
@@ -451,36 +756,38 @@ udp_input(struct mbuf *m, int off)
 
 	if (IN_MULTICAST(ntohl(ip->ip_dst.s_addr)) ||
 	    in_broadcast(ip->ip_dst, ifp)) {
-		struct inpcb *last;
+		struct inpcb *inp_stk[16], **inp_list, *last;
 		struct ip_moptions *imo;
+		int i, ninp;
 
-		INP_INFO_RLOCK(&V_udbinfo);
+		/*
+		 * Reference the candidate pcbs under the list lock alone, so
+		 * that delivery does not exclude every info lock partition.
+		 */
+		ninp = nitems(inp_stk);
+		inp_list = in_pcbref_lport(&V_udbinfo, uh->uh_dport, inp_stk,
+		    &ninp);
 		last = NULL;
-		LIST_FOREACH(inp, &V_udb, inp_list) {
+		for (i = 0; i < ninp; i++) {
+			inp = inp_list[i];
+			INP_RLOCK(inp);
+			if (inp->inp_flags2 & INP_FREED)
+				goto next;
 			if (inp->inp_lport != uh->uh_dport)
-				continue;
+				goto next;
 #ifdef INET6
 			if ((inp->inp_vflag & INP_IPV4) == 0)
-				continue;
+				goto next;
 #endif
 			if (inp->inp_laddr.s_addr != INADDR_ANY &&
 			    inp->inp_laddr.s_addr != ip->ip_dst.s_addr)
-				continue;
+				goto next;
 			if (inp->inp_faddr.s_addr != INADDR_ANY &&
 			    inp->inp_faddr.s_addr != ip->ip_src.s_addr)
-				continue;
+				goto next;
 			if (inp->inp_fport != 0 &&
 			    inp->inp_fport != uh->uh_sport)
-				continue;
-
-			INP_RLOCK(inp);
-
-			/*
-			 * XXXRW: Because we weren't holding either the inpcb
-			 * or the hash lock when we checked for a match
-			 * before, we should probably recheck now that the
-			 * inpcb lock is held.
-			 */
+				goto next;
 
 			/*
 			 * Handle socket delivery policy for any-source
@@ -490,10 +797,8 @@ udp_input(struct mbuf *m, int off)
 			if (IN_MULTICAST(ntohl(ip->ip_dst.s_addr))) {
 				struct sockaddr_in	 group;
 				int			 blocked;
-				if (imo == NULL) {
-					INP_RUNLOCK(inp);
-					continue;
-				}
+				if (imo == NULL)
+					goto next;
 				bzero(&group, sizeof(struct sockaddr_in));
 				group.sin_len = sizeof(struct sockaddr_in);
 				group.sin_family = AF_INET;
@@ -508,16 +813,23 @@ udp_input(struct mbuf *m, int off)
 					if (blocked == MCAST_NOTSMEMBER ||
 					    blocked == MCAST_MUTED)
 						UDPSTAT_INC(udps_filtermcast);
-					INP_RUNLOCK(inp);
-					continue;
+					goto next;
 				}
 			}
 			if (last != NULL) {
 				struct mbuf *n;
 
-				n = m_copy(m, 0, M_COPYALL);
-				udp_append(last, ip, n, iphlen, &udp_in);
-				INP_RUNLOCK(last);
+				/*
+				 * Each member socket gets its own copy:
+				 * udp_append() trims the chain and links it
+				 * into that socket's buffer.  Cluster data
+				 * is referenced, not copied.
+				 */
+				if ((n = m_copypacket(m, M_DONTWAIT)) != NULL)
+					udp_append(last, ip, n, iphlen,
+					    &udp_in);
+				if (!in_pcbrele_rlocked(last))
+					INP_RUNLOCK(last);
 			}
 			last = inp;
 			/*
@@ -529,9 +841,24 @@ udp_input(struct mbuf *m, int off)
 			 * will never clear these options after setting them.
 			 */
 			if ((last->inp_socket->so_options &
-			    (SO_REUSEPORT|SO_REUSEADDR)) == 0)
+			    (SO_REUSEPORT|SO_REUSEADDR)) == 0) {
+				i++;
 				break;
+			}
+			continue;
+next:
+			if (!in_pcbrele_rlocked(inp))
+				INP_RUNLOCK(inp);
+		}
+		/* Drop the references on any pcbs not visited. */
+		for (; i < ninp; i++) {
+			inp = inp_list[i];
+			INP_RLOCK(inp);
+			if (!in_pcbrele_rlocked(inp))
+				INP_RUNLOCK(inp);
 		}
+		if (inp_list != inp_stk)
+			free(inp_list, M_TEMP);
 
 		if (last == NULL) {
 			/*
@@ -540,14 +867,11 @@ udp_input(struct mbuf *m, int off)
 			 * or multicast datgram.)
 			 */
 			UDPSTAT_INC(udps_noportbcast);
-			if (inp)
-				INP_RUNLOCK(inp);
-			INP_INFO_RUNLOCK(&V_udbinfo);
 			goto badunlocked;
 		}
 		udp_append(last, ip, m, iphlen, &udp_in);
-		INP_RUNLOCK(last);
-		INP_INFO_RUNLOCK(&V_udbinfo);
+		if (!in_pcbrele_rlocked(last))
+			INP_RUNLOCK(last);
 		return;
 	}
 
@@ -724,10 +1048,10 @@ udp_pcblist(SYSCTL_HANDLER_ARGS)
 	/*
 	 * OK, now we're committed to doing something.
 	 */
-	INP_INFO_RLOCK(&V_udbinfo);
+	INP_LIST_LOCK(&V_udbinfo);
 	gencnt = V_udbinfo.ipi_gencnt;
 	n = V_udbinfo.ipi_count;
-	INP_INFO_RUNLOCK(&V_udbinfo);
+	INP_LIST_UNLOCK(&V_udbinfo);
 
 	error = sysctl_wire_old_buffer(req, 2 * (sizeof xig)
 		+ n * sizeof(struct xinpcb));
@@ -746,25 +1070,27 @@ udp_pcblist(SYSCTL_HANDLER_ARGS)
 	if (inp_list == 0)
 		return (ENOMEM);
 
-	INP_INFO_RLOCK(&V_udbinfo);
+	/*
+	 * inpcb locks order before the list lock, so only reference the
+	 * pcbs here and check visibility once each is locked below.
+	 */
+	INP_LIST_LOCK(&V_udbinfo);
 	for (inp = LIST_FIRST(V_udbinfo.ipi_listhead), i = 0; inp && i < n;
 	     inp = LIST_NEXT(inp, inp_list)) {
-		INP_WLOCK(inp);
-		if (inp->inp_gencnt <= gencnt &&
-		    cr_canseeinpcb(req->td->td_ucred, inp) == 0) {
+		if (inp->inp_gencnt <= gencnt) {
 			in_pcbref(inp);
 			inp_list[i++] = inp;
 		}
-		INP_WUNLOCK(inp);
 	}
-	INP_INFO_RUNLOCK(&V_udbinfo);
+	INP_LIST_UNLOCK(&V_udbinfo);
 	n = i;
 
 	error = 0;
 	for (i = 0; i < n; i++) {
 		inp = inp_list[i];
 		INP_RLOCK(inp);
-		if (inp->inp_gencnt <= gencnt) {
+		if (inp->inp_gencnt <= gencnt &&
+		    cr_canseeinpcb(req->td->td_ucred, inp) == 0) {
 			struct xinpcb xi;
 
 			bzero(&xi, sizeof(xi));
@@ -779,14 +1105,14 @@ udp_pcblist(SYSCTL_HANDLER_ARGS)
 		} else
 			INP_RUNLOCK(inp);
 	}
-	INP_INFO_WLOCK(&V_udbinfo);
+	INP_INFO_RLOCK(&V_udbinfo);
 	for (i = 0; i < n; i++) {
 		inp = inp_list[i];
 		INP_RLOCK(inp);
 		if (!in_pcbrele_rlocked(inp))
 			INP_RUNLOCK(inp);
 	}
-	INP_INFO_WUNLOCK(&V_udbinfo);
+	INP_INFO_RUNLOCK(&V_udbinfo);
 
 	if (!error) {
 		/*
@@ -795,11 +1121,11 @@ udp_pcblist(SYSCTL_HANDLER_ARGS)
 		 * that something happened while we were processing this
 		 * request, and it might be necessary to retry.
 		 */
-		INP_INFO_RLOCK(&V_udbinfo);
+		INP_LIST_LOCK(&V_udbinfo);
 		xig.xig_gen = V_udbinfo.ipi_gencnt;
 		xig.xig_sogen = V_so_gencnt;
 		xig.xig_count = V_udbinfo.ipi_count;
-		INP_INFO_RUNLOCK(&V_udbinfo);
+		INP_LIST_UNLOCK(&V_udbinfo);
 		error = SYSCTL_OUT(req, &xig, sizeof xig);
 	}
 	free(inp_list, M_TEMP);
@@ -854,9 +1180,7 @@ udp_ctloutput(struct socket *so, struct sockopt *sopt)
 {
 	int error = 0, optval;
 	struct inpcb *inp;
-#ifdef IPSEC_NAT_T
 	struct udpcb *up;
-#endif
 
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("%s: inp == NULL", __func__));
@@ -919,6 +1243,38 @@ udp_ctloutput(struct socket *so, struct sockopt *sopt)
 			}
 			INP_WUNLOCK(inp);
 			break;
+		case UDP_SEGMENT:
+		case UDP_GRO:
+		case UDP_RING:
+			INP_WUNLOCK(inp);
+			error = sooptcopyin(sopt, &optval, sizeof optval,
+					    sizeof optval);
+			if (error)
+				break;
+			if (sopt->sopt_name == UDP_SEGMENT &&
+			    (optval < 0 || optval > IP_MAXPACKET)) {
+				error = EINVAL;
+				break;
+			}
+			inp = sotoinpcb(so);
+			KASSERT(inp != NULL, ("%s: inp == NULL", __func__));
+			INP_WLOCK(inp);
+			up = intoudpcb(inp);
+			KASSERT(up != NULL, ("%s: up == NULL", __func__));
+			if (sopt->sopt_name == UDP_RING) {
+				/* Datagrams already queued would be stranded. */
+				if (up->u_ring != NULL || so->so_rcv.sb_cc != 0)
+					error = EBUSY;
+				else
+					error = udp_ring_alloc(up, optval);
+			} else if (sopt->sopt_name == UDP_SEGMENT)
+				up->u_segsz = optval;
+			else if (optval)
+				up->u_flags |= UF_GRO;
+			else
+				up->u_flags &= ~UF_GRO;
+			INP_WUNLOCK(inp);
+			break;
 		default:
 			INP_WUNLOCK(inp);
 			error = ENOPROTOOPT;
@@ -936,6 +1292,21 @@ udp_ctloutput(struct socket *so, struct sockopt *sopt)
 			error = sooptcopyout(sopt, &optval, sizeof optval);
 			break;
 #endif
+		case UDP_SEGMENT:
+		case UDP_GRO:
+		case UDP_RING:
+			up = intoudpcb(inp);
+			KASSERT(up != NULL, ("%s: up == NULL", __func__));
+			if (sopt->sopt_name == UDP_RING)
+				optval = up->u_ring != NULL ?
+				    up->u_ring->ur_mask + 1 : 0;
+			else if (sopt->sopt_name == UDP_SEGMENT)
+				optval = up->u_segsz;
+			else
+				optval = (up->u_flags & UF_GRO) != 0;
+			INP_WUNLOCK(inp);
+			error = sooptcopyout(sopt, &optval, sizeof optval);
+			break;
 		default:
 			INP_WUNLOCK(inp);
 			error = ENOPROTOOPT;
@@ -955,14 +1326,16 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct sockaddr *addr,
     struct mbuf *control, struct thread *td)
 {
 	struct udpiphdr *ui;
+	struct mbuf *n;
 	int len = m->m_pkthdr.len;
-	struct in_addr faddr, laddr;
+	int seglen, segsz;
+	struct in_addr faddr, laddr, csumdst;
 	struct cmsghdr *cm;
 	struct sockaddr_in *sin, src;
 	int error = 0;
 	int ipflags;
 	u_short fport, lport;
-	int unlock_udbinfo;
+	int unlock_udbinfo, unlock_inp;
 	u_char tos;
 
 	/*
@@ -981,6 +1354,7 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct sockaddr *addr,
 	src.sin_family = 0;
 	INP_RLOCK(inp);
 	tos = inp->inp_ip_tos;
+	segsz = intoudpcb(inp)->u_segsz;
 	if (control != NULL) {
 		/*
 		 * XXX: Currently, we assume all the optional information is
@@ -1001,6 +1375,16 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct sockaddr *addr,
 				error = EINVAL;
 				break;
 			}
+			if (cm->cmsg_level == IPPROTO_UDP &&
+			    cm->cmsg_type == UDP_SEGMENT) {
+				if (cm->cmsg_len !=
+				    CMSG_LEN(sizeof(u_int16_t))) {
+					error = EINVAL;
+					break;
+				}
+				segsz = *(u_int16_t *)CMSG_DATA(cm);
+				continue;
+			}
 			if (cm->cmsg_level != IPPROTO_IP)
 				continue;
 
@@ -1036,6 +1420,8 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct sockaddr *addr,
 		}
 		m_freem(control);
 	}
+	if (error == 0 && segsz != 0 && len > segsz * UDP_MAX_SEGMENTS)
+		error = EINVAL;
 	if (error) {
 		INP_RUNLOCK(inp);
 		m_freem(m);
@@ -1179,79 +1565,122 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct sockaddr *addr,
 		}
 	}
 
-	/*
-	 * Calculate data length and get a mbuf for UDP, IP, and possible
-	 * link-layer headers.  Immediate slide the data pointer back forward
-	 * since we won't use that space at this layer.
-	 */
-	M_PREPEND(m, sizeof(struct udpiphdr) + max_linkhdr, M_DONTWAIT);
-	if (m == NULL) {
-		error = ENOBUFS;
-		goto release;
-	}
-	m->m_data += max_linkhdr;
-	m->m_len -= max_linkhdr;
-	m->m_pkthdr.len -= max_linkhdr;
-
-	/*
-	 * Fill in mbuf with extended UDP header and addresses and length put
-	 * into network format.
-	 */
-	ui = mtod(m, struct udpiphdr *);
-	bzero(ui->ui_x1, sizeof(ui->ui_x1));	/* XXX still needed? */
-	ui->ui_pr = IPPROTO_UDP;
-	ui->ui_src = laddr;
-	ui->ui_dst = faddr;
-	ui->ui_sport = lport;
-	ui->ui_dport = fport;
-	ui->ui_ulen = htons((u_short)len + sizeof(struct udphdr));
-
-	/*
-	 * Set the Don't Fragment bit in the IP header.
-	 */
-	if (inp->inp_flags & INP_DONTFRAG) {
-		struct ip *ip;
-
-		ip = (struct ip *)&ui->ui_i;
-		ip->ip_off |= htons(IP_DF);
-	}
-
 	ipflags = 0;
 	if (inp->inp_socket->so_options & SO_DONTROUTE)
 		ipflags |= IP_ROUTETOIF;
 	if (inp->inp_socket->so_options & SO_BROADCAST)
 		ipflags |= IP_ALLOWBROADCAST;
-	if (inp->inp_flags & INP_ONESBCAST)
+	if (inp->inp_flags & INP_ONESBCAST) {
 		ipflags |= IP_SENDONES;
-
-#ifdef MAC
-	mac_inpcb_create_mbuf(inp, m);
-#endif
-
-	/*
-	 * Set up checksum and output datagram.
-	 */
-	if (V_udp_cksum) {
-		if (inp->inp_flags & INP_ONESBCAST)
-			faddr.s_addr = INADDR_BROADCAST;
-		ui->ui_sum = in_pseudo(ui->ui_src.s_addr, faddr.s_addr,
-		    htons((u_short)len + sizeof(struct udphdr) + IPPROTO_UDP));
-		m->m_pkthdr.csum_flags = CSUM_UDP;
-		m->m_pkthdr.csum_data = offsetof(struct udphdr, uh_sum);
+		if (V_udp_cksum)
+			csumdst.s_addr = INADDR_BROADCAST;
 	} else
-		ui->ui_sum = 0;
-	((struct ip *)ui)->ip_len = htons(sizeof (struct udpiphdr) + len);
-	((struct ip *)ui)->ip_ttl = inp->inp_ip_ttl;	/* XXX */
-	((struct ip *)ui)->ip_tos = tos;		/* XXX */
-	UDPSTAT_INC(udps_opackets);
+		csumdst = faddr;
 
 	if (unlock_udbinfo == UH_WLOCKED)
 		INP_HASH_WUNLOCK(&V_udbinfo);
 	else if (unlock_udbinfo == UH_RLOCKED)
 		INP_HASH_RUNLOCK(&V_udbinfo);
-	error = ip_output(m, inp->inp_options, NULL, ipflags,
-	    inp->inp_moptions, inp);
-	if (unlock_udbinfo == UH_WLOCKED)
+	unlock_inp = (unlock_udbinfo == UH_WLOCKED) ? UH_WLOCKED : UH_RLOCKED;
+#ifdef FLOWTABLE
+	/*
+	 * Connected sends only hold the inpcb read lock.  Upgrade it when
+	 * the socket's cached route needs refilling; if that races, the
+	 * flow table still serves this packet.
+	 */
+	if (unlock_inp == UH_RLOCKED &&
+	    flowtable_inpcb_stale(V_ip_ft, inp) && INP_TRY_UPGRADE(inp))
+		unlock_inp = UH_WLOCKED;
+#endif
+	if (unlock_inp == UH_WLOCKED)
+		ipflags |= IP_INPWLOCKED;
+
+	/*
+	 * With UDP_SEGMENT in effect, the payload leaves as a train of
+	 * datagrams of segsz bytes, the last one possibly shorter, that all
+	 * share the binding and addressing work done above.
+	 */
+	for (;;) {
+		n = m;
+		m = NULL;
+		seglen = len;
+		if (segsz != 0 && len > segsz) {
+			seglen = segsz;
+			m = m_split(n, segsz, M_DONTWAIT);
+			if (m == NULL) {
+				m_freem(n);
+				error = ENOBUFS;
+				break;
+			}
+		}
+		len -= seglen;
+
+		/*
+		 * Get a mbuf for UDP, IP, and possible link-layer headers.
+		 * Immediate slide the data pointer back forward since we
+		 * won't use that space at this layer.
+		 */
+		M_PREPEND(n, sizeof(struct udpiphdr) + max_linkhdr, M_DONTWAIT);
+		if (n == NULL) {
+			error = ENOBUFS;
+			break;
+		}
+		n->m_data += max_linkhdr;
+		n->m_len -= max_linkhdr;
+		n->m_pkthdr.len -= max_linkhdr;
+
+		/*
+		 * Fill in mbuf with extended UDP header and addresses and
+		 * length put into network format.
+		 */
+		ui = mtod(n, struct udpiphdr *);
+		bzero(ui->ui_x1, sizeof(ui->ui_x1));	/* XXX still needed? */
+		ui->ui_pr = IPPROTO_UDP;
+		ui->ui_src = laddr;
+		ui->ui_dst = faddr;
+		ui->ui_sport = lport;
+		ui->ui_dport = fport;
+		ui->ui_ulen = htons((u_short)seglen + sizeof(struct udphdr));
+
+		/*
+		 * Set the Don't Fragment bit in the IP header.
+		 */
+		if (inp->inp_flags & INP_DONTFRAG) {
+			struct ip *ip;
+
+			ip = (struct ip *)&ui->ui_i;
+			ip->ip_off |= htons(IP_DF);
+		}
+
+#ifdef MAC
+		mac_inpcb_create_mbuf(inp, n);
+#endif
+
+		/*
+		 * Set up checksum and output datagram.
+		 */
+		if (V_udp_cksum) {
+			ui->ui_sum = in_pseudo(ui->ui_src.s_addr,
+			    csumdst.s_addr, htons((u_short)seglen +
+			    sizeof(struct udphdr) + IPPROTO_UDP));
+			n->m_pkthdr.csum_flags = CSUM_UDP;
+			n->m_pkthdr.csum_data = offsetof(struct udphdr, uh_sum);
+		} else
+			ui->ui_sum = 0;
+		((struct ip *)ui)->ip_len =
+		    htons(sizeof (struct udpiphdr) + seglen);
+		((struct ip *)ui)->ip_ttl = inp->inp_ip_ttl;	/* XXX */
+		((struct ip *)ui)->ip_tos = tos;		/* XXX */
+		UDPSTAT_INC(udps_opackets);
+
+		error = ip_output(n, inp->inp_options, NULL, ipflags,
+		    inp->inp_moptions, inp);
+		if (error != 0 || m == NULL)
+			break;
+	}
+	if (m != NULL)
+		m_freem(m);
+	if (unlock_inp == UH_WLOCKED)
 		INP_WUNLOCK(inp);
 	else
 		INP_RUNLOCK(inp);
@@ -1434,10 +1863,10 @@ udp_attach(struct socket *so, int proto, struct thread *td)
 	error = soreserve(so, udp_sendspace, udp_recvspace);
 	if (error)
 		return (error);
-	INP_INFO_WLOCK(&V_udbinfo);
+	INP_INFO_RLOCK(&V_udbinfo);
 	error = in_pcballoc(so, &V_udbinfo);
 	if (error) {
-		INP_INFO_WUNLOCK(&V_udbinfo);
+		INP_INFO_RUNLOCK(&V_udbinfo);
 		return (error);
 	}
 
@@ -1449,12 +1878,12 @@ udp_attach(struct socket *so, int proto, struct thread *td)
 	if (error) {
 		in_pcbdetach(inp);
 		in_pcbfree(inp);
-		INP_INFO_WUNLOCK(&V_udbinfo);
+		INP_INFO_RUNLOCK(&V_udbinfo);
 		return (error);
 	}
 
 	INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_udbinfo);
+	INP_INFO_RUNLOCK(&V_udbinfo);
 	return (0);
 }
 #endif /* INET */
@@ -1554,14 +1983,14 @@ udp_detach(struct socket *so)
 	KASSERT(inp != NULL, ("udp_detach: inp == NULL"));
 	KASSERT(inp->inp_faddr.s_addr == INADDR_ANY,
 	    ("udp_detach: not disconnected"));
-	INP_INFO_WLOCK(&V_udbinfo);
+	INP_INFO_RLOCK(&V_udbinfo);
 	INP_WLOCK(inp);
 	up = intoudpcb(inp);
 	KASSERT(up != NULL, ("%s: up == NULL", __func__));
 	inp->inp_ppcb = NULL;
 	in_pcbdetach(inp);
 	in_pcbfree(inp);
-	INP_INFO_WUNLOCK(&V_udbinfo);
+	INP_INFO_RUNLOCK(&V_udbinfo);
 	udp_discardcb(up);
 }
 
@@ -1624,7 +2053,7 @@ struct pr_usrreqs udp_usrreqs = {
 	.pru_disconnect =	udp_disconnect,
 	.pru_peeraddr =		in_getpeeraddr,
 	.pru_send =		udp_send,
-	.pru_soreceive =	soreceive_dgram,
+	.pru_soreceive =	udp_soreceive,
 	.pru_sosend =		sosend_dgram,
 	.pru_shutdown =		udp_shutdown,
 	.pru_sockaddr =		in_getsockaddr,
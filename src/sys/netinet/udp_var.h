@@ -53,12 +53,16 @@ struct udpiphdr {
 
 typedef void(*udp_tun_func_t)(struct mbuf *, int off, struct inpcb *);
 
+struct udp_ring;
+
 /*
  * UDP control block; one per udp.
  */
 struct udpcb {
 	udp_tun_func_t	u_tun_func;	/* UDP kernel tunneling callback. */
 	u_int		u_flags;	/* Generic UDP flags. */
+	u_int16_t	u_segsz;	/* UDP_SEGMENT size, 0 if off. */
+	struct udp_ring	*u_ring;	/* UDP_RING receive ring. */
 };
 
 #define	intoudpcb(ip)	((struct udpcb *)(ip)->inp_ppcb)
@@ -69,6 +73,7 @@ struct udpcb {
 	/* .. per draft-ietf-ipsec-nat-t-ike-0[01],
 	 * and draft-ietf-ipsec-udp-encaps-(00/)01.txt */
 #define	UF_ESPINUDP		0x00000002	/* w/ non-ESP marker. */
+#define	UF_GRO			0x00000004	/* UDP_GRO: coalesce on receive. */
 
 struct udpstat {
 				/* input statistics: */
@@ -158,6 +163,9 @@ struct inpcb	*udp_notify(struct inpcb *inp, int errno);
 int		 udp_shutdown(struct socket *so);
 
 int udp_set_kernel_tunneling(struct socket *so, udp_tun_func_t f);
+int		 udp_ring_get(struct socket *, struct mbuf **,
+		    struct sockaddr_in *, int);
+int		 udp_ring_count(struct socket *);
 #endif
 
 #endif
@@ -42,6 +42,8 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet6/frag6.c 238479 2012-07-15 11:27:1
 #include <sys/errno.h>
 #include <sys/time.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
 #include <sys/syslog.h>
 
 #include <net/if.h>
@@ -90,7 +92,7 @@ static VNET_DEFINE(struct ip6q, ip6q);	/* ip6 reassemble queue */
 #define	IP6Q_LOCK_DESTROY()	VNET_MTX_DESTROY(&V_ip6qlock)
 #define	IP6Q_LOCK()		VNET_MTX_LOCK(&V_ip6qlock)
 #define	IP6Q_TRYLOCK()		VNET_MTX_TRYLOCK(&V_ip6qlock)
-#define	IP6Q_LOCK_ASSERT()	VNET_MTX_ASSSERT(&V_ip6qlock, MA_OWNED)
+#define	IP6Q_LOCK_ASSERT()	VNET_MTX_ASSERT(&V_ip6qlock, MA_OWNED)
 #define	IP6Q_UNLOCK()		VNET_MTX_UNLOCK(&V_ip6qlock)
 
 static MALLOC_DEFINE(M_FTABLE, "fragment", "fragment reassembly header");
@@ -272,17 +272,14 @@ icmp6_error(struct mbuf *m, int type, int code, int param)
 #endif
 
 #ifdef NO_MBUF_TURNAROUND
-	if (turnaround)	{
+	{
 		struct mbuf *m0;
 	
 		m0 = m_dup(m, M_NOWAIT);
 		m_freem(m);
-		if (m0 == NULL) {
-			ICMPSTAT_INC(icps_nomem);
-			goto done;
-		}
+		if (m0 == NULL)
+			return;
 		m = m0;
-		ip = mtod(m, struct ip *);
 	}
 #endif
 
@@ -1013,10 +1010,8 @@ icmp6_notify_error(struct mbuf **mp, int off, int icmp6len, int code)
 
 		m0 = m_dup(m, M_NOWAIT);
 		m_freem(m);
-		if (m0 == NULL) {
-			ICMP6STAT_INC(icp6s_nomem);
+		if (m0 == NULL)
 			return (-1);
-		}
 		m = m0;
 	}
 #endif
@@ -2066,7 +2061,7 @@ icmp6_rip6_input(struct mbuf **mp, int off)
 		return (IPPROTO_DONE);
 	}
 
-	INP_INFO_RLOCK(&V_ripcbinfo);
+	INP_HASH_RLOCK(&V_ripcbinfo);
 	LIST_FOREACH(in6p, &V_ripcb, inp_list) {
 		if ((in6p->inp_vflag & INP_IPV6) == 0)
 			continue;
@@ -2144,7 +2139,7 @@ icmp6_rip6_input(struct mbuf **mp, int off)
 		}
 		last = in6p;
 	}
-	INP_INFO_RUNLOCK(&V_ripcbinfo);
+	INP_HASH_RUNLOCK(&V_ripcbinfo);
 	if (last != NULL) {
 		if (last->inp_flags & INP_CONTROLOPTS)
 			ip6_savecontrol(last, m, &opts);
@@ -2217,10 +2212,8 @@ icmp6_reflect(struct mbuf *m, size_t off, int turnaround)
 	
 		m0 = m_dup(m, M_NOWAIT);
 		m_freem(m);
-		if (m0 == NULL) {
-			ICMPSTAT_INC(icp6s_nomem);
+		if (m0 == NULL)
 			return;
-		}
 		m = m0;
 	}
 #endif
@@ -2481,6 +2481,7 @@ in6_lltable_prefix_free(struct lltable *llt,
 				LLE_WLOCK(lle);
 				if (canceled)
 					LLE_REMREF(lle);
+				nd6_cache_purge(llt->llt_ifp, lle);
 				llentry_free(lle);
 			}
 		}
@@ -2581,6 +2582,7 @@ in6_lltable_lookup(struct lltable *llt, u_int flags,
 		if (!(lle->la_flags & LLE_IFADDR) || (flags & LLE_IFADDR)) {
 			LLE_WLOCK(lle);
 			lle->la_flags = LLE_DELETED;
+			nd6_cache_purge(ifp, lle);
 			LLE_WUNLOCK(lle);
 #ifdef DIAGNOSTIC
 			log(LOG_INFO, "ifaddr cache = %p  is deleted\n", lle);	
@@ -2701,6 +2703,7 @@ in6_domifattach(struct ifnet *ifp)
 	}
 
 	ext->mld_ifinfo = mld_domifattach(ifp);
+	ext->nd6_cache = nd6_cache_alloc(ifp);
 
 	return ext;
 }
@@ -2714,6 +2717,7 @@ in6_domifdetach(struct ifnet *ifp, void *aux)
 	scope6_ifdetach(ext->scope6_id);
 	nd6_ifdetach(ext->nd_ifinfo);
 	lltable_free(ext->lltable);
+	nd6_cache_free(ext->nd6_cache);
 	free(ext->in6_ifstat, M_IFADDR);
 	free(ext->icmp6_ifstat, M_IFADDR);
 	free(ext, M_IFADDR);
@@ -61,7 +61,7 @@ struct inpcbgroup *
 in6_pcbgroup_byhash(struct inpcbinfo *pcbinfo, u_int hashtype, uint32_t hash)
 {
 
-	return (NULL);
+	return (in_pcbgroup_byhash(pcbinfo, hashtype, hash));
 }
 
 struct inpcbgroup *
@@ -104,9 +104,11 @@ struct in6_ifextra {
 	struct scope6_id *scope6_id;
 	struct lltable *lltable;
 	struct mld_ifinfo *mld_ifinfo;
+	struct nd6_cache *nd6_cache;
 };
 
 #define	LLTABLE6(ifp)	(((struct in6_ifextra *)(ifp)->if_afdata[AF_INET6])->lltable)
+#define	ND6CACHE(ifp)	(((struct in6_ifextra *)(ifp)->if_afdata[AF_INET6])->nd6_cache)
 
 struct	in6_ifaddr {
 	struct	ifaddr ia_ifa;		/* protocol-independent info */
@@ -207,6 +207,138 @@ nd6_ifdetach(struct nd_ifinfo *nd)
 	free(nd, M_IP6NDP);
 }
 
+/*
+ * Neighbors in REACHABLE state are also published in a small direct-mapped
+ * cache per interface, which nd6_output_lle() and nd6_storelladdr() read
+ * without taking IF_AFDATA_LOCK or the llentry lock, as arpresolve() does
+ * with the ARP cache in if_ether.c.  A slot's sequence number is odd while
+ * it is being rewritten; a reader that sees it odd or changed falls back
+ * to the llentry table.  Only REACHABLE entries are published, since the
+ * first packet to a STALE neighbor has to start unreachability detection.
+ * Every state change rearms the entry's timer, so
+ * nd6_llinfo_settimer_locked() publishes or withdraws the slot; link-layer
+ * address changes and deletions withdraw it as well.  Writers serialize on
+ * nc_mtx and hold the llentry lock.
+ */
+#define	ND6C_BITS	8
+#define	ND6C_SIZE	(1 << ND6C_BITS)
+
+struct nd6c_slot {
+	volatile u_int	ns_seq;
+	struct in6_addr	ns_addr;
+	time_t		ns_expire;
+	u_char		ns_lladdr[ETHER_ADDR_LEN];
+};
+
+struct nd6_cache {
+	struct mtx	nc_mtx;
+	struct nd6c_slot nc_slot[ND6C_SIZE];
+};
+
+#define	ND6C_SLOT(nc, a)						\
+	(&(nc)->nc_slot[(ntohl((a)->s6_addr32[2] ^ (a)->s6_addr32[3]) *	\
+	    2654435761U) >> (32 - ND6C_BITS)])
+
+struct nd6_cache *
+nd6_cache_alloc(struct ifnet *ifp)
+{
+	struct nd6_cache *nc;
+
+	if (ifp->if_addrlen == 0 || ifp->if_addrlen > ETHER_ADDR_LEN)
+		return (NULL);
+	nc = malloc(sizeof(*nc), M_LLTABLE, M_WAITOK | M_ZERO);
+	mtx_init(&nc->nc_mtx, "nd6 cache", NULL, MTX_DEF);
+	return (nc);
+}
+
+void
+nd6_cache_free(struct nd6_cache *nc)
+{
+
+	if (nc == NULL)
+		return;
+	mtx_destroy(&nc->nc_mtx);
+	free(nc, M_LLTABLE);
+}
+
+static __inline int
+nd6_cache_lookup(struct ifnet *ifp, const struct in6_addr *addr,
+    u_char *desten)
+{
+	struct nd6_cache *nc = ND6CACHE(ifp);
+	struct nd6c_slot *ns;
+	u_int seq;
+
+	if (nc == NULL)
+		return (0);
+	ns = ND6C_SLOT(nc, addr);
+	seq = ns->ns_seq;
+	rmb();
+	if ((seq & 1) || !IN6_ARE_ADDR_EQUAL(&ns->ns_addr, addr) ||
+	    ns->ns_expire <= time_second)
+		return (0);
+	if (desten != NULL)
+		bcopy(ns->ns_lladdr, desten, ifp->if_addrlen);
+	rmb();
+	return (ns->ns_seq == seq);
+}
+
+static void
+nd6_cache_write(struct nd6_cache *nc, struct nd6c_slot *ns,
+    const struct in6_addr *addr, time_t expire, const void *lladdr, int len)
+{
+
+	mtx_lock(&nc->nc_mtx);
+	ns->ns_seq++;
+	wmb();
+	ns->ns_addr = *addr;
+	ns->ns_expire = expire;
+	if (lladdr != NULL)
+		bcopy(lladdr, ns->ns_lladdr, len);
+	wmb();
+	ns->ns_seq++;
+	mtx_unlock(&nc->nc_mtx);
+}
+
+/*
+ * Publish a REACHABLE entry, unless its slot holds another live address,
+ * so that two neighbors hashing to the same slot do not evict each other.
+ */
+static void
+nd6_cache_publish(struct ifnet *ifp, struct llentry *ln)
+{
+	struct nd6_cache *nc = ND6CACHE(ifp);
+	struct nd6c_slot *ns;
+	struct in6_addr *addr;
+
+	if (nc == NULL || ln->ln_state != ND6_LLINFO_REACHABLE ||
+	    (ln->la_flags & (LLE_VALID | LLE_IFADDR)) != LLE_VALID ||
+	    ln->la_expire <= time_second)
+		return;
+	addr = &L3_ADDR_SIN6(ln)->sin6_addr;
+	ns = ND6C_SLOT(nc, addr);
+	if (!IN6_ARE_ADDR_EQUAL(&ns->ns_addr, addr) &&
+	    ns->ns_expire > time_second)
+		return;
+	nd6_cache_write(nc, ns, addr, ln->la_expire, &ln->ll_addr,
+	    ifp->if_addrlen);
+}
+
+void
+nd6_cache_purge(struct ifnet *ifp, struct llentry *ln)
+{
+	struct nd6_cache *nc = ND6CACHE(ifp);
+	struct nd6c_slot *ns;
+	struct in6_addr *addr;
+
+	if (nc == NULL)
+		return;
+	addr = &L3_ADDR_SIN6(ln)->sin6_addr;
+	ns = ND6C_SLOT(nc, addr);
+	if (IN6_ARE_ADDR_EQUAL(&ns->ns_addr, addr))
+		nd6_cache_write(nc, ns, addr, 0, NULL, 0);
+}
+
 /*
  * Reset ND level link MTU. This function is called when the physical MTU
  * changes, which means we might have to adjust the ND level MTU.
@@ -419,6 +551,8 @@ nd6_llinfo_settimer_locked(struct llentry *ln, long tick)
 
 	LLE_WLOCK_ASSERT(ln);
 
+	/* Withdraw the entry first; it is republished below if REACHABLE. */
+	nd6_cache_purge(ln->lle_tbl->llt_ifp, ln);
 	if (tick < 0) {
 		ln->la_expire = 0;
 		ln->ln_ntick = 0;
@@ -435,6 +569,7 @@ nd6_llinfo_settimer_locked(struct llentry *ln, long tick)
 			canceled = vnet_callout_reset(&ln->ln_timer_ch, tick,
 			    nd6_llinfo_timer, ln);
 		}
+		nd6_cache_publish(ln->lle_tbl->llt_ifp, ln);
 	}
 	if (canceled)
 		LLE_REMREF(ln);
@@ -1615,6 +1750,7 @@ nd6_cache_lladdr(struct ifnet *ifp, struct in6_addr *from, char *lladdr,
 		 * Record source link-layer address
 		 * XXX is it dependent to ifp->if_type?
 		 */
+		nd6_cache_purge(ifp, ln);
 		bcopy(lladdr, &ln->ll_addr, ifp->if_addrlen);
 		ln->la_flags |= LLE_VALID;
 	}
@@ -1872,6 +2008,13 @@ nd6_output_lle(struct ifnet *ifp, struct ifnet *origifp, struct mbuf *m0,
 	if (nd6_need_cache(ifp) == 0)
 		goto sendpkt;
 
+	/*
+	 * A REACHABLE neighbor needs no state change; skip the table.
+	 * nd6_storelladdr() finds it in the cache again.
+	 */
+	if (ln == NULL && nd6_cache_lookup(ifp, &dst->sin6_addr, NULL))
+		goto sendpkt;
+
 	/*
 	 * next hop determination.  This routine is derived from ether_output.
 	 */
@@ -1948,8 +2091,10 @@ nd6_output_lle(struct ifnet *ifp, struct ifnet *origifp, struct mbuf *m0,
 	 * (i.e. its link-layer address is already resolved), just
 	 * send the packet.
 	 */
-	if (ln->ln_state > ND6_LLINFO_INCOMPLETE)
+	if (ln->ln_state > ND6_LLINFO_INCOMPLETE) {
+		nd6_cache_publish(ifp, ln);
 		goto sendpkt;
+	}
 
 	/*
 	 * There is a neighbor cache entry, but no ethernet address
@@ -2220,6 +2365,9 @@ nd6_storelladdr(struct ifnet *ifp, struct mbuf *m,
 	}
 
 
+	if (nd6_cache_lookup(ifp, &SIN6(dst)->sin6_addr, desten))
+		return (0);
+
 	/*
 	 * the entry should have been created in nd6_store_lladdr
 	 */
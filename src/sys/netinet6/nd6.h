@@ -390,6 +390,9 @@ void nd6_destroy __P((void));
 #endif
 struct nd_ifinfo *nd6_ifattach __P((struct ifnet *));
 void nd6_ifdetach __P((struct nd_ifinfo *));
+struct nd6_cache *nd6_cache_alloc __P((struct ifnet *));
+void nd6_cache_free __P((struct nd6_cache *));
+void nd6_cache_purge __P((struct ifnet *, struct llentry *));
 int nd6_is_addr_neighbor __P((struct sockaddr_in6 *, struct ifnet *));
 void nd6_option_init __P((void *, int, union nd_opts *));
 struct nd_opt_hdr *nd6_option __P((union nd_opts *));
@@ -78,6 +78,7 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet6/udp6_usrreq.c 238247 2012-07-08 1
 #include <sys/jail.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/mbuf.h>
 #include <sys/priv.h>
 #include <sys/proc.h>
@@ -252,10 +253,17 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 	fromsa.sin6_port = uh->uh_sport;
 
 	if (IN6_IS_ADDR_MULTICAST(&ip6->ip6_dst)) {
-		struct inpcb *last;
+		struct inpcb *inp_stk[16], **inp_list, *last;
 		struct ip6_moptions *imo;
+		int i, ninp;
 
-		INP_INFO_RLOCK(&V_udbinfo);
+		/*
+		 * Reference the candidate pcbs under the list lock alone, so
+		 * that delivery does not exclude every info lock partition.
+		 */
+		ninp = nitems(inp_stk);
+		inp_list = in_pcbref_lport(&V_udbinfo, uh->uh_dport, inp_stk,
+		    &ninp);
 		/*
 		 * In the event that laddr should be set to the link-local
 		 * address (this happens in RIPng), the multicast address
@@ -272,33 +280,30 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 		 * later.
 		 */
 		last = NULL;
-		LIST_FOREACH(inp, &V_udb, inp_list) {
+		for (i = 0; i < ninp; i++) {
+			inp = inp_list[i];
+			INP_RLOCK(inp);
+			if (inp->inp_flags2 & INP_FREED)
+				goto next;
 			if ((inp->inp_vflag & INP_IPV6) == 0)
-				continue;
+				goto next;
 			if (inp->inp_lport != uh->uh_dport)
-				continue;
+				goto next;
 			if (inp->inp_fport != 0 &&
 			    inp->inp_fport != uh->uh_sport)
-				continue;
+				goto next;
 			if (!IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_laddr)) {
 				if (!IN6_ARE_ADDR_EQUAL(&inp->in6p_laddr,
 							&ip6->ip6_dst))
-					continue;
+					goto next;
 			}
 			if (!IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_faddr)) {
 				if (!IN6_ARE_ADDR_EQUAL(&inp->in6p_faddr,
 							&ip6->ip6_src) ||
 				    inp->inp_fport != uh->uh_sport)
-					continue;
+					goto next;
 			}
 
-			/*
-			 * XXXRW: Because we weren't holding either the inpcb
-			 * or the hash lock when we checked for a match 
-			 * before, we should probably recheck now that the 
-			 * inpcb lock is (supposed to be) held.
-			 */
-
 			/*
 			 * Handle socket delivery policy for any-source
 			 * and source-specific multicast. [RFC3678]
@@ -308,8 +313,6 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 				struct sockaddr_in6	 mcaddr;
 				int			 blocked;
 
-				INP_RLOCK(inp);
-
 				bzero(&mcaddr, sizeof(struct sockaddr_in6));
 				mcaddr.sin6_len = sizeof(struct sockaddr_in6);
 				mcaddr.sin6_family = AF_INET6;
@@ -324,33 +327,26 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 					if (blocked == MCAST_NOTSMEMBER ||
 					    blocked == MCAST_MUTED)
 						UDPSTAT_INC(udps_filtermcast);
-					INP_RUNLOCK(inp); /* XXX */
-					continue;
+					goto next;
 				}
-
-				INP_RUNLOCK(inp);
 			}
 			if (last != NULL) {
 				struct mbuf *n;
 
-				if ((n = m_copy(m, 0, M_COPYALL)) != NULL) {
-					INP_RLOCK(last);
+				if ((n = m_copypacket(m, M_DONTWAIT)) != NULL) {
 					up = intoudpcb(last);
 					if (up->u_tun_func == NULL) {
 						udp6_append(last, n, off, &fromsa);
 					} else {
 						/*
 						 * Engage the tunneling
-						 * protocol we will have to
-						 * leave the info_lock up,
-						 * since we are hunting
-						 * through multiple UDP's.
-						 * 
+						 * protocol.
 						 */
 						(*up->u_tun_func)(n, off, last);
 					}
-					INP_RUNLOCK(last);
 				}
+				if (!in_pcbrele_rlocked(last))
+					INP_RUNLOCK(last);
 			}
 			last = inp;
 			/*
@@ -362,9 +358,24 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 			 * will never clear these options after setting them.
 			 */
 			if ((last->inp_socket->so_options &
-			     (SO_REUSEPORT|SO_REUSEADDR)) == 0)
+			     (SO_REUSEPORT|SO_REUSEADDR)) == 0) {
+				i++;
 				break;
+			}
+			continue;
+next:
+			if (!in_pcbrele_rlocked(inp))
+				INP_RUNLOCK(inp);
+		}
+		/* Drop the references on any pcbs not visited. */
+		for (; i < ninp; i++) {
+			inp = inp_list[i];
+			INP_RLOCK(inp);
+			if (!in_pcbrele_rlocked(inp))
+				INP_RUNLOCK(inp);
 		}
+		if (inp_list != inp_stk)
+			free(inp_list, M_TEMP);
 
 		if (last == NULL) {
 			/*
@@ -374,10 +385,8 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 			 */
 			UDPSTAT_INC(udps_noport);
 			UDPSTAT_INC(udps_noportmcast);
-			goto badheadlocked;
+			goto badunlocked;
 		}
-		INP_RLOCK(last);
-		INP_INFO_RUNLOCK(&V_udbinfo);
 		up = intoudpcb(last);
 		if (up->u_tun_func == NULL) {
 			udp6_append(last, m, off, &fromsa);
@@ -387,7 +396,8 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 			 */
 			(*up->u_tun_func)(m, off, last);
 		}
-		INP_RUNLOCK(last);
+		if (!in_pcbrele_rlocked(last))
+			INP_RUNLOCK(last);
 		return (IPPROTO_DONE);
 	}
 	/*
@@ -469,8 +479,6 @@ udp6_input(struct mbuf **mp, int *offp, int proto)
 	INP_RUNLOCK(inp);
 	return (IPPROTO_DONE);
 
-badheadlocked:
-	INP_INFO_RUNLOCK(&V_udbinfo);
 badunlocked:
 	if (m)
 		m_freem(m);
@@ -853,10 +861,10 @@ udp6_attach(struct socket *so, int proto, struct thread *td)
 		if (error)
 			return (error);
 	}
-	INP_INFO_WLOCK(&V_udbinfo);
+	INP_INFO_RLOCK(&V_udbinfo);
 	error = in_pcballoc(so, &V_udbinfo);
 	if (error) {
-		INP_INFO_WUNLOCK(&V_udbinfo);
+		INP_INFO_RUNLOCK(&V_udbinfo);
 		return (error);
 	}
 	inp = (struct inpcb *)so->so_pcb;
@@ -877,11 +885,11 @@ udp6_attach(struct socket *so, int proto, struct thread *td)
 	if (error) {
 		in_pcbdetach(inp);
 		in_pcbfree(inp);
-		INP_INFO_WUNLOCK(&V_udbinfo);
+		INP_INFO_RUNLOCK(&V_udbinfo);
 		return (error);
 	}
 	INP_WUNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_udbinfo);
+	INP_INFO_RUNLOCK(&V_udbinfo);
 	return (0);
 }
 
@@ -1026,13 +1034,13 @@ udp6_detach(struct socket *so)
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("udp6_detach: inp == NULL"));
 
-	INP_INFO_WLOCK(&V_udbinfo);
+	INP_INFO_RLOCK(&V_udbinfo);
 	INP_WLOCK(inp);
 	up = intoudpcb(inp);
 	KASSERT(up != NULL, ("%s: up == NULL", __func__));
 	in_pcbdetach(inp);
 	in_pcbfree(inp);
-	INP_INFO_WUNLOCK(&V_udbinfo);
+	INP_INFO_RUNLOCK(&V_udbinfo);
 	udp_discardcb(up);
 }
 
@@ -70,6 +70,11 @@ struct khelp_modevent_data {
 	uma_dtor		umadtor;
 };
 
+/*
+ * Helpers are registered ahead of the SI_ORDER_ANY consumers (e.g. congestion
+ * control modules) that look them up with khelp_get_id() at load time, as
+ * there is no MODULE_DEPEND() resolution for modules compiled in statically.
+ */
 #define	KHELP_DECLARE_MOD(hname, hdata, hhooks, version)		\
 	static struct khelp_modevent_data kmd_##hname = {		\
 		.name = #hname,						\
@@ -83,7 +88,7 @@ struct khelp_modevent_data {
 		.priv = &kmd_##hname					\
 	};								\
 	DECLARE_MODULE(hname, h_##hname, SI_SUB_PROTO_IFATTACHDOMAIN,	\
-	    SI_ORDER_ANY);						\
+	    SI_ORDER_MIDDLE);						\
 	MODULE_VERSION(hname, version)
 
 #define	KHELP_DECLARE_MOD_UMA(hname, hdata, hhooks, version, size, ctor, dtor) \
@@ -102,7 +107,7 @@ struct khelp_modevent_data {
 		.priv = &kmd_##hname					\
 	};								\
 	DECLARE_MODULE(hname, h_##hname, SI_SUB_PROTO_IFATTACHDOMAIN,	\
-	    SI_ORDER_ANY);						\
+	    SI_ORDER_MIDDLE);						\
 	MODULE_VERSION(hname, version)
 
 int	khelp_modevent(module_t mod, int type, void *data);
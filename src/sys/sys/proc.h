@@ -230,6 +230,7 @@ struct thread {
 	struct thread_stop_req *td_stop_req; /* (t) Stop request */
 	int		td_last_stop_check; /* (k) To rate limit stop-checking */
 	int		td_stop_check_ticks; /* (k) Min. stop check interval */
+	u_int		td_pcbinfo_part; /* (k) pcbinfo lock partition + 1 */
 #endif
 
 /* Cleared during fork1() */
@@ -144,6 +144,7 @@ typedef	__uid_t		uid_t;
 #define	SO_PROTOCOL	0x1016		/* get socket protocol (Linux name) */
 #define	SO_PROTOTYPE	SO_PROTOCOL	/* alias for SO_PROTOCOL (SunOS name) */
 #define SO_L2INFO	0x1017		/* PROMISCUOUS_INET MAC addrs and tags */
+#define	SO_MAX_PACING_RATE 0x1018	/* socket's max TX pacing rate (Linux name) */
 #endif
 
 /*
@@ -457,6 +458,7 @@ struct msghdr {
 #endif
 #ifdef _KERNEL
 #define	MSG_HOLE_BREAK	0x40000		/* stop at and indicate hole boundary */
+#define	MSG_FASTOPEN	0x80000		/* send data in SYN (TCP Fast Open) */
 #endif
 
 /*
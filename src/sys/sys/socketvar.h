@@ -133,6 +133,7 @@ struct socket {
 	 */
 	int so_fibnum;		/* routing domain for this socket */
 	uint32_t so_user_cookie;
+	uint64_t so_max_pacing_rate;	/* TX pacing cap in bytes/s, 0 if none */
 
 	struct so_upcallprep {
 		void (*soup_accept)(struct socket *so, void *arg);